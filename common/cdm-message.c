@@ -23,6 +23,7 @@
 
 #include "cdm-message.h"
 
+#include <errno.h>
 #include <memory.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -308,16 +309,11 @@ cdm_message_get_coredump_file_path (CdmMessage *msg)
   return msg->data.coredump_file_path;
 }
 
-CdmStatus
-cdm_message_read (gint fd, CdmMessage *msg)
+static gint
+set_header_segments (CdmMessage *msg, struct iovec *iov)
 {
-  struct iovec iov[CDM_MESSAGE_IOVEC_MAX_ARRAY] = {};
   gint iov_index = 0;
-  gssize sz;
-
-  g_assert (msg);
 
-  /* set message header segments */
   iov[iov_index].iov_base = &msg->hdr.hsh;
   iov[iov_index++].iov_len = sizeof (msg->hdr.hsh);
   iov[iov_index].iov_base = &msg->hdr.session;
@@ -343,16 +339,22 @@ cdm_message_read (gint fd, CdmMessage *msg)
   iov[iov_index].iov_base = &msg->hdr.size_of_arg8;
   iov[iov_index++].iov_len = sizeof (msg->hdr.size_of_arg8);
 
-  if ((sz = readv (fd, iov, iov_index)) <= 0)
-    return CDM_STATUS_ERROR;
+  return iov_index;
+}
 
-  memset (iov, 0, sizeof (iov));
-  iov_index = 0;
+static gint
+set_read_data_segments (CdmMessage *msg, struct iovec *iov)
+{
+  gint iov_index = 0;
 
-  /* set message data segments */
   switch (cdm_message_get_type (msg))
     {
     case CDM_MESSAGE_COREDUMP_NEW:
+      if (msg->hdr.size_of_arg1 > sizeof (msg->data.process_pid)
+          || msg->hdr.size_of_arg2 > sizeof (msg->data.process_exit_signal)
+          || msg->hdr.size_of_arg3 > sizeof (msg->data.process_timestamp))
+        return -1;
+
       /* arg1 */
       iov[iov_index].iov_base = &msg->data.process_pid;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg1;
@@ -366,63 +368,66 @@ cdm_message_read (gint fd, CdmMessage *msg)
       iov[iov_index++].iov_len = msg->hdr.size_of_arg3;
 
       /* arg4 */
-      msg->data.process_name = g_new0 (gchar, msg->hdr.size_of_arg4);
+      msg->data.process_name = g_new0 (gchar, msg->hdr.size_of_arg4 + 1);
       iov[iov_index].iov_base = msg->data.process_name;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg4;
 
       /* arg5 */
-      msg->data.thread_name = g_new0 (gchar, msg->hdr.size_of_arg5);
+      msg->data.thread_name = g_new0 (gchar, msg->hdr.size_of_arg5 + 1);
       iov[iov_index].iov_base = msg->data.thread_name;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg5;
       break;
 
     case CDM_MESSAGE_COREDUMP_UPDATE:
       /* arg1 */
-      msg->data.process_crash_id = g_new0 (gchar, msg->hdr.size_of_arg1);
+      msg->data.process_crash_id = g_new0 (gchar, msg->hdr.size_of_arg1 + 1);
       iov[iov_index].iov_base = msg->data.process_crash_id;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg1;
 
       /* arg2 */
-      msg->data.process_vector_id = g_new0 (gchar, msg->hdr.size_of_arg2);
+      msg->data.process_vector_id = g_new0 (gchar, msg->hdr.size_of_arg2 + 1);
       iov[iov_index].iov_base = msg->data.process_vector_id;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg2;
 
       /* arg3 */
-      msg->data.process_context_id = g_new0 (gchar, msg->hdr.size_of_arg3);
+      msg->data.process_context_id = g_new0 (gchar, msg->hdr.size_of_arg3 + 1);
       iov[iov_index].iov_base = msg->data.process_context_id;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg3;
       break;
 
     case CDM_MESSAGE_COREDUMP_SUCCESS:
       /* arg1 */
-      msg->data.coredump_file_path = g_new0 (gchar, msg->hdr.size_of_arg1);
+      msg->data.coredump_file_path = g_new0 (gchar, msg->hdr.size_of_arg1 + 1);
       iov[iov_index].iov_base = msg->data.coredump_file_path;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg1;
 
       /* arg2 */
-      msg->data.context_name = g_new0 (gchar, msg->hdr.size_of_arg2);
+      msg->data.context_name = g_new0 (gchar, msg->hdr.size_of_arg2 + 1);
       iov[iov_index].iov_base = msg->data.context_name;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg2;
 
       /* arg3 */
-      msg->data.lifecycle_state = g_new0 (gchar, msg->hdr.size_of_arg3);
+      msg->data.lifecycle_state = g_new0 (gchar, msg->hdr.size_of_arg3 + 1);
       iov[iov_index].iov_base = msg->data.lifecycle_state;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg3;
       break;
 
     case CDM_MESSAGE_COREDUMP_CONTEXT:
       /* arg1 */
-      msg->data.context_name = g_new0 (gchar, msg->hdr.size_of_arg1);
+      msg->data.context_name = g_new0 (gchar, msg->hdr.size_of_arg1 + 1);
       iov[iov_index].iov_base = msg->data.context_name;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg1;
 
       /* arg2 */
-      msg->data.lifecycle_state = g_new0 (gchar, msg->hdr.size_of_arg2);
+      msg->data.lifecycle_state = g_new0 (gchar, msg->hdr.size_of_arg2 + 1);
       iov[iov_index].iov_base = msg->data.lifecycle_state;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg2;
       break;
 
     case CDM_MESSAGE_EPILOG_FRAME_INFO:
+      if (msg->hdr.size_of_arg1 > sizeof (msg->data.epilog_frame_count))
+        return -1;
+
       /* arg1 */
       iov[iov_index].iov_base = &msg->data.epilog_frame_count;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg1;
@@ -430,7 +435,7 @@ cdm_message_read (gint fd, CdmMessage *msg)
 
     case CDM_MESSAGE_EPILOG_FRAME_DATA:
       /* arg1 */
-      msg->data.epilog_frame_data = g_new0 (gchar, msg->hdr.size_of_arg1);
+      msg->data.epilog_frame_data = g_new0 (gchar, msg->hdr.size_of_arg1 + 1);
       iov[iov_index].iov_base = msg->data.epilog_frame_data;
       iov[iov_index++].iov_len = msg->hdr.size_of_arg1;
       break;
@@ -439,6 +444,84 @@ cdm_message_read (gint fd, CdmMessage *msg)
       break;
     }
 
+  return iov_index;
+}
+
+static void
+release_data (CdmMessage *msg)
+{
+  g_clear_pointer (&msg->data.epilog_frame_data, g_free);
+  g_clear_pointer (&msg->data.lifecycle_state, g_free);
+  g_clear_pointer (&msg->data.process_name, g_free);
+  g_clear_pointer (&msg->data.thread_name, g_free);
+  g_clear_pointer (&msg->data.context_name, g_free);
+  g_clear_pointer (&msg->data.process_crash_id, g_free);
+  g_clear_pointer (&msg->data.process_vector_id, g_free);
+  g_clear_pointer (&msg->data.process_context_id, g_free);
+  g_clear_pointer (&msg->data.coredump_file_path, g_free);
+}
+
+static gsize
+segments_length (const struct iovec *iov, gint iov_count)
+{
+  gsize len = 0;
+
+  for (gint i = 0; i < iov_count; i++)
+    len += iov[i].iov_len;
+
+  return len;
+}
+
+static CdmStatus
+write_segments (gint fd, struct iovec *iov, gint iov_count)
+{
+  gint index = 0;
+
+  /* a blocking stream socket may still return short on a signal, finish the message */
+  while (index < iov_count)
+    {
+      gssize sz = writev (fd, iov + index, iov_count - index);
+
+      if (sz < 0 && errno == EINTR)
+        continue;
+
+      if (sz <= 0)
+        return CDM_STATUS_ERROR;
+
+      while (index < iov_count && (gsize)sz >= iov[index].iov_len)
+        sz -= (gssize)iov[index++].iov_len;
+
+      if (index < iov_count)
+        {
+          iov[index].iov_base = (guint8 *)iov[index].iov_base + sz;
+          iov[index].iov_len -= (gsize)sz;
+        }
+    }
+
+  return CDM_STATUS_OK;
+}
+
+CdmStatus
+cdm_message_read (gint fd, CdmMessage *msg)
+{
+  struct iovec iov[CDM_MESSAGE_IOVEC_MAX_ARRAY] = {};
+  gint iov_index = 0;
+  gssize sz;
+
+  g_assert (msg);
+
+  /* set message header segments */
+  iov_index = set_header_segments (msg, iov);
+
+  if ((sz = readv (fd, iov, iov_index)) <= 0)
+    return CDM_STATUS_ERROR;
+
+  memset (iov, 0, sizeof (iov));
+
+  /* set message data segments */
+  if ((iov_index = set_read_data_segments (msg, iov)) < 0)
+    return CDM_STATUS_ERROR;
+
   /* read into the message structure */
   if (iov_index > 0)
     if ((sz = readv (fd, iov, iov_index)) <= 0)
@@ -448,15 +531,58 @@ cdm_message_read (gint fd, CdmMessage *msg)
 }
 
 CdmStatus
-cdm_message_write (gint fd, CdmMessage *msg)
+cdm_message_parse (CdmMessage *msg, const guint8 *buf, gsize len, gsize *consumed)
 {
   struct iovec iov[CDM_MESSAGE_IOVEC_MAX_ARRAY] = {};
+  gsize hdr_len, data_len, offset = 0;
   gint iov_index = 0;
-  gssize sz;
 
   g_assert (msg);
+  g_assert (buf);
+  g_assert (consumed);
+
+  *consumed = 0;
+
+  iov_index = set_header_segments (msg, iov);
+  hdr_len = segments_length (iov, iov_index);
+
+  if (len < hdr_len)
+    return CDM_STATUS_OK;
+
+  for (gint i = 0; i < iov_index; i++)
+    {
+      memcpy (iov[i].iov_base, buf + offset, iov[i].iov_len);
+      offset += iov[i].iov_len;
+    }
+
+  memset (iov, 0, sizeof (iov));
+
+  if ((iov_index = set_read_data_segments (msg, iov)) < 0)
+    return CDM_STATUS_ERROR;
+
+  data_len = segments_length (iov, iov_index);
+
+  if (len < hdr_len + data_len)
+    {
+      /* wait for the rest of the payload, the header is parsed again next time */
+      release_data (msg);
+      return CDM_STATUS_OK;
+    }
 
-  /* set arguments size */
+  for (gint i = 0; i < iov_index; i++)
+    {
+      memcpy (iov[i].iov_base, buf + offset, iov[i].iov_len);
+      offset += iov[i].iov_len;
+    }
+
+  *consumed = offset;
+
+  return CDM_STATUS_OK;
+}
+
+static void
+set_write_sizes (CdmMessage *msg)
+{
   switch (cdm_message_get_type (msg))
     {
     case CDM_MESSAGE_COREDUMP_NEW:
@@ -517,40 +643,13 @@ cdm_message_write (gint fd, CdmMessage *msg)
     default:
       break;
     }
+}
 
-  /* set message header segments */
-  iov[iov_index].iov_base = &msg->hdr.hsh;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.hsh);
-  iov[iov_index].iov_base = &msg->hdr.session;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.session);
-  iov[iov_index].iov_base = &msg->hdr.version;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.version);
-  iov[iov_index].iov_base = &msg->hdr.type;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.type);
-  iov[iov_index].iov_base = &msg->hdr.size_of_arg1;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.size_of_arg1);
-  iov[iov_index].iov_base = &msg->hdr.size_of_arg2;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.size_of_arg2);
-  iov[iov_index].iov_base = &msg->hdr.size_of_arg3;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.size_of_arg3);
-  iov[iov_index].iov_base = &msg->hdr.size_of_arg4;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.size_of_arg4);
-  iov[iov_index].iov_base = &msg->hdr.size_of_arg5;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.size_of_arg5);
-  iov[iov_index].iov_base = &msg->hdr.size_of_arg6;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.size_of_arg6);
-  iov[iov_index].iov_base = &msg->hdr.size_of_arg7;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.size_of_arg7);
-  iov[iov_index].iov_base = &msg->hdr.size_of_arg8;
-  iov[iov_index++].iov_len = sizeof (msg->hdr.size_of_arg8);
-
-  if ((sz = writev (fd, iov, iov_index)) <= 0)
-    return CDM_STATUS_ERROR;
-
-  memset (iov, 0, sizeof (iov));
-  iov_index = 0;
+static gint
+set_write_data_segments (CdmMessage *msg, struct iovec *iov)
+{
+  gint iov_index = 0;
 
-  /* set message data segments */
   switch (cdm_message_get_type (msg))
     {
     case CDM_MESSAGE_COREDUMP_NEW:
@@ -629,10 +728,56 @@ cdm_message_write (gint fd, CdmMessage *msg)
       break;
     }
 
+  return iov_index;
+}
+
+CdmStatus
+cdm_message_write (gint fd, CdmMessage *msg)
+{
+  struct iovec iov[CDM_MESSAGE_IOVEC_MAX_ARRAY] = {};
+  gint iov_index = 0;
+
+  g_assert (msg);
+
+  set_write_sizes (msg);
+
+  /* set message header segments */
+  iov_index = set_header_segments (msg, iov);
+
+  if (write_segments (fd, iov, iov_index) != CDM_STATUS_OK)
+    return CDM_STATUS_ERROR;
+
+  memset (iov, 0, sizeof (iov));
+
+  /* set message data segments */
+  iov_index = set_write_data_segments (msg, iov);
+
   /* write into the message structure */
   if (iov_index > 0)
-    if ((sz = writev (fd, iov, iov_index)) <= 0)
+    if (write_segments (fd, iov, iov_index) != CDM_STATUS_OK)
       return CDM_STATUS_ERROR;
 
   return CDM_STATUS_OK;
 }
+
+void
+cdm_message_serialize (CdmMessage *msg, GByteArray *buf)
+{
+  struct iovec iov[CDM_MESSAGE_IOVEC_MAX_ARRAY] = {};
+  gint iov_index = 0;
+
+  g_assert (msg);
+  g_assert (buf);
+
+  set_write_sizes (msg);
+
+  iov_index = set_header_segments (msg, iov);
+  for (gint i = 0; i < iov_index; i++)
+    g_byte_array_append (buf, (const guint8 *)iov[i].iov_base, (guint)iov[i].iov_len);
+
+  memset (iov, 0, sizeof (iov));
+
+  iov_index = set_write_data_segments (msg, iov);
+  for (gint i = 0; i < iov_index; i++)
+    g_byte_array_append (buf, (const guint8 *)iov[i].iov_base, (guint)iov[i].iov_len);
+}
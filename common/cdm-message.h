@@ -336,6 +336,19 @@ const gchar *cdm_message_get_coredump_file_path (CdmMessage *msg);
  */
 CdmStatus cdm_message_read (gint fd, CdmMessage *msg);
 
+/*
+ * @brief Parse a message object from a receive buffer
+ * Used by non-blocking readers accumulating the stream incrementally. If the buffer does
+ * not hold a complete message consumed is set to 0 and the buffer has to be parsed again
+ * after more data is received.
+ * @param msg The message object
+ * @param buf The receive buffer
+ * @param len The number of bytes available in buffer
+ * @param consumed The number of bytes used by the message if complete
+ * @return CDM_STATUS_OK on success, CDM_STATUS_ERROR if the stream is malformed
+ */
+CdmStatus cdm_message_parse (CdmMessage *msg, const guint8 *buf, gsize len, gsize *consumed);
+
 /*
  * @brief Write data into message object
  * @param m The message object
@@ -344,6 +357,14 @@ CdmStatus cdm_message_read (gint fd, CdmMessage *msg);
  */
 CdmStatus cdm_message_write (gint fd, CdmMessage *msg);
 
+/*
+ * @brief Append the wire encoding of a message object to a buffer
+ * Used by non-blocking writers queueing the stream until the socket accepts it.
+ * @param msg The message object
+ * @param buf The output buffer
+ */
+void cdm_message_serialize (CdmMessage *msg, GByteArray *buf);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (CdmMessage, cdm_message_unref);
 
 G_END_DECLS
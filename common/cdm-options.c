@@ -171,6 +171,16 @@ cdm_options_string_for (CdmOptions *opts, CdmOptionsKey key)
         }
       return g_strdup (CDM_ELOG_SOCK_ADDR);
 
+    case KEY_ELOG_SPOOL_FILE:
+      if (opts->has_conf)
+        {
+          gchar *tmp = g_key_file_get_string (opts->conf, "crashmanager", "ELogSpoolFile", NULL);
+
+          if (tmp != NULL)
+            return tmp;
+        }
+      return g_strdup (CDM_ELOG_SPOOL_FILE);
+
     case KEY_TRANSFER_ADDRESS:
       if (opts->has_conf)
         {
@@ -233,6 +243,37 @@ cdm_options_string_for (CdmOptions *opts, CdmOptionsKey key)
         }
       return g_strdup (CDM_TRANSFER_PRIVATE_KEY);
 
+    case KEY_TRANSFER_BACKEND:
+      if (opts->has_conf)
+        {
+          gchar *tmp = g_key_file_get_string (opts->conf, "crashmanager", "TransferBackend", NULL);
+
+          if (tmp != NULL)
+            return tmp;
+        }
+      return g_strdup (CDM_TRANSFER_BACKEND);
+
+    case KEY_TRANSFER_SPOOL_DIR:
+      if (opts->has_conf)
+        {
+          gchar *tmp
+              = g_key_file_get_string (opts->conf, "crashmanager", "TransferSpoolDirectory", NULL);
+
+          if (tmp != NULL)
+            return tmp;
+        }
+      return g_strdup (CDM_TRANSFER_SPOOL_DIR);
+
+    case KEY_TRANSFER_URL:
+      if (opts->has_conf)
+        {
+          gchar *tmp = g_key_file_get_string (opts->conf, "crashmanager", "TransferURL", NULL);
+
+          if (tmp != NULL)
+            return tmp;
+        }
+      return g_strdup (CDM_TRANSFER_URL);
+
     default:
       break;
     }
@@ -310,6 +351,66 @@ cdm_options_long_for (CdmOptions *opts, CdmOptionsKey key)
         value = CDM_ELOG_TIMEOUT_SEC;
       break;
 
+    case KEY_ELOG_LIFETIME_SEC:
+      value = get_long_option (opts, "crashmanager", "ELogLifetime", &error);
+      if (error != NULL)
+        value = CDM_ELOG_LIFETIME_SEC;
+      break;
+
+    case KEY_ELOG_MAX_MEMORY:
+      value = get_long_option (opts, "crashmanager", "ELogMaxMemory", &error);
+      if (error != NULL)
+        value = CDM_ELOG_MAX_MEMORY;
+      break;
+
+    case KEY_ELOG_SPOOL_SLOTS:
+      value = get_long_option (opts, "crashmanager", "ELogSpoolSlots", &error);
+      if (error != NULL)
+        value = CDM_ELOG_SPOOL_SLOTS;
+      break;
+
+    case KEY_ELOG_SPOOL_LIFETIME_SEC:
+      value = get_long_option (opts, "crashmanager", "ELogSpoolLifetime", &error);
+      if (error != NULL)
+        value = CDM_ELOG_SPOOL_LIFETIME_SEC;
+      break;
+
+    case KEY_IPC_LISTEN_BACKLOG:
+      value = get_long_option (opts, "crashmanager", "IpcListenBacklog", &error);
+      if (error != NULL)
+        value = CDM_IPC_LISTEN_BACKLOG;
+      break;
+
+    case KEY_JOURNAL_BATCH_SIZE:
+      value = get_long_option (opts, "crashmanager", "JournalBatchSize", &error);
+      if (error != NULL)
+        value = CDM_JOURNAL_BATCH_SIZE;
+      break;
+
+    case KEY_JOURNAL_BATCH_LATENCY:
+      value = get_long_option (opts, "crashmanager", "JournalBatchLatency", &error);
+      if (error != NULL)
+        value = CDM_JOURNAL_BATCH_LATENCY;
+      break;
+
+    case KEY_JOURNAL_COMPACT_INTERVAL:
+      value = get_long_option (opts, "crashmanager", "JournalCompactInterval", &error);
+      if (error != NULL)
+        value = CDM_JOURNAL_COMPACT_INTERVAL;
+      break;
+
+    case KEY_RETENTION_KEEP_LATEST:
+      value = get_long_option (opts, "crashmanager", "RetentionKeepLatest", &error);
+      if (error != NULL)
+        value = CDM_RETENTION_KEEP_LATEST;
+      break;
+
+    case KEY_RETENTION_SIZE_WEIGHT:
+      value = get_long_option (opts, "crashmanager", "RetentionSizeWeight", &error);
+      if (error != NULL)
+        value = CDM_RETENTION_SIZE_WEIGHT;
+      break;
+
     case KEY_CRASHDUMP_DIR_MIN_SIZE:
       value = get_long_option (opts, "crashmanager", "MinCrashdumpDirSize", &error);
       if (error != NULL)
@@ -328,12 +429,162 @@ cdm_options_long_for (CdmOptions *opts, CdmOptionsKey key)
         value = CDM_CRASHFILES_MAX_COUNT;
       break;
 
+    case KEY_CONTEXT_DIR_MAX_SIZE:
+      value = get_long_option (opts, "crashmanager", "MaxContextCrashdumpSize", &error);
+      if (error != NULL)
+        value = CDM_CONTEXT_DIR_MAX_SIZE;
+      break;
+
+    case KEY_CONTEXT_FILES_MAX_COUNT:
+      value = get_long_option (opts, "crashmanager", "MaxContextCrashdumpArchives", &error);
+      if (error != NULL)
+        value = CDM_CONTEXT_FILES_MAX_COUNT;
+      break;
+
+    case KEY_PROCESS_DIR_MAX_SIZE:
+      value = get_long_option (opts, "crashmanager", "MaxProcessCrashdumpSize", &error);
+      if (error != NULL)
+        value = CDM_PROCESS_DIR_MAX_SIZE;
+      break;
+
+    case KEY_PROCESS_FILES_MAX_COUNT:
+      value = get_long_option (opts, "crashmanager", "MaxProcessCrashdumpArchives", &error);
+      if (error != NULL)
+        value = CDM_PROCESS_FILES_MAX_COUNT;
+      break;
+
     case KEY_TRANSFER_PORT:
       value = get_long_option (opts, "crashmanager", "TransferPort", &error);
       if (error != NULL)
         value = CDM_TRANSFER_PORT;
       break;
 
+    case KEY_TRANSFER_IDLE_TIMEOUT:
+      value = get_long_option (opts, "crashmanager", "TransferIdleTimeout", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_IDLE_TIMEOUT;
+      break;
+
+    case KEY_TRANSFER_KEEPALIVE:
+      value = get_long_option (opts, "crashmanager", "TransferKeepAlive", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_KEEPALIVE;
+      break;
+
+    case KEY_TRANSFER_WORKERS:
+      value = get_long_option (opts, "crashmanager", "TransferWorkers", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_WORKERS;
+      break;
+
+    case KEY_TRANSFER_DEST_WORKERS:
+      value = get_long_option (opts, "crashmanager", "TransferDestinationWorkers", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_DEST_WORKERS;
+      break;
+
+    case KEY_TRANSFER_SMALL_SIZE:
+      value = get_long_option (opts, "crashmanager", "TransferSmallArchiveSize", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_SMALL_SIZE;
+      break;
+
+    case KEY_TRANSFER_CHUNK_SIZE:
+      value = get_long_option (opts, "crashmanager", "TransferChunkSize", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_CHUNK_SIZE;
+      break;
+
+    case KEY_TRANSFER_RETRY_BASE:
+      value = get_long_option (opts, "crashmanager", "TransferRetryDelay", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_RETRY_BASE;
+      break;
+
+    case KEY_TRANSFER_RETRY_MAX:
+      value = get_long_option (opts, "crashmanager", "TransferRetryMaxDelay", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_RETRY_MAX;
+      break;
+
+    case KEY_TRANSFER_MAX_ATTEMPTS:
+      value = get_long_option (opts, "crashmanager", "TransferMaxAttempts", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_MAX_ATTEMPTS;
+      break;
+
+    case KEY_TRANSFER_RATE_LIMIT:
+      value = get_long_option (opts, "crashmanager", "TransferRateLimit", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_RATE_LIMIT;
+      break;
+
+    case KEY_TRANSFER_MAX_PRESSURE:
+      value = get_long_option (opts, "crashmanager", "TransferMaxPressure", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_MAX_PRESSURE;
+      break;
+
+    case KEY_TRANSFER_IDLE_PRESSURE:
+      value = get_long_option (opts, "crashmanager", "TransferIdlePressure", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_IDLE_PRESSURE;
+      break;
+
+    case KEY_TRANSFER_MAX_LOAD:
+      value = get_long_option (opts, "crashmanager", "TransferMaxLoad", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_MAX_LOAD;
+      break;
+
+    case KEY_TRANSFER_CONNECT_TIMEOUT:
+      value = get_long_option (opts, "crashmanager", "TransferConnectTimeout", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_CONNECT_TIMEOUT;
+      break;
+
+    case KEY_TRANSFER_IO_TIMEOUT:
+      value = get_long_option (opts, "crashmanager", "TransferIOTimeout", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_IO_TIMEOUT;
+      break;
+
+    case KEY_TRANSFER_METADATA_FIRST:
+      value = get_long_option (opts, "crashmanager", "TransferMetadataFirst", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_METADATA_FIRST;
+      break;
+
+    case KEY_TRANSFER_BATCH_WINDOW:
+      value = get_long_option (opts, "crashmanager", "TransferBatchWindow", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_BATCH_WINDOW;
+      break;
+
+    case KEY_TRANSFER_BATCH_SIZE:
+      value = get_long_option (opts, "crashmanager", "TransferBatchSize", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_BATCH_SIZE;
+      break;
+
+    case KEY_TRANSFER_DELTA:
+      value = get_long_option (opts, "crashmanager", "TransferDelta", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_DELTA;
+      break;
+
+    case KEY_TRANSFER_DLT_CPU_BUDGET:
+      value = get_long_option (opts, "crashmanager", "TransferDLTCpuBudget", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_DLT_CPU_BUDGET;
+      break;
+
+    case KEY_TRANSFER_DLT_SIM_RATE:
+      value = get_long_option (opts, "crashmanager", "TransferDLTSimRate", &error);
+      if (error != NULL)
+        value = CDM_TRANSFER_DLT_SIM_RATE;
+      break;
+
     default:
       break;
     }
@@ -46,17 +46,56 @@ typedef enum _CdmOptionsKey
   KEY_CRASHDUMP_DIR_MIN_SIZE,
   KEY_CRASHDUMP_DIR_MAX_SIZE,
   KEY_CRASHFILES_MAX_COUNT,
+  KEY_CONTEXT_DIR_MAX_SIZE,
+  KEY_CONTEXT_FILES_MAX_COUNT,
+  KEY_PROCESS_DIR_MAX_SIZE,
+  KEY_PROCESS_FILES_MAX_COUNT,
   KEY_IPC_SOCK_ADDR,
   KEY_IPC_TIMEOUT_SEC,
   KEY_ELOG_SOCK_ADDR,
+  KEY_ELOG_SPOOL_FILE,
   KEY_ELOG_TIMEOUT_SEC,
+  KEY_ELOG_LIFETIME_SEC,
+  KEY_ELOG_MAX_MEMORY,
+  KEY_ELOG_SPOOL_SLOTS,
+  KEY_ELOG_SPOOL_LIFETIME_SEC,
+  KEY_IPC_LISTEN_BACKLOG,
+  KEY_JOURNAL_BATCH_SIZE,
+  KEY_JOURNAL_BATCH_LATENCY,
+  KEY_JOURNAL_COMPACT_INTERVAL,
+  KEY_RETENTION_KEEP_LATEST,
+  KEY_RETENTION_SIZE_WEIGHT,
   KEY_TRANSFER_ADDRESS,
   KEY_TRANSFER_PORT,
   KEY_TRANSFER_PATH,
   KEY_TRANSFER_USER,
   KEY_TRANSFER_PASSWORD,
   KEY_TRANSFER_PUBLIC_KEY,
-  KEY_TRANSFER_PRIVATE_KEY
+  KEY_TRANSFER_PRIVATE_KEY,
+  KEY_TRANSFER_IDLE_TIMEOUT,
+  KEY_TRANSFER_KEEPALIVE,
+  KEY_TRANSFER_WORKERS,
+  KEY_TRANSFER_DEST_WORKERS,
+  KEY_TRANSFER_SMALL_SIZE,
+  KEY_TRANSFER_CHUNK_SIZE,
+  KEY_TRANSFER_RETRY_BASE,
+  KEY_TRANSFER_RETRY_MAX,
+  KEY_TRANSFER_MAX_ATTEMPTS,
+  KEY_TRANSFER_RATE_LIMIT,
+  KEY_TRANSFER_MAX_PRESSURE,
+  KEY_TRANSFER_IDLE_PRESSURE,
+  KEY_TRANSFER_MAX_LOAD,
+  KEY_TRANSFER_BACKEND,
+  KEY_TRANSFER_SPOOL_DIR,
+  KEY_TRANSFER_URL,
+  KEY_TRANSFER_CONNECT_TIMEOUT,
+  KEY_TRANSFER_IO_TIMEOUT,
+  KEY_TRANSFER_METADATA_FIRST,
+  KEY_TRANSFER_BATCH_WINDOW,
+  KEY_TRANSFER_BATCH_SIZE,
+  KEY_TRANSFER_DELTA,
+  KEY_TRANSFER_DLT_CPU_BUDGET,
+  KEY_TRANSFER_DLT_SIM_RATE
 } CdmOptionsKey;
 
 /**
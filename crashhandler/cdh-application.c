@@ -339,8 +339,11 @@ cdh_application_execute (CdhApplication *app, gint argc, gchar *argv[])
       cdm_message_set_process_name (msg, process_name);
       cdm_message_set_thread_name (msg, thread_name);
 
+      /* the manager answers with the context info, collected after the coredump stream */
       if (cdh_manager_send (app->manager, msg) == CDM_STATUS_ERROR)
         g_warning ("Failed to send new message to manager");
+      else
+        app->context->ctxinfo_pending = TRUE;
     }
 #endif
 
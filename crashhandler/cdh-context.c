@@ -52,6 +52,10 @@ static void crash_context_dump (CdhContext *ctx, gboolean postcore);
 
 static CdmStatus create_crashid (CdhContext *ctx);
 
+#if defined(WITH_CRASHMANAGER)
+static void read_epilog_frames (CdhContext *ctx, uint64_t frame_count);
+#endif
+
 CdhContext *
 cdh_context_new (CdmOptions *opts, CdhArchive *archive)
 {
@@ -507,6 +511,36 @@ cdh_context_generate_prestream (CdhContext *ctx)
 }
 
 #if defined(WITH_CRASHMANAGER)
+static void
+read_epilog_frames (CdhContext *ctx, uint64_t frame_count)
+{
+  gint sfd = cdh_manager_get_socket (ctx->manager);
+
+  if (frame_count == 0)
+    {
+      g_info ("No epilog available from crashmanager");
+      return;
+    }
+
+  ctx->epilog = calloc (CDM_MESSAGE_EPILOG_FRAME_MAX_LEN * frame_count, 1);
+
+  for (guint64 i = 0; i < frame_count; i++)
+    {
+      g_autoptr (CdmMessage) fmsg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
+
+      if (!cdh_manager_wait_reply (ctx->manager) || cdm_message_read (sfd, fmsg) != CDM_STATUS_OK)
+        {
+          g_debug ("Cannot read epilog from manager socket %d", sfd);
+          break;
+        }
+      else if (cdm_message_get_type (fmsg) == CDM_MESSAGE_EPILOG_FRAME_DATA)
+        {
+          memcpy (ctx->epilog + (i * CDM_MESSAGE_EPILOG_FRAME_MAX_LEN),
+                  cdm_message_get_epilog_frame_data (fmsg), CDM_MESSAGE_EPILOG_FRAME_MAX_LEN);
+        }
+    }
+}
+
 void
 cdh_context_set_manager (CdhContext *ctx, CdhManager *manager)
 {
@@ -515,53 +549,50 @@ cdh_context_set_manager (CdhContext *ctx, CdhManager *manager)
 }
 
 void
-cdh_context_read_context_info (CdhContext *ctx)
+cdh_context_read_manager_replies (CdhContext *ctx)
 {
-  g_autoptr (CdmMessage) msg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
+  gint sfd;
 
-  if (cdm_message_read (cdh_manager_get_socket (ctx->manager), msg) != CDM_STATUS_OK)
-    g_debug ("Cannot read from manager socket %d", cdh_manager_get_socket (ctx->manager));
-  else if (cdm_message_get_type (msg) == CDM_MESSAGE_COREDUMP_CONTEXT)
-    {
-      ctx->context_name = g_strdup (cdm_message_get_context_name (msg));
-      ctx->lifecycle_state = g_strdup (cdm_message_get_lifecycle_state (msg));
-    }
-}
+  g_assert (ctx);
 
-void
-cdh_context_read_epilog (CdhContext *ctx)
-{
-  g_autoptr (CdmMessage) msg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
+  if (ctx->manager == NULL || !cdh_manager_connected (ctx->manager))
+    return;
 
-  if (cdm_message_read (cdh_manager_get_socket (ctx->manager), msg) != CDM_STATUS_OK)
-    g_debug ("Cannot epilog read from manager socket %d", cdh_manager_get_socket (ctx->manager));
-  else if (cdm_message_get_type (msg) == CDM_MESSAGE_EPILOG_FRAME_INFO)
+  sfd = cdh_manager_get_socket (ctx->manager);
+
+  while (ctx->ctxinfo_pending || ctx->epilog_pending)
     {
-      const uint64_t frame_count = cdm_message_get_epilog_frame_count (msg);
+      g_autoptr (CdmMessage) msg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
 
-      if (frame_count > 0)
+      if (!cdh_manager_wait_reply (ctx->manager))
         {
-          ctx->epilog = calloc (CDM_MESSAGE_EPILOG_FRAME_MAX_LEN * frame_count, 1);
-
-          for (guint64 i = 0; i < frame_count; i++)
-            {
-              g_autoptr (CdmMessage) fmsg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
-
-              if (cdm_message_read (cdh_manager_get_socket (ctx->manager), fmsg) != CDM_STATUS_OK)
-                {
-                  g_debug ("Cannot read epilog from manager socket %d",
-                           cdh_manager_get_socket (ctx->manager));
-                }
-              else if (cdm_message_get_type (fmsg) == CDM_MESSAGE_EPILOG_FRAME_DATA)
-                {
-                  memcpy (ctx->epilog + (i * CDM_MESSAGE_EPILOG_FRAME_MAX_LEN),
-                          cdm_message_get_epilog_frame_data (fmsg),
-                          CDM_MESSAGE_EPILOG_FRAME_MAX_LEN);
-                }
-            }
+          g_info ("Manager reply not available, continue without it");
+          break;
+        }
+
+      if (cdm_message_read (sfd, msg) != CDM_STATUS_OK)
+        {
+          g_debug ("Cannot read from manager socket %d", sfd);
+          break;
+        }
+
+      switch (cdm_message_get_type (msg))
+        {
+        case CDM_MESSAGE_COREDUMP_CONTEXT:
+          ctx->context_name = g_strdup (cdm_message_get_context_name (msg));
+          ctx->lifecycle_state = g_strdup (cdm_message_get_lifecycle_state (msg));
+          ctx->ctxinfo_pending = FALSE;
+          break;
+
+        case CDM_MESSAGE_EPILOG_FRAME_INFO:
+          read_epilog_frames (ctx, cdm_message_get_epilog_frame_count (msg));
+          ctx->epilog_pending = FALSE;
+          break;
+
+        default:
+          g_debug ("Unexpected message type from manager");
+          break;
         }
-      else
-        g_info ("No epilog available from crashmanager");
     }
 }
 #endif
@@ -575,6 +606,10 @@ cdh_context_generate_poststream (CdhContext *ctx)
 
   g_assert (ctx);
 
+#if defined(WITH_CRASHMANAGER)
+  cdh_context_read_manager_replies (ctx);
+#endif
+
 #ifdef __aarch64__
   ip = ctx->regs.pc;
   ra = ctx->regs.lr;
@@ -76,6 +76,8 @@ typedef struct _CdhContext
   gulong note_page_size;       /**< note section page size */
   gulong elf_vma_page_size;    /**< elf vma page size */
   guint8 crashid_info;         /**< information available for crashid */
+  gboolean ctxinfo_pending;    /**< context info requested from manager */
+  gboolean epilog_pending;     /**< epilog requested from manager */
 } CdhContext;
 
 /**
@@ -106,16 +108,14 @@ void cdh_context_unref (CdhContext *ctx);
 void cdh_context_set_manager (CdhContext *ctx, CdhManager *manager);
 
 /**
- * @brief Request context info from manager
- * @param ctx Pointer to the CdhContext object
- */
-void cdh_context_read_context_info (CdhContext *ctx);
-
-/**
- * @brief Request epilog from manager
+ * @brief Collect the pending context info and epilog replies from manager
+ *
+ * The requests are sent at session start and after the crash id computation while the
+ * replies are collected only here so the coredump stream is never blocked on the manager.
+ *
  * @param ctx Pointer to the CdhContext object
  */
-void cdh_context_read_epilog (CdhContext *ctx);
+void cdh_context_read_manager_replies (CdhContext *ctx);
 #endif
 
 /* @brief Generate crashid file
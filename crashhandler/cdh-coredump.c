@@ -532,13 +532,11 @@ cdh_coredump_generate (CdhCoredump *cd)
           cdm_message_set_process_vector_id (msg, vectorid);
           cdm_message_set_process_context_id (msg, contextid);
 
+          /* the epilog reply is collected after the coredump stream is drained */
           if (cdh_manager_send (cd->manager, msg) == CDM_STATUS_ERROR)
             g_warning ("Failed to send update message to manager");
           else
-            {
-              cdh_context_read_context_info (cd->context);
-              cdh_context_read_epilog (cd->context);
-            }
+            cd->context->epilog_pending = TRUE;
         }
 #endif
     }
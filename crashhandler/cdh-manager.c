@@ -183,3 +183,23 @@ cdh_manager_send (CdhManager *c, CdmMessage *m)
 
   return status;
 }
+
+gboolean
+cdh_manager_wait_reply (CdhManager *c)
+{
+  fd_set rfd;
+  struct timeval tv;
+
+  g_assert (c);
+
+  if (c->sfd < 0 || !c->connected)
+    return FALSE;
+
+  FD_ZERO (&rfd);
+
+  tv.tv_sec = MANAGER_SELECT_TIMEOUT;
+  tv.tv_usec = 0;
+  FD_SET (c->sfd, &rfd);
+
+  return select (c->sfd + 1, &rfd, NULL, NULL, &tv) > 0 ? TRUE : FALSE;
+}
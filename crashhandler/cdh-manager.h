@@ -107,4 +107,11 @@ gint cdh_manager_get_socket (CdhManager *c);
  */
 CdmStatus cdh_manager_send (CdhManager *c, CdmMessage *m);
 
+/**
+ * @brief Wait for manager data to become available for reading
+ * @param c Manager object
+ * @return True if a read will not block
+ */
+gboolean cdh_manager_wait_reply (CdhManager *c);
+
 G_END_DECLS
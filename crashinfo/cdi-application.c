@@ -76,10 +76,17 @@ cdi_application_unref (CdiApplication *app)
 }
 
 void
-cdi_application_list_entries (CdiApplication *app)
+cdi_application_list_entries (CdiApplication *app, const CdiJournalFilter *filter)
 {
   g_assert (app);
-  cdi_journal_list_entries (app->journal, NULL);
+  cdi_journal_list_entries (app->journal, filter, NULL);
+}
+
+void
+cdi_application_list_stats (CdiApplication *app)
+{
+  g_assert (app);
+  cdi_journal_list_stats (app->journal, NULL);
 }
 
 void
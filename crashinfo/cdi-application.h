@@ -71,8 +71,15 @@ void cdi_application_unref (CdiApplication *app);
 /**
  * @brief List crash entries
  * @param app The cdi application
+ * @param filter The entries filter or NULL for all entries
  */
-void cdi_application_list_entries (CdiApplication *app);
+void cdi_application_list_entries (CdiApplication *app, const CdiJournalFilter *filter);
+
+/**
+ * @brief List per crash id statistics
+ * @param app The cdi application
+ */
+void cdi_application_list_stats (CdiApplication *app);
 
 /**
  * @brief List crash archive content
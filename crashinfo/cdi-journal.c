@@ -26,12 +26,17 @@
 
 #include <glib/gprintf.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifndef CDI_JOURNAL_BUSY_TIMEOUT_MSEC
+#define CDI_JOURNAL_BUSY_TIMEOUT_MSEC (5000)
+#endif
+
 typedef enum _JournalQueryType
 {
-  QUERY_LIST_ENTRIES
+  QUERY_LIST_STATS
 } JournalQueryType;
 
 typedef struct _JournalQueryData
@@ -41,57 +46,63 @@ typedef struct _JournalQueryData
 } JournalQueryData;
 
 const gchar *cdi_journal_table_name = "CrashTable";
+const gchar *cdi_journal_stats_table_name = "CrashStats";
+
+/**
+ * @brief Sort key columns, the time is the tie breaker for stable pages
+ */
+static const gchar *journal_sort_sql[] = {
+  [CDI_JOURNAL_SORT_TIME] = "TIMESTAMP",
+  [CDI_JOURNAL_SORT_PROCESS] = "PROCNAME",
+  [CDI_JOURNAL_SORT_CRASHID] = "CRASHID",
+  [CDI_JOURNAL_SORT_CONTEXT] = "CONTEXTNAME",
+  [CDI_JOURNAL_SORT_SIZE] = "FILESIZE",
+};
 
 static int sqlite_callback (void *data, int argc, char **argv, char **colname);
 
+/**
+ * @brief Build the entries query for a filter, the values are bound by journal_filter_bind
+ */
+static gchar *journal_filter_sql (const CdiJournalFilter *filter);
+
+/**
+ * @brief Bind the filter values in the order used by journal_filter_sql
+ */
+static void journal_filter_bind (sqlite3_stmt *stmt, const CdiJournalFilter *filter);
+
 static int
 sqlite_callback (void *data, int argc, char **argv, char **colname)
 {
   JournalQueryData *querydata = (JournalQueryData *)data;
 
+  CDM_UNUSED (colname);
+
   switch (querydata->type)
     {
-    case QUERY_LIST_ENTRIES:
+    case QUERY_LIST_STATS:
       {
-        g_autoptr (GDateTime) dtime = NULL;
-        const gchar *proc_name = NULL;
-        const gchar *context_name = NULL;
-        const gchar *crash_id = NULL;
-        const gchar *vector_id = NULL;
-        const gchar *timestamp = NULL;
-        const gchar *pid = NULL;
-        const gchar *tstate = NULL;
-        const gchar *rstate = NULL;
-        const gchar *file_name = NULL;
-
-        for (gint i = 0; i < argc; i++)
-          {
-            if (g_strcmp0 (colname[i], "PROCNAME") == 0)
-              proc_name = argv[i];
-            else if (g_strcmp0 (colname[i], "CRASHID") == 0)
-              crash_id = argv[i];
-            else if (g_strcmp0 (colname[i], "VECTORID") == 0)
-              vector_id = argv[i];
-            else if (g_strcmp0 (colname[i], "CONTEXTNAME") == 0)
-              context_name = argv[i];
-            else if (g_strcmp0 (colname[i], "TIMESTAMP") == 0)
-              timestamp = argv[i];
-            else if (g_strcmp0 (colname[i], "FILEPATH") == 0)
-              file_name = g_path_get_basename (argv[i]);
-            else if (g_strcmp0 (colname[i], "PID") == 0)
-              pid = argv[i];
-            else if (g_strcmp0 (colname[i], "TSTATE") == 0)
-              tstate = argv[i];
-            else if (g_strcmp0 (colname[i], "RSTATE") == 0)
-              rstate = argv[i];
-          }
-
-        dtime = g_date_time_new_from_unix_utc (g_ascii_strtoll (timestamp, NULL, 10));
-
-        g_print ("%-4u %-20s %20s %16s %16s %16s %6s %3s %3s  %s\n",
-                 *(guint *)(querydata->response), proc_name,
-                 (dtime != NULL) ? g_date_time_format (dtime, "%H:%M:%S %Y-%m-%d") : timestamp,
-                 crash_id, vector_id, context_name, pid, tstate, rstate, file_name);
+        g_autoptr (GDateTime) first_time = NULL;
+        g_autoptr (GDateTime) last_time = NULL;
+        g_autofree gchar *first_seen = NULL;
+        g_autofree gchar *last_seen = NULL;
+
+        /* columns are selected in a fixed order by cdi_journal_list_stats */
+        if (argc != 9)
+          break;
+
+        first_time = g_date_time_new_from_unix_utc (g_ascii_strtoll (argv[3], NULL, 10));
+        last_time = g_date_time_new_from_unix_utc (g_ascii_strtoll (argv[4], NULL, 10));
+
+        if (first_time != NULL)
+          first_seen = g_date_time_format (first_time, "%H:%M:%S %Y-%m-%d");
+        if (last_time != NULL)
+          last_seen = g_date_time_format (last_time, "%H:%M:%S %Y-%m-%d");
+
+        g_print ("%-4u %16s %16s %8s %20s %20s %5s %5s %-20s %s\n",
+                 *(guint *)(querydata->response), argv[0], argv[1], argv[2],
+                 first_seen != NULL ? first_seen : argv[3], last_seen != NULL ? last_seen : argv[4],
+                 argv[5], argv[6], argv[7], argv[8]);
 
         *((guint *)(querydata->response)) += 1;
       }
@@ -120,6 +131,8 @@ cdi_journal_new (CdmOptions *options, GError **error)
       g_warning ("Cannot open journal database at path %s", opt_dbpath);
       g_set_error (error, g_quark_from_static_string ("JournalNew"), 1, "Database open failed");
     }
+  else
+    sqlite3_busy_timeout (journal->database, CDI_JOURNAL_BUSY_TIMEOUT_MSEC);
 
   return journal;
 }
@@ -142,25 +155,212 @@ cdi_journal_unref (CdiJournal *journal)
 }
 
 void
-cdi_journal_list_entries (CdiJournal *journal, GError **error)
+cdi_journal_filter_init (CdiJournalFilter *filter)
+{
+  g_assert (filter);
+
+  memset (filter, 0, sizeof (CdiJournalFilter));
+  filter->tstate = -1;
+  filter->rstate = -1;
+  filter->sort = CDI_JOURNAL_SORT_TIME;
+}
+
+static gchar *
+journal_filter_sql (const CdiJournalFilter *filter)
+{
+  GString *sql = g_string_new (NULL);
+  const gchar *sep = " WHERE ";
+
+  if (filter->count_only)
+    g_string_append_printf (sql, "SELECT COUNT (*) FROM %s", cdi_journal_table_name);
+  else
+    g_string_append_printf (sql,
+                            "SELECT PROCNAME, TIMESTAMP, CRASHID, VECTORID, CONTEXTNAME, PID, "
+                            "TSTATE, RSTATE, FILEPATH FROM %s",
+                            cdi_journal_table_name);
+
+  /* only the set filters are part of the query so the planner picks their index */
+  if (filter->proc_name != NULL)
+    {
+      g_string_append_printf (sql, "%sPROCNAME IS ?", sep);
+      sep = " AND ";
+    }
+  if (filter->crash_id != NULL)
+    {
+      g_string_append_printf (sql, "%sCRASHID IS ?", sep);
+      sep = " AND ";
+    }
+  if (filter->vector_id != NULL)
+    {
+      g_string_append_printf (sql, "%sVECTORID IS ?", sep);
+      sep = " AND ";
+    }
+  if (filter->context_name != NULL)
+    {
+      g_string_append_printf (sql, "%sCONTEXTNAME IS ?", sep);
+      sep = " AND ";
+    }
+  if (filter->since > 0)
+    {
+      g_string_append_printf (sql, "%sTIMESTAMP >= ?", sep);
+      sep = " AND ";
+    }
+  if (filter->until > 0)
+    {
+      g_string_append_printf (sql, "%sTIMESTAMP < ?", sep);
+      sep = " AND ";
+    }
+  if (filter->tstate >= 0)
+    {
+      g_string_append_printf (sql, "%sTSTATE IS ?", sep);
+      sep = " AND ";
+    }
+  if (filter->rstate >= 0)
+    g_string_append_printf (sql, "%sRSTATE IS ?", sep);
+
+  if (!filter->count_only)
+    {
+      const gchar *order = filter->ascending ? "ASC" : "DESC";
+
+      g_string_append_printf (sql, " ORDER BY %s %s", journal_sort_sql[filter->sort], order);
+      if (filter->sort != CDI_JOURNAL_SORT_TIME)
+        g_string_append_printf (sql, ", TIMESTAMP %s", order);
+
+      /* timestamps have a one second resolution, the unique id keeps the pages stable */
+      g_string_append_printf (sql, ", ID %s", order);
+
+      /* a negative limit is no limit for sqlite */
+      g_string_append (sql, " LIMIT ? OFFSET ?");
+    }
+
+  return g_string_free (sql, FALSE);
+}
+
+static void
+journal_filter_bind (sqlite3_stmt *stmt, const CdiJournalFilter *filter)
+{
+  gint index = 1;
+
+  if (filter->proc_name != NULL)
+    sqlite3_bind_text (stmt, index++, filter->proc_name, -1, SQLITE_STATIC);
+  if (filter->crash_id != NULL)
+    sqlite3_bind_text (stmt, index++, filter->crash_id, -1, SQLITE_STATIC);
+  if (filter->vector_id != NULL)
+    sqlite3_bind_text (stmt, index++, filter->vector_id, -1, SQLITE_STATIC);
+  if (filter->context_name != NULL)
+    sqlite3_bind_text (stmt, index++, filter->context_name, -1, SQLITE_STATIC);
+  if (filter->since > 0)
+    sqlite3_bind_int64 (stmt, index++, filter->since);
+  if (filter->until > 0)
+    sqlite3_bind_int64 (stmt, index++, filter->until);
+  if (filter->tstate >= 0)
+    sqlite3_bind_int (stmt, index++, filter->tstate);
+  if (filter->rstate >= 0)
+    sqlite3_bind_int (stmt, index++, filter->rstate);
+
+  if (!filter->count_only)
+    {
+      sqlite3_bind_int64 (stmt, index++, filter->limit > 0 ? filter->limit : -1);
+      sqlite3_bind_int64 (stmt, index, MAX (filter->offset, 0));
+    }
+}
+
+void
+cdi_journal_list_entries (CdiJournal *journal, const CdiJournalFilter *filter, GError **error)
+{
+  g_autofree gchar *sql = NULL;
+  sqlite3_stmt *stmt = NULL;
+  CdiJournalFilter all;
+  gint status;
+  gint64 index;
+
+  g_assert (journal);
+
+  if (filter == NULL)
+    {
+      cdi_journal_filter_init (&all);
+      filter = &all;
+    }
+
+  sql = journal_filter_sql (filter);
+
+  if (sqlite3_prepare_v2 (journal->database, sql, -1, &stmt, NULL) != SQLITE_OK)
+    {
+      g_set_error (error, g_quark_from_static_string ("JournalListEntries"), 1, "SQL query error");
+      g_warning ("Fail to prepare entries query. SQL error %s", sqlite3_errmsg (journal->database));
+      return;
+    }
+
+  journal_filter_bind (stmt, filter);
+
+  if (filter->count_only)
+    {
+      status = sqlite3_step (stmt);
+      if (status == SQLITE_ROW)
+        g_print ("%ld\n", (gint64)sqlite3_column_int64 (stmt, 0));
+    }
+  else
+    {
+      g_print ("%-4s %-20s %20s %16s %16s %16s %6s %3s %3s  %s\n", "Idx", "Procname", "Timestamp",
+               "CrashID", "VectorID", "Context", "PID", "TRS", "REM", "FILE");
+
+      index = MAX (filter->offset, 0) + 1;
+
+      while ((status = sqlite3_step (stmt)) == SQLITE_ROW)
+        {
+          const gint64 timestamp = sqlite3_column_int64 (stmt, 1);
+          g_autoptr (GDateTime) dtime = g_date_time_new_from_unix_utc (timestamp);
+          g_autofree gchar *time_str = NULL;
+          g_autofree gchar *file_name = NULL;
+
+          if (dtime != NULL)
+            time_str = g_date_time_format (dtime, "%H:%M:%S %Y-%m-%d");
+          else
+            time_str = g_strdup_printf ("%ld", timestamp);
+
+          file_name = g_path_get_basename ((const gchar *)sqlite3_column_text (stmt, 8));
+
+          g_print ("%-4ld %-20s %20s %16s %16s %16s %6ld %3d %3d  %s\n",
+                   index++, (const gchar *)sqlite3_column_text (stmt, 0), time_str,
+                   (const gchar *)sqlite3_column_text (stmt, 2),
+                   (const gchar *)sqlite3_column_text (stmt, 3),
+                   (const gchar *)sqlite3_column_text (stmt, 4),
+                   (gint64)sqlite3_column_int64 (stmt, 5), sqlite3_column_int (stmt, 6),
+                   sqlite3_column_int (stmt, 7), file_name);
+        }
+    }
+
+  if (status != SQLITE_ROW && status != SQLITE_DONE)
+    {
+      g_set_error (error, g_quark_from_static_string ("JournalListEntries"), 1, "SQL query error");
+      g_warning ("Fail to list entries. SQL error %s", sqlite3_errmsg (journal->database));
+    }
+
+  sqlite3_finalize (stmt);
+}
+
+void
+cdi_journal_list_stats (CdiJournal *journal, GError **error)
 {
   g_autofree gchar *sql = NULL;
   gchar *query_error = NULL;
   guint index = 1;
-  JournalQueryData data = { .type = QUERY_LIST_ENTRIES, .response = NULL };
+  JournalQueryData data = { .type = QUERY_LIST_STATS, .response = NULL };
 
   g_assert (journal);
 
   data.response = &index;
-  sql = g_strdup_printf ("SELECT * FROM %s ;", cdi_journal_table_name);
+  sql = g_strdup_printf ("SELECT CRASHID, VECTORID, COUNT, FIRSTSEEN, LASTSEEN, PROCESSES, "
+                         "CONTEXTS, PROCNAME, CONTEXTNAME FROM %s ORDER BY LASTSEEN DESC;",
+                         cdi_journal_stats_table_name);
 
-  g_print ("%-4s %-20s %20s %16s %16s %16s %6s %3s %3s  %s\n", "Idx", "Procname", "Timestamp",
-           "CrashID", "VectorID", "Context", "PID", "TRS", "REM", "FILE");
+  g_print ("%-4s %16s %16s %8s %20s %20s %5s %5s %-20s %s\n", "Idx", "CrashID", "VectorID",
+           "Count", "FirstSeen", "LastSeen", "PROCS", "CTXS", "LastProcname", "LastContext");
 
   if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
     {
-      g_set_error (error, g_quark_from_static_string ("JournalListEntries"), 1, "SQL query error");
-      g_warning ("Fail to get entry count. SQL error %s", query_error);
+      g_set_error (error, g_quark_from_static_string ("JournalListStats"), 1, "SQL query error");
+      g_warning ("Fail to get crash statistics. SQL error %s", query_error);
       sqlite3_free (query_error);
     }
 }
@@ -31,6 +31,38 @@
 
 G_BEGIN_DECLS
 
+/**
+ * @enum Journal entries sort key
+ */
+typedef enum _CdiJournalSort
+{
+  CDI_JOURNAL_SORT_TIME,
+  CDI_JOURNAL_SORT_PROCESS,
+  CDI_JOURNAL_SORT_CRASHID,
+  CDI_JOURNAL_SORT_CONTEXT,
+  CDI_JOURNAL_SORT_SIZE
+} CdiJournalSort;
+
+/**
+ * @brief The journal entries query filter
+ */
+typedef struct _CdiJournalFilter
+{
+  const gchar *proc_name;    /**< Only entries for this process name or NULL */
+  const gchar *crash_id;     /**< Only entries with this crash id or NULL */
+  const gchar *vector_id;    /**< Only entries with this vector id or NULL */
+  const gchar *context_name; /**< Only entries in this context or NULL */
+  gint64 since;              /**< Only entries at or after this unix time or 0 */
+  gint64 until;              /**< Only entries before this unix time or 0 */
+  gint tstate;               /**< Only entries with this transfer state or -1 */
+  gint rstate;               /**< Only entries with this removed state or -1 */
+  CdiJournalSort sort;       /**< Sort key */
+  gboolean ascending;        /**< Sort ascending instead of descending */
+  gint64 limit;              /**< Max entries to list or 0 for all */
+  gint64 offset;             /**< Entries to skip before listing */
+  gboolean count_only;       /**< Only print the number of matching entries */
+} CdiJournalFilter;
+
 /**
  * @brief The CdiJournal opaque data structure
  */
@@ -62,12 +94,27 @@ CdiJournal *cdi_journal_ref (CdiJournal *journal);
  */
 void cdi_journal_unref (CdiJournal *journal);
 
+/**
+ * @brief Initialize a filter matching all the entries newest first
+ * @param filter The filter object
+ */
+void cdi_journal_filter_init (CdiJournalFilter *filter);
+
 /**
  * @brief List database entries to stdout
  * @param journal The journal object
+ * @param filter The entries filter or NULL for all entries
+ * @param error The GError object or NULL
+ */
+void cdi_journal_list_entries (CdiJournal *journal, const CdiJournalFilter *filter,
+                               GError **error);
+
+/**
+ * @brief List per crash id statistics to stdout
+ * @param journal The journal object
  * @param error The GError object or NULL
  */
-void cdi_journal_list_entries (CdiJournal *journal, GError **error);
+void cdi_journal_list_stats (CdiJournal *journal, GError **error);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (CdiJournal, cdi_journal_unref);
 
@@ -32,6 +32,53 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+/**
+ * @brief Parse a unix time or an ISO 8601 date, UTC if no zone is given
+ */
+static gboolean
+parse_time_option (const gchar *value, gint64 *out)
+{
+  g_autoptr (GTimeZone) utc = NULL;
+  g_autoptr (GDateTime) dtime = NULL;
+
+  if (value == NULL)
+    return TRUE;
+
+  if (g_ascii_string_to_signed (value, 10, 0, G_MAXINT64, out, NULL))
+    return TRUE;
+
+  utc = g_time_zone_new_utc ();
+  dtime = g_date_time_new_from_iso8601 (value, utc);
+  if (dtime == NULL)
+    return FALSE;
+
+  *out = g_date_time_to_unix (dtime);
+
+  return TRUE;
+}
+
+/**
+ * @brief Parse the sort key name
+ */
+static gboolean
+parse_sort_option (const gchar *value, CdiJournalSort *out)
+{
+  if (value == NULL || g_strcmp0 (value, "time") == 0)
+    *out = CDI_JOURNAL_SORT_TIME;
+  else if (g_strcmp0 (value, "process") == 0)
+    *out = CDI_JOURNAL_SORT_PROCESS;
+  else if (g_strcmp0 (value, "crashid") == 0)
+    *out = CDI_JOURNAL_SORT_CRASHID;
+  else if (g_strcmp0 (value, "context") == 0)
+    *out = CDI_JOURNAL_SORT_CONTEXT;
+  else if (g_strcmp0 (value, "size") == 0)
+    *out = CDI_JOURNAL_SORT_SIZE;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
 gint
 main (gint argc, gchar *argv[])
 {
@@ -40,8 +87,17 @@ main (gint argc, gchar *argv[])
   g_autoptr (CdiApplication) app = NULL;
   g_autofree gchar *config_path = NULL;
   g_autofree gchar *print_file = NULL;
+  g_autofree gchar *opt_process = NULL;
+  g_autofree gchar *opt_crashid = NULL;
+  g_autofree gchar *opt_vectorid = NULL;
+  g_autofree gchar *opt_context = NULL;
+  g_autofree gchar *opt_since = NULL;
+  g_autofree gchar *opt_until = NULL;
+  g_autofree gchar *opt_sort = NULL;
+  CdiJournalFilter filter;
   gboolean version = FALSE;
   gboolean list_entries = FALSE;
+  gboolean list_stats = FALSE;
   gboolean list_files = FALSE;
   gboolean print_info = FALSE;
   gboolean print_epilog = FALSE;
@@ -54,6 +110,7 @@ main (gint argc, gchar *argv[])
     { "version", 'v', 0, G_OPTION_ARG_NONE, &version, "Show program version", "" },
     { "config", 'c', 0, G_OPTION_ARG_FILENAME, &config_path, "Override configuration file", "" },
     { "list", 'l', 0, G_OPTION_ARG_NONE, &list_entries, "List crashes from local database", "" },
+    { "stats", 's', 0, G_OPTION_ARG_NONE, &list_stats, "List crash statistics per crash id", "" },
     { "files", 'f', 0, G_OPTION_ARG_NONE, &list_files, "List content for a crash archive", "" },
     { "info", 'i', 0, G_OPTION_ARG_NONE, &print_info, "Print  nfo file from a crash archive", "" },
     { "epilog", 'e', 0, G_OPTION_ARG_NONE, &print_epilog, "Print epilog file from a archive", "" },
@@ -64,17 +121,51 @@ main (gint argc, gchar *argv[])
     { 0 }
   };
 
+  GOptionEntry filter_entries[] = {
+    { "process", 0, 0, G_OPTION_ARG_STRING, &opt_process, "Only list this process", "NAME" },
+    { "crashid", 0, 0, G_OPTION_ARG_STRING, &opt_crashid, "Only list this crash id", "ID" },
+    { "vectorid", 0, 0, G_OPTION_ARG_STRING, &opt_vectorid, "Only list this vector id", "ID" },
+    { "context", 0, 0, G_OPTION_ARG_STRING, &opt_context, "Only list this context", "NAME" },
+    { "since", 0, 0, G_OPTION_ARG_STRING, &opt_since, "Only list crashes since time", "TIME" },
+    { "until", 0, 0, G_OPTION_ARG_STRING, &opt_until, "Only list crashes before time", "TIME" },
+    { "transferred", 0, 0, G_OPTION_ARG_INT, &filter.tstate,
+      "Only list transfer state (0 pending, 1 transferred, 2 abandoned)", "0|1|2" },
+    { "removed", 0, 0, G_OPTION_ARG_INT, &filter.rstate, "Only list removed state", "0|1" },
+    { "sort", 0, 0, G_OPTION_ARG_STRING, &opt_sort, "Sort by time, process, crashid, context, size",
+      "KEY" },
+    { "asc", 0, 0, G_OPTION_ARG_NONE, &filter.ascending, "Sort ascending", "" },
+    { "limit", 0, 0, G_OPTION_ARG_INT64, &filter.limit, "List at most N crashes", "N" },
+    { "offset", 0, 0, G_OPTION_ARG_INT64, &filter.offset, "Skip the first N crashes", "N" },
+    { "count", 0, 0, G_OPTION_ARG_NONE, &filter.count_only, "Only print the crash count", "" },
+    { 0 }
+  };
+  cdi_journal_filter_init (&filter);
+
   context = g_option_context_new ("- Crash information tool");
   g_option_context_set_summary (context,
                                 "The tool extract information from cdh archives and cdh database");
   g_option_context_add_main_entries (context, main_entries, NULL);
 
+  g_option_context_add_main_entries (context, filter_entries, NULL);
+
   if (!g_option_context_parse (context, &argc, &argv, &error))
     {
       g_printerr ("%s\n", error->message);
       return EXIT_FAILURE;
     }
 
+  if (!parse_time_option (opt_since, &filter.since) || !parse_time_option (opt_until, &filter.until)
+      || !parse_sort_option (opt_sort, &filter.sort))
+    {
+      g_printerr ("Invalid crash list filter\n");
+      return EXIT_FAILURE;
+    }
+
+  filter.proc_name = opt_process;
+  filter.crash_id = opt_crashid;
+  filter.vector_id = opt_vectorid;
+  filter.context_name = opt_context;
+
   if (version)
     {
       g_printerr ("%s\n", CDM_VERSION);
@@ -98,7 +189,9 @@ main (gint argc, gchar *argv[])
           g_info ("Crashinfo tool started for OS version '%s'", cdm_utils_get_osversion ());
 
           if (list_entries)
-            cdi_application_list_entries (app);
+            cdi_application_list_entries (app, &filter);
+          else if (list_stats)
+            cdi_application_list_stats (app);
           else if (print_info && argc == 2)
             cdi_application_print_info (app, argv[1]);
           else if (print_epilog && argc == 2)
@@ -116,7 +209,7 @@ main (gint argc, gchar *argv[])
               if (argc == 2)
                 cdi_application_print_info (app, argv[1]);
               else
-                cdi_application_list_entries (app);
+                cdi_application_list_entries (app, &filter);
             }
         }
     }
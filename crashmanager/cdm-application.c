@@ -139,7 +139,8 @@ archive_early_crashdump (CdmApplication *app, const gchar *crashfile)
           context_name != NULL ? context_name : "unknown",
           lifecycle_state != NULL ? lifecycle_state : "unknown", crashfile,
           proc_pid > 0 ? proc_pid : 0, proc_sig > 0 ? proc_sig : 0,
-          (guint64)(proc_tstamp > 0 ? proc_tstamp : (g_get_real_time () / (1000000))), &error);
+          (guint64)(proc_tstamp > 0 ? proc_tstamp : (g_get_real_time () / (1000000))), NULL, NULL,
+          &error);
 
       if (error != NULL)
         {
@@ -151,7 +152,7 @@ archive_early_crashdump (CdmApplication *app, const gchar *crashfile)
     {
       cdm_journal_add_crash (app->journal, "earlyprocess", "DEADDEADDEADDEAD", "DEADDEADDEADDEAD",
                              "DEADDEADDEADDEAD", "unknown", "unknown", crashfile, 0, 0,
-                             (guint64)(g_get_real_time () / (10000000)), &error);
+                             (guint64)(g_get_real_time () / (10000000)), NULL, NULL, &error);
 
       if (error != NULL)
         g_warning ("Fail to add new crash entry in database %s", error->message);
@@ -205,7 +206,8 @@ archive_early_crashes (CdmApplication *app, const gchar *crashdir)
             {
               cdm_journal_add_crash (app->journal, "kernel", "DEADDEADDEADDEAD", "DEADDEADDEADDEAD",
                                      "DEADDEADDEADDEAD", "unknown", "unknown", fpath, 0, 0,
-                                     (guint64)(g_get_real_time () / (1000000)), &jerror);
+                                     (guint64)(g_get_real_time () / (1000000)), NULL, NULL,
+                                     &jerror);
 
               if (jerror != NULL)
                 {
@@ -276,41 +278,54 @@ archive_kdumps (CdmApplication *app, const gchar *crashdir)
 }
 
 static void
-transfer_complete (gpointer cdmjournal, const gchar *file_path)
+transfer_complete (gpointer cdmjournal, const gchar *file_path, CdmStatus status)
 {
-  CDM_UNUSED (cdmjournal);
+  CdmJournal *journal = (CdmJournal *)cdmjournal;
+  g_autoptr (GError) error = NULL;
+
+  if (status != CDM_STATUS_OK)
+    {
+      g_warning ("Archive transfer failed for %s", file_path);
+      return;
+    }
+
   g_info ("Archive transfer complete for %s", file_path);
+  cdm_journal_set_transfer (journal, file_path, TRUE, NULL, NULL, &error);
+
+  if (error != NULL)
+    g_warning ("Fail to set transfer complete for %s. Error %s", file_path, error->message);
 }
 
 static void
 transfer_missing_files (CdmApplication *app)
 {
-  gboolean finish = FALSE;
+  g_autoptr (GPtrArray) files = NULL;
+  g_autoptr (GError) error = NULL;
 
   g_assert (app);
 
-  while (!finish)
-    {
-      g_autofree gchar *file = cdm_journal_get_untransferred (app->journal, NULL);
+  /* metadata bundles not delivered before the restart go ahead of the archives */
+  files = cdm_journal_get_metadata_untransferred (app->journal, &error);
+  if (error != NULL)
+    g_warning ("Fail to read the untransferred metadata. Error %s", error->message);
 
-      if (file != NULL)
-        {
-          g_autoptr (GError) error = NULL;
+  for (guint i = 0; i < files->len; i++)
+    cdm_transfer_metadata (app->transfer, (const gchar *)g_ptr_array_index (files, i));
 
-          g_info ("Transfer incomplete file %s", file);
+  g_clear_pointer (&files, g_ptr_array_unref);
+  g_clear_error (&error);
 
-          /*
-           * we only retry the transfer once if missing so we mark now the file
-           * transferred to avoid getting it again from the journal
-           */
-          cdm_transfer_file (app->transfer, file, transfer_complete, NULL);
-          cdm_journal_set_transfer (app->journal, file, TRUE, &error);
+  /* the entries stay untransferred until the upload is complete so a failed one resumes */
+  files = cdm_journal_get_untransferred (app->journal, &error);
+  if (error != NULL)
+    g_warning ("Fail to read the untransferred files. Error %s", error->message);
 
-          if (error != NULL)
-            g_warning ("Fail to set transfer complete for %s. Error %s", file, error->message);
-        }
-      else
-        finish = TRUE;
+  for (guint i = 0; i < files->len; i++)
+    {
+      const gchar *file = (const gchar *)g_ptr_array_index (files, i);
+
+      g_info ("Transfer incomplete file %s", file);
+      cdm_transfer_file (app->transfer, file, transfer_complete, app->journal);
     }
 }
 
@@ -340,6 +355,8 @@ cdm_application_new (const gchar *config, GError **error)
   if (*error != NULL)
     return app;
 
+  cdm_transfer_set_journal (app->transfer, app->journal);
+
   /* construct janitor noexept */
   app->janitor = cdm_janitor_new (app->options, app->journal);
 
@@ -361,6 +378,8 @@ cdm_application_new (const gchar *config, GError **error)
 
 #ifdef WITH_DBUS_SERVICES
   app->dbusown = cdm_dbusown_new (app->options);
+  cdm_dbusown_set_journal (app->dbusown, app->journal);
+  cdm_dbusown_set_transfer (app->dbusown, app->transfer);
   cdm_server_set_dbusown (app->server, app->dbusown);
 #endif
 
@@ -459,6 +478,9 @@ cdm_application_execute (CdmApplication *app)
   if (archive_early_crashes (app, opt_crashdir) != CDM_STATUS_OK)
     g_warning ("Fail to add early crashes");
 
+  /* make the early entries visible before querying for untransferred files */
+  cdm_journal_flush (app->journal);
+
   /* transfer all untransferred files */
   transfer_missing_files (app);
 
@@ -0,0 +1,287 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-bundle.c
+ */
+
+#include "cdm-bundle.h"
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BUNDLE_ARCHIVE_SUFFIX ".cdh.tar.gz"
+#define BUNDLE_METADATA_SUFFIX ".meta.tar.gz"
+#define BUNDLE_COREDUMP_PREFIX "core."
+#define BUNDLE_BUFFER_SIZE (64 * 1024)
+#define BUNDLE_MANIFEST_NAME "MANIFEST"
+
+/**
+ * @brief Build the bundle path from the archive name
+ */
+static gchar *bundle_path_for (const gchar *archive_path, const gchar *bundle_dir,
+                               const gchar *suffix);
+
+/**
+ * @brief Copy the current member data from the reader to the writer
+ */
+static gboolean bundle_copy_data (struct archive *reader, struct archive *writer, gchar *buffer);
+
+/**
+ * @brief Store a file as a bundle member and append its manifest line
+ * @return FALSE with skipped set if the file cannot be read, the bundle is left untouched
+ */
+static gboolean bundle_add_file (struct archive *writer, const gchar *file_path,
+                                 GString *manifest, gboolean *skipped);
+
+static gchar *
+bundle_path_for (const gchar *archive_path, const gchar *bundle_dir, const gchar *suffix)
+{
+  g_autofree gchar *file_basename = g_path_get_basename (archive_path);
+  g_autofree gchar *bundle_name = NULL;
+
+  if (g_str_has_suffix (file_basename, BUNDLE_ARCHIVE_SUFFIX))
+    file_basename[strlen (file_basename) - strlen (BUNDLE_ARCHIVE_SUFFIX)] = '\0';
+
+  bundle_name = g_strconcat (file_basename, suffix, NULL);
+
+  return g_build_filename (bundle_dir, bundle_name, NULL);
+}
+
+static gboolean
+bundle_copy_data (struct archive *reader, struct archive *writer, gchar *buffer)
+{
+  ssize_t nread;
+
+  while ((nread = archive_read_data (reader, buffer, BUNDLE_BUFFER_SIZE)) > 0)
+    {
+      if (archive_write_data (writer, buffer, (size_t)nread) != nread)
+        return FALSE;
+    }
+
+  return nread == 0;
+}
+
+static gboolean
+bundle_add_file (struct archive *writer, const gchar *file_path, GString *manifest,
+                 gboolean *skipped)
+{
+  g_autofree gchar *file_basename = g_path_get_basename (file_path);
+  g_autofree gchar *checksum = NULL;
+  g_autofree gchar *data = NULL;
+  struct archive_entry *entry;
+  struct stat fileinfo;
+  gboolean healthy;
+  gsize len = 0;
+
+  /*
+   * The member is read completely before its header is written. A read error after the
+   * header would leave a torn member in the stream, while an unreadable file is only
+   * skipped. Batch members are small so holding one in memory is cheap.
+   */
+  *skipped = (stat (file_path, &fileinfo) != 0
+              || !g_file_get_contents (file_path, &data, &len, NULL));
+  if (*skipped)
+    return FALSE;
+
+  entry = archive_entry_new ();
+  archive_entry_set_pathname (entry, file_basename);
+  archive_entry_set_filetype (entry, AE_IFREG);
+  archive_entry_set_perm (entry, 0644);
+  archive_entry_set_size (entry, (gint64)len);
+  archive_entry_set_mtime (entry, fileinfo.st_mtime, 0);
+
+  healthy = (archive_write_header (writer, entry) == ARCHIVE_OK
+             && (len == 0 || archive_write_data (writer, data, len) == (ssize_t)len));
+  archive_entry_free (entry);
+
+  if (healthy)
+    {
+      checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *)data, len);
+      g_string_append_printf (manifest, "%s %ld %s\n", file_basename, (gint64)len, checksum);
+    }
+
+  return healthy;
+}
+
+gchar *
+cdm_bundle_create_metadata (const gchar *archive_path, const gchar *bundle_dir, GError **error)
+{
+  g_autofree gchar *bundle_path = NULL;
+  g_autofree gchar *buffer = NULL;
+  struct archive_entry *entry;
+  struct archive *reader;
+  struct archive *writer;
+  gboolean healthy = TRUE;
+  gint members = 0;
+
+  g_assert (archive_path);
+  g_assert (bundle_dir);
+
+  reader = archive_read_new ();
+  archive_read_support_filter_all (reader);
+  archive_read_support_format_all (reader);
+
+  if (archive_read_open_filename (reader, archive_path, 10240) != ARCHIVE_OK)
+    {
+      g_set_error (error, g_quark_from_static_string ("BundleCreate"), 1,
+                   "Cannot open archive %s", archive_path);
+      archive_read_free (reader);
+      return NULL;
+    }
+
+  bundle_path = bundle_path_for (archive_path, bundle_dir, BUNDLE_METADATA_SUFFIX);
+
+  writer = archive_write_new ();
+  archive_write_add_filter_gzip (writer);
+  archive_write_set_format_pax_restricted (writer);
+
+  if (archive_write_open_filename (writer, bundle_path) != ARCHIVE_OK)
+    {
+      g_set_error (error, g_quark_from_static_string ("BundleCreate"), 1,
+                   "Cannot create bundle %s", bundle_path);
+      archive_write_free (writer);
+      archive_read_free (reader);
+      return NULL;
+    }
+
+  buffer = g_new0 (gchar, BUNDLE_BUFFER_SIZE);
+
+  /* the coredump streams are the bulk of the archive, everything else is triage data */
+  while (healthy && archive_read_next_header (reader, &entry) == ARCHIVE_OK)
+    {
+      if (g_str_has_prefix (archive_entry_pathname (entry), BUNDLE_COREDUMP_PREFIX))
+        {
+          archive_read_data_skip (reader);
+          continue;
+        }
+
+      healthy = (archive_write_header (writer, entry) == ARCHIVE_OK
+                 && bundle_copy_data (reader, writer, buffer));
+      members++;
+    }
+
+  if (archive_write_close (writer) != ARCHIVE_OK)
+    healthy = FALSE;
+
+  archive_write_free (writer);
+  archive_read_free (reader);
+
+  if (!healthy || members == 0)
+    {
+      g_set_error (error, g_quark_from_static_string ("BundleCreate"), 1,
+                   "Cannot copy the metadata of %s", archive_path);
+      unlink (bundle_path);
+      return NULL;
+    }
+
+  return g_steal_pointer (&bundle_path);
+}
+
+gboolean
+cdm_bundle_create_batch (GPtrArray *archive_paths, const gchar *bundle_path, GPtrArray *skipped,
+                         GError **error)
+{
+  g_autoptr (GString) manifest = g_string_new (NULL);
+  struct archive_entry *entry;
+  struct archive *writer;
+  gboolean healthy = TRUE;
+  guint members = 0;
+
+  g_assert (archive_paths);
+  g_assert (bundle_path);
+
+  writer = archive_write_new ();
+  archive_write_set_format_pax_restricted (writer);
+
+  /* the members are compressed archives already */
+  if (archive_write_open_filename (writer, bundle_path) != ARCHIVE_OK)
+    {
+      g_set_error (error, g_quark_from_static_string ("BundleCreate"), 1,
+                   "Cannot create bundle %s", bundle_path);
+      archive_write_free (writer);
+      return FALSE;
+    }
+
+  for (guint i = 0; i < archive_paths->len && healthy; i++)
+    {
+      const gchar *archive_path = (const gchar *)g_ptr_array_index (archive_paths, i);
+      gboolean unreadable = FALSE;
+
+      if (bundle_add_file (writer, archive_path, manifest, &unreadable))
+        members++;
+      else if (unreadable)
+        {
+          /* one broken archive must not hold back the others */
+          g_warning ("Cannot read %s, it is left out of the batch", archive_path);
+          if (skipped != NULL)
+            g_ptr_array_add (skipped, g_ptr_array_index (archive_paths, i));
+        }
+      else
+        {
+          g_set_error (error, g_quark_from_static_string ("BundleCreate"), 1,
+                       "Cannot add %s to bundle", archive_path);
+          healthy = FALSE;
+        }
+    }
+
+  if (healthy && members == 0)
+    {
+      g_set_error (error, g_quark_from_static_string ("BundleCreate"), 1,
+                   "No readable archive for bundle %s", bundle_path);
+      healthy = FALSE;
+    }
+
+  /* the manifest is written last as the checksums are computed while storing the members */
+  if (healthy)
+    {
+      entry = archive_entry_new ();
+      archive_entry_set_pathname (entry, BUNDLE_MANIFEST_NAME);
+      archive_entry_set_filetype (entry, AE_IFREG);
+      archive_entry_set_perm (entry, 0644);
+      archive_entry_set_size (entry, (gint64)manifest->len);
+      archive_entry_set_mtime (entry, g_get_real_time () / G_USEC_PER_SEC, 0);
+
+      healthy = (archive_write_header (writer, entry) == ARCHIVE_OK
+                 && archive_write_data (writer, manifest->str, manifest->len)
+                        == (ssize_t)manifest->len);
+      archive_entry_free (entry);
+
+      if (!healthy)
+        g_set_error (error, g_quark_from_static_string ("BundleCreate"), 1,
+                     "Cannot write the manifest of %s", bundle_path);
+    }
+
+  if (archive_write_close (writer) != ARCHIVE_OK && healthy)
+    {
+      g_set_error (error, g_quark_from_static_string ("BundleCreate"), 1,
+                   "Cannot close bundle %s", bundle_path);
+      healthy = FALSE;
+    }
+
+  archive_write_free (writer);
+
+  if (!healthy)
+    unlink (bundle_path);
+
+  return healthy;
+}
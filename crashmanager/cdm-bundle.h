@@ -0,0 +1,56 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-bundle.h
+ */
+
+#pragma once
+
+#include "cdm-types.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * @brief Create the metadata bundle of a crash archive
+ * The bundle holds all the archive members except the coredump streams.
+ * @param archive_path The crash archive path
+ * @param bundle_dir The directory to create the bundle in
+ * @param error The GError object or NULL
+ * @return On success return the new bundle path
+ */
+gchar *cdm_bundle_create_metadata (const gchar *archive_path, const gchar *bundle_dir,
+                                   GError **error);
+
+/*
+ * @brief Create a bundle holding a batch of crash archives
+ * The archives are stored as they are followed by a manifest member listing the name, size and
+ * sha256 checksum of each archive, one per line. Archives that cannot be read are left out.
+ * @param archive_paths The crash archive paths
+ * @param bundle_path The bundle path to create
+ * @param skipped Filled with the archive paths left out of the bundle or NULL
+ * @param error The GError object or NULL
+ * @return TRUE on success, FALSE if no archive could be stored
+ */
+gboolean cdm_bundle_create_batch (GPtrArray *archive_paths, const gchar *bundle_path,
+                                  GPtrArray *skipped, GError **error);
+
+G_END_DECLS
@@ -26,12 +26,18 @@
 #include "cdm-transfer.h"
 #include "cdm-utils.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#define CLIENT_READ_CHUNK_SIZE (1024)
+#define CLIENT_RXBUF_MAX_SIZE (65536)
+#define CLIENT_TXBUF_MAX_SIZE (65536)
+
 #ifdef WITH_LXC
 #include <lxc/lxccontainer.h>
 #endif
@@ -61,6 +67,21 @@ static gboolean client_source_callback (gpointer data);
  */
 static void client_source_destroy_notify (gpointer data);
 
+/**
+ * @brief Queue a reply and write as much as the socket accepts
+ */
+static gboolean client_send (CdmClient *c, CdmMessage *msg);
+
+/**
+ * @brief Write queued replies without blocking
+ */
+static gboolean client_flush (CdmClient *c);
+
+/**
+ * @brief Process a complete message received from client
+ */
+static void process_message (CdmClient *c, CdmMessage *msg);
+
 /**
  * @brief Initial message processing
  */
@@ -71,10 +92,21 @@ static void do_initial_message_process (CdmClient *c, CdmMessage *msg);
  */
 static gchar *get_pid_context_id (pid_t pid);
 
+/**
+ * @brief Get context name for context ID
+ */
+static gchar *get_context_name (const gchar *ctxid);
+
 /**
  * @brief Transfer complete callback
  */
-static void archive_transfer_complete (gpointer cdmclient, const gchar *file_path);
+static void archive_transfer_complete (gpointer cdmclient, const gchar *file_path,
+                                       CdmStatus status);
+
+/**
+ * @brief Journal update completion callback
+ */
+static void journal_update_complete (gpointer file_path, const GError *error);
 
 #ifdef WITH_LXC
 /**
@@ -119,15 +151,68 @@ client_source_dispatch (GSource *source, GSourceFunc callback, gpointer user_dat
 static gboolean
 client_source_callback (gpointer data)
 {
-  g_autoptr (CdmMessage) msg = NULL;
   CdmClient *client = (CdmClient *)data;
-  gboolean status = TRUE;
+  gboolean connected = TRUE;
+  gsize offset = 0;
 
   g_assert (client);
 
-  msg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
+  if ((g_source_query_unix_fd (CDM_EVENT_SOURCE (client), client->tag) & G_IO_OUT) != 0)
+    connected = client_flush (client);
+
+  /* drain the socket without blocking so a slow client only delays itself */
+  while (connected)
+    {
+      guint8 buf[CLIENT_READ_CHUNK_SIZE];
+      gssize sz = recv (client->sockfd, buf, sizeof (buf), MSG_DONTWAIT);
+
+      if (sz > 0)
+        g_byte_array_append (client->rxbuf, buf, (guint)sz);
+      else if (sz < 0 && errno == EINTR)
+        continue;
+      else if (sz < 0 && errno == EAGAIN)
+        break;
+      else
+        connected = FALSE;
+    }
+
+  while (offset < client->rxbuf->len)
+    {
+      g_autoptr (CdmMessage) msg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
+      gsize consumed = 0;
+
+      if (cdm_message_parse (msg, client->rxbuf->data + offset, client->rxbuf->len - offset,
+                             &consumed)
+          != CDM_STATUS_OK)
+        {
+          g_warning ("Malformed message from client socket %d", client->sockfd);
+          connected = FALSE;
+          break;
+        }
+
+      if (consumed == 0)
+        break;
+
+      offset += consumed;
+      process_message (client, msg);
+    }
+
+  if (offset > 0)
+    g_byte_array_remove_range (client->rxbuf, 0, (guint)offset);
 
-  if (cdm_message_read (client->sockfd, msg) != CDM_STATUS_OK)
+  if (client->rxbuf->len > CLIENT_RXBUF_MAX_SIZE)
+    {
+      g_warning ("Receive buffer overflow for client socket %d", client->sockfd);
+      connected = FALSE;
+    }
+
+  if (client->txbuf->len > CLIENT_TXBUF_MAX_SIZE)
+    {
+      g_warning ("Send buffer overflow for client socket %d", client->sockfd);
+      connected = FALSE;
+    }
+
+  if (!connected)
     {
       g_debug ("Cannot read from client socket %d", client->sockfd);
 
@@ -141,72 +226,121 @@ client_source_callback (gpointer data)
             }
         }
 #endif
-      status = FALSE;
     }
-  else
-    {
-      CdmMessageType type = cdm_message_get_type (msg);
 
-      do_initial_message_process (client, msg);
+  return connected;
+}
+
+static gboolean
+client_flush (CdmClient *c)
+{
+  guint offset = 0;
 
-      switch (type)
+  while (offset < c->txbuf->len)
+    {
+      gssize sz = send (c->sockfd, c->txbuf->data + offset, c->txbuf->len - offset,
+                        MSG_DONTWAIT | MSG_NOSIGNAL);
+
+      if (sz > 0)
+        offset += (guint)sz;
+      else if (sz < 0 && errno == EINTR)
+        continue;
+      else if (sz < 0 && errno == EAGAIN)
+        break;
+      else
         {
-        case CDM_MESSAGE_COREDUMP_NEW:
+          g_debug ("Cannot write to client socket %d", c->sockfd);
+          return FALSE;
+        }
+    }
+
+  if (offset > 0)
+    g_byte_array_remove_range (c->txbuf, 0, offset);
+
+  /* the rest goes out when the socket is writable, the main loop never waits for the client */
+  g_source_modify_unix_fd (CDM_EVENT_SOURCE (c), c->tag,
+                           c->txbuf->len > 0 ? G_IO_IN | G_IO_PRI | G_IO_OUT
+                                             : G_IO_IN | G_IO_PRI);
+
+  return TRUE;
+}
+
+static gboolean
+client_send (CdmClient *c, CdmMessage *msg)
+{
+  gboolean pending = c->txbuf->len > 0;
+
+  cdm_message_serialize (msg, c->txbuf);
+
+  /* a reply queued behind a pending one waits for the G_IO_OUT watch */
+  return pending ? TRUE : client_flush (c);
+}
+
+static void
+process_message (CdmClient *client, CdmMessage *msg)
+{
+  CdmMessageType type = cdm_message_get_type (msg);
+
+  do_initial_message_process (client, msg);
+
+  switch (type)
+    {
+    case CDM_MESSAGE_COREDUMP_NEW:
 #ifdef WITH_GENIVI_NSM
-          if (cdm_lifecycle_set_session_state (client->lifecycle, LC_SESSION_ACTIVE)
-              != CDM_STATUS_OK)
-            {
-              g_warning ("Fail increment session lifecycle counter");
-            }
+      if (cdm_lifecycle_set_session_state (client->lifecycle, LC_SESSION_ACTIVE) != CDM_STATUS_OK)
+        {
+          g_warning ("Fail increment session lifecycle counter");
+        }
 #endif
-          break;
+      break;
 
-        case CDM_MESSAGE_COREDUMP_FAILED:
-          g_warning ("Coredump processing failed for client %d", client->sockfd);
+    case CDM_MESSAGE_COREDUMP_FAILED:
+      g_warning ("Coredump processing failed for client %d", client->sockfd);
 #ifdef WITH_GENIVI_NSM
-          if (cdm_lifecycle_set_session_state (client->lifecycle, LC_SESSION_INACTIVE)
-              != CDM_STATUS_OK)
-            {
-              g_warning ("Fail decrement session lifecycle counter");
-            }
+      if (cdm_lifecycle_set_session_state (client->lifecycle, LC_SESSION_INACTIVE) != CDM_STATUS_OK)
+        {
+          g_warning ("Fail decrement session lifecycle counter");
+        }
 #endif
-          break;
+      break;
 
-        case CDM_MESSAGE_COREDUMP_SUCCESS:
-          {
-            g_autoptr (GError) error = NULL;
-            guint64 dbid;
-
-            dbid = cdm_journal_add_crash (
-                client->journal, client->process_name, client->process_crash_id,
-                client->process_vector_id, client->process_context_id, client->context_name,
-                client->lifecycle_state, client->coredump_file_path, client->process_pid,
-                client->process_exit_signal, client->process_timestamp, &error);
-
-            if (error != NULL)
-              g_warning ("Fail to add new crash entry in database %s", error->message);
-            else
-              g_debug ("New crash entry added to database with id %016lX", dbid);
-
-            /* even if we fail to add to the database we try to transfer the file */
-            cdm_transfer_file (client->transfer, client->coredump_file_path,
-                               archive_transfer_complete, cdm_client_ref (client));
+    case CDM_MESSAGE_COREDUMP_SUCCESS:
+      {
+        g_autoptr (GError) error = NULL;
+        guint64 dbid;
+
+        dbid = cdm_journal_add_crash (client->journal, client->process_name,
+                                      client->process_crash_id, client->process_vector_id,
+                                      client->process_context_id, client->context_name,
+                                      client->lifecycle_state, client->coredump_file_path,
+                                      client->process_pid, client->process_exit_signal,
+                                      client->process_timestamp, journal_update_complete,
+                                      g_strdup (client->coredump_file_path), &error);
+
+        if (error != NULL)
+          g_warning ("Fail to add new crash entry in database %s", error->message);
+        else
+          g_debug ("New crash entry queued to database with id %016lX", dbid);
+
+        /* the triage data goes ahead, the full archive follows under the bandwidth policy */
+        cdm_transfer_metadata (client->transfer, client->coredump_file_path);
+
+        /* even if we fail to add to the database we try to transfer the file */
+        cdm_transfer_file (client->transfer, client->coredump_file_path,
+                           archive_transfer_complete, cdm_client_ref (client));
 #ifdef WITH_GENIVI_NSM
-            if (cdm_lifecycle_set_session_state (client->lifecycle, LC_SESSION_INACTIVE)
-                != CDM_STATUS_OK)
-              {
-                g_warning ("Fail decrement session lifecycle counter");
-              }
-#endif
+        if (cdm_lifecycle_set_session_state (client->lifecycle, LC_SESSION_INACTIVE)
+            != CDM_STATUS_OK)
+          {
+            g_warning ("Fail decrement session lifecycle counter");
           }
-          break;
+#endif
+      }
+      break;
 
-        default:
-          break;
-        }
+    default:
+      break;
     }
-
-  return status;
 }
 
 static void
@@ -282,6 +416,26 @@ get_pid_context_id (pid_t pid)
   return g_strdup_printf ("%016lX", cdm_utils_jenkins_hash (ctx_str));
 }
 
+static gchar *
+get_context_name (const gchar *ctxid)
+{
+  g_autofree gchar *host_id = NULL;
+
+  if (ctxid == NULL)
+    return g_strdup (cdm_notavailable_str);
+
+  /* Crashmanager is running in host context so use current pid */
+  host_id = get_pid_context_id (getpid ());
+  if (g_strcmp0 (host_id, ctxid) == 0)
+    return g_strdup (g_get_host_name ());
+
+#ifdef WITH_LXC
+  return get_container_name_for_context (ctxid);
+#else
+  return g_strdup ("container");
+#endif
+}
+
 #ifdef WITH_LXC
 static gchar *
 get_container_name_for_context (const gchar *ctxid)
@@ -348,7 +502,7 @@ send_context_info (CdmClient *c, const gchar *context_name)
   cdm_message_set_lifecycle_state (msg, "running");
 #endif
 
-  if (cdm_message_write (c->sockfd, msg) == CDM_STATUS_ERROR)
+  if (!client_send (c, msg))
     g_warning ("Failed to send context information to client");
 }
 
@@ -375,7 +529,7 @@ send_epilog (CdmClient *c, CdmJournalEpilog *elog)
       g_info ("Epilog available for client %lx with %lu frames", c->id, frame_cnt);
     }
 
-  if (cdm_message_write (c->sockfd, msg) == CDM_STATUS_ERROR)
+  if (!client_send (c, msg))
     g_warning ("Failed to send epilog information to client");
 
   if (frame_cnt > 0)
@@ -387,7 +541,7 @@ send_epilog (CdmClient *c, CdmJournalEpilog *elog)
           cdm_message_set_epilog_frame_data (fmsg, elog->backtrace
                                                        + (i * CDM_MESSAGE_EPILOG_FRAME_MAX_LEN));
 
-          if (cdm_message_write (c->sockfd, fmsg) == CDM_STATUS_ERROR)
+          if (!client_send (c, fmsg))
             g_warning ("Failed to send epilog frame %lu to client", i);
         }
     }
@@ -397,7 +551,6 @@ static void
 do_initial_message_process (CdmClient *c, CdmMessage *msg)
 {
   g_autofree gchar *tmp_id = NULL;
-  g_autofree gchar *tmp_name = NULL;
 
   g_assert (c);
   g_assert (msg);
@@ -417,8 +570,19 @@ do_initial_message_process (CdmClient *c, CdmMessage *msg)
       c->process_name = g_strdup (cdm_message_get_process_name (msg));
       c->thread_name = g_strdup (cdm_message_get_thread_name (msg));
 
-      g_info ("New crash id=%lx name=%s thread=%s pid=%d signal=%d", c->id, c->process_name,
-              c->thread_name, (gint)c->process_pid, (gint)c->process_exit_signal);
+      /*
+       * The crashed process namespaces are still available while the kernel streams the
+       * coredump so we resolve the context here and answer right away. The handler does not
+       * wait for this reply, it is picked up when the crashdata file is written.
+       */
+      tmp_id = get_pid_context_id ((pid_t)c->process_pid);
+      c->context_name = get_context_name (tmp_id);
+
+      g_info ("New crash id=%lx name=%s thread=%s pid=%d signal=%d contextName=%s", c->id,
+              c->process_name, c->thread_name, (gint)c->process_pid, (gint)c->process_exit_signal,
+              c->context_name);
+
+      send_context_info (c, c->context_name);
       break;
 
     case CDM_MESSAGE_COREDUMP_UPDATE:
@@ -426,31 +590,26 @@ do_initial_message_process (CdmClient *c, CdmMessage *msg)
       c->process_vector_id = g_strdup (cdm_message_get_process_vector_id (msg));
       c->process_context_id = g_strdup (cdm_message_get_process_context_id (msg));
 
-      /* Crashhandler is running in host context so use current pid */
-      tmp_id = get_pid_context_id (getpid ());
-      if (g_strcmp0 (tmp_id, c->process_context_id) == 0)
-        tmp_name = g_strdup (g_get_host_name ());
-      else
-        {
-#ifdef WITH_LXC
-          tmp_name = get_container_name_for_context (c->process_context_id);
-#else
-          tmp_name = g_strdup ("container");
-#endif
-        }
+      if (c->context_name == NULL)
+        c->context_name = get_context_name (c->process_context_id);
 
       g_info ("Update crash id=%lx crashID=%s vectorID=%s contextID=%s contextName=%s", c->id,
-              c->process_crash_id, c->process_vector_id, c->process_context_id, tmp_name);
+              c->process_crash_id, c->process_vector_id, c->process_context_id, c->context_name);
 
 #ifdef WITH_DBUS_SERVICES
-      cdm_dbusown_emit_new_crash (c->dbusown, c->process_name, tmp_name, c->process_crash_id);
+      cdm_dbusown_emit_new_crash (c->dbusown, c->process_name, c->context_name,
+                                  c->process_crash_id);
 #endif
-      send_context_info (c, tmp_name);
+      /* the epilog is sent late to give the epilog client time to finish its stream */
       send_epilog (c, cdm_journal_epilog_get (c->journal, c->process_pid));
+
+      /* the epilog is consumed, a later crash reusing the pid must not get this backtrace */
+      (void)cdm_journal_epilog_rem (c->journal, c->process_pid);
       break;
 
     case CDM_MESSAGE_COREDUMP_SUCCESS:
       c->coredump_file_path = g_strdup (cdm_message_get_coredump_file_path (msg));
+      g_free (c->context_name);
       c->context_name = g_strdup (cdm_message_get_context_name (msg));
       c->lifecycle_state = g_strdup (cdm_message_get_lifecycle_state (msg));
       g_info ("Coredump id=%lx status OK", c->id);
@@ -466,14 +625,20 @@ do_initial_message_process (CdmClient *c, CdmMessage *msg)
 }
 
 static void
-archive_transfer_complete (gpointer cdmclient, const gchar *file_path)
+archive_transfer_complete (gpointer cdmclient, const gchar *file_path, CdmStatus status)
 {
   CdmClient *client = (CdmClient *)cdmclient;
 
   g_autoptr (GError) error = NULL;
 
-  g_info ("Transfer complete for %s", file_path);
-  cdm_journal_set_transfer (client->journal, file_path, TRUE, &error);
+  if (status == CDM_STATUS_OK)
+    {
+      g_info ("Transfer complete for %s", file_path);
+      cdm_journal_set_transfer (client->journal, file_path, TRUE, journal_update_complete,
+                                g_strdup (file_path), &error);
+    }
+  else
+    g_warning ("Transfer failed for %s", file_path);
 
   if (error != NULL)
     g_warning ("Fail to set transfer complete flag for %s. Error %s", file_path, error->message);
@@ -481,6 +646,16 @@ archive_transfer_complete (gpointer cdmclient, const gchar *file_path)
   cdm_client_unref (client);
 }
 
+static void
+journal_update_complete (gpointer file_path, const GError *error)
+{
+  if (error != NULL)
+    g_warning ("Fail to update journal entry for %s. Error %s", (gchar *)file_path,
+               error->message);
+
+  g_free (file_path);
+}
+
 CdmClient *
 cdm_client_new (gint clientfd, CdmTransfer *transfer, CdmJournal *journal)
 {
@@ -491,6 +666,8 @@ cdm_client_new (gint clientfd, CdmTransfer *transfer, CdmJournal *journal)
   g_ref_count_init (&client->rc);
 
   client->sockfd = clientfd;
+  client->rxbuf = g_byte_array_new ();
+  client->txbuf = g_byte_array_new ();
   client->transfer = cdm_transfer_ref (transfer);
   client->journal = cdm_journal_ref (journal);
 
@@ -539,6 +716,9 @@ cdm_client_unref (CdmClient *client)
       g_free (client->process_vector_id);
       g_free (client->process_context_id);
       g_free (client->coredump_file_path);
+      g_byte_array_unref (client->rxbuf);
+      g_byte_array_unref (client->txbuf);
+      close (client->sockfd);
 
       g_source_unref (CDM_EVENT_SOURCE (client));
     }
@@ -58,6 +58,8 @@ typedef struct _CdmClient
   CdmDBusOwn *dbusown; /**< Own a reference to dbusown object */
 #endif
   CdmMessageType last_msg_type; /**< Last processed message type */
+  GByteArray *rxbuf;            /**< Incremental receive buffer */
+  GByteArray *txbuf;            /**< Replies not yet accepted by the socket */
 
   int64_t process_pid;
   int64_t process_exit_signal;
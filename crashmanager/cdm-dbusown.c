@@ -67,6 +67,28 @@ static void dbusown_queue_destroy_notify (gpointer _dbusown);
  */
 static void dbusown_emit_new_crash (CdmDBusOwn *d, const gchar *proc_name,
                                     const gchar *proc_context, const gchar *proc_crashid);
+/**
+ * @brief Handle crash statistics method call
+ */
+static void dbusown_get_crash_statistics (CdmDBusOwn *d, GVariant *parameters,
+                                          GDBusMethodInvocation *invocation);
+
+/**
+ * @brief Handle transfer metrics method call
+ */
+static void dbusown_get_transfer_metrics (CdmDBusOwn *d, GDBusMethodInvocation *invocation);
+
+/**
+ * @brief Add a transfer record to the metrics reply
+ */
+static void dbusown_add_transfer_record (const CdmTransferRecord *record, gpointer _builder);
+
+/**
+ * @brief Handle transfer limits method call
+ */
+static void dbusown_set_transfer_limits (CdmDBusOwn *d, GVariant *parameters,
+                                         GDBusMethodInvocation *invocation);
+
 /**
  * @brief Handle method call
  */
@@ -131,6 +153,19 @@ static const gchar introspection_xml[]
       "      <arg type='s' name='process_context'/>"
       "      <arg type='s' name='process_crashid'/>"
       "    </signal>"
+      "    <method name='GetCrashStatistics'>"
+      "      <arg type='s' name='process_crashid' direction='in'/>"
+      "      <arg type='a(ssxxxxxss)' name='statistics' direction='out'/>"
+      "    </method>"
+      "    <method name='GetTransferMetrics'>"
+      "      <arg type='a{sv}' name='metrics' direction='out'/>"
+      "    </method>"
+      "    <method name='SetTransferLimits'>"
+      "      <arg type='u' name='rate_limit_kbps' direction='in'/>"
+      "      <arg type='u' name='max_pressure' direction='in'/>"
+      "      <arg type='u' name='idle_pressure' direction='in'/>"
+      "      <arg type='u' name='max_load' direction='in'/>"
+      "    </method>"
       "  </interface>"
       "</node>";
 
@@ -238,19 +273,141 @@ dbusown_emit_new_crash (CdmDBusOwn *d, const gchar *proc_name, const gchar *proc
     }
 }
 
+static void
+dbusown_get_crash_statistics (CdmDBusOwn *d, GVariant *parameters,
+                              GDBusMethodInvocation *invocation)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GPtrArray) stats = NULL;
+  const gchar *crash_id = NULL;
+  GVariantBuilder builder;
+
+  if (d->journal == NULL)
+    {
+      g_dbus_method_invocation_return_dbus_error (
+          invocation, "ro.fxdata.crashmanager.Error.Unavailable", "Journal not available");
+      return;
+    }
+
+  /* an empty crash id requests the statistics for all crash ids */
+  g_variant_get (parameters, "(&s)", &crash_id);
+  stats = cdm_journal_get_stats (d->journal, crash_id[0] != '\0' ? crash_id : NULL, &error);
+
+  if (error != NULL)
+    {
+      g_dbus_method_invocation_return_dbus_error (
+          invocation, "ro.fxdata.crashmanager.Error.Failed", error->message);
+      return;
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssxxxxxss)"));
+
+  for (guint i = 0; i < stats->len; i++)
+    {
+      CdmJournalStats *s = (CdmJournalStats *)g_ptr_array_index (stats, i);
+
+      g_variant_builder_add (&builder, "(ssxxxxxss)", s->crash_id, s->vector_id, s->count,
+                             s->first_seen, s->last_seen, s->processes, s->contexts, s->proc_name,
+                             s->context_name);
+    }
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(a(ssxxxxxss))", &builder));
+}
+
+static void
+dbusown_get_transfer_metrics (CdmDBusOwn *d, GDBusMethodInvocation *invocation)
+{
+  CdmTransferMetrics metrics;
+  GVariantBuilder builder;
+  GVariantBuilder records;
+
+  if (d->transfer == NULL)
+    {
+      g_dbus_method_invocation_return_dbus_error (
+          invocation, "ro.fxdata.crashmanager.Error.Unavailable", "Transfer not available");
+      return;
+    }
+
+  cdm_transfer_get_metrics (d->transfer, &metrics);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&builder, "{sv}", "QueueDepth", g_variant_new_uint32 (metrics.queued));
+  g_variant_builder_add (&builder, "{sv}", "MetadataQueueDepth",
+                         g_variant_new_uint32 (metrics.metadata_queued));
+  g_variant_builder_add (&builder, "{sv}", "Batched", g_variant_new_uint32 (metrics.batched));
+  g_variant_builder_add (&builder, "{sv}", "Delayed", g_variant_new_uint32 (metrics.delayed));
+  g_variant_builder_add (&builder, "{sv}", "InFlight", g_variant_new_uint32 (metrics.in_flight));
+  g_variant_builder_add (&builder, "{sv}", "InFlightBytes",
+                         g_variant_new_uint64 (metrics.in_flight_bytes));
+  g_variant_builder_add (&builder, "{sv}", "Completed", g_variant_new_uint64 (metrics.completed));
+  g_variant_builder_add (&builder, "{sv}", "SentBytes", g_variant_new_uint64 (metrics.sent_bytes));
+  g_variant_builder_add (&builder, "{sv}", "RateLimit", g_variant_new_uint64 (metrics.rate));
+  g_variant_builder_add (&builder, "{sv}", "Window",
+                         g_variant_new_string (metrics.window == CDM_TRANSFER_WINDOW_BUSY ? "busy"
+                                               : metrics.window == CDM_TRANSFER_WINDOW_IDLE
+                                                   ? "idle"
+                                                   : "open"));
+
+  g_variant_builder_init (&records, G_VARIANT_TYPE ("a(sttbb)"));
+  cdm_transfer_foreach_record (d->transfer, dbusown_add_transfer_record, &records);
+  g_variant_builder_add (&builder, "{sv}", "Recent", g_variant_builder_end (&records));
+
+  g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a{sv})", &builder));
+}
+
+static void
+dbusown_add_transfer_record (const CdmTransferRecord *record, gpointer _builder)
+{
+  g_variant_builder_add ((GVariantBuilder *)_builder, "(sttbb)", record->file_name,
+                         (guint64)record->file_size, record->sent_bytes, record->delta,
+                         record->status == CDM_STATUS_OK);
+}
+
+static void
+dbusown_set_transfer_limits (CdmDBusOwn *d, GVariant *parameters,
+                             GDBusMethodInvocation *invocation)
+{
+  CdmTransferLimits limits;
+  guint32 rate_limit = 0;
+
+  if (d->transfer == NULL)
+    {
+      g_dbus_method_invocation_return_dbus_error (
+          invocation, "ro.fxdata.crashmanager.Error.Unavailable", "Transfer not available");
+      return;
+    }
+
+  g_variant_get (parameters, "(uuuu)", &rate_limit, &limits.max_pressure, &limits.idle_pressure,
+                 &limits.max_load);
+  limits.rate_limit = (guint64)rate_limit * 1024;
+
+  cdm_transfer_set_limits (d->transfer, &limits);
+
+  g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
 static void
 handle_method_call (GDBusConnection *connection, const gchar *sender, const gchar *object_path,
                     const gchar *interface_name, const gchar *method_name, GVariant *parameters,
                     GDBusMethodInvocation *invocation, gpointer user_data)
 {
+  CdmDBusOwn *d = (CdmDBusOwn *)user_data;
+
   CDM_UNUSED (connection);
   CDM_UNUSED (sender);
   CDM_UNUSED (object_path);
   CDM_UNUSED (interface_name);
-  CDM_UNUSED (method_name);
-  CDM_UNUSED (parameters);
-  CDM_UNUSED (invocation);
-  CDM_UNUSED (user_data);
+
+  if (g_strcmp0 (method_name, "GetCrashStatistics") == 0)
+    dbusown_get_crash_statistics (d, parameters, invocation);
+  else if (g_strcmp0 (method_name, "GetTransferMetrics") == 0)
+    dbusown_get_transfer_metrics (d, invocation);
+  else if (g_strcmp0 (method_name, "SetTransferLimits") == 0)
+    dbusown_set_transfer_limits (d, parameters, invocation);
+  else
+    g_dbus_method_invocation_return_dbus_error (
+        invocation, "org.freedesktop.DBus.Error.UnknownMethod", "Unknown method");
 }
 
 static GVariant *
@@ -372,6 +529,12 @@ cdm_dbusown_unref (CdmDBusOwn *d)
       if (d->options != NULL)
         cdm_options_unref (d->options);
 
+      if (d->journal != NULL)
+        cdm_journal_unref (d->journal);
+
+      if (d->transfer != NULL)
+        cdm_transfer_unref (d->transfer);
+
       if (d->owner_id > 0)
         g_bus_unown_name (d->owner_id);
 
@@ -383,6 +546,24 @@ cdm_dbusown_unref (CdmDBusOwn *d)
     }
 }
 
+void
+cdm_dbusown_set_journal (CdmDBusOwn *d, CdmJournal *journal)
+{
+  g_assert (d);
+  g_assert (journal);
+
+  d->journal = cdm_journal_ref (journal);
+}
+
+void
+cdm_dbusown_set_transfer (CdmDBusOwn *d, CdmTransfer *transfer)
+{
+  g_assert (d);
+  g_assert (transfer);
+
+  d->transfer = cdm_transfer_ref (transfer);
+}
+
 void
 cdm_dbusown_emit_new_crash (CdmDBusOwn *d, const gchar *pname, const gchar *context,
                             const gchar *crashid)
@@ -28,7 +28,9 @@
 
 #pragma once
 
+#include "cdm-journal.h"
 #include "cdm-options.h"
+#include "cdm-transfer.h"
 #include "cdm-types.h"
 
 #include <gio/gio.h>
@@ -72,6 +74,8 @@ typedef struct _CdmDBusOwn
   CdmOptions *options;
   guint owner_id;              /**< DBUS owner id */
   GDBusConnection *connection; /**< DBUS connection */
+  CdmJournal *journal;         /**< Journal answering the statistics queries */
+  CdmTransfer *transfer;       /**< Transfer answering the metrics queries */
 } CdmDBusOwn;
 
 /*
@@ -92,6 +96,20 @@ CdmDBusOwn *cdm_dbusown_ref (CdmDBusOwn *d);
  */
 void cdm_dbusown_unref (CdmDBusOwn *d);
 
+/**
+ * @brief Set the journal used to answer the crash statistics queries
+ * @param d Pointer to the dbusown object
+ * @param journal Pointer to the journal object
+ */
+void cdm_dbusown_set_journal (CdmDBusOwn *d, CdmJournal *journal);
+
+/**
+ * @brief Set the transfer used to answer the transfer metrics queries
+ * @param d Pointer to the dbusown object
+ * @param transfer Pointer to the transfer object
+ */
+void cdm_dbusown_set_transfer (CdmDBusOwn *d, CdmTransfer *transfer);
+
 /**
  * @brief Build DBus proxy
  * @param d Pointer to the dbusown object
@@ -0,0 +1,176 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-delta.c
+ */
+
+#include "cdm-delta.h"
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#define DELTA_BUFFER_SIZE (64 * 1024)
+#define DELTA_RECIPE_HEADER "CDM-DELTA 1"
+
+#ifndef DELTA_CHUNK_MIN
+#define DELTA_CHUNK_MIN (16 * 1024)
+#endif
+
+#ifndef DELTA_CHUNK_MAX
+#define DELTA_CHUNK_MAX (256 * 1024)
+#endif
+
+/* 16 bits give an average chunk of 64KB past the minimum size */
+#define DELTA_CHUNK_MASK (G_GUINT64_CONSTANT (0xffff) << 48)
+
+/**
+ * @brief Gear value of a byte for the rolling hash
+ */
+static inline guint64 delta_gear (guint8 value);
+
+/**
+ * @brief Hash a chunk and pass it to the callback
+ */
+static gboolean delta_emit (const guint8 *data, gsize size, CdmDeltaChunkCallback callback,
+                            gpointer user_data);
+
+static inline guint64
+delta_gear (guint8 value)
+{
+  /* splitmix64 with a fixed seed, every device must cut the same boundaries */
+  guint64 z = (guint64)value * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)
+              + G_GUINT64_CONSTANT (0x2545f4914f6cdd1d);
+
+  z = (z ^ (z >> 30)) * G_GUINT64_CONSTANT (0xbf58476d1ce4e5b9);
+  z = (z ^ (z >> 27)) * G_GUINT64_CONSTANT (0x94d049bb133111eb);
+
+  return z ^ (z >> 31);
+}
+
+static gboolean
+delta_emit (const guint8 *data, gsize size, CdmDeltaChunkCallback callback, gpointer user_data)
+{
+  g_autoptr (GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  CdmDeltaChunk chunk;
+
+  g_checksum_update (checksum, data, (gssize)size);
+
+  g_strlcpy (chunk.hash, g_checksum_get_string (checksum), sizeof (chunk.hash));
+  chunk.size = size;
+  chunk.missing = FALSE;
+
+  return callback (&chunk, data, user_data);
+}
+
+gboolean
+cdm_delta_foreach_chunk (const gchar *file_path, CdmDeltaChunkCallback callback,
+                         gpointer user_data, GError **error)
+{
+  g_autofree guint8 *chunk_data = NULL;
+  g_autofree guint8 *buffer = NULL;
+  struct archive_entry *entry;
+  struct archive *reader;
+  gboolean healthy = TRUE;
+  gsize chunk_len = 0;
+  guint64 hash = 0;
+  ssize_t nread = 0;
+
+  g_assert (file_path);
+  g_assert (callback);
+
+  /* the compressed stream changes entirely after the first difference, the content does not */
+  reader = archive_read_new ();
+  archive_read_support_filter_all (reader);
+  archive_read_support_format_raw (reader);
+
+  if (archive_read_open_filename (reader, file_path, 10240) != ARCHIVE_OK
+      || archive_read_next_header (reader, &entry) != ARCHIVE_OK)
+    {
+      g_set_error (error, g_quark_from_static_string ("DeltaChunk"), 1, "Cannot open archive %s",
+                   file_path);
+      archive_read_free (reader);
+      return FALSE;
+    }
+
+  chunk_data = g_malloc (DELTA_CHUNK_MAX);
+  buffer = g_malloc (DELTA_BUFFER_SIZE);
+
+  while (healthy && (nread = archive_read_data (reader, buffer, DELTA_BUFFER_SIZE)) > 0)
+    {
+      for (ssize_t i = 0; i < nread && healthy; i++)
+        {
+          chunk_data[chunk_len++] = buffer[i];
+          hash = (hash << 1) + delta_gear (buffer[i]);
+
+          if (chunk_len < DELTA_CHUNK_MIN)
+            continue;
+
+          if ((hash & DELTA_CHUNK_MASK) != 0 && chunk_len < DELTA_CHUNK_MAX)
+            continue;
+
+          healthy = delta_emit (chunk_data, chunk_len, callback, user_data);
+          chunk_len = 0;
+          hash = 0;
+        }
+    }
+
+  if (nread < 0)
+    {
+      g_set_error (error, g_quark_from_static_string ("DeltaChunk"), 1, "Cannot read archive %s",
+                   file_path);
+      healthy = FALSE;
+    }
+  else if (healthy && chunk_len > 0)
+    healthy = delta_emit (chunk_data, chunk_len, callback, user_data);
+
+  archive_read_free (reader);
+
+  if (!healthy && (error == NULL || *error == NULL))
+    g_set_error (error, g_quark_from_static_string ("DeltaChunk"), 1,
+                 "Chunking of %s stopped", file_path);
+
+  return healthy;
+}
+
+gchar *
+cdm_delta_recipe_new (const gchar *file_name, GArray *chunks)
+{
+  GString *recipe = g_string_new (NULL);
+  guint64 size = 0;
+
+  g_assert (file_name);
+  g_assert (chunks);
+
+  for (guint i = 0; i < chunks->len; i++)
+    size += g_array_index (chunks, CdmDeltaChunk, i).size;
+
+  g_string_append_printf (recipe, "%s\nname %s\nsize %lu\nchunks %u\n", DELTA_RECIPE_HEADER,
+                          file_name, size, chunks->len);
+
+  /* concatenating the chunks in this order rebuilds the decompressed archive */
+  for (guint i = 0; i < chunks->len; i++)
+    {
+      const CdmDeltaChunk *chunk = &g_array_index (chunks, CdmDeltaChunk, i);
+
+      g_string_append_printf (recipe, "%s %lu\n", chunk->hash, (guint64)chunk->size);
+    }
+
+  return g_string_free (recipe, FALSE);
+}
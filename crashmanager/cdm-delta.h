@@ -0,0 +1,74 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-delta.h
+ */
+
+#pragma once
+
+#include "cdm-types.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * @brief Length of the hex encoded chunk hash
+ */
+#define CDM_DELTA_HASH_LEN (64)
+
+/**
+ * @brief Content defined chunk of an archive
+ */
+typedef struct _CdmDeltaChunk
+{
+  gchar hash[CDM_DELTA_HASH_LEN + 1]; /**< Hex encoded sha256 of the chunk data */
+  gsize size;                         /**< Chunk size in bytes */
+  gboolean missing;                   /**< The chunk is not known by the destination */
+} CdmDeltaChunk;
+
+/**
+ * @brief Chunk callback, return FALSE to stop the iteration
+ */
+typedef gboolean (*CdmDeltaChunkCallback) (const CdmDeltaChunk *chunk, const guint8 *data,
+                                           gpointer user_data);
+
+/*
+ * @brief Split the decompressed content of an archive in content defined chunks
+ * The boundaries depend only on the data so the chunks shared by two archives are found even if
+ * their offset differs.
+ * @param file_path The archive path
+ * @param callback The function called for each chunk in order
+ * @param user_data The data passed to the callback
+ * @param error The GError object or NULL
+ * @return TRUE if all chunks are passed to the callback
+ */
+gboolean cdm_delta_foreach_chunk (const gchar *file_path, CdmDeltaChunkCallback callback,
+                                  gpointer user_data, GError **error);
+
+/*
+ * @brief Create the recipe to rebuild the decompressed archive content from its chunks
+ * @param file_name The archive name
+ * @param chunks Array of CdmDeltaChunk in content order
+ * @return A new string with the recipe
+ */
+gchar *cdm_delta_recipe_new (const gchar *file_name, GArray *chunks);
+
+G_END_DECLS
@@ -0,0 +1,316 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-dltbackend.c
+ */
+
+#include "cdm-dltbackend.h"
+#include "cdm-dltpacer.h"
+
+#ifdef WITH_GENIVI_DLT
+#include <dlt.h>
+#include <dlt_filetransfer.h>
+#endif
+#include <sys/stat.h>
+
+#define DLT_PACKAGE_SIZE (1024)
+#define DLT_SIM_BUFFER_SIZE (50000)
+
+#ifdef WITH_GENIVI_DLT
+DLT_DECLARE_CONTEXT (cdm_transfer_ctx);
+#endif
+
+/**
+ * @struct Sink state of an upload, it accounts each package against the bandwidth policy
+ */
+typedef struct _DLTBackendSink
+{
+  CdmTransfer *transfer;   /**< The transfer object */
+  CdmTransferEntry *entry; /**< The entry being uploaded */
+  gsize package_size;      /**< Bytes of one package */
+  const CdmDLTSink *sink;  /**< Sink of the dlt library or the stand-in */
+  gpointer sink_data;      /**< Data passed to the sink functions */
+} DLTBackendSink;
+
+/**
+ * @brief Send an archive as a dlt file transfer
+ */
+static CdmStatus dltbackend_upload (CdmTransferBackend *_backend, CdmTransfer *transfer,
+                                    CdmTransferEntry *entry);
+
+/**
+ * @brief Start the file transfer and get the number of packages
+ * @return The number of packages or -1 on error
+ */
+static gint dltbackend_file_begin (CdmDLTBackend *backend, CdmTransferEntry *entry,
+                                   const gchar *file_name, gsize file_size);
+
+/**
+ * @brief Finish the file transfer
+ */
+static CdmStatus dltbackend_file_end (CdmDLTBackend *backend, CdmTransferEntry *entry);
+
+/**
+ * @brief Sink buffer state function
+ */
+static void dltbackend_sink_buffer (gpointer _sink, gint *total, gint *used);
+
+/**
+ * @brief Sink flush function
+ */
+static void dltbackend_sink_flush (gpointer _sink);
+
+/**
+ * @brief Sink send function
+ */
+static gint dltbackend_sink_send (gpointer _sink, const gchar *file_path, gint package);
+
+/**
+ * @brief Log the transfer progress
+ */
+static void dltbackend_progress (const CdmDLTPacerStats *stats, gpointer _file_name);
+
+/**
+ * @brief Free the backend
+ */
+static void dltbackend_free (CdmTransferBackend *_backend);
+
+static const CdmDLTSink dltbackend_sink = {
+  dltbackend_sink_buffer,
+  dltbackend_sink_flush,
+  dltbackend_sink_send,
+};
+
+#ifdef WITH_GENIVI_DLT
+/**
+ * @brief Dlt library buffer state function
+ */
+static void dltlib_buffer (gpointer data, gint *total, gint *used);
+
+/**
+ * @brief Dlt library flush function
+ */
+static void dltlib_flush (gpointer data);
+
+/**
+ * @brief Dlt library package send function
+ */
+static gint dltlib_send (gpointer data, const gchar *file_path, gint package);
+
+static const CdmDLTSink dltlib_sink = {
+  dltlib_buffer,
+  dltlib_flush,
+  dltlib_send,
+};
+
+static void
+dltlib_buffer (gpointer data, gint *total, gint *used)
+{
+  CDM_UNUSED (data);
+  dlt_user_check_buffer (total, used);
+}
+
+static void
+dltlib_flush (gpointer data)
+{
+  CDM_UNUSED (data);
+  dlt_user_log_resend_buffer ();
+}
+
+static gint
+dltlib_send (gpointer data, const gchar *file_path, gint package)
+{
+  CDM_UNUSED (data);
+
+  /* no timeout between the packages, the pacer sets the rate */
+  return dlt_user_log_file_data (&cdm_transfer_ctx, file_path, package, 0);
+}
+#endif
+
+static gint
+dltbackend_file_begin (CdmDLTBackend *backend, CdmTransferEntry *entry, const gchar *file_name,
+                       gsize file_size)
+{
+  if (backend->simulated)
+    return (gint)((file_size + DLT_PACKAGE_SIZE - 1) / DLT_PACKAGE_SIZE);
+
+#ifdef WITH_GENIVI_DLT
+  if (dlt_user_log_file_header_alias (&cdm_transfer_ctx, entry->upload_path, file_name) != 0)
+    return -1;
+
+  return dlt_user_log_file_packagesCount (&cdm_transfer_ctx, entry->upload_path);
+#else
+  CDM_UNUSED (entry);
+  CDM_UNUSED (file_name);
+  return -1;
+#endif
+}
+
+static CdmStatus
+dltbackend_file_end (CdmDLTBackend *backend, CdmTransferEntry *entry)
+{
+  if (backend->simulated)
+    return CDM_STATUS_OK;
+
+#ifdef WITH_GENIVI_DLT
+  if (dlt_user_log_file_end (&cdm_transfer_ctx, entry->upload_path, 0) != 0)
+    return CDM_STATUS_ERROR;
+
+  return CDM_STATUS_OK;
+#else
+  CDM_UNUSED (entry);
+  return CDM_STATUS_ERROR;
+#endif
+}
+
+static void
+dltbackend_sink_buffer (gpointer _sink, gint *total, gint *used)
+{
+  DLTBackendSink *sink = (DLTBackendSink *)_sink;
+
+  sink->sink->buffer (sink->sink_data, total, used);
+}
+
+static void
+dltbackend_sink_flush (gpointer _sink)
+{
+  DLTBackendSink *sink = (DLTBackendSink *)_sink;
+
+  sink->sink->flush (sink->sink_data);
+}
+
+static gint
+dltbackend_sink_send (gpointer _sink, const gchar *file_path, gint package)
+{
+  DLTBackendSink *sink = (DLTBackendSink *)_sink;
+  gint retval;
+
+  for (gsize allowed = 0; allowed < sink->package_size;)
+    allowed = cdm_transfer_throttle (sink->transfer, sink->entry, sink->package_size);
+
+  /* a rejected package keeps its credit for the resend */
+  retval = sink->sink->send (sink->sink_data, file_path, package);
+  if (retval >= 0)
+    cdm_transfer_sent (sink->transfer, sink->entry, sink->package_size);
+
+  return retval;
+}
+
+static void
+dltbackend_progress (const CdmDLTPacerStats *stats, gpointer _file_name)
+{
+  g_info ("DLT transfer %s %d/%d packages, %.0f packages/s, drain %.0f B/s, %u rejected, "
+          "cpu %.1f%%",
+          (const gchar *)_file_name, stats->sent, stats->packages, stats->rate, stats->drain,
+          stats->rejected, stats->cpu);
+}
+
+static CdmStatus
+dltbackend_upload (CdmTransferBackend *_backend, CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  CdmDLTBackend *backend = (CdmDLTBackend *)_backend;
+  g_autofree gchar *file_name = g_path_get_basename (entry->upload_path);
+  DLTBackendSink sink = { transfer, entry, DLT_PACKAGE_SIZE, NULL, NULL };
+  struct stat fileinfo;
+  CdmDLTPacer pacer;
+  CdmDLTSim sim;
+  gint packages;
+
+  if (stat (entry->upload_path, &fileinfo) != 0)
+    {
+      g_warning ("Can't stat local file for transfer %s", entry->upload_path);
+      return CDM_STATUS_ERROR;
+    }
+
+  packages = dltbackend_file_begin (backend, entry, file_name, (gsize)fileinfo.st_size);
+  if (packages < 0)
+    return CDM_STATUS_ERROR;
+
+  if (packages > 0)
+    sink.package_size = ((gsize)fileinfo.st_size + (gsize)packages - 1) / (gsize)packages;
+
+  if (backend->simulated)
+    {
+      cdm_dltsim_init (&sim, DLT_SIM_BUFFER_SIZE, backend->sim_rate, sink.package_size);
+      sink.sink = &cdm_dltsim_sink;
+      sink.sink_data = &sim;
+    }
+#ifdef WITH_GENIVI_DLT
+  else
+    sink.sink = &dltlib_sink;
+#endif
+
+  cdm_dltpacer_init (&pacer, &dltbackend_sink, &sink, sink.package_size, backend->cpu_budget);
+  pacer.progress = dltbackend_progress;
+  pacer.user_data = file_name;
+
+  if (!cdm_dltpacer_run (&pacer, entry->upload_path, packages))
+    return CDM_STATUS_ERROR;
+
+  return dltbackend_file_end (backend, entry);
+}
+
+static void
+dltbackend_free (CdmTransferBackend *_backend)
+{
+  CdmDLTBackend *backend = (CdmDLTBackend *)_backend;
+
+#ifdef WITH_GENIVI_DLT
+  if (!backend->simulated)
+    DLT_UNREGISTER_CONTEXT (cdm_transfer_ctx);
+#endif
+
+  g_free (backend->parent.destination);
+  g_free (backend);
+}
+
+CdmTransferBackend *
+cdm_dltbackend_new (CdmOptions *options, gboolean simulated)
+{
+  CdmDLTBackend *backend;
+
+  g_assert (options);
+
+#ifndef WITH_GENIVI_DLT
+  if (!simulated)
+    return NULL;
+#endif
+
+  backend = g_new0 (CdmDLTBackend, 1);
+
+  backend->simulated = simulated;
+  backend->cpu_budget = (guint)MAX (cdm_options_long_for (options, KEY_TRANSFER_DLT_CPU_BUDGET), 0);
+  backend->sim_rate
+      = (gdouble)MAX (cdm_options_long_for (options, KEY_TRANSFER_DLT_SIM_RATE), 1) * 1024;
+
+#ifdef WITH_GENIVI_DLT
+  if (!simulated)
+    DLT_REGISTER_CONTEXT (cdm_transfer_ctx, "FLTR", "Crashmanager file transfer");
+#endif
+
+  backend->parent.name = simulated ? "dltsim" : "dlt";
+  backend->parent.destination = g_strdup (backend->parent.name);
+  /* file transfer packages of one file at a time can be reassembled by the dlt clients */
+  backend->parent.max_workers = 1;
+  backend->parent.upload = dltbackend_upload;
+  backend->parent.free = dltbackend_free;
+
+  return (CdmTransferBackend *)backend;
+}
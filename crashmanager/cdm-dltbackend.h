@@ -0,0 +1,54 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-dltbackend.h
+ */
+
+#pragma once
+
+#include "cdm-options.h"
+#include "cdm-transfer.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * @brief Backend sending the archives as dlt file transfers
+ */
+typedef struct _CdmDLTBackend
+{
+  CdmTransferBackend parent; /**< Backend interface */
+  gboolean simulated;        /**< Send to the stand-in buffer instead of the dlt library */
+  guint cpu_budget;          /**< Processor share in percent of the sending thread */
+  gdouble sim_rate;          /**< Stand-in buffer drain speed in bytes per second */
+} CdmDLTBackend;
+
+/*
+ * @brief Create a new dlt backend
+ * The simulated backend paces the packages against a stand-in buffer and drops them, it allows
+ * to measure the pacing without a dlt daemon.
+ * @param options Pointer to the options object
+ * @param simulated Use the stand-in buffer instead of the dlt library
+ * @return On success return a new backend, NULL if the dlt library is not available
+ */
+CdmTransferBackend *cdm_dltbackend_new (CdmOptions *options, gboolean simulated);
+
+G_END_DECLS
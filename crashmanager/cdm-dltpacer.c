@@ -0,0 +1,306 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-dltpacer.c
+ */
+
+#include "cdm-dltpacer.h"
+
+#include <string.h>
+#include <time.h>
+
+/* the buffer is refilled below the low mark and left to drain above the high mark */
+#define DLTPACER_LOW_FILL (0.25)
+#define DLTPACER_HIGH_FILL (0.5)
+#define DLTPACER_START_RATE (100.0)
+#define DLTPACER_PROBE_FACTOR (1.25)
+#define DLTPACER_DRAIN_WEIGHT (0.25)
+#define DLTPACER_PROGRESS_STEP (10)
+
+#ifndef DLTPACER_TICK_USEC
+#define DLTPACER_TICK_USEC (10000)
+#endif
+
+#ifndef DLTPACER_MIN_RATE
+#define DLTPACER_MIN_RATE (10.0)
+#endif
+
+#ifndef DLTPACER_MAX_RATE
+#define DLTPACER_MAX_RATE (20000.0)
+#endif
+
+#ifndef DLTPACER_STALL_TIMEOUT_USEC
+#define DLTPACER_STALL_TIMEOUT_USEC (30 * G_USEC_PER_SEC)
+#endif
+
+/**
+ * @brief Processor time used by the calling thread in microseconds
+ */
+static gint64 dltpacer_cpu_time (void);
+
+/**
+ * @brief Set the package rate for the buffer fill and the drain speed
+ */
+static void dltpacer_adapt (CdmDLTPacer *pacer, gdouble fill);
+
+/**
+ * @brief Drain the stand-in buffer for the time elapsed since the last update
+ */
+static void dltsim_update (CdmDLTSim *sim);
+
+/**
+ * @brief Stand-in buffer state function
+ */
+static void dltsim_buffer (gpointer _sim, gint *total, gint *used);
+
+/**
+ * @brief Stand-in buffer flush function
+ */
+static void dltsim_flush (gpointer _sim);
+
+/**
+ * @brief Stand-in package send function
+ */
+static gint dltsim_send (gpointer _sim, const gchar *file_path, gint package);
+
+const CdmDLTSink cdm_dltsim_sink = {
+  dltsim_buffer,
+  dltsim_flush,
+  dltsim_send,
+};
+
+static gint64
+dltpacer_cpu_time (void)
+{
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0;
+
+  return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static void
+dltpacer_adapt (CdmDLTPacer *pacer, gdouble fill)
+{
+  gdouble drain_rate = pacer->stats.drain / (gdouble)pacer->package_size;
+  gdouble rate = pacer->stats.rate;
+
+  if (fill >= DLTPACER_HIGH_FILL)
+    {
+      /* back off below the drain speed so the backlog goes down */
+      rate = drain_rate / 2;
+    }
+  else if (fill <= DLTPACER_LOW_FILL)
+    {
+      /* an almost empty buffer hides the drain speed, probe above it */
+      rate = MAX (rate, drain_rate) * DLTPACER_PROBE_FACTOR;
+    }
+  else
+    rate = drain_rate;
+
+  pacer->stats.rate = CLAMP (rate, DLTPACER_MIN_RATE, DLTPACER_MAX_RATE);
+}
+
+void
+cdm_dltpacer_init (CdmDLTPacer *pacer, const CdmDLTSink *sink, gpointer sink_data,
+                   gsize package_size, guint cpu_budget)
+{
+  g_assert (pacer);
+  g_assert (sink);
+
+  memset (pacer, 0, sizeof (CdmDLTPacer));
+
+  pacer->sink = sink;
+  pacer->sink_data = sink_data;
+  pacer->package_size = MAX (package_size, 1);
+  pacer->cpu_budget = MIN (cpu_budget, 100);
+}
+
+gboolean
+cdm_dltpacer_run (CdmDLTPacer *pacer, const gchar *file_path, gint packages)
+{
+  const gint64 start = g_get_monotonic_time ();
+  const gint64 cpu_start = dltpacer_cpu_time ();
+  gint64 last = start;
+  gint64 last_progress = start;
+  gint next_step = DLTPACER_PROGRESS_STEP;
+  gsize queued = 0;
+  gdouble credit = 1;
+  gint last_used = 0;
+
+  g_assert (pacer);
+  g_assert (file_path);
+
+  pacer->stats.packages = packages;
+  pacer->stats.sent = 0;
+  pacer->stats.rate = DLTPACER_START_RATE;
+
+  while (pacer->stats.sent < packages)
+    {
+      gint64 now = g_get_monotonic_time ();
+      gdouble elapsed = (gdouble)(now - last) / G_USEC_PER_SEC;
+      gint64 cpu_used;
+      gint64 wall;
+      gint total = 0;
+      gint used = 0;
+      gdouble fill;
+
+      pacer->sink->buffer (pacer->sink_data, &total, &used);
+      fill = total > 0 ? (gdouble)used / total : 0;
+
+      /* the bytes that left the buffer since the last tick give the drain speed */
+      if (elapsed > 0)
+        {
+          gdouble drained = MAX ((gdouble)last_used + (gdouble)queued - used, 0) / elapsed;
+
+          pacer->stats.drain += (drained - pacer->stats.drain) * DLTPACER_DRAIN_WEIGHT;
+        }
+
+      last = now;
+      last_used = used;
+      queued = 0;
+
+      dltpacer_adapt (pacer, fill);
+
+      if (fill >= DLTPACER_HIGH_FILL)
+        {
+          /* one flush per tick, the daemon needs the time to read */
+          pacer->sink->flush (pacer->sink_data);
+          credit = 0;
+        }
+      else
+        credit = MIN (credit + pacer->stats.rate * elapsed, pacer->stats.rate * 0.1 + 1);
+
+      while (credit >= 1 && pacer->stats.sent < packages)
+        {
+          if (pacer->sink->send (pacer->sink_data, file_path, pacer->stats.sent + 1) < 0)
+            {
+              pacer->stats.rejected++;
+              pacer->stats.rate = MAX (pacer->stats.rate / 2, DLTPACER_MIN_RATE);
+              credit = 0;
+              break;
+            }
+
+          pacer->stats.sent++;
+          queued += pacer->package_size;
+          credit -= 1;
+          last_progress = now;
+        }
+
+      if (now - last_progress > DLTPACER_STALL_TIMEOUT_USEC)
+        {
+          g_warning ("DLT transfer of %s stalled at package %d of %d", file_path,
+                     pacer->stats.sent, packages);
+          break;
+        }
+
+      cpu_used = dltpacer_cpu_time () - cpu_start;
+      wall = g_get_monotonic_time () - start;
+
+      pacer->stats.elapsed = wall;
+      pacer->stats.cpu = wall > 0 ? (gdouble)cpu_used * 100 / (gdouble)wall : 0;
+
+      if (pacer->progress != NULL && packages > 0
+          && pacer->stats.sent * 100 / packages >= next_step && pacer->stats.sent < packages)
+        {
+          pacer->progress (&pacer->stats, pacer->user_data);
+          next_step = pacer->stats.sent * 100 / packages + DLTPACER_PROGRESS_STEP;
+        }
+
+      if (pacer->stats.sent >= packages)
+        break;
+
+      /* sleep longer when the sender used more than its share of the processor */
+      if (pacer->cpu_budget > 0 && cpu_used * 100 > wall * (gint64)pacer->cpu_budget)
+        g_usleep ((gulong)(DLTPACER_TICK_USEC + cpu_used * 100 / pacer->cpu_budget - wall));
+      else
+        g_usleep (DLTPACER_TICK_USEC);
+    }
+
+  pacer->stats.elapsed = g_get_monotonic_time () - start;
+  pacer->stats.cpu = pacer->stats.elapsed > 0 ? (gdouble)(dltpacer_cpu_time () - cpu_start)
+                                                    * 100 / (gdouble)pacer->stats.elapsed
+                                              : 0;
+
+  if (pacer->progress != NULL)
+    pacer->progress (&pacer->stats, pacer->user_data);
+
+  return pacer->stats.sent >= packages;
+}
+
+static void
+dltsim_update (CdmDLTSim *sim)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  sim->used = MAX (sim->used - sim->drain_rate * (gdouble)(now - sim->last_update)
+                                   / G_USEC_PER_SEC,
+                   0);
+  sim->last_update = now;
+}
+
+static void
+dltsim_buffer (gpointer _sim, gint *total, gint *used)
+{
+  CdmDLTSim *sim = (CdmDLTSim *)_sim;
+
+  dltsim_update (sim);
+
+  *total = sim->total;
+  *used = (gint)sim->used;
+}
+
+static void
+dltsim_flush (gpointer _sim)
+{
+  dltsim_update ((CdmDLTSim *)_sim);
+}
+
+static gint
+dltsim_send (gpointer _sim, const gchar *file_path, gint package)
+{
+  CdmDLTSim *sim = (CdmDLTSim *)_sim;
+
+  CDM_UNUSED (file_path);
+  CDM_UNUSED (package);
+
+  dltsim_update (sim);
+
+  /* a full dlt user buffer drops the message */
+  if (sim->used + (gdouble)sim->package_size > sim->total)
+    return -1;
+
+  sim->used += (gdouble)sim->package_size;
+
+  return 0;
+}
+
+void
+cdm_dltsim_init (CdmDLTSim *sim, gint total, gdouble drain_rate, gsize package_size)
+{
+  g_assert (sim);
+
+  sim->total = total;
+  sim->used = 0;
+  sim->drain_rate = drain_rate;
+  sim->package_size = package_size;
+  sim->last_update = g_get_monotonic_time ();
+}
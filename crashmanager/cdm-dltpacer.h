@@ -0,0 +1,137 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-dltpacer.h
+ */
+
+#pragma once
+
+#include "cdm-types.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * @brief Sink function reading the user buffer size and the bytes waiting in it
+ */
+typedef void (*CdmDLTSinkBufferFunc) (gpointer sink_data, gint *total, gint *used);
+
+/**
+ * @brief Sink function pushing the buffered messages to the daemon
+ */
+typedef void (*CdmDLTSinkFlushFunc) (gpointer sink_data);
+
+/**
+ * @brief Sink function sending one file transfer package
+ * @return A negative value if the package was not accepted
+ */
+typedef gint (*CdmDLTSinkSendFunc) (gpointer sink_data, const gchar *file_path, gint package);
+
+/**
+ * @brief Destination of the paced file transfer packages
+ */
+typedef struct _CdmDLTSink
+{
+  CdmDLTSinkBufferFunc buffer; /**< Buffer state function */
+  CdmDLTSinkFlushFunc flush;   /**< Buffer flush function */
+  CdmDLTSinkSendFunc send;     /**< Package send function */
+} CdmDLTSink;
+
+/**
+ * @brief Paced transfer statistics
+ */
+typedef struct _CdmDLTPacerStats
+{
+  gint packages;  /**< Packages of the file */
+  gint sent;      /**< Packages accepted by the sink */
+  guint rejected; /**< Packages rejected by a full buffer */
+  gdouble rate;   /**< Current package rate per second */
+  gdouble drain;  /**< Observed buffer drain speed in bytes per second */
+  gdouble cpu;    /**< Processor share used by the sender in percent */
+  gint64 elapsed; /**< Transfer time in microseconds */
+} CdmDLTPacerStats;
+
+/**
+ * @brief Progress callback, called at each progress step and at the end of the transfer
+ */
+typedef void (*CdmDLTPacerProgressFunc) (const CdmDLTPacerStats *stats, gpointer user_data);
+
+/**
+ * @brief Paced file transfer
+ */
+typedef struct _CdmDLTPacer
+{
+  const CdmDLTSink *sink;           /**< Sink the packages are sent to */
+  gpointer sink_data;               /**< Data passed to the sink functions */
+  gsize package_size;               /**< Bytes of one package */
+  guint cpu_budget;                 /**< Processor share in percent the sender may use */
+  CdmDLTPacerProgressFunc progress; /**< Optional progress callback */
+  gpointer user_data;               /**< Data passed to the progress callback */
+  CdmDLTPacerStats stats;           /**< Transfer statistics */
+} CdmDLTPacer;
+
+/**
+ * @brief Stand-in for the dlt user buffer draining at a fixed speed
+ */
+typedef struct _CdmDLTSim
+{
+  gint total;         /**< Buffer size in bytes */
+  gdouble used;       /**< Bytes waiting in the buffer */
+  gdouble drain_rate; /**< Drain speed in bytes per second */
+  gsize package_size; /**< Bytes added by one package */
+  gint64 last_update; /**< Monotonic time of the last drain update */
+} CdmDLTSim;
+
+/**
+ * @brief Sink functions of the stand-in buffer, the sink data is a CdmDLTSim
+ */
+extern const CdmDLTSink cdm_dltsim_sink;
+
+/*
+ * @brief Initialize a pacer
+ * @param pacer The pacer to initialize
+ * @param sink The sink the packages are sent to
+ * @param sink_data The data passed to the sink functions
+ * @param package_size The bytes of one package
+ * @param cpu_budget The processor share in percent the sender may use, 0 for no limit
+ */
+void cdm_dltpacer_init (CdmDLTPacer *pacer, const CdmDLTSink *sink, gpointer sink_data,
+                        gsize package_size, guint cpu_budget);
+
+/*
+ * @brief Send the packages of a file adapting the rate to the buffer drain speed
+ * @param pacer The pacer object
+ * @param file_path The file being transferred
+ * @param packages The number of packages, sent from 1 to packages
+ * @return TRUE if all packages are accepted by the sink
+ */
+gboolean cdm_dltpacer_run (CdmDLTPacer *pacer, const gchar *file_path, gint packages);
+
+/*
+ * @brief Initialize a stand-in buffer
+ * @param sim The stand-in to initialize
+ * @param total The buffer size in bytes
+ * @param drain_rate The drain speed in bytes per second
+ * @param package_size The bytes added by one package
+ */
+void cdm_dltsim_init (CdmDLTSim *sim, gint total, gdouble drain_rate, gsize package_size);
+
+G_END_DECLS
@@ -57,6 +57,11 @@ static gboolean client_source_callback (gpointer data);
  */
 static void client_source_destroy_notify (gpointer data);
 
+/**
+ * @brief Parse the init message from the receive buffer
+ */
+static gboolean process_init_message (CdmELogClt *client);
+
 /**
  * @brief GSourceFuncs vtable
  */
@@ -94,63 +99,95 @@ static gboolean
 client_source_callback (gpointer data)
 {
   CdmELogClt *client = (CdmELogClt *)data;
-  gboolean status = TRUE;
+  gboolean connected = TRUE;
 
   g_assert (client);
 
-  if (client->last_msg_type != CDM_ELOGMSG_NEW)
+  /* drain the socket without blocking so a slow client only delays itself */
+  while (connected)
     {
-      CdmELogMessage *msg = cdm_elogmsg_new (CDM_ELOGMSG_INVALID);
+      guint8 buf[CDM_EPILOG_FRAME_LEN];
+      gssize sz;
 
-      if (cdm_elogmsg_read (client->sockfd, msg) != 0)
+      if (client->last_msg_type != CDM_ELOGMSG_NEW)
         {
-          g_warning ("Cannot read from epilog client init message %d", client->sockfd);
-          status = FALSE;
+          sz = read (client->sockfd, buf, sizeof (buf));
+          if (sz > 0)
+            {
+              g_byte_array_append (client->rxbuf, buf, (guint)sz);
+              connected = process_init_message (client);
+            }
         }
       else
         {
-          if (cdm_elogmsg_get_type (msg) == CDM_ELOGMSG_NEW)
-            {
-              client->last_msg_type = cdm_elogmsg_get_type (msg);
-              client->process_pid = cdm_elogmsg_get_process_pid (msg);
-              client->process_sig = cdm_elogmsg_get_process_exit_signal (msg);
+          const guint len = client->elog->len;
+          const gsize avail = CDM_JOURNAL_EPILOG_MAX_BT - 1 - len;
 
-              g_info ("Received epilog notification for process id %ld", client->process_pid);
-            }
+          if (avail == 0)
+            break;
+
+          /* the backtrace buffer only grows as much as the client sends */
+          g_byte_array_set_size (client->elog, len + (guint)MIN (avail, sizeof (buf)));
+          sz = read (client->sockfd, client->elog->data + len, client->elog->len - len);
+          g_byte_array_set_size (client->elog, len + (guint)MAX (sz, 0));
         }
 
-      cdm_elogmsg_free (msg);
+      if (sz < 0 && errno == EINTR)
+        continue;
+      else if (sz < 0 && errno == EAGAIN)
+        return TRUE;
+      else if (sz <= 0)
+        connected = FALSE;
     }
-  else
+
+  if (client->elog != NULL)
     {
-      CdmJournalEpilog *elog = g_new0 (CdmJournalEpilog, 1);
-      gssize toread = CDM_JOURNAL_EPILOG_MAX_BT;
-      gssize sz;
+      if (client->elog->len > 0)
+        cdm_journal_epilog_add (client->journal, client->process_pid,
+                                (const gchar *)client->elog->data, client->elog->len);
+      else
+        g_warning ("Fail to read epilog backtrace from client %d", client->sockfd);
 
-      elog->pid = client->process_pid;
+      g_byte_array_unref (client->elog);
+      client->elog = NULL;
+    }
+  else
+    g_warning ("Cannot read from epilog client init message %d", client->sockfd);
 
-      do
-        {
-          const gssize framesz = toread < CDM_EPILOG_FRAME_LEN ? toread : CDM_EPILOG_FRAME_LEN;
+  return FALSE;
+}
 
-          sz = read (client->sockfd, elog->backtrace + (CDM_JOURNAL_EPILOG_MAX_BT - toread),
-                     (gsize)framesz);
+static gboolean
+process_init_message (CdmELogClt *client)
+{
+  CdmELogMessage *msg = cdm_elogmsg_new (CDM_ELOGMSG_INVALID);
+  gboolean status = TRUE;
+  gint consumed;
 
-          if ((sz >= 0) && (sz <= framesz))
-            toread -= sz;
-        }
-      while (((sz > 0) || (errno == EAGAIN)) && (toread > 0));
+  consumed = cdm_elogmsg_parse (msg, client->rxbuf->data, client->rxbuf->len);
 
-      if (toread < CDM_JOURNAL_EPILOG_MAX_BT)
-        cdm_journal_epilog_add (client->journal, elog);
-      else
-        {
-          g_warning ("Fail to read epilog backtrace from client %d", client->sockfd);
-          g_free (elog);
-        }
+  if (consumed < 0 || cdm_elogmsg_get_type (msg) != CDM_ELOGMSG_NEW)
+    status = FALSE;
+  else if (consumed > 0)
+    {
+      const gsize remaining = client->rxbuf->len - (guint)consumed;
+
+      client->last_msg_type = cdm_elogmsg_get_type (msg);
+      client->process_pid = cdm_elogmsg_get_process_pid (msg);
+      client->process_sig = cdm_elogmsg_get_process_exit_signal (msg);
 
-      status = FALSE;
+      g_info ("Received epilog notification for process id %ld", client->process_pid);
+
+      client->elog = g_byte_array_new ();
+
+      /* bytes already received past the init message belong to the backtrace */
+      g_byte_array_append (client->elog, client->rxbuf->data + consumed,
+                           (guint)MIN (remaining, CDM_JOURNAL_EPILOG_MAX_BT - 1));
     }
+  else if (client->rxbuf->len > CDM_EPILOG_FRAME_LEN)
+    status = FALSE;
+
+  cdm_elogmsg_free (msg);
 
   return status;
 }
@@ -175,6 +212,7 @@ cdm_elogclt_new (gint clientfd, CdmJournal *journal)
 
   g_ref_count_init (&client->rc);
   client->sockfd = clientfd;
+  client->rxbuf = g_byte_array_new ();
   client->journal = cdm_journal_ref (journal);
   client->last_msg_type = CDM_ELOGMSG_INVALID;
 
@@ -204,6 +242,9 @@ cdm_elogclt_unref (CdmELogClt *client)
   if (g_ref_count_dec (&client->rc) == TRUE)
     {
       cdm_journal_unref (client->journal);
+      g_byte_array_unref (client->rxbuf);
+      if (client->elog != NULL)
+        g_byte_array_unref (client->elog);
       g_source_unref (CDM_EVENT_SOURCE (client));
     }
 }
@@ -44,6 +44,8 @@ typedef struct _CdmELogClt
   CdmELogMessageType last_msg_type; /**< Last processed message type */
   int64_t process_pid;              /**< Process PID*/
   int64_t process_sig;              /**< Process exit signal*/
+  GByteArray *rxbuf;                /**< Incremental receive buffer for init message */
+  GByteArray *elog;                 /**< Epilog backtrace under construction */
 } CdmELogClt;
 
 /*
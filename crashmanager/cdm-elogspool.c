@@ -0,0 +1,235 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-elogspool.c
+ */
+
+#include "cdm-elogspool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define ELOGSPOOL_MAGIC (0x53454443)
+#define ELOGSPOOL_VERSION (1)
+#define ELOGSPOOL_SLOT_COMMITTED (0x4d4d4f43)
+
+/**
+ * @brief Get the spool slot for an append sequence
+ */
+static CdmELogSpoolSlot *elogspool_slot (CdmELogSpool *spool, guint64 seq);
+
+/**
+ * @brief Check if the mapped spool has the expected layout
+ */
+static gboolean elogspool_valid (CdmELogSpool *spool, guint slot_count);
+
+static CdmELogSpoolSlot *
+elogspool_slot (CdmELogSpool *spool, guint64 seq)
+{
+  return &spool->slots[seq % spool->header->slot_count];
+}
+
+static gboolean
+elogspool_valid (CdmELogSpool *spool, guint slot_count)
+{
+  return (spool->header->magic == ELOGSPOOL_MAGIC && spool->header->version == ELOGSPOOL_VERSION
+          && spool->header->slot_count == slot_count
+          && spool->header->slot_size == sizeof (CdmELogSpoolSlot));
+}
+
+CdmELogSpool *
+cdm_elogspool_new (const gchar *path, guint slot_count, GError **error)
+{
+  g_autoptr (CdmELogSpool) spool = g_new0 (CdmELogSpool, 1);
+  struct stat st;
+  gpointer map;
+
+  g_assert (path);
+  g_assert (slot_count > 0);
+
+  g_ref_count_init (&spool->rc);
+  spool->size = sizeof (CdmELogSpoolHeader) + slot_count * sizeof (CdmELogSpoolSlot);
+
+  spool->fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (spool->fd < 0)
+    {
+      g_warning ("Cannot open epilog spool %s: %s", path, strerror (errno));
+      g_set_error (error, g_quark_from_static_string ("ELogSpoolNew"), 1, "Spool open failed");
+      return NULL;
+    }
+
+  if (fstat (spool->fd, &st) != 0
+      || ((gsize)st.st_size != spool->size && ftruncate (spool->fd, (off_t)spool->size) != 0))
+    {
+      g_warning ("Cannot size epilog spool %s: %s", path, strerror (errno));
+      g_set_error (error, g_quark_from_static_string ("ELogSpoolNew"), 1, "Spool resize failed");
+      return NULL;
+    }
+
+  map = mmap (NULL, spool->size, PROT_READ | PROT_WRITE, MAP_SHARED, spool->fd, 0);
+  if (map == MAP_FAILED)
+    {
+      g_warning ("Cannot map epilog spool %s: %s", path, strerror (errno));
+      g_set_error (error, g_quark_from_static_string ("ELogSpoolNew"), 1, "Spool map failed");
+      return NULL;
+    }
+
+  spool->header = (CdmELogSpoolHeader *)map;
+  spool->slots = (CdmELogSpoolSlot *)((guint8 *)map + sizeof (CdmELogSpoolHeader));
+
+  /* a spool written with another layout cannot be read back, start with an empty ring */
+  if (!elogspool_valid (spool, slot_count))
+    {
+      g_info ("Reset epilog spool %s", path);
+      memset (map, 0, spool->size);
+      spool->header->magic = ELOGSPOOL_MAGIC;
+      spool->header->version = ELOGSPOOL_VERSION;
+      spool->header->slot_count = slot_count;
+      spool->header->slot_size = sizeof (CdmELogSpoolSlot);
+    }
+
+  return g_steal_pointer (&spool);
+}
+
+CdmELogSpool *
+cdm_elogspool_ref (CdmELogSpool *spool)
+{
+  g_assert (spool);
+  g_ref_count_inc (&spool->rc);
+  return spool;
+}
+
+void
+cdm_elogspool_unref (CdmELogSpool *spool)
+{
+  g_assert (spool);
+
+  if (g_ref_count_dec (&spool->rc) == TRUE)
+    {
+      if (spool->header != NULL)
+        munmap (spool->header, spool->size);
+
+      if (spool->fd >= 0)
+        close (spool->fd);
+
+      g_free (spool);
+    }
+}
+
+void
+cdm_elogspool_append (CdmELogSpool *spool, gint64 pid, gint64 tstamp, const gchar *backtrace,
+                      gsize len)
+{
+  CdmELogSpoolSlot *slot = NULL;
+  guint64 seq;
+
+  g_assert (spool);
+  g_assert (backtrace);
+
+  seq = spool->header->next_seq++;
+  slot = elogspool_slot (spool, seq);
+
+  /*
+   * The slot is invalidated before and committed after the data copy so a daemon killed
+   * in between leaves no torn epilog. The mapping is never synced, the page cache keeps
+   * the ring across daemon restarts which is all the spool is meant to survive.
+   */
+  __atomic_store_n (&slot->state, 0, __ATOMIC_RELEASE);
+
+  slot->len = (guint32)MIN (len, CDM_ELOGSPOOL_DATA_MAX);
+  slot->pid = pid;
+  slot->tstamp = tstamp;
+  slot->seq = seq;
+  memcpy (slot->data, backtrace, slot->len);
+
+  __atomic_store_n (&slot->state, ELOGSPOOL_SLOT_COMMITTED, __ATOMIC_RELEASE);
+}
+
+const gchar *
+cdm_elogspool_lookup (CdmELogSpool *spool, gint64 pid, gint64 min_tstamp, gint64 *tstamp,
+                      gsize *len)
+{
+  CdmELogSpoolSlot *found = NULL;
+
+  g_assert (spool);
+  g_assert (tstamp);
+  g_assert (len);
+
+  /* the ring is small, a scan is cheaper than keeping a second index in sync */
+  for (guint i = 0; i < spool->header->slot_count; i++)
+    {
+      CdmELogSpoolSlot *slot = &spool->slots[i];
+
+      if (slot->state != ELOGSPOOL_SLOT_COMMITTED || slot->pid != pid
+          || slot->tstamp < min_tstamp)
+        continue;
+
+      if (found == NULL || slot->seq > found->seq)
+        found = slot;
+    }
+
+  if (found == NULL)
+    return NULL;
+
+  *tstamp = found->tstamp;
+  *len = found->len;
+
+  return found->data;
+}
+
+void
+cdm_elogspool_clear (CdmELogSpool *spool, gint64 pid)
+{
+  g_assert (spool);
+
+  for (guint i = 0; i < spool->header->slot_count; i++)
+    {
+      CdmELogSpoolSlot *slot = &spool->slots[i];
+
+      if (slot->state == ELOGSPOOL_SLOT_COMMITTED && slot->pid == pid)
+        __atomic_store_n (&slot->state, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void
+cdm_elogspool_foreach (CdmELogSpool *spool, CdmELogSpoolFunc func, gpointer user_data)
+{
+  guint64 next_seq;
+  guint64 seq;
+
+  g_assert (spool);
+  g_assert (func);
+
+  next_seq = spool->header->next_seq;
+  seq = next_seq > spool->header->slot_count ? next_seq - spool->header->slot_count : 0;
+
+  for (; seq < next_seq; seq++)
+    {
+      CdmELogSpoolSlot *slot = elogspool_slot (spool, seq);
+
+      if (slot->state == ELOGSPOOL_SLOT_COMMITTED && slot->seq == seq)
+        func (user_data, slot->pid, slot->tstamp, slot->data, slot->len);
+    }
+}
@@ -0,0 +1,148 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-elogspool.h
+ */
+
+#pragma once
+
+#include "cdm-message.h"
+#include "cdm-types.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define CDM_ELOGSPOOL_DATA_MAX                                                                     \
+  (CDM_MESSAGE_EPILOG_FRAME_MAX_LEN * CDM_MESSAGE_EPILOG_FRAME_MAX_CNT)
+
+/**
+ * @brief The spool file header
+ */
+typedef struct _CdmELogSpoolHeader
+{
+  guint32 magic;      /**< Spool file magic */
+  guint32 version;    /**< Spool file layout version */
+  guint32 slot_count; /**< Number of ring slots */
+  guint32 slot_size;  /**< Size of one ring slot */
+  guint64 next_seq;   /**< Sequence of the next appended epilog */
+} CdmELogSpoolHeader;
+
+/**
+ * @brief The spool ring slot holding one epilog
+ */
+typedef struct _CdmELogSpoolSlot
+{
+  guint32 state;                     /**< Slot commit state */
+  guint32 len;                       /**< Backtrace length */
+  gint64 pid;                        /**< Process ID */
+  gint64 tstamp;                     /**< Epilog monotonic timestamp */
+  guint64 seq;                       /**< Append sequence */
+  gchar data[CDM_ELOGSPOOL_DATA_MAX]; /**< Backtrace data */
+} CdmELogSpoolSlot;
+
+/**
+ * @brief Spool epilog iteration callback
+ * @param user_data The user data provided with the callback
+ * @param pid The epilog process ID
+ * @param tstamp The epilog monotonic timestamp
+ * @param backtrace The backtrace data
+ * @param len The backtrace data length
+ */
+typedef void (*CdmELogSpoolFunc) (gpointer user_data, gint64 pid, gint64 tstamp,
+                                  const gchar *backtrace, gsize len);
+
+/**
+ * @brief The CdmELogSpool opaque data structure
+ */
+typedef struct _CdmELogSpool
+{
+  grefcount rc;               /**< Reference counter variable  */
+  gint fd;                    /**< Spool file descriptor */
+  gsize size;                 /**< Spool mapping size */
+  CdmELogSpoolHeader *header; /**< Spool mapping header */
+  CdmELogSpoolSlot *slots;    /**< Spool mapping ring slots */
+} CdmELogSpool;
+
+/**
+ * @brief Open or create the epilog spool file
+ * An existing spool with a different layout is reset.
+ * @param path The spool file path
+ * @param slot_count The number of epilogs the ring keeps
+ * @param error The GError object or NULL
+ * @return On success return a new CdmELogSpool object otherwise return NULL
+ */
+CdmELogSpool *cdm_elogspool_new (const gchar *path, guint slot_count, GError **error);
+
+/**
+ * @brief Aquire spool object
+ * @param spool Pointer to the spool object
+ * @return The referenced spool object
+ */
+CdmELogSpool *cdm_elogspool_ref (CdmELogSpool *spool);
+
+/**
+ * @brief Release spool object
+ * @param spool Pointer to the spool object
+ */
+void cdm_elogspool_unref (CdmELogSpool *spool);
+
+/**
+ * @brief Append an epilog overwriting the oldest one if the ring is full
+ * @param spool Pointer to the spool object
+ * @param pid Process ID
+ * @param tstamp Epilog monotonic timestamp
+ * @param backtrace The backtrace data
+ * @param len The backtrace data length, truncated to CDM_ELOGSPOOL_DATA_MAX
+ */
+void cdm_elogspool_append (CdmELogSpool *spool, gint64 pid, gint64 tstamp, const gchar *backtrace,
+                           gsize len);
+
+/**
+ * @brief Find the latest epilog for a pid
+ * @param spool Pointer to the spool object
+ * @param pid Process ID
+ * @param min_tstamp Ignore epilogs older than this monotonic timestamp
+ * @param tstamp Set to the epilog monotonic timestamp
+ * @param len Set to the backtrace data length
+ * @return A pointer to the backtrace data in the spool or NULL if not found. The data
+ * is valid until the next append.
+ */
+const gchar *cdm_elogspool_lookup (CdmELogSpool *spool, gint64 pid, gint64 min_tstamp,
+                                   gint64 *tstamp, gsize *len);
+
+/**
+ * @brief Invalidate all epilogs for a pid
+ * @param spool Pointer to the spool object
+ * @param pid Process ID
+ */
+void cdm_elogspool_clear (CdmELogSpool *spool, gint64 pid);
+
+/**
+ * @brief Call func for each epilog in append order
+ * @param spool Pointer to the spool object
+ * @param func The callback function
+ * @param user_data The data passed to func
+ */
+void cdm_elogspool_foreach (CdmELogSpool *spool, CdmELogSpoolFunc func, gpointer user_data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (CdmELogSpool, cdm_elogspool_unref);
+
+G_END_DECLS
@@ -21,6 +21,10 @@
  * \file cdm-elogsrv.c
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "cdm-elogsrv.h"
 #include "cdm-elogclt.h"
 
@@ -101,17 +105,31 @@ elogsrv_source_callback (gpointer cdmelogsrv)
 
   g_assert (elogsrv);
 
-  clientfd = accept (elogsrv->sockfd, (struct sockaddr *)NULL, NULL);
-  if (clientfd >= 0)
+  /* accept all pending connections so a crash storm does not overflow the backlog */
+  while ((clientfd = accept4 (elogsrv->sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
     {
       CdmELogClt *client = cdm_elogclt_new (clientfd, elogsrv->journal);
 
       CDM_UNUSED (client);
       g_debug ("New epilog client connected %d", clientfd);
     }
-  else
+
+  switch (errno)
     {
-      g_warning ("Epilog server accept failed");
+    case EAGAIN:
+    case EINTR:
+    case ECONNABORTED:
+      break;
+
+    case EMFILE:
+    case ENFILE:
+    case ENOBUFS:
+    case ENOMEM:
+      g_warning ("Epilog server accept failed: %s", strerror (errno));
+      break;
+
+    default:
+      g_warning ("Epilog server accept failed: %s", strerror (errno));
       return FALSE;
     }
 
@@ -141,7 +159,7 @@ cdm_elogsrv_new (CdmOptions *options, CdmJournal *journal, GError **error)
   elogsrv->options = cdm_options_ref (options);
   elogsrv->journal = cdm_journal_ref (journal);
 
-  elogsrv->sockfd = socket (AF_UNIX, SOCK_STREAM, 0);
+  elogsrv->sockfd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
   if (elogsrv->sockfd < 0)
     {
       g_warning ("Cannot create elogsrv socket");
@@ -198,12 +216,14 @@ cdm_elogsrv_bind_and_listen (CdmELogSrv *elogsrv)
   g_autofree gchar *udspath = NULL;
   CdmStatus status = CDM_STATUS_OK;
   struct sockaddr_un saddr;
+  gint backlog;
 
   g_assert (elogsrv);
 
   run_dir = cdm_options_string_for (elogsrv->options, KEY_RUN_DIR);
   sock_addr = cdm_options_string_for (elogsrv->options, KEY_ELOG_SOCK_ADDR);
   udspath = g_build_filename (run_dir, sock_addr, NULL);
+  backlog = (gint)cdm_options_long_for (elogsrv->options, KEY_IPC_LISTEN_BACKLOG);
 
   unlink (udspath);
 
@@ -218,7 +238,7 @@ cdm_elogsrv_bind_and_listen (CdmELogSrv *elogsrv)
       if (chmod (udspath, 0666) != 0)
         g_warning ("Epilog server fail to chmod %s", saddr.sun_path);
 
-      if (listen (elogsrv->sockfd, 10) == -1)
+      if (listen (elogsrv->sockfd, backlog) == -1)
         {
           g_warning ("Epilog server listen failed for path %s", saddr.sun_path);
           status = CDM_STATUS_ERROR;
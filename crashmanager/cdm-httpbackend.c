@@ -0,0 +1,465 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-httpbackend.c
+ */
+
+#include "cdm-httpbackend.h"
+
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HTTP_STATUS_RESUME_INCOMPLETE (308)
+#define HTTP_STATUS_RANGE_NOT_SATISFIABLE (416)
+#define HTTP_HASH_SUFFIX ".sha256"
+#define HTTP_BUFFER_SZ (256 * 1024)
+
+/**
+ * @brief The part of an archive sent with one request
+ */
+typedef struct _HTTPUploadChunk
+{
+  CdmTransfer *transfer;  /**< Transfer object owning the rate limiter */
+  CdmTransferEntry *entry; /**< Entry being uploaded */
+  gint fd;                 /**< Archive file descriptor */
+  gint64 offset;           /**< Next offset to send */
+  gint64 end;              /**< End offset of the chunk */
+} HTTPUploadChunk;
+
+/**
+ * @brief A small body sent from memory
+ */
+typedef struct _HTTPUploadBuffer
+{
+  const gchar *data; /**< Body data */
+  gsize len;         /**< Body length */
+  gsize offset;      /**< Next offset to send */
+} HTTPUploadBuffer;
+
+/**
+ * @brief Curl read callback streaming the chunk from the archive file
+ */
+static size_t httpbackend_read (char *buffer, size_t size, size_t nitems, void *_chunk);
+
+/**
+ * @brief Curl read callback streaming a body from memory
+ */
+static size_t httpbackend_read_buffer (char *buffer, size_t size, size_t nitems, void *_buf);
+
+/**
+ * @brief Compute the sha256 of the archive
+ * @return The hash string or NULL on read error
+ */
+static gchar *httpbackend_hash (gint fd);
+
+/**
+ * @brief Publish the archive hash as <archive url>.sha256
+ */
+static CdmStatus httpbackend_put_hash (CURL *curl, const gchar *url, const gchar *name,
+                                       const gchar *hash, gboolean *reuse);
+
+/**
+ * @brief Curl write callback dropping the response body
+ */
+static size_t httpbackend_discard (char *buffer, size_t size, size_t nmemb, void *user_data);
+
+/**
+ * @brief Get an idle handle or create a new one
+ */
+static CURL *httpbackend_acquire (CdmHTTPBackend *backend);
+
+/**
+ * @brief Keep the handle and its connection for the next upload or close it
+ */
+static void httpbackend_release (CdmHTTPBackend *backend, CURL *curl, gboolean reuse);
+
+/**
+ * @brief Upload an archive in chunks resuming from the acknowledged offset
+ */
+static CdmStatus httpbackend_upload (CdmTransferBackend *_backend, CdmTransfer *transfer,
+                                     CdmTransferEntry *entry);
+
+/**
+ * @brief Free the backend
+ */
+static void httpbackend_free (CdmTransferBackend *_backend);
+
+static size_t
+httpbackend_read (char *buffer, size_t size, size_t nitems, void *_chunk)
+{
+  HTTPUploadChunk *chunk = (HTTPUploadChunk *)_chunk;
+  gsize len = MIN (size * nitems, (gsize)(chunk->end - chunk->offset));
+  ssize_t retval;
+
+  if (len == 0)
+    return 0;
+
+  len = cdm_transfer_throttle (chunk->transfer, chunk->entry, len);
+
+  retval = pread (chunk->fd, buffer, len, chunk->offset);
+  if (retval <= 0)
+    return CURL_READFUNC_ABORT;
+
+  chunk->offset += retval;
+  cdm_transfer_sent (chunk->transfer, chunk->entry, (gsize)retval);
+
+  return (size_t)retval;
+}
+
+static size_t
+httpbackend_read_buffer (char *buffer, size_t size, size_t nitems, void *_buf)
+{
+  HTTPUploadBuffer *buf = (HTTPUploadBuffer *)_buf;
+  gsize len = MIN (size * nitems, buf->len - buf->offset);
+
+  memcpy (buffer, buf->data + buf->offset, len);
+  buf->offset += len;
+
+  return len;
+}
+
+static gchar *
+httpbackend_hash (gint fd)
+{
+  g_autoptr (GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_autofree guint8 *buffer = g_malloc (HTTP_BUFFER_SZ);
+  off_t offset = 0;
+  ssize_t nread;
+
+  while ((nread = pread (fd, buffer, HTTP_BUFFER_SZ, offset)) > 0)
+    {
+      g_checksum_update (checksum, buffer, nread);
+      offset += nread;
+    }
+
+  if (nread < 0)
+    return NULL;
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+static CdmStatus
+httpbackend_put_hash (CURL *curl, const gchar *url, const gchar *name, const gchar *hash,
+                      gboolean *reuse)
+{
+  g_autofree gchar *hash_url = g_strconcat (url, HTTP_HASH_SUFFIX, NULL);
+  g_autofree gchar *line = g_strdup_printf ("%s  %s\n", hash, name);
+  struct curl_slist *headers = NULL;
+  HTTPUploadBuffer body = { line, strlen (line), 0 };
+  glong code = 0;
+  CURLcode rc;
+
+  headers = curl_slist_append (headers, "Content-Type: text/plain");
+  headers = curl_slist_append (headers, "Expect:");
+
+  curl_easy_setopt (curl, CURLOPT_URL, hash_url);
+  curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt (curl, CURLOPT_READFUNCTION, httpbackend_read_buffer);
+  curl_easy_setopt (curl, CURLOPT_READDATA, &body);
+  curl_easy_setopt (curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)body.len);
+
+  rc = curl_easy_perform (curl);
+
+  curl_easy_setopt (curl, CURLOPT_HTTPHEADER, NULL);
+  curl_easy_setopt (curl, CURLOPT_READFUNCTION, httpbackend_read);
+  curl_slist_free_all (headers);
+
+  if (rc != CURLE_OK)
+    {
+      g_warning ("Transfer error for %s: %s", hash_url, curl_easy_strerror (rc));
+      *reuse = FALSE;
+      return CDM_STATUS_ERROR;
+    }
+
+  curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &code);
+  if (code < 200 || code >= 300)
+    {
+      g_warning ("Server rejected %s with status %ld", hash_url, code);
+      return CDM_STATUS_ERROR;
+    }
+
+  return CDM_STATUS_OK;
+}
+
+static size_t
+httpbackend_discard (char *buffer, size_t size, size_t nmemb, void *user_data)
+{
+  CDM_UNUSED (buffer);
+  CDM_UNUSED (user_data);
+
+  return size * nmemb;
+}
+
+static CURL *
+httpbackend_acquire (CdmHTTPBackend *backend)
+{
+  CURL *curl;
+
+  g_mutex_lock (&backend->lock);
+  curl = (CURL *)g_queue_pop_tail (&backend->idle);
+  g_mutex_unlock (&backend->lock);
+
+  if (curl != NULL)
+    return curl;
+
+  curl = curl_easy_init ();
+  if (curl == NULL)
+    return NULL;
+
+  /* the handle keeps its connection open between the requests */
+  curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt (curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt (curl, CURLOPT_CONNECTTIMEOUT, backend->connect_timeout);
+  curl_easy_setopt (curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+  curl_easy_setopt (curl, CURLOPT_LOW_SPEED_TIME, backend->io_timeout);
+  curl_easy_setopt (curl, CURLOPT_UPLOAD, 1L);
+  curl_easy_setopt (curl, CURLOPT_READFUNCTION, httpbackend_read);
+  curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, httpbackend_discard);
+
+  return curl;
+}
+
+static void
+httpbackend_release (CdmHTTPBackend *backend, CURL *curl, gboolean reuse)
+{
+  if (reuse)
+    {
+      g_mutex_lock (&backend->lock);
+      if (g_queue_get_length (&backend->idle) < backend->max_idle)
+        {
+          g_queue_push_tail (&backend->idle, curl);
+          curl = NULL;
+        }
+      g_mutex_unlock (&backend->lock);
+    }
+
+  if (curl != NULL)
+    curl_easy_cleanup (curl);
+}
+
+static CdmStatus
+httpbackend_upload (CdmTransferBackend *_backend, CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  CdmHTTPBackend *backend = (CdmHTTPBackend *)_backend;
+  g_autofree gchar *file_basename = g_path_get_basename (entry->upload_path);
+  g_autofree gchar *escaped = g_uri_escape_string (file_basename, NULL, FALSE);
+  g_autofree gchar *url = NULL;
+  CdmStatus status = CDM_STATUS_OK;
+  gboolean restarted = FALSE;
+  gboolean reuse = TRUE;
+  HTTPUploadChunk chunk;
+  struct stat fileinfo;
+  gint64 size;
+  CURL *curl;
+
+  url = g_strconcat (backend->url, g_str_has_suffix (backend->url, "/") ? "" : "/", escaped,
+                     NULL);
+
+  chunk.transfer = transfer;
+  chunk.entry = entry;
+  chunk.fd = open (entry->upload_path, O_RDONLY | O_CLOEXEC);
+  if (chunk.fd < 0)
+    {
+      g_warning ("Can't open local file for transfer %s", entry->upload_path);
+      return CDM_STATUS_ERROR;
+    }
+
+  if (fstat (chunk.fd, &fileinfo) != 0)
+    {
+      g_warning ("Can't stat local file for transfer %s", entry->upload_path);
+      close (chunk.fd);
+      return CDM_STATUS_ERROR;
+    }
+
+  curl = httpbackend_acquire (backend);
+  if (curl == NULL)
+    {
+      g_warning ("Fail to create http handle");
+      close (chunk.fd);
+      return CDM_STATUS_ERROR;
+    }
+
+  /* a checkpoint is below the size, anything else is stale and the upload restarts */
+  size = (gint64)fileinfo.st_size;
+  chunk.offset = (entry->offset > 0 && entry->offset < size) ? entry->offset : 0;
+
+  if (chunk.offset > 0)
+    g_info ("Resume transfer for %s at offset %ld", file_basename, chunk.offset);
+
+  curl_easy_setopt (curl, CURLOPT_URL, url);
+  curl_easy_setopt (curl, CURLOPT_READDATA, &chunk);
+
+  /* each chunk is a request of its own so an acknowledged chunk is never sent again */
+  do
+    {
+      struct curl_slist *headers = NULL;
+      gint64 start = chunk.offset;
+      glong code = 0;
+      CURLcode rc;
+
+      chunk.end = MIN (start + (gint64)transfer->chunk_size, size);
+
+      /* an empty archive has no byte range and goes as a plain PUT */
+      if (size > 0)
+        {
+          g_autofree gchar *range
+              = g_strdup_printf ("Content-Range: bytes %ld-%ld/%ld", start, chunk.end - 1, size);
+
+          headers = curl_slist_append (headers, range);
+        }
+
+      headers = curl_slist_append (headers, "Content-Type: application/octet-stream");
+      /* no 100-continue round trip before each chunk */
+      headers = curl_slist_append (headers, "Expect:");
+
+      curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
+      curl_easy_setopt (curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)(chunk.end - start));
+
+      rc = curl_easy_perform (curl);
+      curl_easy_setopt (curl, CURLOPT_HTTPHEADER, NULL);
+      curl_slist_free_all (headers);
+
+      if (rc != CURLE_OK)
+        {
+          g_warning ("Transfer error for %s: %s", file_basename, curl_easy_strerror (rc));
+          status = CDM_STATUS_ERROR;
+          reuse = FALSE;
+          break;
+        }
+
+      curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &code);
+
+      if (code == HTTP_STATUS_RANGE_NOT_SATISFIABLE && start > 0 && !restarted)
+        {
+          g_info ("Server lost the partial upload for %s, restart from the beginning",
+                  file_basename);
+          cdm_transfer_checkpoint (transfer, entry, 0);
+          chunk.offset = 0;
+          restarted = TRUE;
+          continue;
+        }
+
+      /* the last chunk completes the upload, only a 2xx confirms the server has it all */
+      if (code == HTTP_STATUS_RESUME_INCOMPLETE && chunk.end == size)
+        {
+          g_warning ("Server reports %s incomplete after its last chunk", file_basename);
+          status = CDM_STATUS_ERROR;
+          break;
+        }
+
+      if (code != HTTP_STATUS_RESUME_INCOMPLETE && (code < 200 || code >= 300))
+        {
+          g_warning ("Server rejected %s at offset %ld with status %ld", file_basename, start,
+                     code);
+          status = CDM_STATUS_ERROR;
+          break;
+        }
+
+      /* the response confirms the server stored the chunk */
+      if (chunk.offset < size)
+        cdm_transfer_checkpoint (transfer, entry, chunk.offset);
+    }
+  while (chunk.offset < size);
+
+  /* the hash of the whole archive follows so the receiver can check what it stored */
+  if (status == CDM_STATUS_OK)
+    {
+      g_autofree gchar *hash = httpbackend_hash (chunk.fd);
+
+      if (hash == NULL)
+        {
+          g_warning ("Can't read local file for transfer %s", entry->upload_path);
+          status = CDM_STATUS_ERROR;
+        }
+      else
+        status = httpbackend_put_hash (curl, url, file_basename, hash, &reuse);
+
+      if (status == CDM_STATUS_OK)
+        g_debug ("Transfer complete for %s (%ld bytes) sha256 %s", file_basename, size, hash);
+    }
+
+  curl_easy_setopt (curl, CURLOPT_READDATA, NULL);
+  httpbackend_release (backend, curl, reuse);
+  close (chunk.fd);
+
+  return status;
+}
+
+static void
+httpbackend_free (CdmTransferBackend *_backend)
+{
+  CdmHTTPBackend *backend = (CdmHTTPBackend *)_backend;
+  CURL *curl;
+
+  while ((curl = (CURL *)g_queue_pop_head (&backend->idle)) != NULL)
+    curl_easy_cleanup (curl);
+
+  curl_global_cleanup ();
+
+  g_mutex_clear (&backend->lock);
+  g_free (backend->url);
+  g_free (backend->parent.destination);
+  g_free (backend);
+}
+
+CdmTransferBackend *
+cdm_httpbackend_new (CdmOptions *options)
+{
+  g_autofree gchar *url = NULL;
+  CdmHTTPBackend *backend;
+  CURLcode rc;
+
+  g_assert (options);
+
+  url = cdm_options_string_for (options, KEY_TRANSFER_URL);
+  if (strlen (url) == 0)
+    {
+      g_info ("No transfer url set, http uploads are skipped");
+      return NULL;
+    }
+
+  rc = curl_global_init (CURL_GLOBAL_DEFAULT);
+  if (rc != CURLE_OK)
+    {
+      g_warning ("Libcurl initialization failed: %s", curl_easy_strerror (rc));
+      return NULL;
+    }
+
+  backend = g_new0 (CdmHTTPBackend, 1);
+
+  g_mutex_init (&backend->lock);
+  g_queue_init (&backend->idle);
+
+  backend->parent.name = "http";
+  backend->parent.destination = g_strdup (url);
+  backend->parent.upload = httpbackend_upload;
+  backend->parent.free = httpbackend_free;
+
+  backend->connect_timeout
+      = (glong)MAX (cdm_options_long_for (options, KEY_TRANSFER_CONNECT_TIMEOUT), 0);
+  backend->io_timeout = (glong)MAX (cdm_options_long_for (options, KEY_TRANSFER_IO_TIMEOUT), 0);
+  backend->max_idle = (guint)MAX (cdm_options_long_for (options, KEY_TRANSFER_DEST_WORKERS), 1);
+  backend->url = g_steal_pointer (&url);
+
+  return (CdmTransferBackend *)backend;
+}
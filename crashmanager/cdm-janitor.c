@@ -27,15 +27,47 @@
 #include <fcntl.h>
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #define BTOMB(x) (x / 1024 / 1024)
 
+#ifndef JANITOR_RESYNC_INTERVAL_SEC
+#define JANITOR_RESYNC_INTERVAL_SEC (300)
+#endif
+
+/**
+ * @struct Janitor eviction set handed to the unlink thread
+ */
+typedef struct _JanitorEviction
+{
+  CdmJanitor *janitor; /**< Own a reference to the janitor object */
+  GPtrArray *paths;    /**< Victim file paths */
+  GPtrArray *removed;  /**< Victim file paths removed (not owned) */
+  GPtrArray *failed;   /**< Victim file paths that could not be removed (not owned) */
+} JanitorEviction;
+
 /**
- * @brief GSource prepare function
+ * @struct Janitor accounted usage for a context or process name
  */
-static gboolean janitor_source_prepare (GSource *source, gint *timeout);
+typedef struct _JanitorUsage
+{
+  gssize size;  /**< Accounted data size */
+  gssize count; /**< Accounted entries count */
+} JanitorUsage;
+
+/**
+ * @struct Janitor victims selected in one pass and the usage they release
+ */
+typedef struct _JanitorSelection
+{
+  GPtrArray *victims;    /**< Victim file paths */
+  GHashTable *exclude;   /**< Selected and failed paths not offered again (not owned) */
+  GHashTable *ctxfreed;  /**< Usage released per context name */
+  GHashTable *procfreed; /**< Usage released per process name */
+  JanitorUsage freed;    /**< Usage released in total */
+} JanitorSelection;
 
 /**
  * @brief GSource dispatch function
@@ -53,31 +85,180 @@ static gboolean janitor_source_callback (gpointer cdmjanitor);
  */
 static void janitor_source_destroy_notify (gpointer cdmjanitor);
 
+/**
+ * @brief Eviction thread function
+ */
+static gpointer janitor_unlink_thread (gpointer data);
+
+/**
+ * @brief Journal removal completion callback
+ */
+static void victim_removed (gpointer cdmjanitor, const GError *error);
+
+/**
+ * @brief Main loop handler for an eviction finished by the unlink thread
+ */
+static gboolean janitor_eviction_done (gpointer data);
+
+/**
+ * @brief Journal usage change callback
+ */
+static void journal_usage_changed (gpointer cdmjanitor, const gchar *context_name,
+                                   const gchar *proc_name, gssize delta_size, gssize delta_count);
+
+/**
+ * @brief Apply a usage change to the global and per name totals
+ */
+static void janitor_account (gpointer cdmjanitor, const gchar *context_name,
+                             const gchar *proc_name, gssize delta_size, gssize delta_count);
+
+/**
+ * @brief Apply a usage change to a per name total
+ */
+static void janitor_account_name (GHashTable *usage, const gchar *name, gssize delta_size,
+                                  gssize delta_count);
+
+/**
+ * @brief Add the victims needed to bring each name under its quota
+ */
+static void janitor_collect_victims (CdmJanitor *janitor, GHashTable *usage, gboolean by_context,
+                                     glong max_size, glong max_cnt, JanitorSelection *selection);
+
+/**
+ * @brief Add new victims to the eviction set and account the usage they release
+ */
+static void janitor_merge_victims (JanitorSelection *selection, GPtrArray *victims);
+
+/**
+ * @brief Request the usage totals from journal
+ */
+static void janitor_resync (CdmJanitor *janitor);
+
+/**
+ * @brief Journal usage snapshot callback, the entries are reported right after
+ */
+static void usage_resynced (gpointer cdmjanitor, const GError *error);
+
+/**
+ * @brief Check if the usage totals exceed the quota
+ */
+static gboolean janitor_over_quota (CdmJanitor *janitor);
+
+/**
+ * @brief Schedule a quota evaluation on next main loop iteration
+ */
+static void janitor_schedule (CdmJanitor *janitor);
+
 /**
  * @brief GSourceFuncs vtable
  */
 static GSourceFuncs janitor_source_funcs = {
-  janitor_source_prepare, NULL, janitor_source_dispatch, NULL, NULL, NULL,
+  NULL, NULL, janitor_source_dispatch, NULL, NULL, NULL,
 };
 
 static gboolean
-janitor_source_prepare (GSource *source, gint *timeout)
+janitor_source_dispatch (GSource *source, GSourceFunc callback, gpointer cdmjanitor)
 {
   CdmJanitor *janitor = (CdmJanitor *)source;
-  gssize crash_dir_size;
-  gssize entries_count;
 
-  CDM_UNUSED (timeout);
+  /* the coarse timer runs until the next journal usage event */
+  g_source_set_ready_time (source,
+                           g_get_monotonic_time () + G_USEC_PER_SEC * JANITOR_RESYNC_INTERVAL_SEC);
+
+  /* the quota is evaluated once the snapshot is applied */
+  if (janitor->resync)
+    {
+      janitor_resync (janitor);
+      return G_SOURCE_CONTINUE;
+    }
+
+  janitor->resync = TRUE;
+
+  return callback (cdmjanitor) == TRUE ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static void
+janitor_resync (CdmJanitor *janitor)
+{
+  if (janitor->resyncing)
+    return;
+
+  /* the snapshot is taken by the writer so no committed usage change is counted twice */
+  janitor->resyncing = TRUE;
+  cdm_journal_resync_usage (janitor->journal, usage_resynced, cdm_janitor_ref (janitor));
+}
+
+static void
+usage_resynced (gpointer cdmjanitor, const GError *error)
+{
+  CdmJanitor *janitor = (CdmJanitor *)cdmjanitor;
+
+  g_assert (janitor);
+
+  if (error != NULL)
+    {
+      g_warning ("Fail to read usage from journal %s", error->message);
+    }
+  else
+    {
+      janitor->data_size = 0;
+      janitor->entry_count = 0;
+      g_hash_table_remove_all (janitor->ctxuse);
+      g_hash_table_remove_all (janitor->procuse);
+      g_hash_table_remove_all (janitor->failed);
+    }
+
+  janitor->resyncing = FALSE;
+  janitor_schedule (janitor);
+  cdm_janitor_unref (janitor);
+}
+
+static void
+janitor_account_name (GHashTable *usage, const gchar *name, gssize delta_size, gssize delta_count)
+{
+  JanitorUsage *entry = NULL;
+
+  if (name == NULL)
+    return;
+
+  entry = (JanitorUsage *)g_hash_table_lookup (usage, name);
+  if (entry == NULL)
+    {
+      entry = g_new0 (JanitorUsage, 1);
+      g_hash_table_insert (usage, g_strdup (name), entry);
+    }
+
+  entry->size += delta_size;
+  entry->count += delta_count;
+
+  if (entry->count <= 0)
+    g_hash_table_remove (usage, name);
+}
+
+static void
+janitor_account (gpointer cdmjanitor, const gchar *context_name, const gchar *proc_name,
+                 gssize delta_size, gssize delta_count)
+{
+  CdmJanitor *janitor = (CdmJanitor *)cdmjanitor;
+
+  janitor->data_size += delta_size;
+  janitor->entry_count += delta_count;
 
-  crash_dir_size = cdm_journal_get_data_size (janitor->journal, NULL);
-  entries_count = cdm_journal_get_entry_count (janitor->journal, NULL);
+  janitor_account_name (janitor->ctxuse, context_name, delta_size, delta_count);
+  janitor_account_name (janitor->procuse, proc_name, delta_size, delta_count);
+}
 
-  if ((crash_dir_size > janitor->max_dir_size) || (entries_count > janitor->max_file_cnt)
-      || ((janitor->max_dir_size - crash_dir_size) < janitor->min_dir_size))
+static gboolean
+janitor_over_quota (CdmJanitor *janitor)
+{
+  if ((janitor->data_size > janitor->max_dir_size) || (janitor->entry_count > janitor->max_file_cnt)
+      || ((janitor->max_dir_size - janitor->data_size) < janitor->min_dir_size))
     {
       g_info ("Cleaning database size=%ldMB (max=%ldMB min=%ldMB) count=%ld (max=%ld)",
-              BTOMB (crash_dir_size) == 0 && entries_count > 0 ? 1 : BTOMB (crash_dir_size),
-              BTOMB (janitor->max_dir_size), BTOMB (janitor->min_dir_size), entries_count,
+              BTOMB (janitor->data_size) == 0 && janitor->entry_count > 0
+                  ? 1
+                  : BTOMB (janitor->data_size),
+              BTOMB (janitor->max_dir_size), BTOMB (janitor->min_dir_size), janitor->entry_count,
               janitor->max_file_cnt);
 
       return TRUE;
@@ -86,52 +267,247 @@ janitor_source_prepare (GSource *source, gint *timeout)
   return FALSE;
 }
 
-static gboolean
-janitor_source_dispatch (GSource *source, GSourceFunc callback, gpointer cdmjanitor)
+static void
+janitor_schedule (CdmJanitor *janitor)
 {
-  CDM_UNUSED (callback);
-  CDM_UNUSED (source);
-  return callback (cdmjanitor) == TRUE ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+  janitor->resync = FALSE;
+  g_source_set_ready_time (CDM_EVENT_SOURCE (janitor), 0);
 }
 
 static gboolean
 janitor_source_callback (gpointer cdmjanitor)
 {
   CdmJanitor *janitor = (CdmJanitor *)cdmjanitor;
-  g_autofree gchar *victim_path = NULL;
-
-  g_autoptr (GError) error = NULL;
+  JanitorEviction *eviction = NULL;
+  JanitorSelection selection = { 0 };
+  GHashTableIter iter;
+  gpointer key;
 
   g_assert (janitor);
 
-  victim_path = cdm_journal_get_victim (janitor->journal, &error);
-  if (victim_path == NULL || error != NULL)
+  /* wait for the last eviction to be visible in the journal and for the usage snapshot */
+  if (janitor->pending || janitor->resyncing)
+    return TRUE;
+
+  selection.victims = g_ptr_array_new_with_free_func (g_free);
+  selection.exclude = g_hash_table_new (g_str_hash, g_str_equal);
+  selection.ctxfreed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  selection.procfreed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  g_hash_table_iter_init (&iter, janitor->failed);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_hash_table_add (selection.exclude, key);
+
+  /* per name quotas first, the global quota applies on top */
+  janitor_collect_victims (janitor, janitor->ctxuse, TRUE, janitor->ctx_max_size,
+                           janitor->ctx_max_cnt, &selection);
+  janitor_collect_victims (janitor, janitor->procuse, FALSE, janitor->proc_max_size,
+                           janitor->proc_max_cnt, &selection);
+
+  if (janitor_over_quota (janitor))
     {
-      g_warning ("No victim available to be cleaned");
+      g_autoptr (GError) error = NULL;
+      GPtrArray *victims = NULL;
+
+      /* release enough to get back under quota with the minimum space preserved */
+      victims = cdm_journal_get_victims (
+          janitor->journal, NULL, NULL,
+          janitor->data_size - selection.freed.size
+              - (janitor->max_dir_size - janitor->min_dir_size),
+          janitor->entry_count - selection.freed.count - janitor->max_file_cnt,
+          selection.exclude, &error);
       if (error != NULL)
-        g_warning ("Fail to get a victim from journal %s", error->message);
+        g_warning ("Fail to get victims from journal %s", error->message);
+
+      if (victims->len == 0 && selection.victims->len == 0)
+        g_warning ("No victim available to be cleaned");
+
+      janitor_merge_victims (&selection, victims);
+      g_ptr_array_unref (victims);
     }
-  else
+
+  g_hash_table_destroy (selection.exclude);
+  g_hash_table_destroy (selection.ctxfreed);
+  g_hash_table_destroy (selection.procfreed);
+
+  if (selection.victims->len == 0)
     {
-      g_autofree gchar *victim_basename = g_path_get_basename (victim_path);
+      g_ptr_array_unref (selection.victims);
+      return TRUE;
+    }
 
-      g_info ("Remove old crashdump entry %s", victim_basename);
+  g_info ("Remove %u old crashdump entries", selection.victims->len);
 
-      if (g_remove (victim_path) == -1)
-        {
-          if (errno != ENOENT)
-            g_error ("Fail to remove file %s", victim_path);
-        }
+  eviction = g_new0 (JanitorEviction, 1);
+  eviction->janitor = cdm_janitor_ref (janitor);
+  eviction->paths = selection.victims;
+  eviction->removed = g_ptr_array_new ();
+  eviction->failed = g_ptr_array_new ();
+
+  janitor->pending = TRUE;
+  g_thread_unref (g_thread_new ("janitor", janitor_unlink_thread, eviction));
+
+  return TRUE;
+}
+
+static void
+janitor_merge_victims (JanitorSelection *selection, GPtrArray *victims)
+{
+  for (guint i = 0; i < victims->len; i++)
+    {
+      CdmJournalVictim *victim = (CdmJournalVictim *)victims->pdata[i];
+      gchar *path = g_strdup (victim->file_path);
+
+      /* the journal skips excluded paths so each victim is new to the set */
+      g_ptr_array_add (selection->victims, path);
+      g_hash_table_add (selection->exclude, path);
+
+      janitor_account_name (selection->ctxfreed, victim->context_name, victim->size, 1);
+      janitor_account_name (selection->procfreed, victim->proc_name, victim->size, 1);
+      selection->freed.size += victim->size;
+      selection->freed.count += 1;
+    }
+}
+
+static void
+janitor_collect_victims (CdmJanitor *janitor, GHashTable *usage, gboolean by_context,
+                         glong max_size, glong max_cnt, JanitorSelection *selection)
+{
+  GHashTable *freed = by_context ? selection->ctxfreed : selection->procfreed;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  if (max_size <= 0 && max_cnt <= 0)
+    return;
 
-      cdm_journal_set_removed (janitor->journal, victim_path, TRUE, &error);
+  g_hash_table_iter_init (&iter, usage);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      JanitorUsage *entry = (JanitorUsage *)value;
+      const gchar *name = (const gchar *)key;
+      JanitorUsage *released = (JanitorUsage *)g_hash_table_lookup (freed, name);
+      g_autoptr (GError) error = NULL;
+      gssize size = entry->size - (released != NULL ? released->size : 0);
+      gssize count = entry->count - (released != NULL ? released->count : 0);
+      gssize free_size = max_size > 0 ? size - max_size : 0;
+      gssize free_count = max_cnt > 0 ? count - max_cnt : 0;
+      GPtrArray *victims = NULL;
+
+      /* victims already selected by another quota count towards this one */
+      if (free_size <= 0 && free_count <= 0)
+        continue;
+
+      g_info ("Cleaning %s %s size=%ldMB count=%ld", by_context ? "context" : "process", name,
+              BTOMB (entry->size), entry->count);
+
+      victims = cdm_journal_get_victims (janitor->journal, by_context ? name : NULL,
+                                         by_context ? NULL : name, free_size, free_count,
+                                         selection->exclude, &error);
       if (error != NULL)
+        g_warning ("Fail to get victims for %s from journal %s", name, error->message);
+
+      janitor_merge_victims (selection, victims);
+      g_ptr_array_unref (victims);
+    }
+}
+
+static gpointer
+janitor_unlink_thread (gpointer data)
+{
+  JanitorEviction *eviction = (JanitorEviction *)data;
+
+  for (guint i = 0; i < eviction->paths->len; i++)
+    {
+      gchar *victim_path = (gchar *)eviction->paths->pdata[i];
+
+      if (g_remove (victim_path) == -1 && errno != ENOENT)
         {
-          g_warning ("Fail to set remove flag for victim %s: Error %s", victim_basename,
-                     error->message);
+          g_warning ("Fail to remove file %s. Error %s", victim_path, strerror (errno));
+          g_ptr_array_add (eviction->failed, victim_path);
+          continue;
         }
+
+      g_debug ("Removed old crashdump entry %s", victim_path);
+      g_ptr_array_add (eviction->removed, victim_path);
     }
 
-  return TRUE;
+  g_main_context_invoke (NULL, janitor_eviction_done, eviction);
+
+  return NULL;
+}
+
+static gboolean
+janitor_eviction_done (gpointer data)
+{
+  JanitorEviction *eviction = (JanitorEviction *)data;
+  CdmJanitor *janitor = eviction->janitor;
+  g_autoptr (GError) error = NULL;
+
+  /* the journal still offers these victims, skip them until the next resync */
+  for (guint i = 0; i < eviction->failed->len; i++)
+    g_hash_table_add (janitor->failed, g_strdup ((const gchar *)eviction->failed->pdata[i]));
+
+  if (eviction->removed->len > 0)
+    {
+      cdm_journal_set_removed_list (janitor->journal, eviction->removed, victim_removed, janitor,
+                                    &error);
+    }
+  else
+    {
+      g_set_error (&error, g_quark_from_static_string ("JanitorUnlink"), 1,
+                   "No victim file removed");
+    }
+
+  /*
+   * Nothing was queued so release the eviction without a new evaluation, the same victims
+   * would be selected right away. The next usage event or resync evaluates the quota again.
+   */
+  if (error != NULL)
+    {
+      g_warning ("Fail to set remove flag for victims: Error %s", error->message);
+
+      for (guint i = 0; i < eviction->removed->len; i++)
+        g_hash_table_add (janitor->failed, g_strdup ((const gchar *)eviction->removed->pdata[i]));
+
+      janitor->pending = FALSE;
+      cdm_janitor_unref (janitor);
+    }
+
+  g_ptr_array_unref (eviction->removed);
+  g_ptr_array_unref (eviction->failed);
+  g_ptr_array_unref (eviction->paths);
+  g_free (eviction);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+victim_removed (gpointer cdmjanitor, const GError *error)
+{
+  CdmJanitor *janitor = (CdmJanitor *)cdmjanitor;
+
+  g_assert (janitor);
+
+  if (error != NULL)
+    g_warning ("Fail to set remove flag for victims: Error %s", error->message);
+
+  janitor->pending = FALSE;
+  janitor_schedule (janitor);
+  cdm_janitor_unref (janitor);
+}
+
+static void
+journal_usage_changed (gpointer cdmjanitor, const gchar *context_name, const gchar *proc_name,
+                       gssize delta_size, gssize delta_count)
+{
+  CdmJanitor *janitor = (CdmJanitor *)cdmjanitor;
+
+  g_assert (janitor);
+
+  /* new entries are checked against their quotas right away */
+  janitor_account (janitor, context_name, proc_name, delta_size, delta_count);
+  janitor_schedule (janitor);
 }
 
 static void
@@ -157,9 +533,21 @@ cdm_janitor_new (CdmOptions *options, CdmJournal *journal)
   janitor->max_dir_size = cdm_options_long_for (options, KEY_CRASHDUMP_DIR_MAX_SIZE) * 1024 * 1024;
   janitor->min_dir_size = cdm_options_long_for (options, KEY_CRASHDUMP_DIR_MIN_SIZE) * 1024 * 1024;
   janitor->max_file_cnt = cdm_options_long_for (options, KEY_CRASHFILES_MAX_COUNT);
+  janitor->ctx_max_size = cdm_options_long_for (options, KEY_CONTEXT_DIR_MAX_SIZE) * 1024 * 1024;
+  janitor->ctx_max_cnt = cdm_options_long_for (options, KEY_CONTEXT_FILES_MAX_COUNT);
+  janitor->proc_max_size = cdm_options_long_for (options, KEY_PROCESS_DIR_MAX_SIZE) * 1024 * 1024;
+  janitor->proc_max_cnt = cdm_options_long_for (options, KEY_PROCESS_FILES_MAX_COUNT);
+  janitor->ctxuse = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  janitor->procuse = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  janitor->failed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  /* seed the usage totals once, the journal events keep them updated */
+  cdm_journal_set_usage_callback (janitor->journal, journal_usage_changed, janitor);
+  janitor_resync (janitor);
 
   g_source_set_callback (CDM_EVENT_SOURCE (janitor), G_SOURCE_FUNC (janitor_source_callback),
                          janitor, janitor_source_destroy_notify);
+  g_source_set_ready_time (CDM_EVENT_SOURCE (janitor), 0);
   g_source_attach (CDM_EVENT_SOURCE (janitor), NULL);
 
   return janitor;
@@ -180,7 +568,11 @@ cdm_janitor_unref (CdmJanitor *janitor)
 
   if (g_ref_count_dec (&janitor->rc) == TRUE)
     {
+      cdm_journal_set_usage_callback (janitor->journal, NULL, NULL);
       cdm_journal_unref (janitor->journal);
+      g_hash_table_destroy (janitor->ctxuse);
+      g_hash_table_destroy (janitor->procuse);
+      g_hash_table_destroy (janitor->failed);
       g_source_unref (CDM_EVENT_SOURCE (janitor));
     }
 }
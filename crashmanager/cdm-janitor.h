@@ -41,6 +41,18 @@ typedef struct _CdmJanitor
   glong max_dir_size;  /**< Maximum allowed crash dir size */
   glong min_dir_size;  /**< Minimum space to preserve from quota */
   glong max_file_cnt;  /**< Maximum file count */
+  glong ctx_max_size;  /**< Maximum size per context name or 0 */
+  glong ctx_max_cnt;   /**< Maximum file count per context name or 0 */
+  glong proc_max_size; /**< Maximum size per process name or 0 */
+  glong proc_max_cnt;  /**< Maximum file count per process name or 0 */
+  gssize data_size;    /**< Accounted crash data size */
+  gssize entry_count;  /**< Accounted crash entry count */
+  GHashTable *ctxuse;  /**< Accounted usage per context name */
+  GHashTable *procuse; /**< Accounted usage per process name */
+  GHashTable *failed;  /**< Victim paths not removable until the next resync */
+  gboolean pending;    /**< Victim removal not yet committed in journal */
+  gboolean resync;     /**< Re-read the accounted totals from journal on dispatch */
+  gboolean resyncing;  /**< Usage snapshot requested and not yet applied */
   CdmJournal *journal; /**< Own a reference to journal object */
 } CdmJanitor;
 
@@ -24,40 +24,236 @@
 #include "cdm-journal.h"
 #include "cdm-utils.h"
 
+#include <string.h>
+
 #define USEC2SEC(x) (x / 1000000)
 #define SEC2USEC(x) (x * 1000000)
+#define MSEC2USEC(x) (x * 1000)
+
+#ifndef JOURNAL_BUSY_TIMEOUT_MSEC
+#define JOURNAL_BUSY_TIMEOUT_MSEC (5000)
+#endif
+
+#ifndef JOURNAL_EPILOG_TICK_SEC
+#define JOURNAL_EPILOG_TICK_SEC (1)
+#endif
+
+#ifndef JOURNAL_COMPACT_CHECK_SEC
+#define JOURNAL_COMPACT_CHECK_SEC (60)
+#endif
+
+#ifndef JOURNAL_COMPACT_IDLE_SEC
+#define JOURNAL_COMPACT_IDLE_SEC (30)
+#endif
+
+#ifndef JOURNAL_VACUUM_PAGES
+#define JOURNAL_VACUUM_PAGES (1024)
+#endif
+
+#define JOURNAL_TABLE "CrashTable"
+#define JOURNAL_SCHEMA_TABLE "SchemaVersion"
+#define JOURNAL_SUMMARY_TABLE "CrashSummary"
+#define JOURNAL_STATS_TABLE "CrashStats"
+#define JOURNAL_STATS_NAMES_TABLE "CrashStatsNames"
+
+/* transfer state of an entry given up after the maximum attempts, 1 is a completed upload */
+#define JOURNAL_TRANSFER_ABANDONED (2)
+
+/*
+ * Transferred and abandoned entries are both released to the retention policy. The unary
+ * plus keeps TSTATE out of the index lookup so the ordered covering indexes stay in use.
+ */
+#define JOURNAL_RELEASED_SQL "RSTATE IS 0 AND +TSTATE > 0"
+
+/* distinct name kinds tracked per crash statistics row */
+#define JOURNAL_STATS_PROCESS (0)
+#define JOURNAL_STATS_CONTEXT (1)
+
+#define JOURNAL_STATS_NAMES_COUNT(kind)                                                            \
+  "(SELECT COUNT (*) FROM " JOURNAL_STATS_NAMES_TABLE " "                                         \
+  "WHERE CRASHID IS ?1 AND VECTORID IS ?2 AND KIND IS " G_STRINGIFY (kind) ")"
+
+#define JOURNAL_STATS_COLUMNS                                                                      \
+  "CRASHID, VECTORID, COUNT, FIRSTSEEN, LASTSEEN, PROCESSES, CONTEXTS, PROCNAME, CONTEXTNAME"
+
+/* the first and the latest archives of a crash id are the valuable samples */
+#define JOURNAL_DUPLICATES_SQL(filter)                                                             \
+  "UPDATE " JOURNAL_TABLE " AS C SET DUPLICATE = 1 WHERE DUPLICATE IS 0 " filter " "              \
+  "AND ID NOT IN (SELECT ID FROM " JOURNAL_TABLE " WHERE CRASHID IS C.CRASHID "                   \
+  "ORDER BY TIMESTAMP ASC, ID ASC LIMIT 1) "                                                      \
+  "AND ID NOT IN (SELECT ID FROM " JOURNAL_TABLE " WHERE CRASHID IS C.CRASHID "                   \
+  "ORDER BY TIMESTAMP DESC, ID DESC LIMIT ?2)"
 
 /**
- * @enum Journal query type
+ * @enum Journal prepared statements
  */
-typedef enum _JournalQueryType
+typedef enum _JournalStmt
 {
-  QUERY_CREATE,
-  QUERY_ADD_ENTRY,
-  QUERY_GET_ENTRY,
-  QUERY_SET_TRANSFER,
-  QUERY_SET_REMOVED,
-  QUERY_GET_VICTIM,
-  QUERY_GET_UNTRANSFERRED,
-  QUERY_GET_DATASIZE,
-  QUERY_GET_ENTRY_COUNT
-} JournalQueryType;
+  STMT_ENTRY_EXIST,
+  STMT_ADD_CRASH,
+  STMT_MARK_DUPLICATES,
+  STMT_SET_TRANSFER,
+  STMT_SET_TRANSFER_OFFSET,
+  STMT_SET_TRANSFER_RETRY,
+  STMT_GET_TRANSFER_STATE,
+  STMT_SET_METADATA_TRANSFER,
+  STMT_SET_REMOVED,
+  STMT_GET_ENTRY_USAGE,
+  STMT_GET_USAGE,
+  STMT_GET_TOTALS,
+  STMT_GET_VICTIMS,
+  STMT_GET_CONTEXT_VICTIMS,
+  STMT_GET_PROCESS_VICTIMS,
+  STMT_GET_UNTRANSFERRED,
+  STMT_GET_METADATA_UNTRANSFERRED,
+  STMT_COMPACT_SUMMARY,
+  STMT_COMPACT_DELETE,
+  STMT_ADD_STATS_NAME,
+  STMT_ADD_STATS,
+  STMT_GET_STATS,
+  STMT_GET_CRASH_STATS,
+  STMT_COUNT
+} JournalStmt;
 
 /**
- * @enum Journal query data object
+ * @brief Prepared statements text, compiled once per database connection
  */
-typedef struct _JournalQueryData
+static const gchar *journal_stmt_sql[STMT_COUNT] = {
+  [STMT_ENTRY_EXIST] = "SELECT ID FROM " JOURNAL_TABLE " WHERE ID IS ?1",
+  [STMT_ADD_CRASH]
+  = "INSERT INTO " JOURNAL_TABLE " "
+    "(ID,PROCNAME,CRASHID,VECTORID,CONTEXTID,CONTEXTNAME,LIFECYCLESTATE,FILEPATH,FILESIZE,PID,"
+    "SIGNAL,TIMESTAMP,OSVERSION,TSTATE,RSTATE,DUPLICATE,SCORE) "
+    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, 0, 0, 0, ?14)",
+  [STMT_MARK_DUPLICATES] = JOURNAL_DUPLICATES_SQL ("AND CRASHID IS ?1"),
+  [STMT_SET_TRANSFER] = "UPDATE " JOURNAL_TABLE " SET TSTATE = ?2, TOFFSET = 0, TNEXT = 0 "
+                        "WHERE ID IS ?1",
+  [STMT_SET_TRANSFER_OFFSET] = "UPDATE " JOURNAL_TABLE " SET TOFFSET = ?2 "
+                               "WHERE ID IS ?1 AND TSTATE IS 0",
+  [STMT_SET_TRANSFER_RETRY] = "UPDATE " JOURNAL_TABLE " SET TATTEMPTS = TATTEMPTS + 1, TNEXT = ?2 "
+                              "WHERE ID IS ?1 AND TSTATE IS 0",
+  [STMT_GET_TRANSFER_STATE] = "SELECT TOFFSET, TATTEMPTS, TNEXT FROM " JOURNAL_TABLE " "
+                              "WHERE ID IS ?1",
+  [STMT_SET_METADATA_TRANSFER] = "UPDATE " JOURNAL_TABLE " SET MSTATE = ?2 WHERE ID IS ?1",
+  [STMT_SET_REMOVED] = "UPDATE " JOURNAL_TABLE " SET RSTATE = ?2 WHERE ID IS ?1",
+  [STMT_GET_ENTRY_USAGE] = "SELECT FILESIZE, CONTEXTNAME, PROCNAME FROM " JOURNAL_TABLE " "
+                           "WHERE ID IS ?1 AND " JOURNAL_RELEASED_SQL,
+  [STMT_GET_USAGE] = "SELECT FILESIZE, CONTEXTNAME, PROCNAME FROM " JOURNAL_TABLE " "
+                     "WHERE " JOURNAL_RELEASED_SQL,
+  [STMT_GET_TOTALS] = "SELECT IFNULL (SUM (FILESIZE), 0), COUNT (*) FROM " JOURNAL_TABLE " "
+                      "WHERE " JOURNAL_RELEASED_SQL,
+  [STMT_GET_VICTIMS] = "SELECT FILEPATH, FILESIZE, CONTEXTNAME, PROCNAME FROM " JOURNAL_TABLE " "
+                       "WHERE " JOURNAL_RELEASED_SQL " ORDER BY DUPLICATE DESC, SCORE ASC",
+  [STMT_GET_CONTEXT_VICTIMS] = "SELECT FILEPATH, FILESIZE, CONTEXTNAME, PROCNAME "
+                               "FROM " JOURNAL_TABLE " "
+                               "WHERE CONTEXTNAME IS ?1 AND " JOURNAL_RELEASED_SQL " "
+                               "ORDER BY DUPLICATE DESC, SCORE ASC",
+  [STMT_GET_PROCESS_VICTIMS] = "SELECT FILEPATH, FILESIZE, CONTEXTNAME, PROCNAME "
+                               "FROM " JOURNAL_TABLE " "
+                               "WHERE PROCNAME IS ?1 AND " JOURNAL_RELEASED_SQL " "
+                               "ORDER BY DUPLICATE DESC, SCORE ASC",
+  [STMT_GET_UNTRANSFERRED] = "SELECT FILEPATH FROM " JOURNAL_TABLE " "
+                             "WHERE RSTATE IS 0 AND TSTATE IS 0 ORDER BY TIMESTAMP",
+  [STMT_GET_METADATA_UNTRANSFERRED]
+  = "SELECT FILEPATH FROM " JOURNAL_TABLE " "
+    "WHERE RSTATE IS 0 AND TSTATE IS 0 AND MSTATE IS 0 ORDER BY TIMESTAMP",
+  [STMT_COMPACT_SUMMARY]
+  = "INSERT INTO " JOURNAL_SUMMARY_TABLE " "
+    "(CRASHID, PROCNAME, COUNT, FIRSTSEEN, LASTSEEN, TOTALSIZE) "
+    "SELECT CRASHID, PROCNAME, COUNT (*), MIN (TIMESTAMP), MAX (TIMESTAMP), SUM (FILESIZE) "
+    "FROM " JOURNAL_TABLE " WHERE RSTATE IS 1 GROUP BY CRASHID "
+    "ON CONFLICT (CRASHID) DO UPDATE SET COUNT = COUNT + excluded.COUNT, "
+    "FIRSTSEEN = MIN (FIRSTSEEN, excluded.FIRSTSEEN), "
+    "LASTSEEN = MAX (LASTSEEN, excluded.LASTSEEN), "
+    "TOTALSIZE = TOTALSIZE + excluded.TOTALSIZE",
+  [STMT_COMPACT_DELETE] = "DELETE FROM " JOURNAL_TABLE " WHERE RSTATE IS 1",
+  [STMT_ADD_STATS_NAME] = "INSERT OR IGNORE INTO " JOURNAL_STATS_NAMES_TABLE " "
+                          "(CRASHID, VECTORID, KIND, NAME) VALUES (?1, ?2, ?3, ?4)",
+  [STMT_ADD_STATS]
+  = "INSERT INTO " JOURNAL_STATS_TABLE " (" JOURNAL_STATS_COLUMNS ") "
+    "VALUES (?1, ?2, 1, ?3, ?3, 1, 1, ?4, ?5) "
+    "ON CONFLICT (CRASHID, VECTORID) DO UPDATE SET COUNT = COUNT + 1, "
+    "FIRSTSEEN = MIN (FIRSTSEEN, excluded.FIRSTSEEN), "
+    "LASTSEEN = MAX (LASTSEEN, excluded.LASTSEEN), "
+    "PROCESSES = " JOURNAL_STATS_NAMES_COUNT (JOURNAL_STATS_PROCESS) ", "
+    "CONTEXTS = " JOURNAL_STATS_NAMES_COUNT (JOURNAL_STATS_CONTEXT) ", "
+    "PROCNAME = excluded.PROCNAME, CONTEXTNAME = excluded.CONTEXTNAME",
+  [STMT_GET_STATS] = "SELECT " JOURNAL_STATS_COLUMNS " FROM " JOURNAL_STATS_TABLE " "
+                     "ORDER BY LASTSEEN DESC",
+  [STMT_GET_CRASH_STATS] = "SELECT " JOURNAL_STATS_COLUMNS " FROM " JOURNAL_STATS_TABLE " "
+                           "WHERE CRASHID IS ?1 ORDER BY LASTSEEN DESC",
+};
+
+/**
+ * @struct Journal accounted usage of an entry or a change of it
+ */
+typedef struct _JournalUsage
 {
-  JournalQueryType type;
-  gpointer response;
-} JournalQueryData;
+  gchar *context_name; /**< Entry context name */
+  gchar *proc_name;    /**< Entry process name */
+  gssize size;         /**< Accounted data size */
+  gssize count;        /**< Accounted entries count */
+} JournalUsage;
 
-const gchar *cdm_journal_table_name = "CrashTable";
+/**
+ * @struct Journal new crash entry values
+ */
+typedef struct _JournalCrash
+{
+  gchar *proc_name;       /**< Process name */
+  gchar *crash_id;        /**< Process crash id */
+  gchar *vector_id;       /**< Process vector id */
+  gchar *context_id;      /**< Process context id */
+  gchar *context_name;    /**< Process context name */
+  gchar *lifecycle_state; /**< System lifecycle state */
+  gchar *file_path;       /**< Archive file path */
+  gint64 file_size;       /**< Archive file size */
+  gint64 pid;             /**< Process id */
+  gint64 sig;             /**< Process crash signal */
+  guint64 tstamp;         /**< Process crash timestamp */
+  gint64 score;           /**< Retention score */
+} JournalCrash;
 
 /**
- * @brief SQlite3 callback
+ * @enum Journal writer operation type
  */
-static int sqlite_callback (void *data, int argc, char **argv, char **colname);
+typedef enum _JournalOpType
+{
+  JOURNAL_OP_EXEC,
+  JOURNAL_OP_COMPACT,
+  JOURNAL_OP_USAGE,
+  JOURNAL_OP_FLUSH,
+  JOURNAL_OP_TERMINATE
+} JournalOpType;
+
+/**
+ * @struct Journal writer operation
+ */
+typedef struct _JournalOp
+{
+  JournalOpType type;          /**< Operation type */
+  guint64 seq;                 /**< Operation sequence number */
+  JournalStmt stmt;            /**< Statement to execute */
+  GArray *ids;                 /**< Entry IDs the statement is executed for */
+  gint64 value;                /**< State value bound with each entry ID */
+  JournalCrash *crash;         /**< New crash values for STMT_ADD_CRASH */
+  CdmJournalCallback callback; /**< Completion callback */
+  gpointer user_data;          /**< Completion callback data */
+  GError *error;               /**< Operation error if any */
+  GPtrArray *deltas;           /**< Accounted usage changes (JournalUsage) */
+} JournalOp;
+
+/**
+ * @struct Journal writer completion source
+ */
+typedef struct _JournalCompletionSource
+{
+  GSource source;      /**< Event loop source */
+  GAsyncQueue *queue;  /**< Completed operations queue */
+  CdmJournal *journal; /**< Back reference to the journal (not owned) */
+} JournalCompletionSource;
+
+const gchar *cdm_journal_table_name = JOURNAL_TABLE;
 
 /**
  * @brief GSource callback function
@@ -69,34 +265,422 @@ static gboolean source_timer_callback (gpointer data);
  */
 static void source_destroy_notify (gpointer data);
 
+/**
+ * @brief Insert an epilog in the store expiring its lifetime after tstamp
+ */
+static CdmJournalEpilog *journal_epilog_insert (CdmJournal *journal, int64_t pid, gint64 tstamp,
+                                                const gchar *backtrace, gsize len);
+
+/**
+ * @brief Spool iteration callback reloading the epilogs still alive
+ */
+static void journal_epilog_reload (gpointer user_data, gint64 pid, gint64 tstamp,
+                                   const gchar *backtrace, gsize len);
+
+/**
+ * @brief Drop an epilog from the store and release it
+ */
+static void journal_epilog_drop (CdmJournal *journal, CdmJournalEpilog *elog);
+
+/**
+ * @brief Compaction GSource callback function
+ */
+static gboolean compactor_timer_callback (gpointer data);
+
+/**
+ * @brief Completion GSource prepare function
+ */
+static gboolean completion_source_prepare (GSource *source, gint *timeout);
+
+/**
+ * @brief Completion GSource dispatch function
+ */
+static gboolean completion_source_dispatch (GSource *source, GSourceFunc callback,
+                                            gpointer user_data);
+
+/**
+ * @brief Completion GSource finalize function
+ */
+static void completion_source_finalize (GSource *source);
+
+/**
+ * @brief Writer thread function
+ */
+static gpointer journal_writer_thread (gpointer data);
+
+/**
+ * @brief Execute a batch of operations in one transaction
+ */
+static void journal_writer_commit (CdmJournal *journal, GPtrArray *batch);
+
+/**
+ * @brief Execute one operation on the writer connection
+ */
+static gboolean journal_writer_exec (CdmJournal *journal, JournalOp *op);
+
+/**
+ * @brief Fold the removed entries into the crash id summary on the writer connection
+ */
+static gboolean journal_writer_compact (CdmJournal *journal, JournalOp *op);
+
+/**
+ * @brief Read the usage of each accounted entry on the writer connection
+ */
+static void journal_writer_usage (CdmJournal *journal, JournalOp *op);
+
+/**
+ * @brief Release the free pages of the writer connection database
+ */
+static void journal_writer_vacuum (CdmJournal *journal);
+
+/**
+ * @brief Queue a new operation to the writer thread
+ */
+static guint64 journal_enqueue (CdmJournal *journal, JournalOp *op);
+
+/**
+ * @brief Create a new writer operation for a statement
+ */
+static JournalOp *journal_op_new (JournalStmt stmt, CdmJournalCallback callback,
+                                  gpointer user_data);
+
+/**
+ * @brief Compile the statements cache for a database connection
+ */
+static gboolean journal_prepare (sqlite3 *database, sqlite3_stmt **stmts);
+
+/**
+ * @brief Release the statements cache for a database connection
+ */
+static void journal_finalize (sqlite3_stmt **stmts);
+
+/**
+ * @brief Reset a statement after use and report step errors
+ */
+static gboolean journal_stmt_reset (sqlite3_stmt *stmt, gint status);
+
+/**
+ * @brief Set the database connection options
+ */
+static void journal_configure (sqlite3 *database);
+
+/**
+ * @brief Get the accounted usage for a set of entries from the writer connection
+ */
+static GHashTable *journal_accounted_usage (CdmJournal *journal, GArray *ids);
+
+/**
+ * @brief Read one accounted usage row
+ */
+static JournalUsage *journal_usage_read (sqlite3_stmt *stmt);
+
+/**
+ * @brief Compute the usage changes between two accounted usage snapshots
+ */
+static GPtrArray *journal_usage_diff (GHashTable *before, GHashTable *after);
+
+/**
+ * @brief Release usage object
+ */
+static void journal_usage_free (gpointer data);
+
+/**
+ * @brief Release crash values object
+ */
+static void journal_crash_free (JournalCrash *crash);
+
+/**
+ * @brief Bring the database schema to the latest version
+ */
+static gboolean journal_migrate (CdmJournal *journal, GError **error);
+
+/**
+ * @brief Get the current database schema version or -1 on error
+ */
+static gint64 journal_schema_version (CdmJournal *journal);
+
+/**
+ * @brief Switch the database to incremental vacuum if not already set
+ */
+static void journal_vacuum_setup (CdmJournal *journal);
+
+/**
+ * @brief Compute the retention scores for entries added before schema version 2
+ */
+static gboolean journal_migration_score (CdmJournal *journal);
+
+/**
+ * @brief Mark the duplicates for entries added before schema version 2
+ */
+static gboolean journal_migration_duplicates (CdmJournal *journal);
+
+/**
+ * @brief Build the crash statistics for entries added before schema version 5
+ */
+static gboolean journal_migration_stats (CdmJournal *journal);
+
+/**
+ * @brief Read one crash statistics row
+ */
+static CdmJournalStats *journal_stats_read (sqlite3_stmt *stmt);
+
+/**
+ * @brief Release operation object
+ */
+static void journal_op_free (JournalOp *op);
+
+/**
+ * @struct Journal schema migration step
+ */
+typedef struct _JournalMigration
+{
+  const gchar *sql;                       /**< Schema change statements */
+  gboolean (*post) (CdmJournal *journal); /**< Optional data update after schema change */
+} JournalMigration;
+
+/**
+ * @brief Schema migrations, the entry index plus one is the resulting schema version
+ */
+static const JournalMigration journal_migrations[] = {
+  { "CREATE TABLE IF NOT EXISTS " JOURNAL_TABLE " "
+    "(ID INT PRIMARY KEY     NOT   NULL, "
+    "PROCNAME        TEXT    NOT   NULL, "
+    "CRASHID         TEXT    NOT   NULL, "
+    "VECTORID        TEXT    NOT   NULL, "
+    "CONTEXTID       TEXT    NOT   NULL, "
+    "CONTEXTNAME     TEXT    NOT   NULL, "
+    "LIFECYCLESTATE  TEXT    NOT   NULL, "
+    "FILEPATH        TEXT    NOT   NULL, "
+    "FILESIZE        INT     NOT   NULL, "
+    "PID             INT     NOT   NULL, "
+    "SIGNAL          INT     NOT   NULL, "
+    "TIMESTAMP       INT     NOT   NULL, "
+    "OSVERSION       TEXT    NOT   NULL, "
+    "TSTATE          BOOL    NOT   NULL, "
+    "RSTATE          BOOL    NOT   NULL);",
+    NULL },
+  { "ALTER TABLE " JOURNAL_TABLE " ADD COLUMN DUPLICATE BOOL NOT NULL DEFAULT 0;"
+    "ALTER TABLE " JOURNAL_TABLE " ADD COLUMN SCORE INT NOT NULL DEFAULT 0;",
+    journal_migration_score },
+  /* covering indexes for the victim, untransferred, usage and duplicate access paths */
+  { "DROP INDEX IF EXISTS " JOURNAL_TABLE "CrashId;"
+    "DROP INDEX IF EXISTS " JOURNAL_TABLE "Retention;"
+    "CREATE INDEX " JOURNAL_TABLE "Victims ON " JOURNAL_TABLE " "
+    "(RSTATE, TSTATE, DUPLICATE DESC, SCORE, FILESIZE, FILEPATH, CONTEXTNAME, PROCNAME);"
+    "CREATE INDEX " JOURNAL_TABLE "Context ON " JOURNAL_TABLE " "
+    "(CONTEXTNAME, RSTATE, TSTATE, DUPLICATE DESC, SCORE, FILESIZE, FILEPATH);"
+    "CREATE INDEX " JOURNAL_TABLE "Process ON " JOURNAL_TABLE " "
+    "(PROCNAME, RSTATE, TSTATE, DUPLICATE DESC, SCORE, FILESIZE, FILEPATH);"
+    "CREATE INDEX " JOURNAL_TABLE "Pending ON " JOURNAL_TABLE " "
+    "(RSTATE, TSTATE, TIMESTAMP, FILEPATH);"
+    "CREATE INDEX " JOURNAL_TABLE "CrashId ON " JOURNAL_TABLE " (CRASHID, TIMESTAMP, ID);",
+    journal_migration_duplicates },
+  /* removed entries are folded in the summary by the compaction */
+  { "CREATE TABLE IF NOT EXISTS " JOURNAL_SUMMARY_TABLE " "
+    "(CRASHID        TEXT    PRIMARY KEY NOT NULL, "
+    "PROCNAME        TEXT    NOT   NULL, "
+    "COUNT           INT     NOT   NULL, "
+    "FIRSTSEEN       INT     NOT   NULL, "
+    "LASTSEEN        INT     NOT   NULL, "
+    "TOTALSIZE       INT     NOT   NULL);",
+    NULL },
+  /* per crash id and vector id statistics updated with each new entry */
+  { "CREATE TABLE IF NOT EXISTS " JOURNAL_STATS_TABLE " "
+    "(CRASHID        TEXT    NOT   NULL, "
+    "VECTORID        TEXT    NOT   NULL, "
+    "COUNT           INT     NOT   NULL, "
+    "FIRSTSEEN       INT     NOT   NULL, "
+    "LASTSEEN        INT     NOT   NULL, "
+    "PROCESSES       INT     NOT   NULL, "
+    "CONTEXTS        INT     NOT   NULL, "
+    "PROCNAME        TEXT    NOT   NULL, "
+    "CONTEXTNAME     TEXT    NOT   NULL, "
+    "PRIMARY KEY (CRASHID, VECTORID));"
+    "CREATE TABLE IF NOT EXISTS " JOURNAL_STATS_NAMES_TABLE " "
+    "(CRASHID        TEXT    NOT   NULL, "
+    "VECTORID        TEXT    NOT   NULL, "
+    "KIND            INT     NOT   NULL, "
+    "NAME            TEXT    NOT   NULL, "
+    "PRIMARY KEY (CRASHID, VECTORID, KIND, NAME)) WITHOUT ROWID;"
+    "CREATE INDEX " JOURNAL_STATS_TABLE "LastSeen ON " JOURNAL_STATS_TABLE " (LASTSEEN);",
+    journal_migration_stats },
+  /* time ordered and vector id access paths for the crashinfo queries */
+  { "CREATE INDEX " JOURNAL_TABLE "Timestamp ON " JOURNAL_TABLE " (TIMESTAMP);"
+    "CREATE INDEX " JOURNAL_TABLE "VectorId ON " JOURNAL_TABLE " (VECTORID, TIMESTAMP);",
+    NULL },
+  /* acknowledged upload offset of an incomplete transfer */
+  { "ALTER TABLE " JOURNAL_TABLE " ADD COLUMN TOFFSET INT NOT NULL DEFAULT 0;", NULL },
+  /* failed upload attempts and the time of the next one */
+  { "ALTER TABLE " JOURNAL_TABLE " ADD COLUMN TATTEMPTS INT NOT NULL DEFAULT 0;"
+    "ALTER TABLE " JOURNAL_TABLE " ADD COLUMN TNEXT INT NOT NULL DEFAULT 0;",
+    NULL },
+  /* transfer state of the metadata bundle uploaded ahead of the archive */
+  { "ALTER TABLE " JOURNAL_TABLE " ADD COLUMN MSTATE BOOL NOT NULL DEFAULT 0;", NULL },
+  /* per name victims carry both names so overlapping quotas are accounted once */
+  { "DROP INDEX IF EXISTS " JOURNAL_TABLE "Context;"
+    "DROP INDEX IF EXISTS " JOURNAL_TABLE "Process;"
+    "CREATE INDEX " JOURNAL_TABLE "Context ON " JOURNAL_TABLE " "
+    "(CONTEXTNAME, RSTATE, TSTATE, DUPLICATE DESC, SCORE, FILESIZE, FILEPATH, PROCNAME);"
+    "CREATE INDEX " JOURNAL_TABLE "Process ON " JOURNAL_TABLE " "
+    "(PROCNAME, RSTATE, TSTATE, DUPLICATE DESC, SCORE, FILESIZE, FILEPATH, CONTEXTNAME);",
+    NULL },
+  /* abandoned transfers are released too, the retention order no longer starts at TSTATE */
+  { "DROP INDEX IF EXISTS " JOURNAL_TABLE "Victims;"
+    "DROP INDEX IF EXISTS " JOURNAL_TABLE "Context;"
+    "DROP INDEX IF EXISTS " JOURNAL_TABLE "Process;"
+    "CREATE INDEX " JOURNAL_TABLE "Victims ON " JOURNAL_TABLE " "
+    "(RSTATE, DUPLICATE DESC, SCORE, TSTATE, FILESIZE, FILEPATH, CONTEXTNAME, PROCNAME);"
+    "CREATE INDEX " JOURNAL_TABLE "Context ON " JOURNAL_TABLE " "
+    "(CONTEXTNAME, RSTATE, DUPLICATE DESC, SCORE, TSTATE, FILESIZE, FILEPATH, PROCNAME);"
+    "CREATE INDEX " JOURNAL_TABLE "Process ON " JOURNAL_TABLE " "
+    "(PROCNAME, RSTATE, DUPLICATE DESC, SCORE, TSTATE, FILESIZE, FILEPATH, CONTEXTNAME);",
+    NULL },
+};
+
+/**
+ * @brief GSourceFuncs vtable for writer completions
+ */
+static GSourceFuncs completion_source_funcs = {
+  completion_source_prepare, NULL, completion_source_dispatch, completion_source_finalize,
+  NULL,                      NULL,
+};
+
 static gboolean
 source_timer_callback (gpointer data)
 {
   CdmJournal *journal = (CdmJournal *)data;
   gint64 current_time = 0;
-  GList *l = NULL;
+  guint ticks = 0;
 
   g_assert (journal);
 
-  l = journal->elogs;
   current_time = g_get_monotonic_time ();
 
-  while (l != NULL)
+  /* advance one slot per elapsed second, a late dispatch catches up on all the missed slots */
+  while (current_time - journal->ewheel_time >= SEC2USEC (JOURNAL_EPILOG_TICK_SEC))
     {
-      GList *next = l->next;
+      GQueue *slot = NULL;
 
-      if (((CdmJournalEpilog *)l->data)->tstamp + SEC2USEC (10) > current_time)
+      journal->ewheel_pos = (journal->ewheel_pos + 1) % journal->ewheel_slots;
+      journal->ewheel_time += SEC2USEC (JOURNAL_EPILOG_TICK_SEC);
+      slot = &journal->ewheel[journal->ewheel_pos];
+
+      while (!g_queue_is_empty (slot))
         {
-          g_debug ("Journal remove epilog for pid %ld", ((CdmJournalEpilog *)l->data)->pid);
-          g_free (l->data);
-          journal->elogs = g_list_delete_link (journal->elogs, l);
+          CdmJournalEpilog *elog = (CdmJournalEpilog *)g_queue_peek_head (slot);
+
+          g_debug ("Journal remove epilog for pid %ld", elog->pid);
+          journal_epilog_drop (journal, elog);
         }
-      l = next;
+
+      if (++ticks == journal->ewheel_slots)
+        journal->ewheel_time = current_time;
     }
 
   return TRUE;
 }
 
+static CdmJournalEpilog *
+journal_epilog_insert (CdmJournal *journal, int64_t pid, gint64 tstamp, const gchar *backtrace,
+                       gsize len)
+{
+  CdmJournalEpilog *elog = NULL;
+  gint64 ticks;
+
+  elog = (CdmJournalEpilog *)g_malloc0 (sizeof (CdmJournalEpilog) + len + 1);
+  elog->tstamp = tstamp;
+  elog->pid = pid;
+  elog->size = sizeof (CdmJournalEpilog) + len + 1;
+  elog->lru_link.data = elog;
+  elog->wheel_link.data = elog;
+  memcpy (elog->backtrace, backtrace, len);
+
+  /* expire on the first tick after the lifetime is over, at least one tick from now */
+  ticks = (tstamp + SEC2USEC ((gint64)journal->elog_lifetime) - journal->ewheel_time)
+              / SEC2USEC (JOURNAL_EPILOG_TICK_SEC)
+          + 1;
+  ticks = CLAMP (ticks, 1, (gint64)journal->ewheel_slots - 1);
+  elog->slot = (journal->ewheel_pos + (guint)ticks) % journal->ewheel_slots;
+
+  g_hash_table_insert (journal->elogs, &elog->pid, elog);
+  g_queue_push_tail_link (&journal->elru, &elog->lru_link);
+  g_queue_push_tail_link (&journal->ewheel[elog->slot], &elog->wheel_link);
+  journal->elog_size += elog->size;
+
+  /* a crash storm cannot grow the store past the limit, the newest epilog is always kept */
+  while (journal->elog_size > journal->elog_max_size && journal->elru.length > 1)
+    {
+      CdmJournalEpilog *victim = (CdmJournalEpilog *)g_queue_peek_head (&journal->elru);
+
+      g_warning ("Journal epilog memory limit reached, drop epilog for pid %ld", victim->pid);
+      journal_epilog_drop (journal, victim);
+    }
+
+  return elog;
+}
+
+static void
+journal_epilog_reload (gpointer user_data, gint64 pid, gint64 tstamp, const gchar *backtrace,
+                       gsize len)
+{
+  CdmJournal *journal = (CdmJournal *)user_data;
+  CdmJournalEpilog *elog = NULL;
+
+  if (tstamp + SEC2USEC ((gint64)journal->espool_lifetime) <= g_get_monotonic_time ())
+    return;
+
+  g_info ("Journal reload epilog for pid %ld from spool", pid);
+
+  /* only the memory copy is replaced, the spool slot being reloaded must stay valid */
+  elog = (CdmJournalEpilog *)g_hash_table_lookup (journal->elogs, &pid);
+  if (elog != NULL)
+    journal_epilog_drop (journal, elog);
+
+  journal_epilog_insert (journal, pid, tstamp, backtrace, len);
+}
+
+static void
+journal_epilog_drop (CdmJournal *journal, CdmJournalEpilog *elog)
+{
+  g_hash_table_remove (journal->elogs, &elog->pid);
+  g_queue_unlink (&journal->elru, &elog->lru_link);
+  g_queue_unlink (&journal->ewheel[elog->slot], &elog->wheel_link);
+
+  journal->elog_size -= elog->size;
+  g_free (elog);
+}
+
+static gboolean
+compactor_timer_callback (gpointer data)
+{
+  CdmJournal *journal = (CdmJournal *)data;
+  gint64 current_time = g_get_monotonic_time ();
+  gboolean idle;
+  JournalOp *op = NULL;
+
+  g_assert (journal);
+
+  if (current_time - journal->compact_last < journal->compact_interval)
+    return G_SOURCE_CONTINUE;
+
+  g_mutex_lock (&journal->wlock);
+  idle = (journal->cseq == journal->wseq
+          && current_time - journal->wlast >= SEC2USEC (JOURNAL_COMPACT_IDLE_SEC));
+  g_mutex_unlock (&journal->wlock);
+
+  /* retry on the next check if the journal was updated recently */
+  if (!idle)
+    return G_SOURCE_CONTINUE;
+
+  journal->compact_last = current_time;
+
+  op = g_new0 (JournalOp, 1);
+  op->type = JOURNAL_OP_COMPACT;
+  journal_enqueue (journal, op);
+
+  return G_SOURCE_CONTINUE;
+}
+
 static void
 source_destroy_notify (gpointer data)
 {
@@ -104,68 +688,715 @@ source_destroy_notify (gpointer data)
   g_info ("Journal epilog cleanup event disabled");
 }
 
-static int
-sqlite_callback (void *data, int argc, char **argv, char **colname)
+static gboolean
+completion_source_prepare (GSource *source, gint *timeout)
+{
+  JournalCompletionSource *csource = (JournalCompletionSource *)source;
+
+  *timeout = -1;
+
+  return (g_async_queue_length (csource->queue) > 0);
+}
+
+static gboolean
+completion_source_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
+{
+  JournalCompletionSource *csource = (JournalCompletionSource *)source;
+  CdmJournal *journal = csource->journal;
+  JournalOp *op = NULL;
+
+  CDM_UNUSED (callback);
+  CDM_UNUSED (user_data);
+
+  while ((op = (JournalOp *)g_async_queue_try_pop (csource->queue)) != NULL)
+    {
+      /* a usage snapshot is announced first so the receiver can drop its totals */
+      if (op->type == JOURNAL_OP_USAGE && op->callback != NULL)
+        op->callback (op->user_data, op->error);
+
+      for (guint i = 0; op->deltas != NULL && i < op->deltas->len; i++)
+        {
+          JournalUsage *delta = (JournalUsage *)g_ptr_array_index (op->deltas, i);
+
+          if (journal->usage_callback != NULL)
+            journal->usage_callback (journal->usage_data, delta->context_name, delta->proc_name,
+                                     delta->size, delta->count);
+        }
+
+      if (op->type != JOURNAL_OP_USAGE && op->callback != NULL)
+        op->callback (op->user_data, op->error);
+
+      journal_op_free (op);
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+completion_source_finalize (GSource *source)
+{
+  JournalCompletionSource *csource = (JournalCompletionSource *)source;
+
+  g_async_queue_unref (csource->queue);
+}
+
+static void
+journal_crash_free (JournalCrash *crash)
+{
+  g_free (crash->proc_name);
+  g_free (crash->crash_id);
+  g_free (crash->vector_id);
+  g_free (crash->context_id);
+  g_free (crash->context_name);
+  g_free (crash->lifecycle_state);
+  g_free (crash->file_path);
+  g_free (crash);
+}
+
+static void
+journal_op_free (JournalOp *op)
+{
+  if (op->ids != NULL)
+    g_array_unref (op->ids);
+
+  if (op->crash != NULL)
+    journal_crash_free (op->crash);
+
+  if (op->deltas != NULL)
+    g_ptr_array_unref (op->deltas);
+
+  if (op->error != NULL)
+    g_error_free (op->error);
+
+  g_free (op);
+}
+
+static JournalOp *
+journal_op_new (JournalStmt stmt, CdmJournalCallback callback, gpointer user_data)
+{
+  JournalOp *op = g_new0 (JournalOp, 1);
+
+  op->type = JOURNAL_OP_EXEC;
+  op->stmt = stmt;
+  op->ids = g_array_new (FALSE, FALSE, sizeof (guint64));
+  op->callback = callback;
+  op->user_data = user_data;
+
+  return op;
+}
+
+static guint64
+journal_enqueue (CdmJournal *journal, JournalOp *op)
+{
+  guint64 seq;
+
+  /* sequence and queue order must match so the commit sequence is monotonic */
+  g_mutex_lock (&journal->wlock);
+  seq = op->seq = ++journal->wseq;
+  journal->wlast = g_get_monotonic_time ();
+  g_async_queue_push (journal->wqueue, op);
+  g_mutex_unlock (&journal->wlock);
+
+  return seq;
+}
+
+static gboolean
+journal_prepare (sqlite3 *database, sqlite3_stmt **stmts)
+{
+  for (gint i = 0; i < STMT_COUNT; i++)
+    {
+      if (sqlite3_prepare_v2 (database, journal_stmt_sql[i], -1, &stmts[i], NULL) != SQLITE_OK)
+        {
+          g_warning ("Fail to prepare journal statement. SQL error %s", sqlite3_errmsg (database));
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+journal_finalize (sqlite3_stmt **stmts)
+{
+  for (gint i = 0; i < STMT_COUNT; i++)
+    sqlite3_finalize (stmts[i]);
+
+  g_free (stmts);
+}
+
+static gboolean
+journal_stmt_reset (sqlite3_stmt *stmt, gint status)
+{
+  gboolean ok = (status == SQLITE_ROW || status == SQLITE_DONE);
+
+  if (!ok)
+    g_warning ("Journal statement failed. SQL error %s", sqlite3_errmsg (sqlite3_db_handle (stmt)));
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+
+  return ok;
+}
+
+static void
+journal_configure (sqlite3 *database)
+{
+  gchar *query_error = NULL;
+
+  sqlite3_busy_timeout (database, JOURNAL_BUSY_TIMEOUT_MSEC);
+
+  /* readers like crashinfo do not block the writer and commits skip the per transaction fsync */
+  if (sqlite3_exec (database, "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;", NULL,
+                    NULL, &query_error)
+      != SQLITE_OK)
+    {
+      g_warning ("Fail to configure journal database. SQL error %s", query_error);
+      sqlite3_free (query_error);
+    }
+}
+
+static void
+journal_usage_free (gpointer data)
+{
+  JournalUsage *usage = (JournalUsage *)data;
+
+  g_free (usage->context_name);
+  g_free (usage->proc_name);
+  g_free (usage);
+}
+
+static JournalUsage *
+journal_usage_read (sqlite3_stmt *stmt)
+{
+  JournalUsage *usage = g_new0 (JournalUsage, 1);
+
+  usage->size = (gssize)sqlite3_column_int64 (stmt, 0);
+  usage->context_name = g_strdup ((const gchar *)sqlite3_column_text (stmt, 1));
+  usage->proc_name = g_strdup ((const gchar *)sqlite3_column_text (stmt, 2));
+  usage->count = 1;
+
+  return usage;
+}
+
+static GHashTable *
+journal_accounted_usage (CdmJournal *journal, GArray *ids)
+{
+  sqlite3_stmt *stmt = journal->wstmts[STMT_GET_ENTRY_USAGE];
+  GHashTable *usage = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free,
+                                             journal_usage_free);
+
+  for (guint i = 0; i < ids->len; i++)
+    {
+      gint64 *id = g_new (gint64, 1);
+      gint status;
+
+      *id = (gint64)g_array_index (ids, guint64, i);
+      sqlite3_bind_int64 (stmt, 1, *id);
+
+      status = sqlite3_step (stmt);
+      if (status == SQLITE_ROW)
+        g_hash_table_replace (usage, id, journal_usage_read (stmt));
+      else
+        g_free (id);
+
+      journal_stmt_reset (stmt, status);
+    }
+
+  return usage;
+}
+
+static GPtrArray *
+journal_usage_diff (GHashTable *before, GHashTable *after)
+{
+  GPtrArray *deltas = g_ptr_array_new_with_free_func (journal_usage_free);
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, after);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      JournalUsage *now = (JournalUsage *)value;
+      JournalUsage *old = (JournalUsage *)g_hash_table_lookup (before, key);
+      JournalUsage *delta = NULL;
+
+      if (old != NULL && old->size == now->size)
+        continue;
+
+      delta = g_new0 (JournalUsage, 1);
+      delta->context_name = g_strdup (now->context_name);
+      delta->proc_name = g_strdup (now->proc_name);
+      delta->size = now->size - (old != NULL ? old->size : 0);
+      delta->count = old != NULL ? 0 : 1;
+
+      g_ptr_array_add (deltas, delta);
+    }
+
+  g_hash_table_iter_init (&iter, before);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      JournalUsage *old = (JournalUsage *)value;
+      JournalUsage *delta = NULL;
+
+      if (g_hash_table_contains (after, key))
+        continue;
+
+      delta = g_new0 (JournalUsage, 1);
+      delta->context_name = g_strdup (old->context_name);
+      delta->proc_name = g_strdup (old->proc_name);
+      delta->size = -old->size;
+      delta->count = -1;
+
+      g_ptr_array_add (deltas, delta);
+    }
+
+  return deltas;
+}
+
+static void
+journal_vacuum_setup (CdmJournal *journal)
+{
+  sqlite3_stmt *stmt = NULL;
+  gchar *query_error = NULL;
+  gint64 mode = -1;
+
+  if (sqlite3_prepare_v2 (journal->database, "PRAGMA auto_vacuum", -1, &stmt, NULL) == SQLITE_OK)
+    {
+      if (sqlite3_step (stmt) == SQLITE_ROW)
+        mode = sqlite3_column_int64 (stmt, 0);
+      sqlite3_finalize (stmt);
+    }
+
+  /* 2 is incremental, changing the mode of an existing database needs one full vacuum */
+  if (mode == 2)
+    return;
+
+  g_info ("Switch journal database to incremental vacuum");
+
+  if (sqlite3_exec (journal->database, "PRAGMA auto_vacuum = INCREMENTAL; VACUUM;", NULL, NULL,
+                    &query_error)
+      != SQLITE_OK)
+    {
+      g_warning ("Fail to set journal vacuum mode. SQL error %s", query_error);
+      sqlite3_free (query_error);
+    }
+}
+
+static gboolean
+journal_migration_score (CdmJournal *journal)
+{
+  g_autofree gchar *sql = NULL;
+
+  sql = g_strdup_printf ("UPDATE %s SET SCORE = TIMESTAMP - FILESIZE * %ld / 1048576;",
+                         cdm_journal_table_name, journal->size_weight);
+
+  return (sqlite3_exec (journal->database, sql, NULL, NULL, NULL) == SQLITE_OK);
+}
+
+static gboolean
+journal_migration_duplicates (CdmJournal *journal)
+{
+  sqlite3_stmt *stmt = NULL;
+  gboolean ok;
+
+  /* mark the duplicates of all crash ids once the crash id index exists */
+  if (sqlite3_prepare_v2 (journal->database, JOURNAL_DUPLICATES_SQL (""), -1, &stmt, NULL)
+      != SQLITE_OK)
+    return FALSE;
+
+  sqlite3_bind_int64 (stmt, 2, journal->keep_latest);
+  ok = (sqlite3_step (stmt) == SQLITE_DONE);
+  sqlite3_finalize (stmt);
+
+  return ok;
+}
+
+static gboolean
+journal_migration_stats (CdmJournal *journal)
+{
+  /* removed entries already folded by a compaction are not part of the statistics */
+  return (sqlite3_exec (
+              journal->database,
+              "INSERT OR IGNORE INTO " JOURNAL_STATS_NAMES_TABLE " "
+              "SELECT CRASHID, VECTORID, " G_STRINGIFY (JOURNAL_STATS_PROCESS) ", PROCNAME "
+              "FROM " JOURNAL_TABLE ";"
+              "INSERT OR IGNORE INTO " JOURNAL_STATS_NAMES_TABLE " "
+              "SELECT CRASHID, VECTORID, " G_STRINGIFY (JOURNAL_STATS_CONTEXT) ", CONTEXTNAME "
+              "FROM " JOURNAL_TABLE ";"
+              "INSERT INTO " JOURNAL_STATS_TABLE " (" JOURNAL_STATS_COLUMNS ") "
+              "SELECT C.CRASHID, C.VECTORID, COUNT (*), MIN (C.TIMESTAMP), MAX (C.TIMESTAMP), "
+              "(SELECT COUNT (*) FROM " JOURNAL_STATS_NAMES_TABLE " WHERE CRASHID IS C.CRASHID "
+              "AND VECTORID IS C.VECTORID AND KIND IS " G_STRINGIFY (JOURNAL_STATS_PROCESS) "), "
+              "(SELECT COUNT (*) FROM " JOURNAL_STATS_NAMES_TABLE " WHERE CRASHID IS C.CRASHID "
+              "AND VECTORID IS C.VECTORID AND KIND IS " G_STRINGIFY (JOURNAL_STATS_CONTEXT) "), "
+              "(SELECT PROCNAME FROM " JOURNAL_TABLE " WHERE CRASHID IS C.CRASHID "
+              "AND VECTORID IS C.VECTORID ORDER BY TIMESTAMP DESC LIMIT 1), "
+              "(SELECT CONTEXTNAME FROM " JOURNAL_TABLE " WHERE CRASHID IS C.CRASHID "
+              "AND VECTORID IS C.VECTORID ORDER BY TIMESTAMP DESC LIMIT 1) "
+              "FROM " JOURNAL_TABLE " AS C GROUP BY C.CRASHID, C.VECTORID;",
+              NULL, NULL, NULL)
+          == SQLITE_OK);
+}
+
+static CdmJournalStats *
+journal_stats_read (sqlite3_stmt *stmt)
+{
+  CdmJournalStats *stats = g_new0 (CdmJournalStats, 1);
+
+  stats->crash_id = g_strdup ((const gchar *)sqlite3_column_text (stmt, 0));
+  stats->vector_id = g_strdup ((const gchar *)sqlite3_column_text (stmt, 1));
+  stats->count = sqlite3_column_int64 (stmt, 2);
+  stats->first_seen = sqlite3_column_int64 (stmt, 3);
+  stats->last_seen = sqlite3_column_int64 (stmt, 4);
+  stats->processes = sqlite3_column_int64 (stmt, 5);
+  stats->contexts = sqlite3_column_int64 (stmt, 6);
+  stats->proc_name = g_strdup ((const gchar *)sqlite3_column_text (stmt, 7));
+  stats->context_name = g_strdup ((const gchar *)sqlite3_column_text (stmt, 8));
+
+  return stats;
+}
+
+static gint64
+journal_schema_version (CdmJournal *journal)
+{
+  sqlite3_stmt *stmt = NULL;
+  gint64 version = -1;
+
+  if (sqlite3_exec (journal->database,
+                    "CREATE TABLE IF NOT EXISTS " JOURNAL_SCHEMA_TABLE " "
+                    "(VERSION INT NOT NULL, TIMESTAMP INT NOT NULL);",
+                    NULL, NULL, NULL)
+      != SQLITE_OK)
+    return -1;
+
+  if (sqlite3_prepare_v2 (journal->database,
+                          "SELECT IFNULL (MAX (VERSION), 0) FROM " JOURNAL_SCHEMA_TABLE, -1,
+                          &stmt, NULL)
+      == SQLITE_OK)
+    {
+      if (sqlite3_step (stmt) == SQLITE_ROW)
+        version = sqlite3_column_int64 (stmt, 0);
+      sqlite3_finalize (stmt);
+    }
+
+  return version;
+}
+
+static gboolean
+journal_migrate (CdmJournal *journal, GError **error)
+{
+  gint64 version = journal_schema_version (journal);
+
+  if (version < 0)
+    {
+      g_warning ("Fail to read journal schema version. SQL error %s",
+                 sqlite3_errmsg (journal->database));
+      g_set_error (error, g_quark_from_static_string ("JournalMigrate"), 1,
+                   "Schema version read fail");
+      return FALSE;
+    }
+
+  for (gsize i = (gsize)version; i < G_N_ELEMENTS (journal_migrations); i++)
+    {
+      const JournalMigration *migration = &journal_migrations[i];
+      g_autofree gchar *sql = NULL;
+      gchar *query_error = NULL;
+      gboolean ok;
+
+      g_info ("Migrate journal schema to version %zu", i + 1);
+
+      sql = g_strdup_printf ("BEGIN IMMEDIATE; %s "
+                             "INSERT INTO " JOURNAL_SCHEMA_TABLE " (VERSION, TIMESTAMP) "
+                             "VALUES (%zu, strftime ('%%s', 'now'));",
+                             migration->sql, i + 1);
+
+      ok = (sqlite3_exec (journal->database, sql, NULL, NULL, &query_error) == SQLITE_OK);
+      if (ok && migration->post != NULL)
+        ok = migration->post (journal);
+
+      if (!ok || sqlite3_exec (journal->database, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
+        {
+          g_warning ("Fail to migrate journal schema to version %zu. SQL error %s", i + 1,
+                     query_error != NULL ? query_error : sqlite3_errmsg (journal->database));
+          sqlite3_free (query_error);
+          sqlite3_exec (journal->database, "ROLLBACK;", NULL, NULL, NULL);
+          g_set_error (error, g_quark_from_static_string ("JournalMigrate"), 1,
+                       "Schema migration fail");
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+journal_writer_exec (CdmJournal *journal, JournalOp *op)
+{
+  sqlite3_stmt *stmt = journal->wstmts[op->stmt];
+  gboolean ok = TRUE;
+
+  if (op->stmt == STMT_ADD_CRASH)
+    {
+      JournalCrash *crash = op->crash;
+
+      sqlite3_bind_int64 (stmt, 1, (sqlite3_int64)g_array_index (op->ids, guint64, 0));
+      sqlite3_bind_text (stmt, 2, crash->proc_name, -1, SQLITE_STATIC);
+      sqlite3_bind_text (stmt, 3, crash->crash_id, -1, SQLITE_STATIC);
+      sqlite3_bind_text (stmt, 4, crash->vector_id, -1, SQLITE_STATIC);
+      sqlite3_bind_text (stmt, 5, crash->context_id, -1, SQLITE_STATIC);
+      sqlite3_bind_text (stmt, 6, crash->context_name, -1, SQLITE_STATIC);
+      sqlite3_bind_text (stmt, 7, crash->lifecycle_state, -1, SQLITE_STATIC);
+      sqlite3_bind_text (stmt, 8, crash->file_path, -1, SQLITE_STATIC);
+      sqlite3_bind_int64 (stmt, 9, crash->file_size);
+      sqlite3_bind_int64 (stmt, 10, crash->pid);
+      sqlite3_bind_int64 (stmt, 11, crash->sig);
+      sqlite3_bind_int64 (stmt, 12, (sqlite3_int64)crash->tstamp);
+      sqlite3_bind_text (stmt, 13, cdm_utils_get_osversion (), -1, SQLITE_TRANSIENT);
+      sqlite3_bind_int64 (stmt, 14, crash->score);
+      ok = journal_stmt_reset (stmt, sqlite3_step (stmt));
+
+      if (ok)
+        {
+          stmt = journal->wstmts[STMT_MARK_DUPLICATES];
+          sqlite3_bind_text (stmt, 1, crash->crash_id, -1, SQLITE_STATIC);
+          sqlite3_bind_int64 (stmt, 2, journal->keep_latest);
+          ok = journal_stmt_reset (stmt, sqlite3_step (stmt));
+        }
+
+      /* the crash statistics are updated in the same transaction as the entry */
+      for (gint kind = JOURNAL_STATS_PROCESS; kind <= JOURNAL_STATS_CONTEXT && ok; kind++)
+        {
+          stmt = journal->wstmts[STMT_ADD_STATS_NAME];
+          sqlite3_bind_text (stmt, 1, crash->crash_id, -1, SQLITE_STATIC);
+          sqlite3_bind_text (stmt, 2, crash->vector_id, -1, SQLITE_STATIC);
+          sqlite3_bind_int (stmt, 3, kind);
+          sqlite3_bind_text (stmt, 4,
+                             kind == JOURNAL_STATS_PROCESS ? crash->proc_name : crash->context_name,
+                             -1, SQLITE_STATIC);
+          ok = journal_stmt_reset (stmt, sqlite3_step (stmt));
+        }
+
+      if (ok)
+        {
+          stmt = journal->wstmts[STMT_ADD_STATS];
+          sqlite3_bind_text (stmt, 1, crash->crash_id, -1, SQLITE_STATIC);
+          sqlite3_bind_text (stmt, 2, crash->vector_id, -1, SQLITE_STATIC);
+          sqlite3_bind_int64 (stmt, 3, (sqlite3_int64)crash->tstamp);
+          sqlite3_bind_text (stmt, 4, crash->proc_name, -1, SQLITE_STATIC);
+          sqlite3_bind_text (stmt, 5, crash->context_name, -1, SQLITE_STATIC);
+          ok = journal_stmt_reset (stmt, sqlite3_step (stmt));
+        }
+    }
+  else
+    {
+      for (guint i = 0; i < op->ids->len && ok; i++)
+        {
+          sqlite3_bind_int64 (stmt, 1, (sqlite3_int64)g_array_index (op->ids, guint64, i));
+          sqlite3_bind_int64 (stmt, 2, op->value);
+          ok = journal_stmt_reset (stmt, sqlite3_step (stmt));
+        }
+    }
+
+  if (!ok)
+    g_set_error (&op->error, g_quark_from_static_string ("JournalWriter"), 1, "SQL query error");
+
+  return ok;
+}
+
+static gboolean
+journal_writer_compact (CdmJournal *journal, JournalOp *op)
+{
+  sqlite3_stmt *stmt = journal->wstmts[STMT_COMPACT_SUMMARY];
+  gboolean ok;
+
+  /* the summary and the delete run in the same transaction so no entry is lost or counted twice */
+  ok = journal_stmt_reset (stmt, sqlite3_step (stmt));
+
+  if (ok)
+    {
+      stmt = journal->wstmts[STMT_COMPACT_DELETE];
+      ok = journal_stmt_reset (stmt, sqlite3_step (stmt));
+    }
+
+  if (ok)
+    g_info ("Journal compaction folded %d removed entries", sqlite3_changes (journal->wdatabase));
+  else
+    g_set_error (&op->error, g_quark_from_static_string ("JournalCompact"), 1, "SQL query error");
+
+  return ok;
+}
+
+static void
+journal_writer_usage (CdmJournal *journal, JournalOp *op)
+{
+  sqlite3_stmt *stmt = journal->wstmts[STMT_GET_USAGE];
+  gint status;
+
+  op->deltas = g_ptr_array_new_with_free_func (journal_usage_free);
+
+  while ((status = sqlite3_step (stmt)) == SQLITE_ROW)
+    g_ptr_array_add (op->deltas, journal_usage_read (stmt));
+
+  if (!journal_stmt_reset (stmt, status))
+    {
+      g_set_error (&op->error, g_quark_from_static_string ("JournalResyncUsage"), 1,
+                   "SQL query error");
+      g_ptr_array_set_size (op->deltas, 0);
+    }
+}
+
+static void
+journal_writer_vacuum (CdmJournal *journal)
+{
+  g_autofree gchar *sql = NULL;
+  gchar *query_error = NULL;
+
+  /* release a bounded number of pages so a compaction never blocks the writer for long */
+  sql = g_strdup_printf ("PRAGMA incremental_vacuum (%d);", JOURNAL_VACUUM_PAGES);
+
+  if (sqlite3_exec (journal->wdatabase, sql, NULL, NULL, &query_error) != SQLITE_OK)
+    {
+      g_warning ("Fail to vacuum journal database. SQL error %s", query_error);
+      sqlite3_free (query_error);
+    }
+}
+
+static void
+journal_writer_commit (CdmJournal *journal, GPtrArray *batch)
 {
-  JournalQueryData *querydata = (JournalQueryData *)data;
+  JournalCompletionSource *csource = (JournalCompletionSource *)journal->csource;
+  gchar *query_error = NULL;
+  gboolean in_transaction;
+  gboolean vacuum = FALSE;
+  guint64 last_seq = 0;
 
-  switch (querydata->type)
+  in_transaction = (sqlite3_exec (journal->wdatabase, "BEGIN IMMEDIATE;", NULL, NULL, &query_error)
+                    == SQLITE_OK);
+  if (!in_transaction)
     {
-    case QUERY_CREATE:
-      break;
+      g_warning ("Fail to start journal transaction. SQL error %s", query_error);
+      sqlite3_free (query_error);
+      query_error = NULL;
+    }
 
-    case QUERY_ADD_ENTRY:
-      break;
+  for (guint i = 0; i < batch->len; i++)
+    {
+      JournalOp *op = (JournalOp *)g_ptr_array_index (batch, i);
+      g_autoptr (GHashTable) before = NULL;
 
-    case QUERY_GET_ENTRY:
-      *((gboolean *)(querydata->response)) = TRUE;
-      break;
+      /* removed entries are not accounted so the compaction has no usage change */
+      if (op->type == JOURNAL_OP_COMPACT)
+        vacuum = journal_writer_compact (journal, op);
 
-    case QUERY_SET_TRANSFER:
-      break;
+      /* the snapshot sees exactly the updates queued before it */
+      if (op->type == JOURNAL_OP_USAGE)
+        journal_writer_usage (journal, op);
 
-    case QUERY_SET_REMOVED:
-      break;
+      if (op->type != JOURNAL_OP_EXEC)
+        continue;
 
-    case QUERY_GET_VICTIM:
-    /* falltrough */
-    case QUERY_GET_UNTRANSFERRED:
-      for (gint i = 0; i < argc; i++)
+      /* usage accounting tracks the same entries as get_data_size and get_entry_count */
+      before = journal_accounted_usage (journal, op->ids);
+
+      if (journal_writer_exec (journal, op))
         {
-          if (g_strcmp0 (colname[i], "FILEPATH") == 0)
-            querydata->response = (gpointer)g_strdup (argv[i]);
+          g_autoptr (GHashTable) after = journal_accounted_usage (journal, op->ids);
+
+          op->deltas = journal_usage_diff (before, after);
         }
-      break;
+    }
 
-    case QUERY_GET_DATASIZE:
-      for (gint i = 0; i < argc; i++)
+  if (in_transaction
+      && sqlite3_exec (journal->wdatabase, "COMMIT;", NULL, NULL, &query_error) != SQLITE_OK)
+    {
+      g_warning ("Fail to commit journal transaction. SQL error %s", query_error);
+      sqlite3_free (query_error);
+      sqlite3_exec (journal->wdatabase, "ROLLBACK;", NULL, NULL, NULL);
+
+      for (guint i = 0; i < batch->len; i++)
         {
-          if (g_strcmp0 (colname[i], "FILESIZE") == 0)
-            *((gssize *)(querydata->response)) += g_ascii_strtoll (argv[i], NULL, 10);
+          JournalOp *op = (JournalOp *)g_ptr_array_index (batch, i);
+
+          vacuum = FALSE;
+
+          if (op->type != JOURNAL_OP_FLUSH && op->type != JOURNAL_OP_TERMINATE
+              && op->error == NULL)
+            g_set_error (&op->error, g_quark_from_static_string ("JournalWriter"), 1,
+                         "SQL commit error");
+
+          if (op->deltas != NULL)
+            g_ptr_array_set_size (op->deltas, 0);
         }
-      break;
+    }
+
+  if (vacuum)
+    journal_writer_vacuum (journal);
+
+  for (guint i = 0; i < batch->len; i++)
+    {
+      JournalOp *op = (JournalOp *)g_ptr_array_index (batch, i);
+
+      last_seq = op->seq;
+
+      if (op->callback != NULL || (op->deltas != NULL && op->deltas->len > 0))
+        g_async_queue_push (csource->queue, op);
+      else
+        journal_op_free (op);
+    }
+
+  g_main_context_wakeup (g_source_get_context (journal->csource));
+
+  g_mutex_lock (&journal->wlock);
+  journal->cseq = last_seq;
+  g_cond_broadcast (&journal->wcond);
+  g_mutex_unlock (&journal->wlock);
+}
+
+static gpointer
+journal_writer_thread (gpointer data)
+{
+  CdmJournal *journal = (CdmJournal *)data;
+  gboolean running = TRUE;
 
-    case QUERY_GET_ENTRY_COUNT:
-      *((gssize *)(querydata->response)) += 1;
-      break;
+  while (running)
+    {
+      g_autoptr (GPtrArray) batch = g_ptr_array_new ();
+      JournalOp *op = (JournalOp *)g_async_queue_pop (journal->wqueue);
+      const gint64 deadline = g_get_monotonic_time () + journal->batch_latency;
+
+      /* group operations until the batch is full, the window expires or a sync is requested */
+      while (op != NULL)
+        {
+          gint64 now;
+
+          g_ptr_array_add (batch, op);
 
-    default:
-      break;
+          if (op->type == JOURNAL_OP_TERMINATE)
+            running = FALSE;
+
+          if (op->type != JOURNAL_OP_EXEC || batch->len >= journal->batch_size)
+            break;
+
+          now = g_get_monotonic_time ();
+          if (now >= deadline)
+            break;
+
+          op = (JournalOp *)g_async_queue_timeout_pop (journal->wqueue, (guint64)(deadline - now));
+        }
+
+      journal_writer_commit (journal, batch);
     }
 
-  return (0);
+  return NULL;
 }
 
 CdmJournal *
 cdm_journal_new (CdmOptions *options, GError **error)
 {
   CdmJournal *journal = NULL;
-  g_autofree gchar *sql = NULL;
   g_autofree gchar *opt_dbpath = NULL;
   g_autofree gchar *opt_user = NULL;
   g_autofree gchar *opt_group = NULL;
-  gchar *query_error = NULL;
-  JournalQueryData data = { .type = QUERY_CREATE, .response = NULL };
 
   journal = g_new0 (CdmJournal, 1);
 
@@ -177,6 +1408,12 @@ cdm_journal_new (CdmOptions *options, GError **error)
   opt_user = cdm_options_string_for (options, KEY_USER_NAME);
   opt_group = cdm_options_string_for (options, KEY_GROUP_NAME);
 
+  journal->keep_latest = cdm_options_long_for (options, KEY_RETENTION_KEEP_LATEST);
+  journal->size_weight = cdm_options_long_for (options, KEY_RETENTION_SIZE_WEIGHT);
+
+  journal->stmts = g_new0 (sqlite3_stmt *, STMT_COUNT);
+  journal->wstmts = g_new0 (sqlite3_stmt *, STMT_COUNT);
+
   if (sqlite3_open (opt_dbpath, &journal->database))
     {
       g_warning ("Cannot open journal database at path %s", opt_dbpath);
@@ -184,42 +1421,100 @@ cdm_journal_new (CdmOptions *options, GError **error)
     }
   else
     {
-      sql = g_strdup_printf ("CREATE TABLE IF NOT EXISTS %s       "
-                             "(ID INT PRIMARY KEY     NOT   NULL, "
-                             "PROCNAME        TEXT    NOT   NULL, "
-                             "CRASHID         TEXT    NOT   NULL, "
-                             "VECTORID        TEXT    NOT   NULL, "
-                             "CONTEXTID       TEXT    NOT   NULL, "
-                             "CONTEXTNAME     TEXT    NOT   NULL, "
-                             "LIFECYCLESTATE  TEXT    NOT   NULL, "
-                             "FILEPATH        TEXT    NOT   NULL, "
-                             "FILESIZE        INT     NOT   NULL, "
-                             "PID             INT     NOT   NULL, "
-                             "SIGNAL          INT     NOT   NULL, "
-                             "TIMESTAMP       INT     NOT   NULL, "
-                             "OSVERSION       TEXT    NOT   NULL, "
-                             "TSTATE          BOOL    NOT   NULL, "
-                             "RSTATE          BOOL    NOT   NULL);",
-                             cdm_journal_table_name);
-
-      if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
-        {
-          g_warning ("Fail to create crash table. SQL error %s", query_error);
-          g_set_error (error, g_quark_from_static_string ("JournalNew"), 1,
-                       "Create crash table fail");
-        }
+      journal_configure (journal->database);
 
       if (cdm_utils_chown (opt_dbpath, opt_user, opt_group) == CDM_STATUS_ERROR)
         g_warning ("Failed to set user and group owner for database %s", opt_dbpath);
+
+      if (journal_migrate (journal, error))
+        {
+          journal_vacuum_setup (journal);
+
+          if (!journal_prepare (journal->database, journal->stmts))
+            g_set_error (error, g_quark_from_static_string ("JournalNew"), 1,
+                         "Prepare statements fail");
+        }
+    }
+
+  /* the writer thread owns a dedicated connection, queries stay on the main connection */
+  if (sqlite3_open (opt_dbpath, &journal->wdatabase))
+    {
+      g_warning ("Cannot open journal writer database at path %s", opt_dbpath);
+      g_set_error (error, g_quark_from_static_string ("JournalNew"), 1, "Database open failed");
+    }
+  else
+    {
+      journal_configure (journal->wdatabase);
+
+      if (!journal_prepare (journal->wdatabase, journal->wstmts))
+        g_set_error (error, g_quark_from_static_string ("JournalNew"), 1,
+                     "Prepare statements fail");
+    }
+
+  journal->batch_size = (guint)cdm_options_long_for (options, KEY_JOURNAL_BATCH_SIZE);
+  journal->batch_latency = MSEC2USEC (cdm_options_long_for (options, KEY_JOURNAL_BATCH_LATENCY));
+
+  if (journal->batch_size == 0)
+    journal->batch_size = 1;
+
+  journal->csource = g_source_new (&completion_source_funcs, sizeof (JournalCompletionSource));
+  ((JournalCompletionSource *)journal->csource)->queue = g_async_queue_new ();
+  ((JournalCompletionSource *)journal->csource)->journal = journal;
+  g_source_attach (journal->csource, NULL);
+
+  g_mutex_init (&journal->wlock);
+  g_cond_init (&journal->wcond);
+  journal->wqueue = g_async_queue_new ();
+  journal->writer = g_thread_new ("journal", journal_writer_thread, journal);
+
+  /* prepare epilog store, the wheel has a slot per second of lifetime plus the current one */
+  journal->elog_lifetime = (guint)cdm_options_long_for (options, KEY_ELOG_LIFETIME_SEC);
+  journal->elog_max_size = (gsize)cdm_options_long_for (options, KEY_ELOG_MAX_MEMORY) * 1024;
+  journal->elogs = g_hash_table_new (g_int64_hash, g_int64_equal);
+  journal->ewheel_slots = journal->elog_lifetime / JOURNAL_EPILOG_TICK_SEC + 2;
+  journal->ewheel = g_new0 (GQueue, journal->ewheel_slots);
+  journal->ewheel_time = g_get_monotonic_time ();
+
+  /* epilogs received before a restart are reloaded from the spool in the run directory */
+  if (cdm_options_long_for (options, KEY_ELOG_SPOOL_SLOTS) > 0)
+    {
+      g_autofree gchar *run_dir = cdm_options_string_for (options, KEY_RUN_DIR);
+      g_autofree gchar *spool_file = cdm_options_string_for (options, KEY_ELOG_SPOOL_FILE);
+      g_autofree gchar *spool_path = g_build_filename (run_dir, spool_file, NULL);
+      g_autoptr (GError) spool_error = NULL;
+
+      journal->espool_lifetime
+          = MAX ((guint)cdm_options_long_for (options, KEY_ELOG_SPOOL_LIFETIME_SEC),
+                 journal->elog_lifetime);
+      journal->espool = cdm_elogspool_new (
+          spool_path, (guint)cdm_options_long_for (options, KEY_ELOG_SPOOL_SLOTS), &spool_error);
+
+      if (journal->espool != NULL)
+        cdm_elogspool_foreach (journal->espool, journal_epilog_reload, journal);
+      else
+        g_warning ("Epilog spool disabled. Error %s", spool_error->message);
     }
 
   /* prepare epilog cleanup source */
-  journal->source = g_timeout_source_new_seconds (10);
+  journal->source = g_timeout_source_new_seconds (JOURNAL_EPILOG_TICK_SEC);
   g_source_ref (journal->source);
   g_source_set_callback (journal->source, G_SOURCE_FUNC (source_timer_callback), journal,
                          source_destroy_notify);
   g_source_attach (journal->source, NULL);
 
+  /* prepare compaction source, the interval is checked against the journal idle time */
+  journal->compact_interval
+      = SEC2USEC (cdm_options_long_for (options, KEY_JOURNAL_COMPACT_INTERVAL));
+  journal->compact_last = g_get_monotonic_time ();
+
+  if (journal->compact_interval > 0)
+    {
+      journal->compactor = g_timeout_source_new_seconds (JOURNAL_COMPACT_CHECK_SEC);
+      g_source_set_callback (journal->compactor, G_SOURCE_FUNC (compactor_timer_callback),
+                             journal, NULL);
+      g_source_attach (journal->compactor, NULL);
+    }
+
   return journal;
 }
 
@@ -236,49 +1531,84 @@ cdm_journal_unref (CdmJournal *journal)
 {
   g_assert (journal);
 
-  if (g_ref_count_dec (&journal->rc) == TRUE)
-    {
+  if (g_ref_count_dec (&journal->rc) == TRUE)
+    {
+      /* commit pending operations and stop the writer */
+      JournalOp *op = g_new0 (JournalOp, 1);
+
+      if (journal->compactor != NULL)
+        {
+          g_source_destroy (journal->compactor);
+          g_source_unref (journal->compactor);
+        }
+
+      op->type = JOURNAL_OP_TERMINATE;
+      journal_enqueue (journal, op);
+      g_thread_join (journal->writer);
+      g_async_queue_unref (journal->wqueue);
+      g_mutex_clear (&journal->wlock);
+      g_cond_clear (&journal->wcond);
+
+      g_source_destroy (journal->csource);
+      g_source_unref (journal->csource);
+
       if (journal->source != NULL)
-        g_source_unref (journal->source);
+        {
+          g_source_destroy (journal->source);
+          g_source_unref (journal->source);
+        }
+
+      while (!g_queue_is_empty (&journal->elru))
+        journal_epilog_drop (journal, (CdmJournalEpilog *)g_queue_peek_head (&journal->elru));
+
+      g_hash_table_unref (journal->elogs);
+      g_free (journal->ewheel);
+
+      if (journal->espool != NULL)
+        cdm_elogspool_unref (journal->espool);
+
+      journal_finalize (journal->wstmts);
+      journal_finalize (journal->stmts);
+      sqlite3_close (journal->wdatabase);
+      sqlite3_close (journal->database);
 
       g_free (journal);
     }
 }
 
 void
-cdm_journal_epilog_add (CdmJournal *journal, CdmJournalEpilog *elog)
+cdm_journal_epilog_add (CdmJournal *journal, int64_t pid, const gchar *backtrace, gsize len)
 {
-  g_assert (elog);
+  gint64 tstamp = g_get_monotonic_time ();
+
   g_assert (journal);
+  g_assert (backtrace);
+
+  cdm_journal_epilog_rem (journal, pid);
+  journal_epilog_insert (journal, pid, tstamp, backtrace, len);
 
-  elog->tstamp = g_get_monotonic_time ();
-  journal->elogs = g_list_append (journal->elogs, elog);
+  if (journal->espool != NULL)
+    cdm_elogspool_append (journal->espool, pid, tstamp, backtrace, len);
 }
 
 CdmStatus
 cdm_journal_epilog_rem (CdmJournal *journal, int64_t pid)
 {
-  CdmStatus status = CDM_STATUS_ERROR;
-  GList *l = NULL;
+  CdmJournalEpilog *elog = NULL;
 
   g_assert (journal);
 
-  l = journal->elogs;
+  /* a removed epilog must not come back from the spool for a reused pid */
+  if (journal->espool != NULL)
+    cdm_elogspool_clear (journal->espool, pid);
 
-  while (l != NULL)
-    {
-      GList *next = l->next;
+  elog = (CdmJournalEpilog *)g_hash_table_lookup (journal->elogs, &pid);
+  if (elog == NULL)
+    return CDM_STATUS_ERROR;
 
-      if (((CdmJournalEpilog *)l->data)->pid == pid)
-        {
-          status = CDM_STATUS_OK;
-          g_free (l->data);
-          journal->elogs = g_list_delete_link (journal->elogs, l);
-        }
-      l = next;
-    }
+  journal_epilog_drop (journal, elog);
 
-  return status;
+  return CDM_STATUS_OK;
 }
 
 CdmJournalEpilog *
@@ -286,14 +1616,29 @@ cdm_journal_epilog_get (CdmJournal *journal, int64_t pid)
 {
   CdmJournalEpilog *elog = NULL;
 
-  GList *l = NULL;
-
   g_assert (journal);
 
-  for (l = journal->elogs; l != NULL; l = l->next)
+  elog = (CdmJournalEpilog *)g_hash_table_lookup (journal->elogs, &pid);
+
+  /* an epilog expired or dropped by the memory limit is still found in the spool */
+  if (elog == NULL && journal->espool != NULL)
+    {
+      const gint64 min_tstamp
+          = g_get_monotonic_time () - SEC2USEC ((gint64)journal->espool_lifetime);
+      const gchar *backtrace = NULL;
+      gint64 tstamp = 0;
+      gsize len = 0;
+
+      backtrace = cdm_elogspool_lookup (journal->espool, pid, min_tstamp, &tstamp, &len);
+      if (backtrace != NULL)
+        elog = journal_epilog_insert (journal, pid, tstamp, backtrace, len);
+    }
+
+  /* a read makes the epilog the most recently used one */
+  if (elog != NULL)
     {
-      if (((CdmJournalEpilog *)l->data)->pid == pid)
-        elog = (CdmJournalEpilog *)l->data;
+      g_queue_unlink (&journal->elru, &elog->lru_link);
+      g_queue_push_tail_link (&journal->elru, &elog->lru_link);
     }
 
   return elog;
@@ -303,13 +1648,13 @@ guint64
 cdm_journal_add_crash (CdmJournal *journal, const gchar *proc_name, const gchar *crash_id,
                        const gchar *vector_id, const gchar *context_id, const gchar *context_name,
                        const gchar *lifecycle_state, const gchar *file_path, gint64 pid, gint64 sig,
-                       guint64 tstamp, GError **error)
+                       guint64 tstamp, CdmJournalCallback callback, gpointer user_data,
+                       GError **error)
 {
-  g_autofree gchar *sql = NULL;
-  gchar *query_error = NULL;
+  JournalOp *op = NULL;
+  JournalCrash *crash = NULL;
   gint64 file_size;
   guint64 id;
-  JournalQueryData data = { .type = QUERY_ADD_ENTRY, .response = NULL };
 
   g_assert (journal);
 
@@ -329,23 +1674,25 @@ cdm_journal_add_crash (CdmJournal *journal, const gchar *proc_name, const gchar
 
   id = cdm_utils_jenkins_hash (file_path);
 
-  sql = g_strdup_printf ("INSERT INTO %s "
-                         "(ID,PROCNAME,CRASHID,VECTORID,CONTEXTID,CONTEXTNAME,LIFECYCLESTATE,"
-                         "FILEPATH,FILESIZE,PID,SIGNAL,TIMESTAMP,OSVERSION,TSTATE,RSTATE) VALUES("
-                         "%lu, '%s', '%s', '%s', '%s', '%s', '%s', '%s', %ld, %ld, %ld, %lu, '%s',"
-                         "%d, %d);",
-                         cdm_journal_table_name, id, proc_name, crash_id, vector_id, context_id,
-                         context_name, lifecycle_state, file_path, file_size, pid, sig, tstamp,
-                         cdm_utils_get_osversion (), 0, 0);
-
-  if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
-    {
-      g_set_error (error, g_quark_from_static_string ("JournalAddCrash"), 1, "SQL query error");
-      g_warning ("Fail to add new entry. SQL error %s", query_error);
-      sqlite3_free (query_error);
-
-      return 0;
-    }
+  crash = g_new0 (JournalCrash, 1);
+  crash->proc_name = g_strdup (proc_name);
+  crash->crash_id = g_strdup (crash_id);
+  crash->vector_id = g_strdup (vector_id);
+  crash->context_id = g_strdup (context_id);
+  crash->context_name = g_strdup (context_name != NULL ? context_name : "unknown");
+  crash->lifecycle_state = g_strdup (lifecycle_state != NULL ? lifecycle_state : "unknown");
+  crash->file_path = g_strdup (file_path);
+  crash->file_size = file_size;
+  crash->pid = pid;
+  crash->sig = sig;
+  crash->tstamp = tstamp;
+  crash->score = (gint64)tstamp - file_size * journal->size_weight / 1048576;
+
+  op = journal_op_new (STMT_ADD_CRASH, callback, user_data);
+  op->crash = crash;
+  g_array_append_val (op->ids, id);
+
+  journal_enqueue (journal, op);
 
   return id;
 }
@@ -353,31 +1700,27 @@ cdm_journal_add_crash (CdmJournal *journal, const gchar *proc_name, const gchar
 gboolean
 cdm_journal_archive_exist (CdmJournal *journal, const gchar *file_path, GError **error)
 {
-  g_autofree gchar *sql = NULL;
-  gchar *query_error = NULL;
+  sqlite3_stmt *stmt = NULL;
   gboolean entry_exist = FALSE;
-  guint64 id;
-  JournalQueryData data = { .type = QUERY_GET_ENTRY, .response = NULL };
+  gint status;
 
   g_assert (journal);
 
-  id = cdm_utils_jenkins_hash (file_path);
-  data.response = (gpointer)&entry_exist;
+  stmt = journal->stmts[STMT_ENTRY_EXIST];
+  sqlite3_bind_int64 (stmt, 1, (sqlite3_int64)cdm_utils_jenkins_hash (file_path));
 
-  sql = g_strdup_printf ("SELECT ID FROM %s WHERE ID IS %lu", cdm_journal_table_name, id);
-  if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
-    {
-      g_set_error (error, g_quark_from_static_string ("JournalGetEntry"), 1, "SQL query error");
-      g_warning ("Fail to get victim. SQL error %s", query_error);
-      sqlite3_free (query_error);
-    }
+  status = sqlite3_step (stmt);
+  entry_exist = (status == SQLITE_ROW);
+
+  if (!journal_stmt_reset (stmt, status))
+    g_set_error (error, g_quark_from_static_string ("JournalGetEntry"), 1, "SQL query error");
 
-  return *(gboolean *)data.response;
+  return entry_exist;
 }
 
 void
 cdm_journal_set_transfer (CdmJournal *journal, const gchar *file_path, gboolean complete,
-                          GError **error)
+                          CdmJournalCallback callback, gpointer user_data, GError **error)
 {
   g_assert (journal);
 
@@ -388,28 +1731,152 @@ cdm_journal_set_transfer (CdmJournal *journal, const gchar *file_path, gboolean
     }
   else
     {
-      g_autofree gchar *sql = NULL;
-      gchar *query_error = NULL;
-      JournalQueryData data = { .type = QUERY_SET_TRANSFER, .response = NULL };
-
+      JournalOp *op = journal_op_new (STMT_SET_TRANSFER, callback, user_data);
       guint64 id = cdm_utils_jenkins_hash (file_path);
 
-      sql = g_strdup_printf ("UPDATE %s SET TSTATE = %d WHERE ID IS %lu", cdm_journal_table_name,
-                             complete, id);
+      op->value = complete;
+      g_array_append_val (op->ids, id);
 
-      if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
-        {
-          g_set_error (error, g_quark_from_static_string ("JournalSetTransfer"), 1,
-                       "SQL query error");
-          g_warning ("Fail to set transfer state. SQL error %s", query_error);
-          sqlite3_free (query_error);
-        }
+      journal_enqueue (journal, op);
+    }
+}
+
+void
+cdm_journal_set_transfer_list (CdmJournal *journal, GPtrArray *file_paths, gboolean complete,
+                               CdmJournalCallback callback, gpointer user_data, GError **error)
+{
+  JournalOp *op = NULL;
+
+  g_assert (journal);
+
+  if (file_paths == NULL || file_paths->len == 0)
+    {
+      g_set_error (error, g_quark_from_static_string ("JournalSetTransferList"), 1,
+                   "Invalid arguments");
+      return;
+    }
+
+  /* a single operation marks the whole set in one transaction */
+  op = journal_op_new (STMT_SET_TRANSFER, callback, user_data);
+  op->value = complete;
+
+  for (guint i = 0; i < file_paths->len; i++)
+    {
+      guint64 id = cdm_utils_jenkins_hash ((const gchar *)file_paths->pdata[i]);
+
+      g_array_append_val (op->ids, id);
+    }
+
+  journal_enqueue (journal, op);
+}
+
+void
+cdm_journal_set_transfer_abandoned (CdmJournal *journal, const gchar *file_path)
+{
+  JournalOp *op = NULL;
+  guint64 id;
+
+  g_assert (journal);
+  g_assert (file_path);
+
+  op = journal_op_new (STMT_SET_TRANSFER, NULL, NULL);
+  id = cdm_utils_jenkins_hash (file_path);
+
+  op->value = JOURNAL_TRANSFER_ABANDONED;
+  g_array_append_val (op->ids, id);
+
+  journal_enqueue (journal, op);
+}
+
+void
+cdm_journal_set_transfer_offset (CdmJournal *journal, const gchar *file_path, gint64 offset)
+{
+  JournalOp *op = NULL;
+  guint64 id;
+
+  g_assert (journal);
+  g_assert (file_path);
+
+  op = journal_op_new (STMT_SET_TRANSFER_OFFSET, NULL, NULL);
+  id = cdm_utils_jenkins_hash (file_path);
+
+  op->value = offset;
+  g_array_append_val (op->ids, id);
+
+  journal_enqueue (journal, op);
+}
+
+void
+cdm_journal_set_transfer_retry (CdmJournal *journal, const gchar *file_path, gint64 next_attempt)
+{
+  JournalOp *op = NULL;
+  guint64 id;
+
+  g_assert (journal);
+  g_assert (file_path);
+
+  op = journal_op_new (STMT_SET_TRANSFER_RETRY, NULL, NULL);
+  id = cdm_utils_jenkins_hash (file_path);
+
+  op->value = next_attempt;
+  g_array_append_val (op->ids, id);
+
+  journal_enqueue (journal, op);
+}
+
+void
+cdm_journal_get_transfer_state (CdmJournal *journal, const gchar *file_path,
+                                CdmJournalTransferState *state, GError **error)
+{
+  sqlite3_stmt *stmt = NULL;
+  gint status;
+
+  g_assert (journal);
+  g_assert (file_path);
+  g_assert (state);
+
+  memset (state, 0, sizeof (CdmJournalTransferState));
+
+  stmt = journal->stmts[STMT_GET_TRANSFER_STATE];
+  sqlite3_bind_int64 (stmt, 1, (sqlite3_int64)cdm_utils_jenkins_hash (file_path));
+
+  status = sqlite3_step (stmt);
+  if (status == SQLITE_ROW)
+    {
+      state->offset = sqlite3_column_int64 (stmt, 0);
+      state->attempts = sqlite3_column_int64 (stmt, 1);
+      state->next_attempt = sqlite3_column_int64 (stmt, 2);
     }
+
+  if (!journal_stmt_reset (stmt, status))
+    {
+      g_set_error (error, g_quark_from_static_string ("JournalGetTransferState"), 1,
+                   "SQL query error");
+      memset (state, 0, sizeof (CdmJournalTransferState));
+    }
+}
+
+void
+cdm_journal_set_metadata_transfer (CdmJournal *journal, const gchar *file_path, gboolean complete)
+{
+  JournalOp *op = NULL;
+  guint64 id;
+
+  g_assert (journal);
+  g_assert (file_path);
+
+  op = journal_op_new (STMT_SET_METADATA_TRANSFER, NULL, NULL);
+  id = cdm_utils_jenkins_hash (file_path);
+
+  op->value = complete;
+  g_array_append_val (op->ids, id);
+
+  journal_enqueue (journal, op);
 }
 
 void
 cdm_journal_set_removed (CdmJournal *journal, const gchar *file_path, gboolean complete,
-                         GError **error)
+                         CdmJournalCallback callback, gpointer user_data, GError **error)
 {
   g_assert (journal);
 
@@ -419,93 +1886,179 @@ cdm_journal_set_removed (CdmJournal *journal, const gchar *file_path, gboolean c
     }
   else
     {
-      g_autofree gchar *sql = NULL;
-      gchar *query_error = NULL;
-      JournalQueryData data = { .type = QUERY_SET_REMOVED, .response = NULL };
-
+      JournalOp *op = journal_op_new (STMT_SET_REMOVED, callback, user_data);
       guint64 id = cdm_utils_jenkins_hash (file_path);
 
-      sql = g_strdup_printf ("UPDATE %s SET RSTATE = %d WHERE ID IS %lu", cdm_journal_table_name,
-                             complete, id);
+      op->value = complete;
+      g_array_append_val (op->ids, id);
 
-      if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
-        {
-          g_set_error (error, g_quark_from_static_string ("JournalSetRemoved"), 1,
-                       "SQL query error");
-          g_warning ("Fail to set removed state. SQL error %s", query_error);
-          sqlite3_free (query_error);
-        }
+      journal_enqueue (journal, op);
     }
 }
 
-gchar *
-cdm_journal_get_victim (CdmJournal *journal, GError **error)
+void
+cdm_journal_set_removed_list (CdmJournal *journal, GPtrArray *file_paths,
+                              CdmJournalCallback callback, gpointer user_data, GError **error)
 {
-  g_autofree gchar *sql = NULL;
-  gchar *query_error = NULL;
-  JournalQueryData data = { .type = QUERY_GET_VICTIM, .response = NULL };
+  JournalOp *op = NULL;
 
   g_assert (journal);
 
-  sql = g_strdup_printf ("SELECT FILEPATH FROM %s "
-                         "WHERE RSTATE IS 0 AND TSTATE IS 1 ORDER BY TIMESTAMP LIMIT 1",
-                         cdm_journal_table_name);
+  if (file_paths == NULL || file_paths->len == 0)
+    {
+      g_set_error (error, g_quark_from_static_string ("JournalSetRemovedList"), 1,
+                   "Invalid arguments");
+      return;
+    }
+
+  /* a single operation marks the whole set in one transaction */
+  op = journal_op_new (STMT_SET_REMOVED, callback, user_data);
+  op->value = TRUE;
 
-  if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
+  for (guint i = 0; i < file_paths->len; i++)
     {
-      g_set_error (error, g_quark_from_static_string ("JournalGetVictim"), 1, "SQL query error");
-      g_warning ("Fail to get victim. SQL error %s", query_error);
-      sqlite3_free (query_error);
+      guint64 id = cdm_utils_jenkins_hash ((const gchar *)file_paths->pdata[i]);
+
+      g_array_append_val (op->ids, id);
     }
 
-  return (gchar *)data.response;
+  journal_enqueue (journal, op);
 }
 
 gchar *
-cdm_journal_get_untransferred (CdmJournal *journal, GError **error)
+cdm_journal_get_victim (CdmJournal *journal, GError **error)
 {
-  g_autofree gchar *sql = NULL;
-  gchar *query_error = NULL;
-  JournalQueryData data = { .type = QUERY_GET_UNTRANSFERRED, .response = NULL };
+  sqlite3_stmt *stmt = NULL;
+  gchar *victim = NULL;
+  gint status;
+
+  g_assert (journal);
+
+  stmt = journal->stmts[STMT_GET_VICTIMS];
+
+  status = sqlite3_step (stmt);
+  if (status == SQLITE_ROW)
+    victim = g_strdup ((const gchar *)sqlite3_column_text (stmt, 0));
+
+  if (!journal_stmt_reset (stmt, status))
+    g_set_error (error, g_quark_from_static_string ("JournalGetVictim"), 1, "SQL query error");
+
+  return victim;
+}
+
+GPtrArray *
+cdm_journal_get_victims (CdmJournal *journal, const gchar *context_name, const gchar *proc_name,
+                         gssize free_size, gssize free_count, GHashTable *exclude,
+                         GError **error)
+{
+  GPtrArray *victims = g_ptr_array_new_with_free_func ((GDestroyNotify)cdm_journal_victim_free);
+  sqlite3_stmt *stmt = NULL;
+  gint status = SQLITE_DONE;
 
   g_assert (journal);
 
-  sql = g_strdup_printf ("SELECT FILEPATH FROM %s "
-                         "WHERE RSTATE IS 0 AND TSTATE IS 0 ORDER BY TIMESTAMP LIMIT 1",
-                         cdm_journal_table_name);
+  if (free_size <= 0 && free_count <= 0)
+    return victims;
 
-  if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
+  /* each filter has its own statement so the matching index is used */
+  if (context_name != NULL)
     {
-      g_set_error (error, g_quark_from_static_string ("JournalGetUntrasnferred"), 1,
-                   "SQL query error");
-      g_warning ("Fail to get untransfered. SQL error %s", query_error);
-      sqlite3_free (query_error);
+      stmt = journal->stmts[STMT_GET_CONTEXT_VICTIMS];
+      sqlite3_bind_text (stmt, 1, context_name, -1, SQLITE_STATIC);
+    }
+  else if (proc_name != NULL)
+    {
+      stmt = journal->stmts[STMT_GET_PROCESS_VICTIMS];
+      sqlite3_bind_text (stmt, 1, proc_name, -1, SQLITE_STATIC);
+    }
+  else
+    stmt = journal->stmts[STMT_GET_VICTIMS];
+
+  /* stop stepping once enough space and entries are selected */
+  while ((free_size > 0 || free_count > 0) && (status = sqlite3_step (stmt)) == SQLITE_ROW)
+    {
+      const gchar *path = (const gchar *)sqlite3_column_text (stmt, 0);
+      CdmJournalVictim *victim = NULL;
+
+      if (exclude != NULL && g_hash_table_contains (exclude, path))
+        continue;
+
+      victim = g_new0 (CdmJournalVictim, 1);
+      victim->file_path = g_strdup (path);
+      victim->size = (gssize)sqlite3_column_int64 (stmt, 1);
+      victim->context_name = g_strdup ((const gchar *)sqlite3_column_text (stmt, 2));
+      victim->proc_name = g_strdup ((const gchar *)sqlite3_column_text (stmt, 3));
+      g_ptr_array_add (victims, victim);
+
+      free_size -= victim->size;
+      free_count -= 1;
     }
 
-  return (gchar *)data.response;
+  if (!journal_stmt_reset (stmt, status))
+    g_set_error (error, g_quark_from_static_string ("JournalGetVictims"), 1, "SQL query error");
+
+  return victims;
+}
+
+GPtrArray *
+cdm_journal_get_untransferred (CdmJournal *journal, GError **error)
+{
+  sqlite3_stmt *stmt = NULL;
+  GPtrArray *untransferred = g_ptr_array_new_with_free_func (g_free);
+  gint status;
+
+  g_assert (journal);
+
+  stmt = journal->stmts[STMT_GET_UNTRANSFERRED];
+
+  while ((status = sqlite3_step (stmt)) == SQLITE_ROW)
+    g_ptr_array_add (untransferred, g_strdup ((const gchar *)sqlite3_column_text (stmt, 0)));
+
+  if (!journal_stmt_reset (stmt, status))
+    g_set_error (error, g_quark_from_static_string ("JournalGetUntrasnferred"), 1,
+                 "SQL query error");
+
+  return untransferred;
+}
+
+GPtrArray *
+cdm_journal_get_metadata_untransferred (CdmJournal *journal, GError **error)
+{
+  sqlite3_stmt *stmt = NULL;
+  GPtrArray *untransferred = g_ptr_array_new_with_free_func (g_free);
+  gint status;
+
+  g_assert (journal);
+
+  stmt = journal->stmts[STMT_GET_METADATA_UNTRANSFERRED];
+
+  while ((status = sqlite3_step (stmt)) == SQLITE_ROW)
+    g_ptr_array_add (untransferred, g_strdup ((const gchar *)sqlite3_column_text (stmt, 0)));
+
+  if (!journal_stmt_reset (stmt, status))
+    g_set_error (error, g_quark_from_static_string ("JournalGetMetadataUntransferred"), 1,
+                 "SQL query error");
+
+  return untransferred;
 }
 
 gssize
 cdm_journal_get_data_size (CdmJournal *journal, GError **error)
 {
-  g_autofree gchar *sql = NULL;
-  gchar *query_error = NULL;
+  sqlite3_stmt *stmt = NULL;
   gssize crash_dir_size = 0;
-  JournalQueryData data = { .type = QUERY_GET_DATASIZE, .response = NULL };
+  gint status;
 
   g_assert (journal);
 
-  data.response = (gpointer)&crash_dir_size;
+  stmt = journal->stmts[STMT_GET_TOTALS];
 
-  sql = g_strdup_printf ("SELECT FILESIZE FROM %s WHERE RSTATE IS 0 AND TSTATE IS 1",
-                         cdm_journal_table_name);
+  status = sqlite3_step (stmt);
+  if (status == SQLITE_ROW)
+    crash_dir_size = (gssize)sqlite3_column_int64 (stmt, 0);
 
-  if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
-    {
-      g_set_error (error, g_quark_from_static_string ("JournalGetDatasize"), 1, "SQL query error");
-      g_warning ("Fail to get data size. SQL error %s", query_error);
-      sqlite3_free (query_error);
-    }
+  if (!journal_stmt_reset (stmt, status))
+    g_set_error (error, g_quark_from_static_string ("JournalGetDatasize"), 1, "SQL query error");
 
   return crash_dir_size;
 }
@@ -513,24 +2066,174 @@ cdm_journal_get_data_size (CdmJournal *journal, GError **error)
 gssize
 cdm_journal_get_entry_count (CdmJournal *journal, GError **error)
 {
-  g_autofree gchar *sql = NULL;
-  gchar *query_error = NULL;
+  sqlite3_stmt *stmt = NULL;
   gssize crash_entries = 0;
-  JournalQueryData data = { .type = QUERY_GET_ENTRY_COUNT, .response = NULL };
+  gint status;
+
+  g_assert (journal);
+
+  stmt = journal->stmts[STMT_GET_TOTALS];
+
+  status = sqlite3_step (stmt);
+  if (status == SQLITE_ROW)
+    crash_entries = (gssize)sqlite3_column_int64 (stmt, 1);
+
+  if (!journal_stmt_reset (stmt, status))
+    g_set_error (error, g_quark_from_static_string ("JournalGetDatasize"), 1, "SQL query error");
+
+  return crash_entries;
+}
+
+void
+cdm_journal_flush (CdmJournal *journal)
+{
+  JournalOp *op = NULL;
+  guint64 seq;
+
+  g_assert (journal);
+
+  op = g_new0 (JournalOp, 1);
+  op->type = JOURNAL_OP_FLUSH;
+  seq = journal_enqueue (journal, op);
+
+  g_mutex_lock (&journal->wlock);
+  while (journal->cseq < seq)
+    g_cond_wait (&journal->wcond, &journal->wlock);
+  g_mutex_unlock (&journal->wlock);
+}
+
+void
+cdm_journal_set_usage_callback (CdmJournal *journal, CdmJournalUsageCallback callback,
+                                gpointer user_data)
+{
+  g_assert (journal);
+
+  journal->usage_callback = callback;
+  journal->usage_data = user_data;
+}
+
+void
+cdm_journal_resync_usage (CdmJournal *journal, CdmJournalCallback callback, gpointer user_data)
+{
+  JournalOp *op = NULL;
 
   g_assert (journal);
+  g_assert (callback);
+
+  op = g_new0 (JournalOp, 1);
+  op->type = JOURNAL_OP_USAGE;
+  op->callback = callback;
+  op->user_data = user_data;
+
+  journal_enqueue (journal, op);
+}
 
-  data.response = (gpointer)&crash_entries;
+GPtrArray *
+cdm_journal_get_stats (CdmJournal *journal, const gchar *crash_id, GError **error)
+{
+  GPtrArray *stats = g_ptr_array_new_with_free_func ((GDestroyNotify)cdm_journal_stats_free);
+  sqlite3_stmt *stmt = NULL;
+  gint status;
 
-  sql = g_strdup_printf ("SELECT FILEPATH FROM %s WHERE RSTATE IS 0 AND TSTATE IS 1",
-                         cdm_journal_table_name);
+  g_assert (journal);
 
-  if (sqlite3_exec (journal->database, sql, sqlite_callback, &data, &query_error) != SQLITE_OK)
+  if (crash_id != NULL)
     {
-      g_set_error (error, g_quark_from_static_string ("JournalGetDatasize"), 1, "SQL query error");
-      g_warning ("Fail to get entry count. SQL error %s", query_error);
-      sqlite3_free (query_error);
+      stmt = journal->stmts[STMT_GET_CRASH_STATS];
+      sqlite3_bind_text (stmt, 1, crash_id, -1, SQLITE_STATIC);
     }
+  else
+    stmt = journal->stmts[STMT_GET_STATS];
 
-  return crash_entries;
+  while ((status = sqlite3_step (stmt)) == SQLITE_ROW)
+    g_ptr_array_add (stats, journal_stats_read (stmt));
+
+  if (!journal_stmt_reset (stmt, status))
+    g_set_error (error, g_quark_from_static_string ("JournalGetStats"), 1, "SQL query error");
+
+  return stats;
+}
+
+void
+cdm_journal_stats_free (CdmJournalStats *stats)
+{
+  g_assert (stats);
+
+  g_free (stats->crash_id);
+  g_free (stats->vector_id);
+  g_free (stats->proc_name);
+  g_free (stats->context_name);
+  g_free (stats);
+}
+
+void
+cdm_journal_victim_free (CdmJournalVictim *victim)
+{
+  g_assert (victim);
+
+  g_free (victim->file_path);
+  g_free (victim->context_name);
+  g_free (victim->proc_name);
+  g_free (victim);
+}
+
+#ifdef WITH_TESTS
+gboolean
+cdm_journal_check_query_plans (CdmJournal *journal, GError **error)
+{
+  /* these statements walk their index in the requested order */
+  static const JournalStmt ordered[]
+      = { STMT_GET_USAGE,           STMT_GET_TOTALS,          STMT_GET_VICTIMS,
+          STMT_GET_CONTEXT_VICTIMS, STMT_GET_PROCESS_VICTIMS, STMT_GET_UNTRANSFERRED,
+          STMT_GET_METADATA_UNTRANSFERRED };
+
+  g_assert (journal);
+
+  for (gint i = 0; i < STMT_COUNT; i++)
+    {
+      g_autofree gchar *sql = g_strdup_printf ("EXPLAIN QUERY PLAN %s", journal_stmt_sql[i]);
+      gboolean sorted = FALSE;
+      sqlite3_stmt *stmt = NULL;
+      gint status;
+
+      for (gsize j = 0; j < G_N_ELEMENTS (ordered); j++)
+        sorted = sorted || ordered[j] == (JournalStmt)i;
+
+      if (sqlite3_prepare_v2 (journal->database, sql, -1, &stmt, NULL) != SQLITE_OK)
+        {
+          g_set_error (error, g_quark_from_static_string ("JournalQueryPlan"), 1,
+                       "Statement %d does not compile: %s", i, sqlite3_errmsg (journal->database));
+          return FALSE;
+        }
+
+      while ((status = sqlite3_step (stmt)) == SQLITE_ROW)
+        {
+          const gchar *detail = (const gchar *)sqlite3_column_text (stmt, 3);
+
+          if (detail == NULL)
+            continue;
+
+          if ((strstr (detail, "SCAN") != NULL && strstr (detail, JOURNAL_TABLE) != NULL
+               && strstr (detail, "INDEX") == NULL)
+              || (sorted && strstr (detail, "TEMP B-TREE") != NULL))
+            {
+              g_set_error (error, g_quark_from_static_string ("JournalQueryPlan"), 1,
+                           "Statement %d plan '%s' for: %s", i, detail, journal_stmt_sql[i]);
+              sqlite3_finalize (stmt);
+              return FALSE;
+            }
+        }
+
+      sqlite3_finalize (stmt);
+
+      if (status != SQLITE_DONE)
+        {
+          g_set_error (error, g_quark_from_static_string ("JournalQueryPlan"), 1,
+                       "Statement %d plan read fail", i);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
 }
+#endif
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include "cdm-elogspool.h"
 #include "cdm-message.h"
 #include "cdm-options.h"
 #include "cdm-types.h"
@@ -36,24 +37,117 @@ G_BEGIN_DECLS
   (CDM_MESSAGE_EPILOG_FRAME_MAX_LEN * CDM_MESSAGE_EPILOG_FRAME_MAX_CNT)
 
 /**
- * @brief The CdmJournalEpilog data structure
+ * @brief The CdmJournalEpilog data structure, allocated with the backtrace size
  */
 typedef struct _CdmJournalEpilog
 {
-  gint64 tstamp; /**< Epilog creation timestamp */
-  int64_t pid;   /**< Process ID */
-  char backtrace[CDM_JOURNAL_EPILOG_MAX_BT];
+  gint64 tstamp;    /**< Epilog creation timestamp */
+  int64_t pid;      /**< Process ID */
+  GList lru_link;   /**< Link in the least recently used order */
+  GList wheel_link; /**< Link in the expiry wheel slot */
+  guint slot;       /**< Expiry wheel slot */
+  gsize size;       /**< Accounted memory size */
+  char backtrace[]; /**< Null terminated backtrace */
 } CdmJournalEpilog;
 
+/**
+ * @brief The upload state of an untransferred entry
+ */
+typedef struct _CdmJournalTransferState
+{
+  gint64 offset;       /**< Acknowledged upload offset */
+  gint64 attempts;     /**< Failed upload attempts */
+  gint64 next_attempt; /**< Wall clock time in seconds of the next attempt, 0 if not delayed */
+} CdmJournalTransferState;
+
+/**
+ * @brief The CdmJournalStats data structure
+ */
+typedef struct _CdmJournalStats
+{
+  gchar *crash_id;     /**< Crash id */
+  gchar *vector_id;    /**< Vector id */
+  gint64 count;        /**< Number of crashes recorded */
+  gint64 first_seen;   /**< Timestamp of the first crash */
+  gint64 last_seen;    /**< Timestamp of the latest crash */
+  gint64 processes;    /**< Number of distinct processes affected */
+  gint64 contexts;     /**< Number of distinct contexts affected */
+  gchar *proc_name;    /**< Process name of the latest crash */
+  gchar *context_name; /**< Context name of the latest crash */
+} CdmJournalStats;
+
+/**
+ * @brief The CdmJournalVictim data structure
+ */
+typedef struct _CdmJournalVictim
+{
+  gchar *file_path;    /**< Archive file path */
+  gchar *context_name; /**< Context name of the entry */
+  gchar *proc_name;    /**< Process name of the entry */
+  gssize size;         /**< Archive file size */
+} CdmJournalVictim;
+
+/**
+ * @brief Journal operation completion callback, called from the main loop context
+ * @param user_data The user data provided with the operation
+ * @param error The operation error or NULL on success
+ */
+typedef void (*CdmJournalCallback) (gpointer user_data, const GError *error);
+
+/**
+ * @brief Journal usage change callback, called from the main loop context
+ * @param user_data The user data provided with the callback
+ * @param context_name The context name of the changed entry
+ * @param proc_name The process name of the changed entry
+ * @param delta_size Change of the data size for unremoved released entries
+ * @param delta_count Change of the number of unremoved released entries
+ */
+typedef void (*CdmJournalUsageCallback) (gpointer user_data, const gchar *context_name,
+                                         const gchar *proc_name, gssize delta_size,
+                                         gssize delta_count);
+
 /**
  * @brief The CdmJournal opaque data structure
  */
 typedef struct _CdmJournal
 {
-  GSource *source;   /**< Event loop source */
-  sqlite3 *database; /**< The sqlite3 database object */
-  grefcount rc;      /**< Reference counter variable  */
-  GList *elogs;      /**< Current epilog list */
+  GSource *source;       /**< Event loop source */
+  GSource *csource;      /**< Writer completion event source */
+  GSource *compactor;    /**< Journal compaction event source */
+  sqlite3 *database;     /**< The sqlite3 database object used for queries */
+  sqlite3 *wdatabase;    /**< The sqlite3 database object owned by the writer thread */
+  sqlite3_stmt **stmts;  /**< Prepared statements for the query connection */
+  sqlite3_stmt **wstmts; /**< Prepared statements for the writer connection */
+  grefcount rc;          /**< Reference counter variable  */
+  GHashTable *elogs;     /**< Current epilogs indexed by pid */
+  GQueue elru;           /**< Epilogs in least recently used order */
+  GQueue *ewheel;        /**< Epilog expiry wheel slots */
+  guint ewheel_slots;    /**< Number of expiry wheel slots */
+  guint ewheel_pos;      /**< Expiry wheel slot of the current second */
+  gint64 ewheel_time;    /**< Monotonic time in usec of the current slot */
+  guint elog_lifetime;   /**< Epilog lifetime in seconds */
+  gsize elog_size;       /**< Memory used by the epilogs */
+  gsize elog_max_size;   /**< Max memory used by the epilogs */
+  CdmELogSpool *espool;  /**< Persistent epilog spool or NULL if disabled */
+  guint espool_lifetime; /**< Spooled epilog lifetime in seconds */
+
+  CdmJournalUsageCallback usage_callback; /**< Usage change notification */
+  gpointer usage_data;                    /**< Usage change notification data */
+
+  GThread *writer;      /**< Writer thread */
+  GAsyncQueue *wqueue;  /**< Writer operations queue */
+  GMutex wlock;         /**< Writer sequence lock */
+  GCond wcond;          /**< Writer commit condition */
+  guint64 wseq;         /**< Last enqueued operation sequence */
+  guint64 cseq;         /**< Last committed operation sequence */
+  guint batch_size;     /**< Max operations per transaction */
+  gint64 batch_latency; /**< Max time in usec an operation waits for its transaction */
+  glong keep_latest;    /**< Latest archives per crash id not counted as duplicates */
+  glong size_weight;    /**< Seconds of age added to the eviction score per MB */
+
+  gint64 wlast;            /**< Monotonic time in usec of the last enqueued operation */
+  gint64 compact_interval; /**< Min time in usec between compactions, 0 if disabled */
+  gint64 compact_last;     /**< Monotonic time in usec of the last compaction */
 } CdmJournal;
 
 /**
@@ -78,14 +172,19 @@ CdmJournal *cdm_journal_ref (CdmJournal *journal);
 void cdm_journal_unref (CdmJournal *journal);
 
 /**
- * @brief Add new epilog entry. The object will be freed when the epilog entry will be removed
+ * @brief Add new epilog entry replacing any epilog for the same pid
+ * The backtrace is copied and the least recently used epilogs are dropped if the
+ * epilog memory limit is exceeded.
  * @param journal The journal object
- * @param elog Reference to epilog object
+ * @param pid Process ID
+ * @param backtrace The backtrace data
+ * @param len The backtrace data length
  */
-void cdm_journal_epilog_add (CdmJournal *journal, CdmJournalEpilog *elog);
+void cdm_journal_epilog_add (CdmJournal *journal, int64_t pid, const gchar *backtrace,
+                             gsize len);
 
 /**
- * @brief Remove epilog by pid
+ * @brief Remove epilog by pid from memory and from the spool
  * @param journal The journal object
  * @param pid Reference to epilog object
  * @return on success return CDM_STATUS_OK
@@ -98,7 +197,8 @@ CdmStatus cdm_journal_epilog_rem (CdmJournal *journal, int64_t pid);
  * @param journal The journal object
  * @param pid Reference to epilog object
  *
- * @return Return a reference to epilog entry or NULL if don't exist
+ * @return Return a reference to epilog entry or NULL if don't exist. The reference is
+ * valid until the next epilog add or remove.
  */
 CdmJournalEpilog *cdm_journal_epilog_get (CdmJournal *journal, int64_t pid);
 
@@ -124,34 +224,151 @@ gboolean cdm_journal_archive_exist (CdmJournal *journal, const gchar *file_path,
  * @param pid Process id
  * @param sig Process crash signal id
  * @param tstamp Process crash timestamp
+ * @param callback Optional completion callback
+ * @param user_data Data passed to the completion callback
  * @param error Optional GError object reference to set on error
  * @return Return the new journal entry ID. If error is not NULL and an error
- * occured the error is set and return value is 0
+ * occured the error is set and return value is 0. The entry is written asynchronously
+ * and database errors are reported to the completion callback.
  */
 guint64 cdm_journal_add_crash (CdmJournal *journal, const gchar *proc_name, const gchar *crash_id,
                                const gchar *vector_id, const gchar *context_id,
                                const gchar *context_name, const gchar *lifecycle_state,
                                const gchar *file_path, gint64 pid, gint64 sig, guint64 tstamp,
-                               GError **error);
+                               CdmJournalCallback callback, gpointer user_data, GError **error);
 /**
  * @brief Set transfer state for an entry
+ * Can be called from any thread, the update is written asynchronously.
  * @param journal The journal object
  * @param file_path The archive file path
  * @param complete The transfer complete state
+ * @param callback Optional completion callback
+ * @param user_data Data passed to the completion callback
  * @param error The GError object or NULL
  */
 void cdm_journal_set_transfer (CdmJournal *journal, const gchar *file_path, gboolean complete,
-                               GError **error);
+                               CdmJournalCallback callback, gpointer user_data, GError **error);
+
+/**
+ * @brief Set transfer state for a list of entries in one transaction
+ * Can be called from any thread, the update is written asynchronously.
+ * @param journal The journal object
+ * @param file_paths The archive file paths
+ * @param complete The transfer complete state
+ * @param callback Optional completion callback
+ * @param user_data Data passed to the completion callback
+ * @param error The GError object or NULL
+ */
+void cdm_journal_set_transfer_list (CdmJournal *journal, GPtrArray *file_paths, gboolean complete,
+                                    CdmJournalCallback callback, gpointer user_data,
+                                    GError **error);
+
+/**
+ * @brief Give up the transfer of an entry
+ * The entry is released to the retention policy like a transferred one but keeps a
+ * distinct transfer state so it is never reported as uploaded.
+ * Can be called from any thread, the update is written asynchronously.
+ * @param journal The journal object
+ * @param file_path The archive file path
+ */
+void cdm_journal_set_transfer_abandoned (CdmJournal *journal, const gchar *file_path);
+
+/**
+ * @brief Checkpoint the acknowledged upload offset of an incomplete transfer
+ * Can be called from any thread, the update is written asynchronously.
+ * Setting the transfer state resets the offset.
+ * @param journal The journal object
+ * @param file_path The archive file path
+ * @param offset The number of bytes the destination acknowledged
+ */
+void cdm_journal_set_transfer_offset (CdmJournal *journal, const gchar *file_path, gint64 offset);
+
+/**
+ * @brief Count a failed upload attempt and set the time of the next one
+ * Can be called from any thread, the update is written asynchronously.
+ * Setting the transfer state resets the next attempt time.
+ * @param journal The journal object
+ * @param file_path The archive file path
+ * @param next_attempt Wall clock time in seconds of the next attempt
+ */
+void cdm_journal_set_transfer_retry (CdmJournal *journal, const gchar *file_path,
+                                     gint64 next_attempt);
+
+/**
+ * @brief Get the upload state of an incomplete transfer
+ * @param journal The journal object
+ * @param file_path The archive file path
+ * @param state The state to fill, all zero if the entry is unknown or on error
+ * @param error The GError object or NULL
+ */
+void cdm_journal_get_transfer_state (CdmJournal *journal, const gchar *file_path,
+                                     CdmJournalTransferState *state, GError **error);
+
+/**
+ * @brief Set the transfer state of the metadata bundle for an entry
+ * Can be called from any thread, the update is written asynchronously.
+ * @param journal The journal object
+ * @param file_path The archive file path
+ * @param complete The metadata transfer complete state
+ */
+void cdm_journal_set_metadata_transfer (CdmJournal *journal, const gchar *file_path,
+                                        gboolean complete);
 
 /**
  * @brief Set archive removed state for an entry
+ * Can be called from any thread, the update is written asynchronously.
  * @param journal The journal object
  * @param file_path The archive file path
  * @param complete The transfer complete state
+ * @param callback Optional completion callback
+ * @param user_data Data passed to the completion callback
  * @param error The GError object or NULL
  */
 void cdm_journal_set_removed (CdmJournal *journal, const gchar *file_path, gboolean removed,
-                              GError **error);
+                              CdmJournalCallback callback, gpointer user_data, GError **error);
+
+/**
+ * @brief Set archive removed state for a list of entries in one transaction
+ * Can be called from any thread, the update is written asynchronously.
+ * @param journal The journal object
+ * @param file_paths The archive file paths
+ * @param callback Optional completion callback
+ * @param user_data Data passed to the completion callback
+ * @param error The GError object or NULL
+ */
+void cdm_journal_set_removed_list (CdmJournal *journal, GPtrArray *file_paths,
+                                   CdmJournalCallback callback, gpointer user_data,
+                                   GError **error);
+
+/**
+ * @brief Set the usage change notification callback
+ * The callback is invoked after commit for each update changing the values reported
+ * by cdm_journal_get_data_size and cdm_journal_get_entry_count.
+ * @param journal The journal object
+ * @param callback The callback function or NULL to disable notifications
+ * @param user_data The data passed to callback
+ */
+void cdm_journal_set_usage_callback (CdmJournal *journal, CdmJournalUsageCallback callback,
+                                     gpointer user_data);
+
+/**
+ * @brief Queue a usage snapshot behind the pending journal updates
+ * The writer reads the usage in commit order. From the main loop the callback is invoked
+ * first, then the usage callback reports each unremoved released entry with a count of
+ * one. The usage changes of earlier updates are part of the snapshot and only the changes
+ * of later updates are reported after it. On error no entry is reported.
+ * @param journal The journal object
+ * @param callback The callback function
+ * @param user_data The data passed to callback
+ */
+void cdm_journal_resync_usage (CdmJournal *journal, CdmJournalCallback callback,
+                               gpointer user_data);
+
+/**
+ * @brief Wait until all the pending journal updates are committed
+ * @param journal The journal object
+ */
+void cdm_journal_flush (CdmJournal *journal);
 
 /**
  * @brief Get total file size for unremoved transfered entries
@@ -170,14 +387,22 @@ gssize cdm_journal_get_data_size (CdmJournal *journal, GError **error);
 gssize cdm_journal_get_entry_count (CdmJournal *journal, GError **error);
 
 /**
- * @brief Get next untransferred file
+ * @brief Get the untransferred files
  * @param journal The journal object
  * @param error The GError object or NULL
- * @return If a file is found a pointer to untranferred's file path is returned (new
- * string to be released by the caller). If no vicitm available NULL is
- * returned. If an error occured the error is set and NULL is returned.
+ * @return A new array with the file paths of the unremoved untransferred entries, oldest
+ * first. If an error occured the error is set and the array holds the paths read so far.
  */
-gchar *cdm_journal_get_untransferred (CdmJournal *journal, GError **error);
+GPtrArray *cdm_journal_get_untransferred (CdmJournal *journal, GError **error);
+
+/**
+ * @brief Get the untransferred files with the metadata bundle not yet transferred
+ * @param journal The journal object
+ * @param error The GError object or NULL
+ * @return A new array with the file paths, oldest first. If an error occured the error is set
+ * and the array holds the paths read so far.
+ */
+GPtrArray *cdm_journal_get_metadata_untransferred (CdmJournal *journal, GError **error);
 
 /**
  * @brief Get next victim
@@ -189,6 +414,57 @@ gchar *cdm_journal_get_untransferred (CdmJournal *journal, GError **error);
  */
 gchar *cdm_journal_get_victim (CdmJournal *journal, GError **error);
 
+/**
+ * @brief Get the oldest victims needed to release the requested usage
+ * @param journal The journal object
+ * @param context_name Only select victims from this context or NULL for any
+ * @param proc_name Only select victims from this process or NULL for any, ignored if
+ * context_name is set
+ * @param free_size The data size to release
+ * @param free_count The number of entries to release
+ * @param exclude Set of file paths never selected as victims or NULL
+ * @param error The GError object or NULL
+ * @return A new array of CdmJournalVictim objects in eviction order, empty if no victim is
+ * needed or available. If an error occured the error is set.
+ */
+GPtrArray *cdm_journal_get_victims (CdmJournal *journal, const gchar *context_name,
+                                    const gchar *proc_name, gssize free_size, gssize free_count,
+                                    GHashTable *exclude, GError **error);
+
+/**
+ * @brief Get the crash statistics, each entry added is counted even after its removal
+ * @param journal The journal object
+ * @param crash_id Only get the statistics for this crash id or NULL for all
+ * @param error The GError object or NULL
+ * @return A new array of CdmJournalStats ordered by latest crash first. If an error
+ * occured the error is set.
+ */
+GPtrArray *cdm_journal_get_stats (CdmJournal *journal, const gchar *crash_id, GError **error);
+
+/**
+ * @brief Release a crash statistics object
+ * @param stats The crash statistics object
+ */
+void cdm_journal_stats_free (CdmJournalStats *stats);
+
+/**
+ * @brief Release a victim object
+ * @param victim The victim object
+ */
+void cdm_journal_victim_free (CdmJournalVictim *victim);
+
+#ifdef WITH_TESTS
+/**
+ * @brief Check the query plan of each prepared statement
+ * Fails on a full scan of the journal table and on a temporary sort for the statements
+ * expected to read their covering index in order.
+ * @param journal The journal object
+ * @param error The GError object or NULL
+ * @return TRUE if all plans are as expected
+ */
+gboolean cdm_journal_check_query_plans (CdmJournal *journal, GError **error);
+#endif
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (CdmJournal, cdm_journal_unref);
 
 G_END_DECLS
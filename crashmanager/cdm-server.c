@@ -21,6 +21,10 @@
  * \file cdm-server.c
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "cdm-server.h"
 #include "cdm-client.h"
 
@@ -101,9 +105,8 @@ server_source_callback (gpointer cdmserver)
 
   g_assert (server);
 
-  clientfd = accept (server->sockfd, (struct sockaddr *)NULL, NULL);
-
-  if (clientfd >= 0)
+  /* accept all pending connections so a crash storm does not overflow the backlog */
+  while ((clientfd = accept4 (server->sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
     {
       CdmClient *client = cdm_client_new (clientfd, server->transfer, server->journal);
 
@@ -118,9 +121,23 @@ server_source_callback (gpointer cdmserver)
 #endif
       g_debug ("New client connected %d", clientfd);
     }
-  else
+
+  switch (errno)
     {
-      g_warning ("Server accept failed");
+    case EAGAIN:
+    case EINTR:
+    case ECONNABORTED:
+      break;
+
+    case EMFILE:
+    case ENFILE:
+    case ENOBUFS:
+    case ENOMEM:
+      g_warning ("Server accept failed: %s", strerror (errno));
+      break;
+
+    default:
+      g_warning ("Server accept failed: %s", strerror (errno));
       return FALSE;
     }
 
@@ -153,7 +170,7 @@ cdm_server_new (CdmOptions *options, CdmTransfer *transfer, CdmJournal *journal,
   server->transfer = cdm_transfer_ref (transfer);
   server->journal = cdm_journal_ref (journal);
 
-  server->sockfd = socket (AF_UNIX, SOCK_STREAM, 0);
+  server->sockfd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
   if (server->sockfd < 0)
     {
       g_warning ("Cannot create server socket");
@@ -219,12 +236,14 @@ cdm_server_bind_and_listen (CdmServer *server)
   g_autofree gchar *udspath = NULL;
   CdmStatus status = CDM_STATUS_OK;
   struct sockaddr_un saddr;
+  gint backlog;
 
   g_assert (server);
 
   run_dir = cdm_options_string_for (server->options, KEY_RUN_DIR);
   sock_addr = cdm_options_string_for (server->options, KEY_IPC_SOCK_ADDR);
   udspath = g_build_filename (run_dir, sock_addr, NULL);
+  backlog = (gint)cdm_options_long_for (server->options, KEY_IPC_LISTEN_BACKLOG);
 
   unlink (udspath);
 
@@ -236,7 +255,7 @@ cdm_server_bind_and_listen (CdmServer *server)
 
   if (bind (server->sockfd, (struct sockaddr *)&saddr, sizeof (struct sockaddr_un)) != -1)
     {
-      if (listen (server->sockfd, 10) == -1)
+      if (listen (server->sockfd, backlog) == -1)
         {
           g_warning ("Server listen failed for path %s", saddr.sun_path);
           status = CDM_STATUS_ERROR;
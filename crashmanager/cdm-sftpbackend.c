@@ -0,0 +1,304 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-sftpbackend.c
+ */
+
+#include "cdm-sftpbackend.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SFTP_BUFFER_SZ (256 * 1024)
+#define SFTP_PART_SUFFIX ".part"
+#define SFTP_HASH_SUFFIX ".sha256"
+
+/**
+ * @brief Write the archive hash file next to the remote archive
+ */
+static CdmStatus sftpbackend_write_hash (CdmSSHSession *ssh, const gchar *remote_path,
+                                         const gchar *hash);
+
+/**
+ * @brief Upload an archive over sftp resuming from the acknowledged offset
+ */
+static CdmStatus sftpbackend_upload (CdmTransferBackend *_backend, CdmTransfer *transfer,
+                                     CdmTransferEntry *entry);
+
+/**
+ * @brief Free the backend
+ */
+static void sftpbackend_free (CdmTransferBackend *_backend);
+
+static CdmStatus
+sftpbackend_write_hash (CdmSSHSession *ssh, const gchar *remote_path, const gchar *hash)
+{
+  g_autofree gchar *hash_path = g_strconcat (remote_path, SFTP_HASH_SUFFIX, NULL);
+  g_autofree gchar *file_basename = g_path_get_basename (remote_path);
+  g_autofree gchar *line = g_strdup_printf ("%s  %s\n", hash, file_basename);
+  LIBSSH2_SFTP_HANDLE *handle = NULL;
+  gsize len = strlen (line);
+  gsize written = 0;
+
+  handle = libssh2_sftp_open (ssh->sftp, hash_path,
+                              LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC, 0644);
+  if (handle == NULL)
+    return CDM_STATUS_ERROR;
+
+  while (written < len)
+    {
+      ssize_t retval = libssh2_sftp_write (handle, line + written, len - written);
+
+      if (retval < 0)
+        break;
+
+      written += (gsize)retval;
+    }
+
+  if (libssh2_sftp_close (handle) != 0)
+    return CDM_STATUS_ERROR;
+
+  return written == len ? CDM_STATUS_OK : CDM_STATUS_ERROR;
+}
+
+static CdmStatus
+sftpbackend_upload (CdmTransferBackend *_backend, CdmTransfer *transfer,
+                    CdmTransferEntry *entry)
+{
+  CdmSFTPBackend *backend = (CdmSFTPBackend *)_backend;
+  g_autofree gchar *file_basename = NULL;
+  g_autofree gchar *remote_path = NULL;
+  g_autofree gchar *part_path = NULL;
+  g_autofree gchar *buffer = NULL;
+  g_autoptr (GChecksum) checksum = NULL;
+  g_autoptr (GError) error = NULL;
+  LIBSSH2_SFTP_HANDLE *handle = NULL;
+  LIBSSH2_SFTP_ATTRIBUTES attrs;
+  CdmSSHSession *ssh = NULL;
+  gboolean healthy = TRUE;
+  gboolean done = FALSE;
+  struct stat fileinfo;
+  gint64 checkpoint;
+  gint64 offset;
+  FILE *local = NULL;
+
+  local = fopen (entry->upload_path, "rb");
+  if (!local)
+    {
+      g_warning ("Can't open local file for transfer %s", entry->upload_path);
+      return CDM_STATUS_ERROR;
+    }
+
+  if (fstat (fileno (local), &fileinfo) != 0)
+    {
+      g_warning ("Can't stat local file for transfer %s", entry->upload_path);
+      fclose (local);
+      return CDM_STATUS_ERROR;
+    }
+
+  ssh = cdm_sshpool_acquire (backend->sshpool, &error);
+  if (ssh == NULL)
+    {
+      g_warning ("Fail to open ssh session. Error %s", error->message);
+      fclose (local);
+      return CDM_STATUS_ERROR;
+    }
+
+  file_basename = g_path_get_basename (entry->upload_path);
+  remote_path = g_build_filename (backend->remote_dir, file_basename, NULL);
+  part_path = g_strconcat (remote_path, SFTP_PART_SUFFIX, NULL);
+
+  /* a resume needs the remote part file to hold at least the acknowledged data */
+  offset = CLAMP (entry->offset, 0, (gint64)fileinfo.st_size);
+  if (offset > 0
+      && (libssh2_sftp_stat (ssh->sftp, part_path, &attrs) != 0
+          || (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) == 0 || attrs.filesize < (guint64)offset))
+    {
+      g_info ("Cannot resume transfer for %s, restart from the beginning", file_basename);
+      offset = 0;
+    }
+
+  /* upload under a temporary name so the server never sees a partial archive */
+  handle = libssh2_sftp_open (ssh->sftp, part_path,
+                              LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT
+                                  | (offset == 0 ? LIBSSH2_FXF_TRUNC : 0),
+                              (long)(fileinfo.st_mode & 0777));
+  if (handle == NULL)
+    {
+      g_warning ("Unable to open remote file %s: (%lu)", part_path,
+                 libssh2_sftp_last_error (ssh->sftp));
+      cdm_sshpool_release (backend->sshpool, ssh, FALSE);
+      fclose (local);
+      return CDM_STATUS_ERROR;
+    }
+
+  /* libssh2 splits large writes into several in-flight sftp packets */
+  buffer = g_malloc (SFTP_BUFFER_SZ);
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  /* the archive hash also covers the data acknowledged by a previous attempt */
+  for (gint64 hashed = 0; hashed < offset && healthy;)
+    {
+      size_t nread = fread (buffer, 1, (size_t)MIN (offset - hashed, SFTP_BUFFER_SZ), local);
+
+      if (nread == 0)
+        healthy = FALSE;
+
+      g_checksum_update (checksum, (const guchar *)buffer, (gssize)nread);
+      hashed += (gint64)nread;
+    }
+
+  if (offset > 0)
+    {
+      g_info ("Resume transfer for %s at offset %ld", file_basename, offset);
+      libssh2_sftp_seek64 (handle, (libssh2_uint64_t)offset);
+    }
+
+  checkpoint = offset;
+
+  while (healthy)
+    {
+      size_t nread = fread (buffer, 1, SFTP_BUFFER_SZ, local);
+      gchar *ptr = buffer;
+
+      if (nread == 0)
+        {
+          done = (ferror (local) == 0);
+          break;
+        }
+
+      g_checksum_update (checksum, (const guchar *)buffer, (gssize)nread);
+
+      while (nread > 0)
+        {
+          gsize allowed = cdm_transfer_throttle (transfer, entry, nread);
+          ssize_t retval = libssh2_sftp_write (handle, ptr, allowed);
+
+          if (retval < 0)
+            {
+              g_warning ("Transfer error %ld", retval);
+              healthy = FALSE;
+              break;
+            }
+
+          /* pipelined writes may take less than allowed, the rest stays paid for */
+          cdm_transfer_sent (transfer, entry, (gsize)retval);
+
+          ptr += retval;
+          nread -= (size_t)retval;
+          offset += retval;
+        }
+
+      /* the write returns once the server acknowledged the data */
+      if (offset - checkpoint >= (gint64)transfer->chunk_size)
+        {
+          cdm_transfer_checkpoint (transfer, entry, offset);
+          checkpoint = offset;
+        }
+    }
+
+  if (libssh2_sftp_close (handle) != 0)
+    done = FALSE;
+
+  if (!done && offset > checkpoint)
+    cdm_transfer_checkpoint (transfer, entry, offset);
+
+  if (done
+      && (libssh2_sftp_stat (ssh->sftp, part_path, &attrs) != 0
+          || attrs.filesize != (guint64)fileinfo.st_size))
+    {
+      g_warning ("Remote size mismatch for %s, the transfer restarts", part_path);
+
+      cdm_transfer_checkpoint (transfer, entry, 0);
+
+      done = FALSE;
+    }
+
+  if (done)
+    {
+      const gchar *hash = g_checksum_get_string (checksum);
+
+      /* the hash file is in place before the archive shows up under its final name, the
+       * archive keeps its part name and the next attempt only writes the hash again */
+      if (sftpbackend_write_hash (ssh, remote_path, hash) != CDM_STATUS_OK)
+        {
+          g_warning ("Unable to write the hash file for %s", remote_path);
+          cdm_transfer_checkpoint (transfer, entry, offset);
+          done = FALSE;
+        }
+      else
+        libssh2_sftp_unlink (ssh->sftp, remote_path);
+
+      if (done && libssh2_sftp_rename (ssh->sftp, part_path, remote_path) != 0)
+        {
+          g_warning ("Unable to rename remote file %s: (%lu)", part_path,
+                     libssh2_sftp_last_error (ssh->sftp));
+          done = FALSE;
+        }
+      else if (done)
+        g_debug ("Transfer complete for %s (%ld bytes) sha256 %s", file_basename,
+                 fileinfo.st_size, hash);
+    }
+
+  cdm_sshpool_release (backend->sshpool, ssh, healthy);
+  fclose (local);
+
+  return done ? CDM_STATUS_OK : CDM_STATUS_ERROR;
+}
+
+static void
+sftpbackend_free (CdmTransferBackend *_backend)
+{
+  CdmSFTPBackend *backend = (CdmSFTPBackend *)_backend;
+
+  cdm_sshpool_unref (backend->sshpool);
+  g_free (backend->remote_dir);
+  g_free (backend->parent.destination);
+  g_free (backend);
+}
+
+CdmTransferBackend *
+cdm_sftpbackend_new (CdmOptions *options)
+{
+  g_autofree gchar *serveraddr = NULL;
+  CdmSFTPBackend *backend;
+
+  g_assert (options);
+
+  serveraddr = cdm_options_string_for (options, KEY_TRANSFER_ADDRESS);
+  if (strlen (serveraddr) == 0)
+    {
+      g_info ("No transfer address set, sftp uploads are skipped");
+      return NULL;
+    }
+
+  backend = g_new0 (CdmSFTPBackend, 1);
+
+  backend->parent.name = "sftp";
+  backend->parent.destination = g_strdup_printf ("sftp://%s", serveraddr);
+  backend->parent.upload = sftpbackend_upload;
+  backend->parent.free = sftpbackend_free;
+
+  backend->sshpool = cdm_sshpool_new (options);
+  backend->remote_dir = cdm_options_string_for (options, KEY_TRANSFER_PATH);
+
+  return (CdmTransferBackend *)backend;
+}
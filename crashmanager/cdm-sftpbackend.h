@@ -0,0 +1,51 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-sftpbackend.h
+ */
+
+#pragma once
+
+#include "cdm-options.h"
+#include "cdm-sshpool.h"
+#include "cdm-transfer.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * @brief Backend uploading the archives over sftp
+ */
+typedef struct _CdmSFTPBackend
+{
+  CdmTransferBackend parent; /**< Backend interface */
+  CdmSSHPool *sshpool;       /**< Pooled ssh sessions for uploads */
+  gchar *remote_dir;         /**< Remote directory the archives are uploaded to */
+} CdmSFTPBackend;
+
+/*
+ * @brief Create a new sftp backend
+ * @param options Pointer to the options object
+ * @return On success return a new backend, NULL if no server is configured
+ */
+CdmTransferBackend *cdm_sftpbackend_new (CdmOptions *options);
+
+G_END_DECLS
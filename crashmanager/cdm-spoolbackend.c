@@ -0,0 +1,541 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-spoolbackend.c
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "cdm-spoolbackend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPOOL_BUFFER_SZ (256 * 1024)
+#define SPOOL_TEMP_SUFFIX ".part"
+#define SPOOL_MARKER_SUFFIX ".done"
+#define SPOOL_HASH_SUFFIX ".sha256"
+#define SPOOL_RECIPE_SUFFIX ".recipe"
+#define SPOOL_CHUNK_DIR "chunks"
+
+/**
+ * @brief Copy the archive data from offset using copy_file_range or a plain copy as fallback
+ * @return TRUE if all data is copied
+ */
+static gboolean spoolbackend_copy (CdmTransfer *transfer, CdmTransferEntry *entry, gint src,
+                                   gint dst, gint64 offset, gint64 size);
+
+/**
+ * @brief Flush a directory so the renames inside are persistent
+ */
+static void spoolbackend_sync_dir (const gchar *path);
+
+/**
+ * @brief Deliver an archive to the spool directory
+ */
+static CdmStatus spoolbackend_upload (CdmTransferBackend *_backend, CdmTransfer *transfer,
+                                      CdmTransferEntry *entry);
+
+/**
+ * @brief Compute the sha256 of a file
+ * @return The hash string or NULL on read error
+ */
+static gchar *spoolbackend_hash (gint fd, gsize *size);
+
+/**
+ * @brief Check the size and the sha256 of a written file, the hash check is skipped if NULL
+ */
+static gboolean spoolbackend_verify (gint fd, gsize size, const gchar *hash);
+
+/**
+ * @brief Write a file through a unique temporary file and rename it in place
+ * @return TRUE if the file is on disk with the expected size and hash
+ */
+static gboolean spoolbackend_store (const gchar *dir, const gchar *name, const guint8 *data,
+                                    gsize size, const gchar *hash);
+
+/**
+ * @brief Path of a chunk in the chunk store
+ */
+static gchar *spoolbackend_chunk_path (CdmSpoolBackend *backend, const gchar *hash);
+
+/**
+ * @brief Mark the chunks not in the chunk store
+ */
+static CdmStatus spoolbackend_delta_query (CdmTransferBackend *_backend, CdmTransferEntry *entry,
+                                           GArray *chunks);
+
+/**
+ * @brief Add a chunk to the chunk store
+ */
+static CdmStatus spoolbackend_delta_chunk (CdmTransferBackend *_backend, CdmTransferEntry *entry,
+                                           const CdmDeltaChunk *chunk, const guint8 *data);
+
+/**
+ * @brief Deliver the recipe of an archive to the spool directory
+ */
+static CdmStatus spoolbackend_delta_recipe (CdmTransferBackend *_backend, CdmTransferEntry *entry,
+                                            const gchar *recipe);
+
+/**
+ * @brief Free the backend
+ */
+static void spoolbackend_free (CdmTransferBackend *_backend);
+
+static gboolean
+spoolbackend_copy (CdmTransfer *transfer, CdmTransferEntry *entry, gint src, gint dst,
+                   gint64 offset, gint64 size)
+{
+  g_autofree gchar *buffer = NULL;
+  loff_t off_in = offset;
+  loff_t off_out = offset;
+  gint64 checkpoint = offset;
+
+  while (off_in < size)
+    {
+      gsize len
+          = cdm_transfer_throttle (transfer, entry, (gsize)MIN (size - off_in, SPOOL_BUFFER_SZ));
+      loff_t off_start = off_out;
+      ssize_t retval = -1;
+
+      if (buffer == NULL)
+        {
+          /* the data is copied inside the kernel or shared by the filesystem */
+          retval = copy_file_range (src, &off_in, dst, &off_out, len, 0);
+
+          if (retval < 0
+              && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+            {
+              g_debug ("No copy_file_range support for %s, fallback to copy", entry->upload_path);
+              buffer = g_malloc (SPOOL_BUFFER_SZ);
+            }
+        }
+
+      if (buffer != NULL)
+        {
+          retval = pread (src, buffer, len, off_in);
+
+          for (ssize_t written = 0; retval > 0 && written < retval;)
+            {
+              ssize_t wrote = pwrite (dst, buffer + written, (size_t)(retval - written), off_out);
+
+              if (wrote < 0)
+                {
+                  retval = -1;
+                  break;
+                }
+
+              written += wrote;
+              off_out += wrote;
+            }
+
+          if (retval > 0)
+            off_in += retval;
+        }
+
+      /* a short copy only counts what reached the destination */
+      if (off_out > off_start)
+        cdm_transfer_sent (transfer, entry, (gsize)(off_out - off_start));
+
+      if (retval <= 0)
+        {
+          g_warning ("Copy failed for %s at offset %ld: %s", entry->upload_path, (gint64)off_out,
+                     retval < 0 ? strerror (errno) : "unexpected end of file");
+          break;
+        }
+
+      /* only data on disk counts as acknowledged */
+      if (off_out - checkpoint >= (gint64)transfer->chunk_size && fdatasync (dst) == 0)
+        {
+          cdm_transfer_checkpoint (transfer, entry, off_out);
+          checkpoint = off_out;
+        }
+    }
+
+  if (off_out < size && off_out > checkpoint && fdatasync (dst) == 0)
+    cdm_transfer_checkpoint (transfer, entry, off_out);
+
+  return off_out == size;
+}
+
+static void
+spoolbackend_sync_dir (const gchar *path)
+{
+  gint fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (fd < 0)
+    return;
+
+  if (fsync (fd) != 0)
+    g_warning ("Fail to sync spool directory %s", path);
+
+  close (fd);
+}
+
+static CdmStatus
+spoolbackend_upload (CdmTransferBackend *_backend, CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  CdmSpoolBackend *backend = (CdmSpoolBackend *)_backend;
+  g_autofree gchar *file_basename = g_path_get_basename (entry->upload_path);
+  g_autofree gchar *spool_path = g_build_filename (backend->spool_dir, file_basename, NULL);
+  g_autofree gchar *marker_path = g_strconcat (spool_path, SPOOL_MARKER_SUFFIX, NULL);
+  g_autofree gchar *temp_name = g_strconcat (".", file_basename, SPOOL_TEMP_SUFFIX, NULL);
+  g_autofree gchar *temp_path = g_build_filename (backend->spool_dir, temp_name, NULL);
+  g_autofree gchar *hash_name = g_strconcat (file_basename, SPOOL_HASH_SUFFIX, NULL);
+  g_autofree gchar *hash_line = NULL;
+  g_autofree gchar *hash = NULL;
+  g_autofree gchar *marker = NULL;
+  g_autoptr (GError) error = NULL;
+  struct stat fileinfo;
+  struct stat tempinfo;
+  gboolean done = FALSE;
+  gint64 offset;
+  gint src;
+  gint dst;
+
+  src = open (entry->upload_path, O_RDONLY | O_CLOEXEC);
+  if (src < 0)
+    {
+      g_warning ("Can't open local file for transfer %s", entry->upload_path);
+      return CDM_STATUS_ERROR;
+    }
+
+  if (fstat (src, &fileinfo) != 0)
+    {
+      g_warning ("Can't stat local file for transfer %s", entry->upload_path);
+      close (src);
+      return CDM_STATUS_ERROR;
+    }
+
+  /* a resume needs the temporary file to hold at least the acknowledged data */
+  offset = CLAMP (entry->offset, 0, (gint64)fileinfo.st_size);
+  if (offset > 0 && (stat (temp_path, &tempinfo) != 0 || tempinfo.st_size < offset))
+    {
+      g_info ("Cannot resume transfer for %s, restart from the beginning", file_basename);
+      offset = 0;
+    }
+
+  /* the temporary name is hidden and in the same directory for an atomic rename */
+  dst = open (temp_path, O_RDWR | O_CREAT | O_CLOEXEC | (offset == 0 ? O_TRUNC : 0),
+              fileinfo.st_mode & 0777);
+  if (dst < 0)
+    {
+      g_warning ("Can't open spool file %s: %s", temp_path, strerror (errno));
+      close (src);
+      return CDM_STATUS_ERROR;
+    }
+
+  /* a reflink shares the extents with the archive, no data is copied */
+  if (offset == 0 && ioctl (dst, FICLONE, src) == 0)
+    {
+      g_debug ("Reflink archive %s to spool", file_basename);
+      done = TRUE;
+    }
+  else
+    {
+      if (offset > 0)
+        g_info ("Resume transfer for %s at offset %ld", file_basename, offset);
+
+      done = spoolbackend_copy (transfer, entry, src, dst, offset, (gint64)fileinfo.st_size);
+
+      /* drop any data left beyond the archive size by an earlier attempt */
+      if (done && ftruncate (dst, fileinfo.st_size) != 0)
+        done = FALSE;
+    }
+
+  if (fsync (dst) != 0)
+    done = FALSE;
+
+  /* the spool copy is read back and checked against the archive, resumed parts included */
+  if (done)
+    {
+      gsize hashed = 0;
+
+      hash = spoolbackend_hash (src, &hashed);
+
+      if (hash == NULL || hashed != (gsize)fileinfo.st_size
+          || !spoolbackend_verify (dst, hashed, hash))
+        {
+          g_warning ("Spool file %s does not match the archive, the transfer restarts",
+                     temp_path);
+          cdm_transfer_checkpoint (transfer, entry, 0);
+          done = FALSE;
+        }
+    }
+
+  if (close (dst) != 0)
+    done = FALSE;
+
+  close (src);
+
+  if (!done)
+    return CDM_STATUS_ERROR;
+
+  /* the hash file is in place before the archive shows up under its final name */
+  hash_line = g_strdup_printf ("%s  %s\n", hash, file_basename);
+  if (!spoolbackend_store (backend->spool_dir, hash_name, (const guint8 *)hash_line,
+                           strlen (hash_line), NULL))
+    return CDM_STATUS_ERROR;
+
+  /* a marker left by an earlier delivery must not announce the new archive early */
+  unlink (marker_path);
+
+  if (rename (temp_path, spool_path) != 0)
+    {
+      g_warning ("Unable to rename spool file %s: %s", temp_path, strerror (errno));
+      return CDM_STATUS_ERROR;
+    }
+
+  marker = g_strdup_printf ("%ld\n", (gint64)fileinfo.st_size);
+  if (!g_file_set_contents (marker_path, marker, -1, &error))
+    {
+      g_warning ("Unable to write spool marker %s: %s", marker_path, error->message);
+      return CDM_STATUS_ERROR;
+    }
+
+  spoolbackend_sync_dir (backend->spool_dir);
+
+  g_debug ("Transfer complete for %s (%ld bytes) to spool sha256 %s", file_basename,
+           (gint64)fileinfo.st_size, hash);
+
+  return CDM_STATUS_OK;
+}
+
+static gchar *
+spoolbackend_hash (gint fd, gsize *size)
+{
+  g_autoptr (GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_autofree guint8 *buffer = g_malloc (SPOOL_BUFFER_SZ);
+  gsize total = 0;
+  ssize_t nread;
+
+  while ((nread = pread (fd, buffer, SPOOL_BUFFER_SZ, (off_t)total)) > 0)
+    {
+      g_checksum_update (checksum, buffer, nread);
+      total += (gsize)nread;
+    }
+
+  if (nread < 0)
+    return NULL;
+
+  *size = total;
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+static gboolean
+spoolbackend_verify (gint fd, gsize size, const gchar *hash)
+{
+  g_autofree gchar *file_hash = NULL;
+  gsize total = 0;
+
+  /* the file is read back so only the content that reached the disk is checked */
+  file_hash = spoolbackend_hash (fd, &total);
+  if (file_hash == NULL || total != size)
+    return FALSE;
+
+  return hash == NULL || g_str_equal (file_hash, hash);
+}
+
+static gboolean
+spoolbackend_store (const gchar *dir, const gchar *name, const guint8 *data, gsize size,
+                    const gchar *hash)
+{
+  g_autofree gchar *temp_name = g_strconcat (".", name, ".XXXXXX", SPOOL_TEMP_SUFFIX, NULL);
+  g_autofree gchar *temp_path = g_build_filename (dir, temp_name, NULL);
+  g_autofree gchar *file_path = g_build_filename (dir, name, NULL);
+  gboolean done = TRUE;
+  gsize written = 0;
+  gint fd;
+
+  /* each writer owns its temporary file, concurrent uploads of a name never share one */
+  fd = g_mkstemp_full (temp_path, O_RDWR | O_CLOEXEC, 0644);
+  if (fd < 0)
+    {
+      g_warning ("Can't open spool file %s: %s", temp_path, strerror (errno));
+      return FALSE;
+    }
+
+  while (done && written < size)
+    {
+      ssize_t wrote = write (fd, data + written, size - written);
+
+      if (wrote < 0)
+        done = FALSE;
+      else
+        written += (gsize)wrote;
+    }
+
+  if (fdatasync (fd) != 0)
+    done = FALSE;
+
+  if (done && !spoolbackend_verify (fd, size, hash))
+    {
+      g_warning ("Spool file %s does not match the data sent", temp_path);
+      errno = EIO;
+      done = FALSE;
+    }
+
+  if (close (fd) != 0)
+    done = FALSE;
+
+  if (done && rename (temp_path, file_path) != 0)
+    done = FALSE;
+
+  if (!done)
+    {
+      g_warning ("Unable to write spool file %s: %s", file_path, strerror (errno));
+      unlink (temp_path);
+      return FALSE;
+    }
+
+  spoolbackend_sync_dir (dir);
+
+  return TRUE;
+}
+
+static gchar *
+spoolbackend_chunk_path (CdmSpoolBackend *backend, const gchar *hash)
+{
+  g_autofree gchar *prefix = g_strndup (hash, 2);
+
+  /* the hash prefix keeps the directories small */
+  return g_build_filename (backend->chunk_dir, prefix, hash, NULL);
+}
+
+static CdmStatus
+spoolbackend_delta_query (CdmTransferBackend *_backend, CdmTransferEntry *entry, GArray *chunks)
+{
+  CdmSpoolBackend *backend = (CdmSpoolBackend *)_backend;
+  g_autoptr (GHashTable) seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+  CDM_UNUSED (entry);
+
+  for (guint i = 0; i < chunks->len; i++)
+    {
+      CdmDeltaChunk *chunk = &g_array_index (chunks, CdmDeltaChunk, i);
+      g_autofree gchar *chunk_path = NULL;
+
+      /* a chunk repeated inside the archive is sent once */
+      if (!g_hash_table_add (seen, chunk->hash))
+        {
+          chunk->missing = FALSE;
+          continue;
+        }
+
+      chunk_path = spoolbackend_chunk_path (backend, chunk->hash);
+      chunk->missing = !g_file_test (chunk_path, G_FILE_TEST_EXISTS);
+    }
+
+  return CDM_STATUS_OK;
+}
+
+static CdmStatus
+spoolbackend_delta_chunk (CdmTransferBackend *_backend, CdmTransferEntry *entry,
+                          const CdmDeltaChunk *chunk, const guint8 *data)
+{
+  CdmSpoolBackend *backend = (CdmSpoolBackend *)_backend;
+  g_autofree gchar *chunk_path = spoolbackend_chunk_path (backend, chunk->hash);
+  g_autofree gchar *chunk_dir = g_path_get_dirname (chunk_path);
+
+  CDM_UNUSED (entry);
+
+  if (g_mkdir_with_parents (chunk_dir, 0755) != 0)
+    {
+      g_warning ("Fail to create chunk directory %s: %s", chunk_dir, strerror (errno));
+      return CDM_STATUS_ERROR;
+    }
+
+  /*
+   * The delta query only checks that a chunk exists, so a chunk is installed only after its
+   * size and hash are verified. Concurrent uploads of the same chunk write their own
+   * temporary files and each rename installs a complete copy.
+   */
+  if (!spoolbackend_store (chunk_dir, chunk->hash, data, chunk->size, chunk->hash))
+    return CDM_STATUS_ERROR;
+
+  return CDM_STATUS_OK;
+}
+
+static CdmStatus
+spoolbackend_delta_recipe (CdmTransferBackend *_backend, CdmTransferEntry *entry,
+                           const gchar *recipe)
+{
+  CdmSpoolBackend *backend = (CdmSpoolBackend *)_backend;
+  g_autofree gchar *file_basename = g_path_get_basename (entry->upload_path);
+  g_autofree gchar *recipe_name = g_strconcat (file_basename, SPOOL_RECIPE_SUFFIX, NULL);
+
+  /* the chunks are on disk already so the recipe announces a complete archive */
+  if (!spoolbackend_store (backend->spool_dir, recipe_name, (const guint8 *)recipe,
+                           strlen (recipe), NULL))
+    return CDM_STATUS_ERROR;
+
+  g_debug ("Delta transfer complete for %s to spool", file_basename);
+
+  return CDM_STATUS_OK;
+}
+
+static void
+spoolbackend_free (CdmTransferBackend *_backend)
+{
+  CdmSpoolBackend *backend = (CdmSpoolBackend *)_backend;
+
+  g_free (backend->spool_dir);
+  g_free (backend->chunk_dir);
+  g_free (backend->parent.destination);
+  g_free (backend);
+}
+
+CdmTransferBackend *
+cdm_spoolbackend_new (CdmOptions *options)
+{
+  g_autofree gchar *spool_dir = NULL;
+  CdmSpoolBackend *backend;
+
+  g_assert (options);
+
+  spool_dir = cdm_options_string_for (options, KEY_TRANSFER_SPOOL_DIR);
+  if (g_mkdir_with_parents (spool_dir, 0755) != 0)
+    {
+      g_warning ("Fail to create spool directory %s: %s", spool_dir, strerror (errno));
+      return NULL;
+    }
+
+  backend = g_new0 (CdmSpoolBackend, 1);
+
+  backend->parent.name = "spool";
+  backend->parent.destination = g_strdup_printf ("file://%s", spool_dir);
+  backend->parent.upload = spoolbackend_upload;
+  backend->parent.free = spoolbackend_free;
+  backend->parent.delta_query = spoolbackend_delta_query;
+  backend->parent.delta_chunk = spoolbackend_delta_chunk;
+  backend->parent.delta_recipe = spoolbackend_delta_recipe;
+  backend->chunk_dir = g_build_filename (spool_dir, SPOOL_CHUNK_DIR, NULL);
+  backend->spool_dir = g_steal_pointer (&spool_dir);
+
+  return (CdmTransferBackend *)backend;
+}
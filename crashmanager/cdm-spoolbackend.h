@@ -0,0 +1,50 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-spoolbackend.h
+ */
+
+#pragma once
+
+#include "cdm-options.h"
+#include "cdm-transfer.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * @brief Backend delivering the archives to a local or mounted spool directory
+ */
+typedef struct _CdmSpoolBackend
+{
+  CdmTransferBackend parent; /**< Backend interface */
+  gchar *spool_dir;          /**< Directory the archives are delivered to */
+  gchar *chunk_dir;          /**< Content addressed store of the delta chunks */
+} CdmSpoolBackend;
+
+/*
+ * @brief Create a new spool directory backend
+ * @param options Pointer to the options object
+ * @return On success return a new backend, NULL if the spool directory is not usable
+ */
+CdmTransferBackend *cdm_spoolbackend_new (CdmOptions *options);
+
+G_END_DECLS
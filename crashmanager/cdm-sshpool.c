@@ -0,0 +1,437 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-sshpool.c
+ */
+
+#include "cdm-sshpool.h"
+
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define SEC2USEC(x) (x * 1000000)
+
+#ifndef SSHPOOL_IO_TIMEOUT_MSEC
+#define SSHPOOL_IO_TIMEOUT_MSEC (30000)
+#endif
+
+/**
+ * @brief Idle sessions handed to a reaper thread
+ */
+typedef struct _SSHPoolReap
+{
+  CdmSSHPool *pool; /**< Referenced pool the sessions return to */
+  GList *sessions;  /**< Sessions taken out of the idle queue */
+} SSHPoolReap;
+
+/**
+ * @brief Open a tcp connection to the first reachable address of the server
+ */
+static gint sshpool_socket_connect (const gchar *address, glong port);
+
+/**
+ * @brief Connect and authenticate a new session
+ */
+static CdmSSHSession *sshpool_session_connect (CdmSSHPool *pool, GError **error);
+
+/**
+ * @brief Close a session and free its resources
+ */
+static void sshpool_session_close (CdmSSHSession *session);
+
+/**
+ * @brief Check if an idle session is still usable
+ */
+static gboolean sshpool_session_alive (CdmSSHSession *session);
+
+/**
+ * @brief Order idle sessions by release time
+ */
+static gint sshpool_session_compare (gconstpointer a, gconstpointer b, gpointer user_data);
+
+/**
+ * @brief Reaper thread sending keepalives and closing expired sessions
+ */
+static gpointer reaper_thread (gpointer _reap);
+
+/**
+ * @brief Reaper timer callback handing the sessions due for a check to a reaper thread
+ */
+static gboolean reaper_timer_callback (gpointer _pool);
+
+static gint
+sshpool_socket_connect (const gchar *address, glong port)
+{
+  g_autofree gchar *service = g_strdup_printf ("%ld", port);
+  struct addrinfo hints;
+  struct addrinfo *result = NULL;
+  gint sock = -1;
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV;
+
+  if (getaddrinfo (address, service, &hints, &result) != 0)
+    return -1;
+
+  for (struct addrinfo *ai = result; ai != NULL; ai = ai->ai_next)
+    {
+      sock = socket (ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+      if (sock < 0)
+        continue;
+
+      if (connect (sock, ai->ai_addr, ai->ai_addrlen) == 0)
+        break;
+
+      close (sock);
+      sock = -1;
+    }
+
+  freeaddrinfo (result);
+
+  return sock;
+}
+
+static CdmSSHSession *
+sshpool_session_connect (CdmSSHPool *pool, GError **error)
+{
+  g_autofree gchar *serveraddr = NULL;
+  g_autofree gchar *username = NULL;
+  g_autofree gchar *password = NULL;
+  g_autofree gchar *publickey = NULL;
+  g_autofree gchar *privatekey = NULL;
+  CdmSSHSession *session = g_new0 (CdmSSHSession, 1);
+  gint rc;
+
+  serveraddr = cdm_options_string_for (pool->options, KEY_TRANSFER_ADDRESS);
+
+  session->sock = sshpool_socket_connect (
+      serveraddr, cdm_options_long_for (pool->options, KEY_TRANSFER_PORT));
+  if (session->sock < 0)
+    {
+      g_set_error (error, g_quark_from_static_string ("SSHPoolConnect"), 1,
+                   "Failed to connect to %s", serveraddr);
+      goto connect_error;
+    }
+
+  session->session = libssh2_session_init ();
+  if (session->session == NULL)
+    {
+      g_set_error (error, g_quark_from_static_string ("SSHPoolConnect"), 1,
+                   "Failed to create libssh2 session");
+      goto connect_error;
+    }
+
+  libssh2_session_set_blocking (session->session, 1);
+  libssh2_session_set_timeout (session->session, SSHPOOL_IO_TIMEOUT_MSEC);
+
+  rc = libssh2_session_handshake (session->session, session->sock);
+  if (rc != 0)
+    {
+      g_set_error (error, g_quark_from_static_string ("SSHPoolConnect"), 1,
+                   "Failure establishing SSH session: %d", rc);
+      goto connect_error;
+    }
+
+  username = cdm_options_string_for (pool->options, KEY_TRANSFER_USER);
+  password = cdm_options_string_for (pool->options, KEY_TRANSFER_PASSWORD);
+  publickey = cdm_options_string_for (pool->options, KEY_TRANSFER_PUBLIC_KEY);
+  privatekey = cdm_options_string_for (pool->options, KEY_TRANSFER_PRIVATE_KEY);
+
+  if (libssh2_userauth_publickey_fromfile (session->session, username, publickey, privatekey,
+                                           password))
+    {
+      g_set_error (error, g_quark_from_static_string ("SSHPoolConnect"), 1,
+                   "Authentication by public key failed");
+      goto connect_error;
+    }
+
+  session->sftp = libssh2_sftp_init (session->session);
+  if (session->sftp == NULL)
+    {
+      gchar *errmsg = NULL;
+      gint err = libssh2_session_last_error (session->session, &errmsg, NULL, 0);
+
+      g_set_error (error, g_quark_from_static_string ("SSHPoolConnect"), 1,
+                   "Unable to start sftp: (%d) %s", err, errmsg);
+      goto connect_error;
+    }
+
+  if (pool->keepalive > 0)
+    libssh2_keepalive_config (session->session, 1, pool->keepalive);
+
+  g_debug ("New ssh session to %s", serveraddr);
+
+  return session;
+
+connect_error:
+  sshpool_session_close (session);
+  return NULL;
+}
+
+static void
+sshpool_session_close (CdmSSHSession *session)
+{
+  if (session->sftp != NULL)
+    libssh2_sftp_shutdown (session->sftp);
+
+  if (session->session != NULL)
+    {
+      libssh2_session_disconnect (session->session, "Normal Shutdown");
+      libssh2_session_free (session->session);
+    }
+
+  if (session->sock >= 0)
+    close (session->sock);
+
+  g_free (session);
+}
+
+static gboolean
+sshpool_session_alive (CdmSSHSession *session)
+{
+  gint next = 0;
+
+  /* a no-op if the interval did not elapse, otherwise sends and fails on a dead peer */
+  return libssh2_keepalive_send (session->session, &next) == 0;
+}
+
+static gint
+sshpool_session_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const CdmSSHSession *sa = (const CdmSSHSession *)a;
+  const CdmSSHSession *sb = (const CdmSSHSession *)b;
+
+  CDM_UNUSED (user_data);
+
+  return (sa->last_used > sb->last_used) - (sa->last_used < sb->last_used);
+}
+
+static gpointer
+reaper_thread (gpointer _reap)
+{
+  SSHPoolReap *reap = (SSHPoolReap *)_reap;
+  CdmSSHPool *pool = reap->pool;
+
+  for (GList *link = reap->sessions; link != NULL; link = link->next)
+    {
+      CdmSSHSession *session = (CdmSSHSession *)link->data;
+      gint64 now = g_get_monotonic_time ();
+
+      /* a dead peer blocks here up to the io timeout, never on the main loop */
+      if ((now - session->last_used) < pool->idle_timeout && sshpool_session_alive (session))
+        {
+          session->last_alive = now;
+
+          g_mutex_lock (&pool->lock);
+          if (g_queue_get_length (&pool->idle) < pool->max_idle)
+            {
+              g_queue_insert_sorted (&pool->idle, session, sshpool_session_compare, NULL);
+              session = NULL;
+            }
+          g_mutex_unlock (&pool->lock);
+        }
+
+      if (session != NULL)
+        {
+          g_debug ("Close idle ssh session");
+          sshpool_session_close (session);
+        }
+    }
+
+  g_mutex_lock (&pool->lock);
+  pool->reaping = FALSE;
+  g_mutex_unlock (&pool->lock);
+
+  g_list_free (reap->sessions);
+  cdm_sshpool_unref (pool);
+  g_free (reap);
+
+  return NULL;
+}
+
+static gboolean
+reaper_timer_callback (gpointer _pool)
+{
+  CdmSSHPool *pool = (CdmSSHPool *)_pool;
+  gint64 keepalive = SEC2USEC ((gint64)pool->keepalive);
+  gint64 now = g_get_monotonic_time ();
+  GList *sessions = NULL;
+  GList *link;
+
+  g_assert (pool);
+
+  /* only the queue is touched under the lock, the session io runs on the reaper thread */
+  g_mutex_lock (&pool->lock);
+
+  link = pool->reaping ? NULL : pool->idle.head;
+  while (link != NULL)
+    {
+      CdmSSHSession *session = (CdmSSHSession *)link->data;
+      GList *next = link->next;
+
+      if ((now - session->last_used) >= pool->idle_timeout
+          || (keepalive > 0 && (now - session->last_alive) >= keepalive))
+        {
+          g_queue_unlink (&pool->idle, link);
+          sessions = g_list_concat (sessions, link);
+        }
+
+      link = next;
+    }
+
+  if (sessions != NULL)
+    pool->reaping = TRUE;
+
+  g_mutex_unlock (&pool->lock);
+
+  if (sessions != NULL)
+    {
+      SSHPoolReap *reap = g_new0 (SSHPoolReap, 1);
+
+      reap->pool = cdm_sshpool_ref (pool);
+      reap->sessions = sessions;
+
+      g_thread_unref (g_thread_new ("sshreaper", reaper_thread, reap));
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+CdmSSHPool *
+cdm_sshpool_new (CdmOptions *options)
+{
+  CdmSSHPool *pool = g_new0 (CdmSSHPool, 1);
+  gint rc;
+
+  g_assert (options);
+
+  g_ref_count_init (&pool->rc);
+  g_mutex_init (&pool->lock);
+  g_queue_init (&pool->idle);
+
+  rc = libssh2_init (0);
+  if (rc != 0)
+    g_warning ("Libssh2 initialization failed (%d)", rc);
+
+  pool->options = cdm_options_ref (options);
+  pool->idle_timeout = SEC2USEC (cdm_options_long_for (options, KEY_TRANSFER_IDLE_TIMEOUT));
+  pool->keepalive = (guint)cdm_options_long_for (options, KEY_TRANSFER_KEEPALIVE);
+  pool->max_idle = (guint)MAX (cdm_options_long_for (options, KEY_TRANSFER_DEST_WORKERS), 1);
+
+  if (pool->idle_timeout > 0)
+    {
+      guint interval = pool->keepalive > 0 ? pool->keepalive : 1;
+
+      pool->reaper = g_timeout_source_new_seconds (interval);
+      g_source_set_callback (pool->reaper, G_SOURCE_FUNC (reaper_timer_callback), pool, NULL);
+      g_source_attach (pool->reaper, NULL);
+    }
+
+  return pool;
+}
+
+CdmSSHPool *
+cdm_sshpool_ref (CdmSSHPool *pool)
+{
+  g_assert (pool);
+  g_ref_count_inc (&pool->rc);
+  return pool;
+}
+
+void
+cdm_sshpool_unref (CdmSSHPool *pool)
+{
+  g_assert (pool);
+
+  if (g_ref_count_dec (&pool->rc) == TRUE)
+    {
+      CdmSSHSession *session;
+
+      if (pool->reaper != NULL)
+        {
+          g_source_destroy (pool->reaper);
+          g_source_unref (pool->reaper);
+        }
+
+      while ((session = (CdmSSHSession *)g_queue_pop_head (&pool->idle)) != NULL)
+        sshpool_session_close (session);
+
+      libssh2_exit ();
+      cdm_options_unref (pool->options);
+      g_mutex_clear (&pool->lock);
+      g_free (pool);
+    }
+}
+
+CdmSSHSession *
+cdm_sshpool_acquire (CdmSSHPool *pool, GError **error)
+{
+  CdmSSHSession *session;
+
+  g_assert (pool);
+
+  do
+    {
+      g_mutex_lock (&pool->lock);
+      session = (CdmSSHSession *)g_queue_pop_tail (&pool->idle);
+      g_mutex_unlock (&pool->lock);
+
+      if (session == NULL)
+        break;
+
+      if (sshpool_session_alive (session))
+        return session;
+
+      g_debug ("Drop dead ssh session");
+      sshpool_session_close (session);
+    }
+  while (TRUE);
+
+  return sshpool_session_connect (pool, error);
+}
+
+void
+cdm_sshpool_release (CdmSSHPool *pool, CdmSSHSession *session, gboolean reuse)
+{
+  g_assert (pool);
+  g_assert (session);
+
+  if (reuse && pool->idle_timeout > 0)
+    {
+      session->last_used = g_get_monotonic_time ();
+      session->last_alive = session->last_used;
+
+      g_mutex_lock (&pool->lock);
+      if (g_queue_get_length (&pool->idle) < pool->max_idle)
+        {
+          g_queue_push_tail (&pool->idle, session);
+          session = NULL;
+        }
+      g_mutex_unlock (&pool->lock);
+    }
+
+  if (session != NULL)
+    sshpool_session_close (session);
+}
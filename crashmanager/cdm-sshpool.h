@@ -0,0 +1,102 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-sshpool.h
+ */
+
+#pragma once
+
+#include "cdm-options.h"
+#include "cdm-types.h"
+
+#include <glib.h>
+#include <libssh2.h>
+#include <libssh2_sftp.h>
+
+G_BEGIN_DECLS
+
+/**
+ * @brief An authenticated ssh session with its sftp channel
+ */
+typedef struct _CdmSSHSession
+{
+  gint sock;                /**< Connected socket */
+  LIBSSH2_SESSION *session; /**< The ssh session */
+  LIBSSH2_SFTP *sftp;       /**< The sftp channel on the session */
+  gint64 last_used;         /**< Monotonic time when the session was last released */
+  gint64 last_alive;        /**< Monotonic time when the session was last known alive */
+} CdmSSHSession;
+
+/**
+ * @brief The CdmSSHPool opaque data structure
+ */
+typedef struct _CdmSSHPool
+{
+  grefcount rc;         /**< Reference counter variable  */
+  CdmOptions *options;  /**< Options object */
+  GMutex lock;          /**< Protects the idle session queue */
+  GQueue idle;          /**< Idle sessions, most recently used at the tail */
+  gint64 idle_timeout;  /**< Idle session lifetime in microseconds */
+  guint keepalive;      /**< Keepalive interval in seconds */
+  guint max_idle;       /**< Maximum number of idle sessions kept */
+  GSource *reaper;      /**< Idle session keepalive and teardown source */
+  gboolean reaping;     /**< A reaper thread owns the sessions taken out for checking */
+} CdmSSHPool;
+
+/*
+ * @brief Create a new ssh session pool
+ * @param options Pointer to the options object
+ * @return On success return a new CdmSSHPool object
+ */
+CdmSSHPool *cdm_sshpool_new (CdmOptions *options);
+
+/**
+ * @brief Aquire ssh pool object
+ * @param pool Pointer to the ssh pool object
+ * @return The referenced ssh pool object
+ */
+CdmSSHPool *cdm_sshpool_ref (CdmSSHPool *pool);
+
+/**
+ * @brief Release ssh pool object
+ * @param pool Pointer to the ssh pool object
+ */
+void cdm_sshpool_unref (CdmSSHPool *pool);
+
+/**
+ * @brief Take a live session from the pool or connect a new one
+ * The caller owns the session until cdm_sshpool_release is called.
+ * @param pool Pointer to the ssh pool object
+ * @param error The GError object or NULL
+ * @return On success return a session otherwise return NULL
+ */
+CdmSSHSession *cdm_sshpool_acquire (CdmSSHPool *pool, GError **error);
+
+/**
+ * @brief Return a session to the pool
+ * @param pool Pointer to the ssh pool object
+ * @param session The session returned by cdm_sshpool_acquire
+ * @param reuse If FALSE the session had an error and is closed
+ */
+void cdm_sshpool_release (CdmSSHPool *pool, CdmSSHSession *session, gboolean reuse);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (CdmSSHPool, cdm_sshpool_unref);
+
+G_END_DECLS
@@ -0,0 +1,156 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-tokenbucket.c
+ */
+
+#include "cdm-tokenbucket.h"
+
+#ifndef TOKENBUCKET_MIN_BURST
+#define TOKENBUCKET_MIN_BURST (4096)
+#endif
+
+/* waiting threads wake up at least this often to see rate changes */
+#ifndef TOKENBUCKET_MAX_WAIT_USEC
+#define TOKENBUCKET_MAX_WAIT_USEC (100000)
+#endif
+
+/**
+ * @brief Add the tokens accumulated since the last refill
+ */
+static void tokenbucket_refill (CdmTokenBucket *bucket, gint64 now);
+
+static void
+tokenbucket_refill (CdmTokenBucket *bucket, gint64 now)
+{
+  gdouble added = (gdouble)bucket->rate * (gdouble)(now - bucket->last) / G_USEC_PER_SEC;
+
+  bucket->level = MIN (bucket->level + added, bucket->burst);
+  bucket->last = now;
+}
+
+CdmTokenBucket *
+cdm_tokenbucket_new (guint64 rate)
+{
+  CdmTokenBucket *bucket = g_new0 (CdmTokenBucket, 1);
+
+  g_ref_count_init (&bucket->rc);
+  g_mutex_init (&bucket->lock);
+
+  bucket->last = g_get_monotonic_time ();
+  cdm_tokenbucket_set_rate (bucket, rate);
+
+  return bucket;
+}
+
+CdmTokenBucket *
+cdm_tokenbucket_ref (CdmTokenBucket *bucket)
+{
+  g_assert (bucket);
+  g_ref_count_inc (&bucket->rc);
+  return bucket;
+}
+
+void
+cdm_tokenbucket_unref (CdmTokenBucket *bucket)
+{
+  g_assert (bucket);
+
+  if (g_ref_count_dec (&bucket->rc) == TRUE)
+    {
+      g_mutex_clear (&bucket->lock);
+      g_free (bucket);
+    }
+}
+
+void
+cdm_tokenbucket_set_rate (CdmTokenBucket *bucket, guint64 rate)
+{
+  g_assert (bucket);
+
+  g_mutex_lock (&bucket->lock);
+
+  tokenbucket_refill (bucket, g_get_monotonic_time ());
+
+  /* one second of traffic may be sent at once */
+  bucket->rate = rate;
+  bucket->burst = (gdouble)MAX (rate, TOKENBUCKET_MIN_BURST);
+  bucket->level = MIN (bucket->level, bucket->burst);
+
+  g_mutex_unlock (&bucket->lock);
+}
+
+guint64
+cdm_tokenbucket_get_rate (CdmTokenBucket *bucket)
+{
+  guint64 rate;
+
+  g_assert (bucket);
+
+  g_mutex_lock (&bucket->lock);
+  rate = bucket->rate;
+  g_mutex_unlock (&bucket->lock);
+
+  return rate;
+}
+
+gsize
+cdm_tokenbucket_take (CdmTokenBucket *bucket, gsize size)
+{
+  gsize granted = 0;
+
+  g_assert (bucket);
+  g_assert (size > 0);
+
+  g_mutex_lock (&bucket->lock);
+
+  while (granted == 0)
+    {
+      gdouble want;
+
+      tokenbucket_refill (bucket, g_get_monotonic_time ());
+
+      if (bucket->rate == 0)
+        {
+          granted = size;
+          break;
+        }
+
+      want = MIN ((gdouble)size, bucket->burst);
+
+      if (bucket->level >= want)
+        {
+          bucket->level -= want;
+          granted = (gsize)want;
+        }
+      else
+        {
+          gdouble wait = (want - bucket->level) * G_USEC_PER_SEC / (gdouble)bucket->rate;
+
+          g_mutex_unlock (&bucket->lock);
+          g_usleep ((gulong)MIN (wait, TOKENBUCKET_MAX_WAIT_USEC) + 1);
+          g_mutex_lock (&bucket->lock);
+        }
+    }
+
+  g_mutex_unlock (&bucket->lock);
+
+  return granted;
+}
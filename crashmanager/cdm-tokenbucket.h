@@ -0,0 +1,91 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file cdm-tokenbucket.h
+ */
+
+#pragma once
+
+#include "cdm-types.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * @brief The CdmTokenBucket opaque data structure
+ */
+typedef struct _CdmTokenBucket
+{
+  grefcount rc;  /**< Reference counter variable  */
+  GMutex lock;   /**< Protects the bucket state */
+  guint64 rate;  /**< Refill rate in bytes per second, 0 for no limit */
+  gdouble burst; /**< Bucket capacity in bytes */
+  gdouble level; /**< Available tokens in bytes */
+  gint64 last;   /**< Monotonic time of the last refill */
+} CdmTokenBucket;
+
+/*
+ * @brief Create a new token bucket
+ * @param rate Refill rate in bytes per second, 0 for no limit
+ * @return On success return a new CdmTokenBucket object
+ */
+CdmTokenBucket *cdm_tokenbucket_new (guint64 rate);
+
+/**
+ * @brief Aquire token bucket object
+ * @param bucket Pointer to the token bucket object
+ * @return The referenced token bucket object
+ */
+CdmTokenBucket *cdm_tokenbucket_ref (CdmTokenBucket *bucket);
+
+/**
+ * @brief Release token bucket object
+ * @param bucket Pointer to the token bucket object
+ */
+void cdm_tokenbucket_unref (CdmTokenBucket *bucket);
+
+/**
+ * @brief Change the refill rate, the change applies to the threads waiting for tokens
+ * @param bucket Pointer to the token bucket object
+ * @param rate Refill rate in bytes per second, 0 for no limit
+ */
+void cdm_tokenbucket_set_rate (CdmTokenBucket *bucket, guint64 rate);
+
+/**
+ * @brief Get the refill rate
+ * @param bucket Pointer to the token bucket object
+ * @return Refill rate in bytes per second, 0 for no limit
+ */
+guint64 cdm_tokenbucket_get_rate (CdmTokenBucket *bucket);
+
+/**
+ * @brief Take tokens for sending data, blocking until some are available
+ * Can be called from any thread.
+ * @param bucket Pointer to the token bucket object
+ * @param size The number of bytes to send
+ * @return The number of bytes allowed, between 1 and size. A large size is
+ * granted in parts no bigger than the bucket capacity.
+ */
+gsize cdm_tokenbucket_take (CdmTokenBucket *bucket, gsize size);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (CdmTokenBucket, cdm_tokenbucket_unref);
+
+G_END_DECLS
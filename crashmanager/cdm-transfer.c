@@ -22,105 +22,858 @@
  */
 
 #include "cdm-transfer.h"
+#include "cdm-bundle.h"
+#include "cdm-dltbackend.h"
+#include "cdm-spoolbackend.h"
+#ifdef WITH_SCP_TRANSFER
+#include "cdm-sftpbackend.h"
+#endif
+#ifdef WITH_HTTP_TRANSFER
+#include "cdm-httpbackend.h"
+#endif
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRANSFER_RETRY_MAX_SHIFT (20)
+#define TRANSFER_METADATA_WORKERS (1)
+#define TRANSFER_BATCH_SUFFIX ".batch.tar"
+#define TRANSFER_RECENT_RECORDS (32)
+
+#ifndef TRANSFER_WINDOW_CHECK_SEC
+#define TRANSFER_WINDOW_CHECK_SEC (5)
+#endif
+
+/**
+ * @brief Destination of the entries when no backend is available
+ */
+static gchar transfer_dest_none[] = "none";
+
+/**
+ * @struct Delta upload state while sending the missing chunks
+ */
+typedef struct _TransferDeltaSend
+{
+  CdmTransfer *transfer;   /**< The transfer object */
+  CdmTransferEntry *entry; /**< The entry being uploaded */
+  GArray *chunks;          /**< Chunk manifest marked by the destination */
+  guint index;             /**< Index of the next chunk in the manifest */
+  CdmStatus status;        /**< Result of the last chunk upload */
+} TransferDeltaSend;
+
+/**
+ * @brief GSource prepare function
+ */
+static gboolean transfer_source_prepare (GSource *source, gint *timeout);
+
+/**
+ * @brief GSource dispatch function
+ */
+static gboolean transfer_source_dispatch (GSource *source, GSourceFunc callback,
+                                          gpointer _transfer);
+
+/**
+ * @brief GSource callback function
+ */
+static gboolean transfer_source_callback (gpointer _transfer, gpointer _entry);
+
+/**
+ * @brief GSource destroy notification callback function
+ */
+static void transfer_source_destroy_notify (gpointer _transfer);
+
+/**
+ * @brief Async queue destroy notification callback function
+ */
+static void transfer_queue_destroy_notify (gpointer _transfer);
+
+/**
+ * @brief Transfer thread function
+ */
+static void transfer_thread_func (gpointer _entry, gpointer _transfer);
+
+/**
+ * @brief Build the metadata bundle of an archive and upload it
+ */
+static CdmStatus transfer_metadata_upload (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Build the bundle of a batch and upload it
+ */
+static CdmStatus transfer_batch_upload (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Upload the chunks of an archive missing at the destination and its recipe
+ */
+static CdmStatus transfer_delta_upload (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Chunk callback collecting the archive manifest
+ */
+static gboolean transfer_delta_collect (const CdmDeltaChunk *chunk, const guint8 *data,
+                                        gpointer _chunks);
+
+/**
+ * @brief Chunk callback sending the chunks marked missing
+ */
+static gboolean transfer_delta_send (const CdmDeltaChunk *chunk, const guint8 *data,
+                                     gpointer _send);
+
+/**
+ * @brief Keep the upload record of a finished entry
+ */
+static void transfer_record_add (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Free an upload record
+ */
+static void transfer_record_free (gpointer _record);
+
+/**
+ * @brief Create the backend selected by the configuration
+ */
+static CdmTransferBackend *transfer_backend_new (CdmOptions *options);
+
+/**
+ * @brief Order entries by priority class and then newest first
+ */
+static gint transfer_entry_compare (gconstpointer a, gconstpointer b, gpointer user_data);
+
+/**
+ * @brief Maximum concurrent uploads allowed for the backend destination
+ */
+static guint transfer_destination_cap (CdmTransfer *transfer);
+
+/**
+ * @brief Add an entry to the queue of its tier
+ */
+static void transfer_entry_enqueue (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Check if an archive entry can join a batch bundle
+ */
+static gboolean transfer_batch_eligible (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Add an archive entry to the open batch
+ */
+static void transfer_batch_add (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Close the open batch and queue it as a single entry
+ */
+static void transfer_batch_flush (CdmTransfer *transfer);
+
+/**
+ * @brief Batch timer callback closing the batch window
+ */
+static gboolean batch_timer_callback (gpointer _transfer);
+
+/**
+ * @brief Mark the members of a finished batch and notify their clients
+ */
+static void transfer_batch_complete (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Account an entry against its destination and hand it to the workers
+ */
+static void transfer_dispatch (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Hand pending entries to the workers within the concurrency limits
+ */
+static void transfer_schedule (CdmTransfer *transfer);
+
+/**
+ * @brief Release the worker slot of a finished entry and notify the client
+ */
+static void transfer_entry_complete (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Free a transfer entry
+ */
+static void transfer_entry_free (CdmTransferEntry *entry);
+
+/**
+ * @brief Order delayed entries by the next attempt time
+ */
+static gint transfer_retry_compare (gconstpointer a, gconstpointer b, gpointer user_data);
+
+/**
+ * @brief Delay a failed entry for a new attempt
+ * @return FALSE if the attempts limit is reached
+ */
+static gboolean transfer_retry (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Add an entry to the delayed queue
+ */
+static void transfer_retry_delay (CdmTransfer *transfer, CdmTransferEntry *entry);
+
+/**
+ * @brief Arm the retry timer for the earliest delayed entry
+ */
+static void transfer_retry_arm (CdmTransfer *transfer);
+
+/**
+ * @brief Retry timer callback moving the due entries to the pending queue
+ */
+static gboolean retry_timer_callback (gpointer _transfer);
+
+/**
+ * @brief Read the highest 10 seconds pressure average of the cpu, io and memory
+ * @return The pressure in percent or -1 if not available
+ */
+static gdouble transfer_read_pressure (void);
+
+/**
+ * @brief Read the 1 minute load average relative to the number of processors
+ * @return The load in percent or -1 if not available
+ */
+static gdouble transfer_read_load (void);
+
+/**
+ * @brief Sample the system state and update the transfer window
+ */
+static void transfer_window_update (CdmTransfer *transfer);
+
+/**
+ * @brief Start or stop the window sampling timer for the current limits
+ */
+static void transfer_window_setup (CdmTransfer *transfer);
+
+/**
+ * @brief Window timer callback
+ */
+static gboolean window_timer_callback (gpointer _transfer);
+
+/**
+ * @brief GSourceFuncs vtable
+ */
+static GSourceFuncs transfer_source_funcs = {
+  transfer_source_prepare, NULL, transfer_source_dispatch, NULL, NULL, NULL,
+};
+
+static gboolean
+transfer_source_prepare (GSource *source, gint *timeout)
+{
+  CdmTransfer *transfer = (CdmTransfer *)source;
+
+  CDM_UNUSED (timeout);
+
+  return (g_async_queue_length (transfer->queue) > 0 || g_async_queue_length (transfer->done) > 0);
+}
+
+static gboolean
+transfer_source_dispatch (GSource *source, GSourceFunc callback, gpointer _transfer)
+{
+  CdmTransfer *transfer = (CdmTransfer *)source;
+  gpointer entry;
+
+  CDM_UNUSED (callback);
+  CDM_UNUSED (_transfer);
+
+  while ((entry = g_async_queue_try_pop (transfer->done)) != NULL)
+    transfer_entry_complete (transfer, (CdmTransferEntry *)entry);
+
+  while ((entry = g_async_queue_try_pop (transfer->queue)) != NULL)
+    {
+      if (transfer->callback (transfer, entry) == FALSE)
+        return G_SOURCE_REMOVE;
+    }
+
+  transfer_schedule (transfer);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+transfer_source_callback (gpointer _transfer, gpointer _entry)
+{
+  CdmTransfer *transfer = (CdmTransfer *)_transfer;
+  CdmTransferEntry *entry = (CdmTransferEntry *)_entry;
+
+  g_assert (transfer);
+  g_assert (entry);
+
+  /* entries delayed before a restart keep their next attempt time */
+  if (entry->next_attempt > g_get_real_time () / G_USEC_PER_SEC)
+    {
+      g_debug ("Delay file transfer %s", entry->file_path);
+      transfer_retry_delay (transfer, entry);
+      return TRUE;
+    }
+
+  g_debug ("Queue file for transfer %s", entry->file_path);
+  transfer_entry_enqueue (transfer, entry);
+
+  return TRUE;
+}
+
+static gint
+transfer_entry_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const CdmTransferEntry *ea = (const CdmTransferEntry *)a;
+  const CdmTransferEntry *eb = (const CdmTransferEntry *)b;
+
+  CDM_UNUSED (user_data);
+
+  if (ea->tclass != eb->tclass)
+    return ea->tclass < eb->tclass ? -1 : 1;
+
+  if (ea->tstamp != eb->tstamp)
+    return ea->tstamp > eb->tstamp ? -1 : 1;
+
+  return 0;
+}
+
+static guint
+transfer_destination_cap (CdmTransfer *transfer)
+{
+  if (transfer->backend != NULL && transfer->backend->max_workers > 0)
+    return transfer->backend->max_workers;
+
+  return transfer->dest_max_workers;
+}
+
+static void
+transfer_entry_enqueue (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  if (entry->tier == CDM_TRANSFER_TIER_METADATA)
+    g_queue_push_tail (&transfer->metadata, entry);
+  else if (transfer_batch_eligible (transfer, entry))
+    transfer_batch_add (transfer, entry);
+  else
+    g_queue_insert_sorted (&transfer->pending, entry, transfer_entry_compare, NULL);
+}
+
+static gboolean
+transfer_batch_eligible (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  /* a partially uploaded archive resumes on its own */
+  return (transfer->batch_window > 0 && transfer->backend != NULL
+          && entry->tier == CDM_TRANSFER_TIER_ARCHIVE && entry->tclass != CDM_TRANSFER_CLASS_BULK
+          && entry->offset == 0 && entry->file_size < transfer->batch_size);
+}
+
+static void
+transfer_batch_add (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  if (transfer->batch->len > 0 && transfer->batch_bytes + entry->file_size > transfer->batch_size)
+    transfer_batch_flush (transfer);
+
+  g_ptr_array_add (transfer->batch, entry);
+  transfer->batch_bytes += entry->file_size;
+  transfer->metrics.batched = transfer->batch->len;
+
+  if (transfer->batch_bytes >= transfer->batch_size)
+    {
+      transfer_batch_flush (transfer);
+      return;
+    }
+
+  /* the window starts with the first archive of the batch */
+  if (transfer->batch_timer == NULL)
+    {
+      transfer->batch_timer = g_timeout_source_new_seconds (transfer->batch_window);
+      g_source_set_callback (transfer->batch_timer, G_SOURCE_FUNC (batch_timer_callback),
+                             transfer, NULL);
+      g_source_attach (transfer->batch_timer, g_source_get_context (CDM_EVENT_SOURCE (transfer)));
+    }
+}
+
+static void
+transfer_batch_flush (CdmTransfer *transfer)
+{
+  CdmTransferEntry *entry;
+
+  if (transfer->batch_timer != NULL)
+    {
+      g_source_destroy (transfer->batch_timer);
+      g_source_unref (transfer->batch_timer);
+      transfer->batch_timer = NULL;
+    }
+
+  if (transfer->batch->len == 1)
+    {
+      /* a single archive is not worth a bundle */
+      entry = (CdmTransferEntry *)g_ptr_array_index (transfer->batch, 0);
+      g_queue_insert_sorted (&transfer->pending, entry, transfer_entry_compare, NULL);
+      g_ptr_array_set_size (transfer->batch, 0);
+    }
+  else if (transfer->batch->len > 1)
+    {
+      g_autofree gchar *bundle_name = NULL;
+
+      entry = g_new0 (CdmTransferEntry, 1);
+
+      bundle_name = g_strdup_printf ("%ld" TRANSFER_BATCH_SUFFIX, g_get_real_time ());
+
+      entry->file_path = g_build_filename (transfer->bundle_dir, bundle_name, NULL);
+      entry->tier = CDM_TRANSFER_TIER_BATCH;
+      entry->tclass = CDM_TRANSFER_CLASS_BULK;
+      entry->file_size = transfer->batch_bytes;
+      entry->destination = transfer->backend->destination;
+      entry->members = g_steal_pointer (&transfer->batch);
+
+      /* the batch goes in the slot of its most urgent member */
+      for (guint i = 0; i < entry->members->len; i++)
+        {
+          CdmTransferEntry *member = (CdmTransferEntry *)g_ptr_array_index (entry->members, i);
+
+          entry->tclass = MIN (entry->tclass, member->tclass);
+          entry->tstamp = MAX (entry->tstamp, member->tstamp);
+        }
+
+      g_debug ("Queue batch of %u archives for transfer %s", entry->members->len,
+               entry->file_path);
+
+      g_queue_insert_sorted (&transfer->pending, entry, transfer_entry_compare, NULL);
+      transfer->batch = g_ptr_array_new ();
+    }
+
+  transfer->batch_bytes = 0;
+  transfer->metrics.batched = 0;
+}
+
+static gboolean
+batch_timer_callback (gpointer _transfer)
+{
+  CdmTransfer *transfer = (CdmTransfer *)_transfer;
+
+  g_assert (transfer);
+
+  /* the source is destroyed when the callback returns */
+  g_source_unref (transfer->batch_timer);
+  transfer->batch_timer = NULL;
+
+  transfer_batch_flush (transfer);
+  transfer_schedule (transfer);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+transfer_dispatch (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  guint active = GPOINTER_TO_UINT (g_hash_table_lookup (transfer->dest_active, entry->destination));
+
+  g_hash_table_insert (transfer->dest_active, entry->destination, GUINT_TO_POINTER (active + 1));
+
+  if (entry->tier == CDM_TRANSFER_TIER_METADATA)
+    transfer->metadata_in_flight++;
+
+  transfer->metrics.in_flight++;
+  transfer->metrics.in_flight_bytes += entry->file_size;
+
+  g_debug ("Push file to thread pool transfer %s", entry->file_path);
+  g_thread_pool_push (transfer->tpool, entry, NULL);
+}
+
+static void
+transfer_schedule (CdmTransfer *transfer)
+{
+  CdmTransferEntry *entry;
+  GList *link = transfer->pending.head;
+
+  /* metadata bundles have a worker of their own and are not held back by a busy window */
+  while (transfer->metadata_in_flight < TRANSFER_METADATA_WORKERS
+         && (entry = (CdmTransferEntry *)g_queue_peek_head (&transfer->metadata)) != NULL)
+    {
+      guint active
+          = GPOINTER_TO_UINT (g_hash_table_lookup (transfer->dest_active, entry->destination));
+
+      /* only a destination accepting a single upload at a time holds back the metadata */
+      if (transfer->backend != NULL && transfer->backend->max_workers > 0
+          && active >= transfer->backend->max_workers)
+        break;
+
+      g_queue_pop_head (&transfer->metadata);
+      transfer_dispatch (transfer, entry);
+    }
+
+  /* uploads in flight continue, new ones wait for the system to calm down */
+  if (transfer->window == CDM_TRANSFER_WINDOW_BUSY)
+    link = NULL;
+
+  while (link != NULL
+         && transfer->metrics.in_flight - transfer->metadata_in_flight < transfer->max_workers)
+    {
+      GList *next = link->next;
+      guint active;
+
+      entry = (CdmTransferEntry *)link->data;
+      active = GPOINTER_TO_UINT (g_hash_table_lookup (transfer->dest_active, entry->destination));
+
+      /* a busy destination does not hold back entries for the other destinations */
+      if (active < transfer_destination_cap (transfer))
+        {
+          g_queue_delete_link (&transfer->pending, link);
+          transfer_dispatch (transfer, entry);
+        }
+
+      link = next;
+    }
+
+  transfer->metrics.queued = g_queue_get_length (&transfer->pending);
+  transfer->metrics.metadata_queued = g_queue_get_length (&transfer->metadata);
+}
+
+static void
+transfer_entry_complete (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  guint active
+      = GPOINTER_TO_UINT (g_hash_table_lookup (transfer->dest_active, entry->destination));
+
+  if (active > 1)
+    g_hash_table_insert (transfer->dest_active, entry->destination,
+                         GUINT_TO_POINTER (active - 1));
+  else
+    g_hash_table_remove (transfer->dest_active, entry->destination);
+
+  if (entry->tier == CDM_TRANSFER_TIER_METADATA)
+    transfer->metadata_in_flight--;
+
+  transfer->metrics.in_flight--;
+  transfer->metrics.in_flight_bytes -= entry->file_size;
+
+  if (entry->tier == CDM_TRANSFER_TIER_BATCH)
+    {
+      transfer_batch_complete (transfer, entry);
+      return;
+    }
+
+  if (entry->status != CDM_STATUS_OK && transfer_retry (transfer, entry))
+    return;
+
+  transfer->metrics.completed++;
+  transfer->metrics.sent_bytes += entry->sent_bytes;
+
+  if (entry->tier == CDM_TRANSFER_TIER_ARCHIVE)
+    transfer_record_add (transfer, entry);
+
+  /* the archive tier state is set by the client callback */
+  if (entry->tier == CDM_TRANSFER_TIER_METADATA && entry->status == CDM_STATUS_OK
+      && transfer->journal != NULL)
+    cdm_journal_set_metadata_transfer (transfer->journal, entry->file_path, TRUE);
+
+  if (entry->callback)
+    entry->callback (entry->user_data, entry->file_path, entry->status);
+
+  transfer_entry_free (entry);
+}
+
+static void
+transfer_batch_complete (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  transfer->metrics.sent_bytes += entry->sent_bytes;
+  transfer_record_add (transfer, entry);
+
+  if (entry->status == CDM_STATUS_OK && transfer->journal != NULL)
+    {
+      g_autoptr (GPtrArray) file_paths = g_ptr_array_new ();
+      g_autoptr (GError) error = NULL;
+
+      for (guint i = 0; i < entry->members->len; i++)
+        {
+          CdmTransferEntry *member = (CdmTransferEntry *)g_ptr_array_index (entry->members, i);
+
+          if (member->status == CDM_STATUS_OK)
+            g_ptr_array_add (file_paths, member->file_path);
+        }
+
+      /* all uploaded members are marked in one transaction ahead of their own callbacks */
+      if (file_paths->len > 0)
+        cdm_journal_set_transfer_list (transfer->journal, file_paths, TRUE, NULL, NULL, &error);
+      if (error != NULL)
+        g_warning ("Fail to set transfer complete for batch %s. Error %s", entry->file_path,
+                   error->message);
+    }
+
+  for (guint i = 0; i < entry->members->len; i++)
+    {
+      CdmTransferEntry *member = (CdmTransferEntry *)g_ptr_array_index (entry->members, i);
+
+      /* a failed member retries on its own schedule and may join a later batch */
+      if (member->status == CDM_STATUS_OK)
+        member->status = entry->status;
+      if (member->status != CDM_STATUS_OK && transfer_retry (transfer, member))
+        continue;
+
+      transfer->metrics.completed++;
+
+      if (member->callback)
+        member->callback (member->user_data, member->file_path, member->status);
+
+      transfer_entry_free (member);
+    }
+
+  g_ptr_array_set_size (entry->members, 0);
+  transfer_entry_free (entry);
+}
+
+static void
+transfer_entry_free (CdmTransferEntry *entry)
+{
+  if (entry->members != NULL)
+    {
+      for (guint i = 0; i < entry->members->len; i++)
+        transfer_entry_free ((CdmTransferEntry *)g_ptr_array_index (entry->members, i));
+
+      g_ptr_array_unref (entry->members);
+    }
+
+  g_free (entry->file_path);
+  g_free (entry->upload_path);
+  g_free (entry);
+}
+
+static void
+transfer_record_add (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  CdmTransferRecord *record = g_new0 (CdmTransferRecord, 1);
+
+  record->file_name = g_path_get_basename (entry->file_path);
+  record->file_size = entry->file_size;
+  record->sent_bytes = entry->sent_bytes;
+  record->delta = entry->delta;
+  record->status = entry->status;
+
+  g_queue_push_head (&transfer->records, record);
+
+  if (g_queue_get_length (&transfer->records) > TRANSFER_RECENT_RECORDS)
+    transfer_record_free (g_queue_pop_tail (&transfer->records));
+}
+
+static void
+transfer_record_free (gpointer _record)
+{
+  CdmTransferRecord *record = (CdmTransferRecord *)_record;
+
+  g_free (record->file_name);
+  g_free (record);
+}
+
+static gint
+transfer_retry_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const CdmTransferEntry *ea = (const CdmTransferEntry *)a;
+  const CdmTransferEntry *eb = (const CdmTransferEntry *)b;
+
+  CDM_UNUSED (user_data);
+
+  if (ea->next_attempt != eb->next_attempt)
+    return ea->next_attempt < eb->next_attempt ? -1 : 1;
+
+  return 0;
+}
+
+static gboolean
+transfer_retry (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  gint64 delay;
+
+  entry->attempts++;
+
+  if (transfer->retry_max_attempts > 0 && entry->attempts >= transfer->retry_max_attempts)
+    {
+      g_warning ("Give up transfer for %s after %ld attempts", entry->file_path, entry->attempts);
+
+      /* released to the retention policy, the attempts count is kept for inspection */
+      if (entry->tier == CDM_TRANSFER_TIER_ARCHIVE && transfer->journal != NULL)
+        cdm_journal_set_transfer_abandoned (transfer->journal, entry->file_path);
+
+      return FALSE;
+    }
+
+  /* exponential backoff with the upper half randomized to spread the retries */
+  delay = transfer->retry_base << MIN (entry->attempts - 1, TRANSFER_RETRY_MAX_SHIFT);
+  delay = MIN (delay, transfer->retry_max);
+  delay = delay / 2 + g_random_int_range (0, (gint32)MAX (delay / 2, 1));
+
+  entry->next_attempt = g_get_real_time () / G_USEC_PER_SEC + MAX (delay, 1);
+
+  g_info ("Transfer for %s failed, attempt %ld retries in %ld seconds", entry->file_path,
+          entry->attempts, MAX (delay, 1));
+
+  /* the metadata attempts are not persisted, the full archive carries the same data */
+  if (entry->tier == CDM_TRANSFER_TIER_ARCHIVE && transfer->journal != NULL)
+    cdm_journal_set_transfer_retry (transfer->journal, entry->file_path, entry->next_attempt);
+
+  transfer_retry_delay (transfer, entry);
+
+  return TRUE;
+}
+
+static void
+transfer_retry_delay (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  g_queue_insert_sorted (&transfer->delayed, entry, transfer_retry_compare, NULL);
+  transfer->metrics.delayed = g_queue_get_length (&transfer->delayed);
+
+  /* the timer only follows the earliest entry */
+  if (transfer->delayed.head->data == entry)
+    transfer_retry_arm (transfer);
+}
+
+static void
+transfer_retry_arm (CdmTransfer *transfer)
+{
+  CdmTransferEntry *entry = (CdmTransferEntry *)g_queue_peek_head (&transfer->delayed);
+  gint64 delay;
+
+  if (transfer->retry_timer != NULL)
+    {
+      g_source_destroy (transfer->retry_timer);
+      g_source_unref (transfer->retry_timer);
+      transfer->retry_timer = NULL;
+    }
+
+  if (entry == NULL)
+    return;
+
+  delay = MAX (entry->next_attempt - g_get_real_time () / G_USEC_PER_SEC, 0);
+
+  transfer->retry_timer = g_timeout_source_new_seconds ((guint)delay);
+  g_source_set_callback (transfer->retry_timer, G_SOURCE_FUNC (retry_timer_callback), transfer,
+                         NULL);
+  g_source_attach (transfer->retry_timer, g_source_get_context (CDM_EVENT_SOURCE (transfer)));
+}
+
+static gboolean
+retry_timer_callback (gpointer _transfer)
+{
+  CdmTransfer *transfer = (CdmTransfer *)_transfer;
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  CdmTransferEntry *entry;
+
+  g_assert (transfer);
 
-#ifdef WITH_GENIVI_DLT
-#include <dlt.h>
-#include <dlt_filetransfer.h>
-#endif
-#ifdef WITH_SCP_TRANSFER
-#include <arpa/inet.h>
-#include <libssh2.h>
-#include <netinet/in.h>
-#include <stdio.h>
-#include <sys/socket.h>
-#include <unistd.h>
-#endif
+  /* the source is destroyed when the callback returns */
+  g_source_unref (transfer->retry_timer);
+  transfer->retry_timer = NULL;
 
-#ifdef WITH_GENIVI_DLT
-DLT_DECLARE_CONTEXT (cdm_transfer_ctx);
-#define DLT_MIN_TIMEOUT 1
-#endif
+  while ((entry = (CdmTransferEntry *)g_queue_peek_head (&transfer->delayed)) != NULL
+         && entry->next_attempt <= now)
+    {
+      g_queue_pop_head (&transfer->delayed);
+      g_debug ("Retry file transfer %s", entry->file_path);
+      transfer_entry_enqueue (transfer, entry);
+    }
 
-#ifdef WITH_SCP_TRANSFER
-#define SCP_BUFFER_SZ 1024
-#endif
+  transfer->metrics.delayed = g_queue_get_length (&transfer->delayed);
 
-/**
- * @brief GSource prepare function
- */
-static gboolean transfer_source_prepare (GSource *source, gint *timeout);
+  transfer_schedule (transfer);
+  transfer_retry_arm (transfer);
 
-/**
- * @brief GSource dispatch function
- */
-static gboolean transfer_source_dispatch (GSource *source, GSourceFunc callback,
-                                          gpointer _transfer);
+  return G_SOURCE_REMOVE;
+}
 
-/**
- * @brief GSource callback function
- */
-static gboolean transfer_source_callback (gpointer _transfer, gpointer _entry);
+static gdouble
+transfer_read_pressure (void)
+{
+  const gchar *resources[] = { "/proc/pressure/cpu", "/proc/pressure/io", "/proc/pressure/memory" };
+  gdouble pressure = -1;
 
-/**
- * @brief GSource destroy notification callback function
- */
-static void transfer_source_destroy_notify (gpointer _transfer);
+  for (gsize i = 0; i < G_N_ELEMENTS (resources); i++)
+    {
+      g_autofree gchar *content = NULL;
+      const gchar *avg;
 
-/**
- * @brief Async queue destroy notification callback function
- */
-static void transfer_queue_destroy_notify (gpointer _transfer);
+      if (!g_file_get_contents (resources[i], &content, NULL, NULL))
+        continue;
 
-/**
- * @brief Transfer thread function
- */
-static void transfer_thread_func (gpointer _entry, gpointer _transfer);
+      avg = strstr (content, "some avg10=");
+      if (avg != NULL)
+        pressure = MAX (pressure, g_ascii_strtod (avg + strlen ("some avg10="), NULL));
+    }
 
-/**
- * @brief GSourceFuncs vtable
- */
-static GSourceFuncs transfer_source_funcs = {
-  transfer_source_prepare, NULL, transfer_source_dispatch, NULL, NULL, NULL,
-};
+  return pressure;
+}
 
-static gboolean
-transfer_source_prepare (GSource *source, gint *timeout)
+static gdouble
+transfer_read_load (void)
 {
-  CdmTransfer *transfer = (CdmTransfer *)source;
+  g_autofree gchar *content = NULL;
 
-  CDM_UNUSED (timeout);
+  if (!g_file_get_contents ("/proc/loadavg", &content, NULL, NULL))
+    return -1;
 
-  return (g_async_queue_length (transfer->queue) > 0);
+  return g_ascii_strtod (content, NULL) * 100 / g_get_num_processors ();
 }
 
-static gboolean
-transfer_source_dispatch (GSource *source, GSourceFunc callback, gpointer _transfer)
+static void
+transfer_window_update (CdmTransfer *transfer)
 {
-  CdmTransfer *transfer = (CdmTransfer *)source;
-  gpointer entry = g_async_queue_try_pop (transfer->queue);
+  CdmTransferWindow window = CDM_TRANSFER_WINDOW_OPEN;
+  gdouble pressure = transfer_read_pressure ();
+  gdouble load = transfer_read_load ();
+
+  if ((transfer->limits.max_pressure > 0 && pressure >= transfer->limits.max_pressure)
+      || (transfer->limits.max_load > 0 && load >= transfer->limits.max_load))
+    window = CDM_TRANSFER_WINDOW_BUSY;
+  else if (transfer->limits.idle_pressure > 0 && pressure >= 0
+           && pressure <= transfer->limits.idle_pressure)
+    window = CDM_TRANSFER_WINDOW_IDLE;
+
+  if (window == transfer->window)
+    return;
 
-  CDM_UNUSED (callback);
-  CDM_UNUSED (_transfer);
+  g_info ("Transfer window %s (pressure %.2f load %.2f)",
+          window == CDM_TRANSFER_WINDOW_BUSY   ? "busy"
+          : window == CDM_TRANSFER_WINDOW_IDLE ? "idle"
+                                               : "open",
+          pressure, load);
 
-  if (entry == NULL)
-    return G_SOURCE_CONTINUE;
+  transfer->window = window;
+
+  /* an idle system flushes the backlog without the rate limit */
+  cdm_tokenbucket_set_rate (transfer->bucket,
+                            window == CDM_TRANSFER_WINDOW_IDLE ? 0 : transfer->limits.rate_limit);
+
+  transfer_schedule (transfer);
+}
+
+static void
+transfer_window_setup (CdmTransfer *transfer)
+{
+  gboolean sample = (transfer->limits.max_pressure > 0 || transfer->limits.idle_pressure > 0
+                     || transfer->limits.max_load > 0);
+
+  if (sample && transfer->window_timer == NULL)
+    {
+      transfer->window_timer = g_timeout_source_new_seconds (TRANSFER_WINDOW_CHECK_SEC);
+      g_source_set_callback (transfer->window_timer, G_SOURCE_FUNC (window_timer_callback),
+                             transfer, NULL);
+      g_source_attach (transfer->window_timer,
+                       g_source_get_context (CDM_EVENT_SOURCE (transfer)));
+    }
+  else if (!sample && transfer->window_timer != NULL)
+    {
+      g_source_destroy (transfer->window_timer);
+      g_source_unref (transfer->window_timer);
+      transfer->window_timer = NULL;
+    }
 
-  return transfer->callback (transfer, entry) == TRUE ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+  /* force the rate and the schedule to follow the new limits */
+  transfer->window = CDM_TRANSFER_WINDOW_OPEN;
+  cdm_tokenbucket_set_rate (transfer->bucket, transfer->limits.rate_limit);
+
+  if (sample)
+    transfer_window_update (transfer);
 }
 
 static gboolean
-transfer_source_callback (gpointer _transfer, gpointer _entry)
+window_timer_callback (gpointer _transfer)
 {
   CdmTransfer *transfer = (CdmTransfer *)_transfer;
-  CdmTransferEntry *entry = (CdmTransferEntry *)_entry;
 
   g_assert (transfer);
-  g_assert (entry);
 
-  g_debug ("Push file to tread pool transfer %s", entry->file_path);
-  g_thread_pool_push (transfer->tpool, entry, NULL);
+  transfer_window_update (transfer);
 
-  return TRUE;
+  return G_SOURCE_CONTINUE;
 }
 
 static void
@@ -141,163 +894,217 @@ transfer_queue_destroy_notify (gpointer _transfer)
   g_debug ("Transfer queue destroy notification");
 }
 
-#ifdef WITH_SCP_TRANSFER
-static void
-transfer_scp_upload (CdmOptions *options, const gchar *file_path)
-{
-  g_autofree gchar *username = NULL;
-  g_autofree gchar *password = NULL;
-  g_autofree gchar *publickey = NULL;
-  g_autofree gchar *privatekey = NULL;
-  g_autofree gchar *serveraddr = NULL;
-  g_autofree gchar *serverpath = NULL;
-  g_autofree gchar *file_basename = NULL;
-  g_autofree gchar *scppath = NULL;
-  LIBSSH2_SESSION *session = NULL;
-  LIBSSH2_CHANNEL *channel = NULL;
-  struct sockaddr_in sin;
-  struct stat fileinfo;
-  FILE *local = NULL;
-  gchar mem[SCP_BUFFER_SZ];
-  size_t nread;
-  char *ptr;
-  gint sock;
-  gint rc;
-
-  serveraddr = cdm_options_string_for (options, KEY_TRANSFER_ADDRESS);
-  if (strlen (serveraddr) == 0)
-    return;
+static CdmTransferBackend *
+transfer_backend_new (CdmOptions *options)
+{
+  g_autofree gchar *name = cdm_options_string_for (options, KEY_TRANSFER_BACKEND);
 
-  rc = libssh2_init (0);
-  if (rc != 0)
+  /* without a configured backend the one selected at build time is used */
+  if (strlen (name) == 0)
     {
-      g_warning ("Libssh2 initialization failed (%d)", rc);
-      return;
+#if defined(WITH_GENIVI_DLT)
+      return cdm_dltbackend_new (options, FALSE);
+#elif defined(WITH_SCP_TRANSFER)
+      return cdm_sftpbackend_new (options);
+#elif defined(WITH_HTTP_TRANSFER)
+      return cdm_httpbackend_new (options);
+#else
+      return NULL;
+#endif
     }
 
-  sock = socket (AF_INET, SOCK_STREAM, 0);
-  if (sock == -1)
-    {
-      g_warning ("Failed to create scp transfer socket");
-      return;
-    }
+  if (g_str_equal (name, "spool"))
+    return cdm_spoolbackend_new (options);
+  if (g_str_equal (name, "dltsim"))
+    return cdm_dltbackend_new (options, TRUE);
+#ifdef WITH_GENIVI_DLT
+  if (g_str_equal (name, "dlt"))
+    return cdm_dltbackend_new (options, FALSE);
+#endif
+#ifdef WITH_SCP_TRANSFER
+  if (g_str_equal (name, "sftp"))
+    return cdm_sftpbackend_new (options);
+#endif
+#ifdef WITH_HTTP_TRANSFER
+  if (g_str_equal (name, "http"))
+    return cdm_httpbackend_new (options);
+#endif
+
+  g_warning ("Transfer backend %s is not available", name);
+
+  return NULL;
+}
 
-  sin.sin_family = AF_INET;
-  sin.sin_port = htons ((guint16)cdm_options_long_for (options, KEY_TRANSFER_PORT));
+static CdmStatus
+transfer_metadata_upload (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  g_autoptr (GError) error = NULL;
+  CdmStatus status;
 
-  if (inet_pton (AF_INET, serveraddr, &sin.sin_addr.s_addr) <= 0)
+  entry->upload_path = cdm_bundle_create_metadata (entry->file_path, transfer->bundle_dir, &error);
+  if (entry->upload_path == NULL)
     {
-      g_warning ("Failed inet_pton error occured");
-      return;
+      g_warning ("Fail to create the metadata bundle. Error %s", error->message);
+      return CDM_STATUS_ERROR;
     }
 
-  if (connect (sock, (struct sockaddr *)(&sin), sizeof (struct sockaddr_in)) != 0)
+  status = transfer->backend->upload (transfer->backend, transfer, entry);
+
+  /* the bundle is rebuilt from the archive for each attempt */
+  unlink (entry->upload_path);
+  g_clear_pointer (&entry->upload_path, g_free);
+
+  return status;
+}
+
+static CdmStatus
+transfer_batch_upload (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  g_autoptr (GPtrArray) archive_paths = g_ptr_array_new ();
+  g_autoptr (GPtrArray) skipped = g_ptr_array_new ();
+  g_autoptr (GError) error = NULL;
+  CdmStatus status;
+
+  for (guint i = 0; i < entry->members->len; i++)
     {
-      g_warning ("Failed to connect to scp server");
-      return;
+      CdmTransferEntry *member = (CdmTransferEntry *)g_ptr_array_index (entry->members, i);
+
+      member->status = CDM_STATUS_OK;
+      g_ptr_array_add (archive_paths, member->file_path);
     }
 
-  session = libssh2_session_init ();
-  if (!session)
+  if (!cdm_bundle_create_batch (archive_paths, entry->file_path, skipped, &error))
     {
-      g_warning ("Failed to create libssh2 session");
-      return;
+      g_warning ("Fail to create the batch bundle. Error %s", error->message);
+      return CDM_STATUS_ERROR;
     }
 
-  rc = libssh2_session_handshake (session, sock);
-  if (rc)
+  /* only the unreadable members fail, the batch status is applied to the others */
+  for (guint i = 0; i < entry->members->len; i++)
     {
-      g_warning ("Failure establishing SSH session: %d", rc);
-      return;
+      CdmTransferEntry *member = (CdmTransferEntry *)g_ptr_array_index (entry->members, i);
+
+      if (g_ptr_array_find (skipped, member->file_path, NULL))
+        member->status = CDM_STATUS_ERROR;
     }
 
-  /* no early return from now on, go to scp_shutdown for cleanup */
+  entry->upload_path = g_strdup (entry->file_path);
+  status = transfer->backend->upload (transfer->backend, transfer, entry);
+
+  /* a failed batch is split and its members gathered again */
+  unlink (entry->upload_path);
+  g_clear_pointer (&entry->upload_path, g_free);
+
+  return status;
+}
+
+static gboolean
+transfer_delta_collect (const CdmDeltaChunk *chunk, const guint8 *data, gpointer _chunks)
+{
+  CDM_UNUSED (data);
+
+  g_array_append_vals ((GArray *)_chunks, chunk, 1);
+
+  return TRUE;
+}
 
-  username = cdm_options_string_for (options, KEY_TRANSFER_USER);
-  password = cdm_options_string_for (options, KEY_TRANSFER_PASSWORD);
-  publickey = cdm_options_string_for (options, KEY_TRANSFER_PUBLIC_KEY);
-  privatekey = cdm_options_string_for (options, KEY_TRANSFER_PRIVATE_KEY);
+static gboolean
+transfer_delta_send (const CdmDeltaChunk *chunk, const guint8 *data, gpointer _send)
+{
+  TransferDeltaSend *send = (TransferDeltaSend *)_send;
+  CdmTransferBackend *backend = send->transfer->backend;
+  const CdmDeltaChunk *known;
 
-  if (libssh2_userauth_publickey_fromfile (session, username, publickey, privatekey, password))
+  if (send->index >= send->chunks->len)
     {
-      g_warning ("Authentication by public key failed");
-      goto scp_shutdown;
+      g_warning ("Archive %s changed during the delta upload", send->entry->file_path);
+      send->status = CDM_STATUS_ERROR;
+      return FALSE;
     }
 
-  local = fopen (file_path, "rb");
-  if (!local)
+  known = &g_array_index (send->chunks, CdmDeltaChunk, send->index++);
+  if (known->size != chunk->size || !g_str_equal (known->hash, chunk->hash))
     {
-      g_warning ("Can't open local file for transfer %s", file_path);
-      goto scp_shutdown;
+      g_warning ("Archive %s changed during the delta upload", send->entry->file_path);
+      send->status = CDM_STATUS_ERROR;
+      return FALSE;
     }
 
-  stat (file_path, &fileinfo);
+  if (!known->missing)
+    return TRUE;
 
-  serverpath = cdm_options_string_for (options, KEY_TRANSFER_PATH);
-  file_basename = g_path_get_basename (file_path);
-  scppath = g_build_filename (serverpath, file_basename, NULL);
+  for (gsize allowed = 0; allowed < chunk->size;)
+    allowed = cdm_transfer_throttle (send->transfer, send->entry, chunk->size);
 
-  channel = libssh2_scp_send (session, scppath, fileinfo.st_mode & 0777,
-                              (unsigned long)fileinfo.st_size);
-  if (!channel)
-    {
-      gchar *errmsg;
-      gint errlen;
-      gint err = libssh2_session_last_error (session, &errmsg, &errlen, 0);
+  send->status = backend->delta_chunk (backend, send->entry, chunk, data);
+  if (send->status == CDM_STATUS_OK)
+    cdm_transfer_sent (send->transfer, send->entry, chunk->size);
 
-      g_warning ("Unable to open a session: (%d) %s", err, errmsg);
-      goto scp_shutdown;
-    }
+  return send->status == CDM_STATUS_OK;
+}
 
-  do
+static CdmStatus
+transfer_delta_upload (CdmTransfer *transfer, CdmTransferEntry *entry)
+{
+  g_autofree gchar *file_basename = g_path_get_basename (entry->upload_path);
+  g_autoptr (GArray) chunks = g_array_new (FALSE, FALSE, sizeof (CdmDeltaChunk));
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *recipe = NULL;
+  TransferDeltaSend send = { transfer, entry, chunks, 0, CDM_STATUS_OK };
+  guint64 missing_bytes = 0;
+  guint missing = 0;
+  CdmStatus status;
+
+  entry->delta = FALSE;
+
+  if (!cdm_delta_foreach_chunk (entry->upload_path, transfer_delta_collect, chunks, &error))
     {
-      nread = fread (mem, 1, sizeof (mem), local);
-      if (nread <= 0)
-        break;
+      g_warning ("Fail to chunk %s, upload the archive. Error %s", file_basename, error->message);
+      return transfer->backend->upload (transfer->backend, transfer, entry);
+    }
 
-      ptr = mem;
+  /* the manifest exchange marks the chunks the destination does not hold */
+  status = transfer->backend->delta_query (transfer->backend, entry, chunks);
+  if (status != CDM_STATUS_OK)
+    return status;
 
-      do
+  for (guint i = 0; i < chunks->len; i++)
+    {
+      const CdmDeltaChunk *chunk = &g_array_index (chunks, CdmDeltaChunk, i);
+
+      if (chunk->missing)
         {
-          /* write the same data over and over, until error or completion */
-          ssize_t retval = libssh2_channel_write (channel, mem, nread);
-
-          if (retval < 0)
-            {
-              g_warning ("Transfer error %ld", retval);
-              break;
-            }
-          else
-            {
-              /* retval indicates how many bytes were written this time */
-              ptr += retval;
-              nread -= (size_t)retval;
-            }
+          missing_bytes += chunk->size;
+          missing++;
         }
-      while (nread);
     }
-  while (TRUE);
 
-  libssh2_channel_send_eof (channel);
-  libssh2_channel_wait_eof (channel);
-  libssh2_channel_wait_closed (channel);
-  libssh2_channel_free (channel);
+  /* the chunks are not compressed, new content is cheaper to send as the archive itself */
+  if (missing_bytes >= entry->file_size)
+    {
+      g_debug ("No delta gain for %s (%lu missing bytes), upload the archive", file_basename,
+               missing_bytes);
+      return transfer->backend->upload (transfer->backend, transfer, entry);
+    }
 
-scp_shutdown:
-  if (session)
+  if (!cdm_delta_foreach_chunk (entry->upload_path, transfer_delta_send, &send, &error))
     {
-      libssh2_session_disconnect (session, "Normal Shutdown");
-      libssh2_session_free (session);
+      g_warning ("Delta upload failed for %s. Error %s", file_basename, error->message);
+      return CDM_STATUS_ERROR;
     }
 
-  close (sock);
+  recipe = cdm_delta_recipe_new (file_basename, chunks);
 
-  if (local)
-    fclose (local);
+  status = transfer->backend->delta_recipe (transfer->backend, entry, recipe);
+  if (status == CDM_STATUS_OK)
+    {
+      entry->delta = TRUE;
+      g_info ("Delta upload for %s sent %u of %u chunks (%lu bytes for a %lu bytes archive)",
+              file_basename, missing, chunks->len, missing_bytes, (guint64)entry->file_size);
+    }
 
-  libssh2_exit ();
+  return status;
 }
-#endif
 
 static void
 transfer_thread_func (gpointer _entry, gpointer _transfer)
@@ -311,52 +1118,26 @@ transfer_thread_func (gpointer _entry, gpointer _transfer)
 
   file_name = g_path_get_basename (entry->file_path);
 
-  g_info ("Transfer file %s", file_name);
-
-#if defined(WITH_GENIVI_DLT)
-  if (dlt_user_log_file_header_alias (&cdm_transfer_ctx, entry->file_path, file_name) == 0)
-    {
-      gint pkgcount = dlt_user_log_file_packagesCount (&cdm_transfer_ctx, entry->file_path);
-      gint lastpkg = 0;
-      gint success = 1;
-
-      while (lastpkg < pkgcount)
-        {
-          gint total = 2;
-          gint used = 2;
-          dlt_user_check_buffer (&total, &used);
-
-          while ((total - used) < (total / 2))
-            {
-              usleep (100 * DLT_MIN_TIMEOUT);
-              dlt_user_log_resend_buffer ();
-              dlt_user_check_buffer (&total, &used);
-            }
-
-          lastpkg++;
-
-          if (dlt_user_log_file_data (&cdm_transfer_ctx, entry->file_path, lastpkg, DLT_MIN_TIMEOUT)
-              < 0)
-            {
-              success = 0;
-              break;
-            }
-        }
-
-      if (success)
-        dlt_user_log_file_end (&cdm_transfer_ctx, entry->file_path, 0);
-    }
-#elif defined(WITH_SCP_TRANSFER)
-  transfer_scp_upload (transfer->options, entry->file_path);
-#else
-  g_debug ("No transfer method selected at build time");
-#endif
-
-  if (entry->callback)
-    entry->callback (entry->user_data, entry->file_path);
-
-  g_free (entry->file_path);
-  g_free (entry);
+  g_info ("Transfer %s %s",
+          entry->tier == CDM_TRANSFER_TIER_METADATA ? "metadata of"
+          : entry->tier == CDM_TRANSFER_TIER_BATCH  ? "batch"
+                                                    : "file",
+          file_name);
+
+  if (transfer->backend == NULL)
+    g_debug ("No transfer backend available");
+  else if (entry->tier == CDM_TRANSFER_TIER_METADATA)
+    entry->status = transfer_metadata_upload (transfer, entry);
+  else if (entry->tier == CDM_TRANSFER_TIER_BATCH)
+    entry->status = transfer_batch_upload (transfer, entry);
+  else if (transfer->delta)
+    entry->status = transfer_delta_upload (transfer, entry);
+  else
+    entry->status = transfer->backend->upload (transfer->backend, transfer, entry);
+
+  /* the completion is handled from the main context */
+  g_async_queue_push (transfer->done, entry);
+  g_main_context_wakeup (g_source_get_context (CDM_EVENT_SOURCE (transfer)));
 }
 
 CdmTransfer *
@@ -370,19 +1151,66 @@ cdm_transfer_new (CdmOptions *options)
 
   g_ref_count_init (&transfer->rc);
 
-#ifdef WITH_GENIVI_DLT
-  DLT_REGISTER_CONTEXT (cdm_transfer_ctx, "FLTR", "Crashmanager file transfer");
-#endif
-
   transfer->options = cdm_options_ref (options);
   transfer->callback = transfer_source_callback;
   transfer->queue = g_async_queue_new_full (transfer_queue_destroy_notify);
-  transfer->tpool = g_thread_pool_new (transfer_thread_func, transfer, 1, TRUE, NULL);
+  transfer->done = g_async_queue_new_full (transfer_queue_destroy_notify);
+  transfer->dest_active = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&transfer->pending);
+  g_queue_init (&transfer->metadata);
+  g_queue_init (&transfer->delayed);
+  g_queue_init (&transfer->records);
+
+  transfer->max_workers = (guint)MAX (cdm_options_long_for (options, KEY_TRANSFER_WORKERS), 1);
+  transfer->dest_max_workers
+      = (guint)MAX (cdm_options_long_for (options, KEY_TRANSFER_DEST_WORKERS), 1);
+  transfer->small_size = (gsize)cdm_options_long_for (options, KEY_TRANSFER_SMALL_SIZE) * 1024;
+  transfer->metadata_only = (cdm_options_long_for (options, KEY_TRUNCATE_COREDUMPS) != 0);
+  transfer->metadata_first = (cdm_options_long_for (options, KEY_TRANSFER_METADATA_FIRST) != 0);
+  transfer->bundle_dir = cdm_options_string_for (options, KEY_RUN_DIR);
+  transfer->batch = g_ptr_array_new ();
+  transfer->batch_size
+      = (gsize)MAX (cdm_options_long_for (options, KEY_TRANSFER_BATCH_SIZE), 1) * 1024;
+  transfer->batch_window
+      = (guint)MAX (cdm_options_long_for (options, KEY_TRANSFER_BATCH_WINDOW), 0);
+  transfer->chunk_size
+      = (gsize)MAX (cdm_options_long_for (options, KEY_TRANSFER_CHUNK_SIZE), 1) * 1024;
+  transfer->retry_base = MAX (cdm_options_long_for (options, KEY_TRANSFER_RETRY_BASE), 1);
+  transfer->retry_max
+      = MAX (cdm_options_long_for (options, KEY_TRANSFER_RETRY_MAX), transfer->retry_base);
+  transfer->retry_max_attempts = cdm_options_long_for (options, KEY_TRANSFER_MAX_ATTEMPTS);
+
+  transfer->limits.rate_limit
+      = (guint64)MAX (cdm_options_long_for (options, KEY_TRANSFER_RATE_LIMIT), 0) * 1024;
+  transfer->limits.max_pressure
+      = (guint)MAX (cdm_options_long_for (options, KEY_TRANSFER_MAX_PRESSURE), 0);
+  transfer->limits.idle_pressure
+      = (guint)MAX (cdm_options_long_for (options, KEY_TRANSFER_IDLE_PRESSURE), 0);
+  transfer->limits.max_load = (guint)MAX (cdm_options_long_for (options, KEY_TRANSFER_MAX_LOAD), 0);
+  transfer->bucket = cdm_tokenbucket_new (transfer->limits.rate_limit);
+
+  transfer->tpool = g_thread_pool_new (transfer_thread_func, transfer,
+                                      (gint)(transfer->max_workers + TRANSFER_METADATA_WORKERS),
+                                      TRUE, NULL);
+
+  transfer->backend = transfer_backend_new (options);
+  if (transfer->backend != NULL)
+    g_info ("Transfer backend %s to %s", transfer->backend->name, transfer->backend->destination);
+
+  transfer->delta = (transfer->backend != NULL
+                     && cdm_options_long_for (options, KEY_TRANSFER_DELTA) != 0);
+  if (transfer->delta && transfer->backend->delta_query == NULL)
+    {
+      g_warning ("Transfer backend %s has no delta upload support", transfer->backend->name);
+      transfer->delta = FALSE;
+    }
 
   g_source_set_callback (CDM_EVENT_SOURCE (transfer), NULL, transfer,
                          transfer_source_destroy_notify);
   g_source_attach (CDM_EVENT_SOURCE (transfer), NULL);
 
+  transfer_window_setup (transfer);
+
   return transfer;
 }
 
@@ -401,12 +1229,55 @@ cdm_transfer_unref (CdmTransfer *transfer)
 
   if (g_ref_count_dec (&transfer->rc) == TRUE)
     {
+      CdmTransferEntry *entry;
+
+      if (transfer->retry_timer != NULL)
+        {
+          g_source_destroy (transfer->retry_timer);
+          g_source_unref (transfer->retry_timer);
+        }
+
+      if (transfer->window_timer != NULL)
+        {
+          g_source_destroy (transfer->window_timer);
+          g_source_unref (transfer->window_timer);
+        }
+
+      if (transfer->batch_timer != NULL)
+        {
+          g_source_destroy (transfer->batch_timer);
+          g_source_unref (transfer->batch_timer);
+        }
+
+      for (guint i = 0; i < transfer->batch->len; i++)
+        transfer_entry_free ((CdmTransferEntry *)g_ptr_array_index (transfer->batch, i));
+
+      while ((entry = (CdmTransferEntry *)g_queue_pop_head (&transfer->pending)) != NULL)
+        transfer_entry_free (entry);
+
+      while ((entry = (CdmTransferEntry *)g_queue_pop_head (&transfer->metadata)) != NULL)
+        transfer_entry_free (entry);
+
+      while ((entry = (CdmTransferEntry *)g_queue_pop_head (&transfer->delayed)) != NULL)
+        transfer_entry_free (entry);
+
+      while (!g_queue_is_empty (&transfer->records))
+        transfer_record_free (g_queue_pop_head (&transfer->records));
+
       g_async_queue_unref (transfer->queue);
-#ifdef WITH_GENIVI_DLT
-      DLT_UNREGISTER_CONTEXT (cdm_transfer_ctx);
-#endif
       cdm_options_unref (transfer->options);
       g_thread_pool_free (transfer->tpool, TRUE, FALSE);
+      g_async_queue_unref (transfer->done);
+      g_hash_table_destroy (transfer->dest_active);
+      cdm_tokenbucket_unref (transfer->bucket);
+      g_free (transfer->bundle_dir);
+      g_ptr_array_unref (transfer->batch);
+
+      if (transfer->backend != NULL)
+        transfer->backend->free (transfer->backend);
+
+      if (transfer->journal != NULL)
+        cdm_journal_unref (transfer->journal);
       g_source_unref (CDM_EVENT_SOURCE (transfer));
     }
 }
@@ -416,6 +1287,7 @@ cdm_transfer_file (CdmTransfer *transfer, const gchar *file_path, CdmTransferEnt
                    gpointer user_data)
 {
   CdmTransferEntry *entry = NULL;
+  struct stat fileinfo;
 
   g_assert (transfer);
   g_assert (file_path);
@@ -423,10 +1295,158 @@ cdm_transfer_file (CdmTransfer *transfer, const gchar *file_path, CdmTransferEnt
   entry = g_new0 (CdmTransferEntry, 1);
 
   entry->file_path = g_strdup (file_path);
+  entry->upload_path = g_strdup (file_path);
+  entry->tier = CDM_TRANSFER_TIER_ARCHIVE;
   entry->user_data = user_data;
   entry->callback = callback;
+  entry->destination
+      = transfer->backend != NULL ? transfer->backend->destination : transfer_dest_none;
+
+  if (transfer->journal != NULL)
+    {
+      CdmJournalTransferState state;
+
+      cdm_journal_get_transfer_state (transfer->journal, file_path, &state, NULL);
+
+      entry->offset = state.offset;
+      entry->attempts = state.attempts;
+      entry->next_attempt = state.next_attempt;
+    }
+
+  if (stat (file_path, &fileinfo) == 0)
+    {
+      entry->file_size = (gsize)fileinfo.st_size;
+      entry->tstamp = (gint64)fileinfo.st_mtime;
+    }
+  else
+    entry->tstamp = g_get_real_time () / G_USEC_PER_SEC;
+
+  if (transfer->metadata_only)
+    entry->tclass = CDM_TRANSFER_CLASS_METADATA;
+  else if (entry->file_size <= transfer->small_size)
+    entry->tclass = CDM_TRANSFER_CLASS_SMALL;
+  else
+    entry->tclass = CDM_TRANSFER_CLASS_BULK;
+
+  g_async_queue_push (transfer->queue, entry);
+
+  return CDM_STATUS_OK;
+}
+
+CdmStatus
+cdm_transfer_metadata (CdmTransfer *transfer, const gchar *file_path)
+{
+  CdmTransferEntry *entry = NULL;
+
+  g_assert (transfer);
+  g_assert (file_path);
+
+  /* archives without coredump data are small enough to go in one tier */
+  if (!transfer->metadata_first || transfer->metadata_only)
+    return CDM_STATUS_ERROR;
+
+  entry = g_new0 (CdmTransferEntry, 1);
+
+  entry->file_path = g_strdup (file_path);
+  entry->tier = CDM_TRANSFER_TIER_METADATA;
+  entry->tclass = CDM_TRANSFER_CLASS_METADATA;
+  entry->tstamp = g_get_real_time () / G_USEC_PER_SEC;
+  entry->destination
+      = transfer->backend != NULL ? transfer->backend->destination : transfer_dest_none;
 
   g_async_queue_push (transfer->queue, entry);
 
   return CDM_STATUS_OK;
 }
+
+void
+cdm_transfer_checkpoint (CdmTransfer *transfer, CdmTransferEntry *entry, gint64 offset)
+{
+  g_assert (transfer);
+  g_assert (entry);
+
+  /* a metadata bundle is small and rebuilt for each attempt */
+  if (entry->tier == CDM_TRANSFER_TIER_ARCHIVE && transfer->journal != NULL)
+    cdm_journal_set_transfer_offset (transfer->journal, entry->file_path, offset);
+}
+
+gsize
+cdm_transfer_throttle (CdmTransfer *transfer, CdmTransferEntry *entry, gsize size)
+{
+  g_assert (transfer);
+  g_assert (entry);
+
+  if (entry->tier == CDM_TRANSFER_TIER_METADATA)
+    return size;
+
+  /* a short write leaves credit behind, only the uncovered remainder takes tokens */
+  if (entry->throttle_credit < size)
+    entry->throttle_credit += cdm_tokenbucket_take (transfer->bucket, size - entry->throttle_credit);
+
+  return MIN (size, entry->throttle_credit);
+}
+
+void
+cdm_transfer_sent (CdmTransfer *transfer, CdmTransferEntry *entry, gsize size)
+{
+  g_assert (transfer);
+  g_assert (entry);
+
+  entry->throttle_credit -= MIN (size, entry->throttle_credit);
+  entry->sent_bytes += size;
+}
+
+void
+cdm_transfer_set_journal (CdmTransfer *transfer, CdmJournal *journal)
+{
+  g_assert (transfer);
+  g_assert (journal);
+
+  transfer->journal = cdm_journal_ref (journal);
+}
+
+void
+cdm_transfer_foreach_record (CdmTransfer *transfer, CdmTransferRecordCallback callback,
+                             gpointer user_data)
+{
+  g_assert (transfer);
+  g_assert (callback);
+
+  for (GList *link = transfer->records.head; link != NULL; link = link->next)
+    callback ((const CdmTransferRecord *)link->data, user_data);
+}
+
+void
+cdm_transfer_set_limits (CdmTransfer *transfer, const CdmTransferLimits *limits)
+{
+  g_assert (transfer);
+  g_assert (limits);
+
+  g_info ("Transfer limits rate %lu B/s pressure %u%% idle %u%% load %u%%", limits->rate_limit,
+          limits->max_pressure, limits->idle_pressure, limits->max_load);
+
+  transfer->limits = *limits;
+  transfer_window_setup (transfer);
+}
+
+void
+cdm_transfer_get_limits (CdmTransfer *transfer, CdmTransferLimits *limits)
+{
+  g_assert (transfer);
+  g_assert (limits);
+
+  *limits = transfer->limits;
+}
+
+void
+cdm_transfer_get_metrics (CdmTransfer *transfer, CdmTransferMetrics *metrics)
+{
+  g_assert (transfer);
+  g_assert (metrics);
+
+  *metrics = transfer->metrics;
+  metrics->window = transfer->window;
+  metrics->rate = cdm_tokenbucket_get_rate (transfer->bucket);
+  metrics->queued += (guint)g_async_queue_length (transfer->queue);
+  metrics->metadata_queued = g_queue_get_length (&transfer->metadata);
+}
@@ -23,7 +23,10 @@
 
 #pragma once
 
+#include "cdm-delta.h"
+#include "cdm-journal.h"
 #include "cdm-options.h"
+#include "cdm-tokenbucket.h"
 #include "cdm-types.h"
 
 #include <glib.h>
@@ -38,7 +41,28 @@ typedef gboolean (*CdmTransferCallback) (gpointer _transfer, gpointer _entry);
 /**
  * @brief Client callback to pass when requesting a file transfer
  */
-typedef void (*CdmTransferEntryCallback) (gpointer _transfer, const gchar *file_path);
+typedef void (*CdmTransferEntryCallback) (gpointer _transfer, const gchar *file_path,
+                                          CdmStatus status);
+
+/**
+ * @brief Transfer priority class, lower classes are uploaded first
+ */
+typedef enum _CdmTransferClass
+{
+  CDM_TRANSFER_CLASS_METADATA, /**< Archive without coredump data */
+  CDM_TRANSFER_CLASS_SMALL,    /**< Archive below the small archive size */
+  CDM_TRANSFER_CLASS_BULK      /**< Any other archive */
+} CdmTransferClass;
+
+/**
+ * @brief Transfer tier, each tier has its own queue and journal state
+ */
+typedef enum _CdmTransferTier
+{
+  CDM_TRANSFER_TIER_METADATA, /**< Metadata bundle uploaded ahead of the archive */
+  CDM_TRANSFER_TIER_ARCHIVE,  /**< Full archive uploaded under the bandwidth policy */
+  CDM_TRANSFER_TIER_BATCH     /**< Bundle of small archives sharing a single upload */
+} CdmTransferTier;
 
 /**
  * @brief The file transfer entry
@@ -48,12 +72,131 @@ typedef struct _CdmTransferEntry
   gchar *file_path;
   gpointer user_data;
   CdmTransferEntryCallback callback;
+  gchar *destination;       /**< Destination the entry is counted against, not owned */
+  CdmTransferTier tier;     /**< Transfer tier */
+  gchar *upload_path;       /**< File sent by the backend, the archive or its bundle */
+  CdmTransferClass tclass;  /**< Priority class */
+  gsize file_size;          /**< Archive size in bytes */
+  gint64 tstamp;            /**< Archive modification time, newer archives go first */
+  gint64 offset;            /**< Acknowledged offset to resume the upload from */
+  gint64 attempts;          /**< Failed upload attempts */
+  gint64 next_attempt;      /**< Wall clock time in seconds of the next attempt */
+  CdmStatus status;         /**< Upload result passed to the callback */
+  GPtrArray *members;       /**< Archive entries carried by a batch bundle */
+  guint64 sent_bytes;       /**< Bytes sent over all attempts */
+  gsize throttle_credit;    /**< Bytes allowed by the rate limiter and not sent yet */
+  gboolean delta;           /**< Uploaded as missing chunks and a recipe */
 } CdmTransferEntry;
 
+typedef struct _CdmTransfer CdmTransfer;
+typedef struct _CdmTransferBackend CdmTransferBackend;
+
+/**
+ * @brief Backend upload function called from the transfer workers
+ * @return CDM_STATUS_OK once the archive is delivered to the destination
+ */
+typedef CdmStatus (*CdmTransferUploadFunc) (CdmTransferBackend *backend, CdmTransfer *transfer,
+                                            CdmTransferEntry *entry);
+
+/**
+ * @brief Backend delta function marking the chunks the destination does not hold
+ * @return CDM_STATUS_OK once the destination answered
+ */
+typedef CdmStatus (*CdmTransferDeltaQueryFunc) (CdmTransferBackend *backend,
+                                                CdmTransferEntry *entry, GArray *chunks);
+
+/**
+ * @brief Backend delta function storing a missing chunk at the destination
+ */
+typedef CdmStatus (*CdmTransferDeltaChunkFunc) (CdmTransferBackend *backend,
+                                                CdmTransferEntry *entry,
+                                                const CdmDeltaChunk *chunk, const guint8 *data);
+
+/**
+ * @brief Backend delta function storing the recipe, the archive is delivered once it is stored
+ */
+typedef CdmStatus (*CdmTransferDeltaRecipeFunc) (CdmTransferBackend *backend,
+                                                 CdmTransferEntry *entry, const gchar *recipe);
+
+/**
+ * @brief Backend destroy function
+ */
+typedef void (*CdmTransferBackendFree) (CdmTransferBackend *backend);
+
+/**
+ * @brief Transfer backend interface, backends embed it as their first member
+ */
+struct _CdmTransferBackend
+{
+  const gchar *name;                       /**< Backend name as used in the configuration */
+  gchar *destination;                      /**< Destination the uploads are counted against */
+  guint max_workers;                       /**< Concurrent uploads, 0 for the default */
+  CdmTransferUploadFunc upload;            /**< Upload function, must be thread safe */
+  CdmTransferBackendFree free;             /**< Destroy function */
+  CdmTransferDeltaQueryFunc delta_query;   /**< Chunk manifest exchange, NULL without delta */
+  CdmTransferDeltaChunkFunc delta_chunk;   /**< Chunk upload, must be thread safe */
+  CdmTransferDeltaRecipeFunc delta_recipe; /**< Recipe upload, must be thread safe */
+};
+
+/**
+ * @brief Transfer window state derived from the system load
+ */
+typedef enum _CdmTransferWindow
+{
+  CDM_TRANSFER_WINDOW_OPEN, /**< Uploads start and run under the rate limit */
+  CDM_TRANSFER_WINDOW_BUSY, /**< New uploads are deferred */
+  CDM_TRANSFER_WINDOW_IDLE  /**< Uploads run without rate limit */
+} CdmTransferWindow;
+
+/**
+ * @brief Transfer limits adjustable at runtime
+ */
+typedef struct _CdmTransferLimits
+{
+  guint64 rate_limit;  /**< Upload rate in bytes per second, 0 for no limit */
+  guint max_pressure;  /**< Pressure in percent deferring new uploads, 0 to disable */
+  guint idle_pressure; /**< Pressure in percent lifting the rate limit, 0 to disable */
+  guint max_load;      /**< Load per processor in percent deferring new uploads, 0 to disable */
+} CdmTransferLimits;
+
+/**
+ * @brief Transfer queue metrics
+ */
+typedef struct _CdmTransferMetrics
+{
+  guint queued;             /**< Entries waiting for a worker */
+  guint metadata_queued;    /**< Metadata bundles waiting for the metadata worker */
+  guint batched;            /**< Archives gathered for the next batch bundle */
+  guint delayed;            /**< Failed entries waiting for a new attempt */
+  guint in_flight;          /**< Entries being uploaded */
+  guint64 in_flight_bytes;  /**< Bytes of the entries being uploaded */
+  guint64 completed;        /**< Entries processed since start */
+  guint64 sent_bytes;       /**< Bytes sent since start */
+  CdmTransferWindow window; /**< Current transfer window */
+  guint64 rate;             /**< Current upload rate limit in bytes per second */
+} CdmTransferMetrics;
+
+/**
+ * @brief Upload record of a finished archive or batch
+ */
+typedef struct _CdmTransferRecord
+{
+  gchar *file_name;   /**< Archive or batch bundle name */
+  gsize file_size;    /**< Archive size in bytes */
+  guint64 sent_bytes; /**< Bytes sent over all attempts */
+  gboolean delta;     /**< Uploaded as missing chunks and a recipe */
+  CdmStatus status;   /**< Upload result */
+} CdmTransferRecord;
+
+/**
+ * @brief Callback for each upload record
+ */
+typedef void (*CdmTransferRecordCallback) (const CdmTransferRecord *record, gpointer user_data);
+
 /**
  * @brief The CdmTransfer opaque data structure
  */
-typedef struct _CdmTransfer
+struct _CdmTransfer
 {
   GSource source;               /**< Event loop source */
   grefcount rc;                 /**< Reference counter variable  */
@@ -61,7 +204,38 @@ typedef struct _CdmTransfer
   GThreadPool *tpool;           /**< Transfer thread pool */
   CdmOptions *options;          /**< Options object */
   CdmTransferCallback callback; /**< Transfer callback function */
-} CdmTransfer;
+  GAsyncQueue *done;            /**< Entries finished by the workers */
+  GQueue pending;               /**< Entries waiting for a worker in priority order */
+  GQueue metadata;              /**< Metadata entries waiting for the metadata worker */
+  guint metadata_in_flight;     /**< Metadata bundles being uploaded */
+  gboolean metadata_first;      /**< Upload a metadata bundle ahead of each archive */
+  gchar *bundle_dir;            /**< Directory the metadata and batch bundles are created in */
+  GPtrArray *batch;             /**< Small archives gathered for the next batch bundle */
+  gsize batch_bytes;            /**< Size of the gathered archives */
+  gsize batch_size;             /**< Batch bundle size triggering the upload */
+  guint batch_window;           /**< Seconds to gather archives in a batch, 0 to disable */
+  GSource *batch_timer;         /**< Timer closing the batch window */
+  gboolean delta;               /**< Upload the archives as missing chunks and a recipe */
+  GQueue records;               /**< Upload records of the last finished archives */
+  GQueue delayed;               /**< Failed entries ordered by the next attempt time */
+  GSource *retry_timer;         /**< Timer for the earliest delayed entry */
+  GHashTable *dest_active;      /**< Active uploads per destination */
+  CdmTransferBackend *backend;  /**< Backend delivering the archives */
+  guint max_workers;            /**< Maximum concurrent uploads */
+  guint dest_max_workers;       /**< Maximum concurrent uploads per destination */
+  gsize small_size;             /**< Archives up to this size are small */
+  gboolean metadata_only;       /**< Archives are created without coredump data */
+  gsize chunk_size;             /**< Bytes uploaded between two offset checkpoints */
+  CdmJournal *journal;          /**< Journal keeping the upload offsets */
+  gint64 retry_base;            /**< Delay in seconds after the first failed attempt */
+  gint64 retry_max;             /**< Maximum delay in seconds between attempts */
+  gint64 retry_max_attempts;    /**< Attempts before giving up, 0 for no limit */
+  CdmTransferLimits limits;     /**< Rate and window limits */
+  CdmTransferWindow window;     /**< Current transfer window */
+  GSource *window_timer;        /**< System load sampling timer */
+  CdmTokenBucket *bucket;       /**< Upload rate limiter shared by the workers */
+  CdmTransferMetrics metrics;   /**< Transfer queue metrics */
+};
 
 /*
  * @brief Create a new transfer object
@@ -82,6 +256,40 @@ CdmTransfer *cdm_transfer_ref (CdmTransfer *transfer);
  */
 void cdm_transfer_unref (CdmTransfer *transfer);
 
+/**
+ * @brief Set the journal used to checkpoint and resume the uploads
+ * @param transfer Pointer to the transfer object
+ * @param journal Pointer to the journal object
+ */
+void cdm_transfer_set_journal (CdmTransfer *transfer, CdmJournal *journal);
+
+/**
+ * @brief Record the offset acknowledged by the destination so the upload can resume from it
+ * @param transfer Pointer to the transfer object
+ * @param entry The entry being uploaded
+ * @param offset The acknowledged offset
+ */
+void cdm_transfer_checkpoint (CdmTransfer *transfer, CdmTransferEntry *entry, gint64 offset);
+
+/**
+ * @brief Wait for the bandwidth policy to allow sending data
+ * Metadata bundles are not rate limited. Bytes allowed by an earlier call and not yet
+ * reported with cdm_transfer_sent are not paid for again.
+ * @param transfer Pointer to the transfer object
+ * @param entry The entry being uploaded
+ * @param size The number of bytes to send
+ * @return The number of bytes allowed, between 1 and size
+ */
+gsize cdm_transfer_throttle (CdmTransfer *transfer, CdmTransferEntry *entry, gsize size);
+
+/**
+ * @brief Count the bytes the destination actually accepted
+ * @param transfer Pointer to the transfer object
+ * @param entry The entry being uploaded
+ * @param size The number of bytes sent
+ */
+void cdm_transfer_sent (CdmTransfer *transfer, CdmTransferEntry *entry, gsize size);
+
 /**
  * @brief Transfer a file
  * @param transfer Pointer to the transfer object
@@ -93,6 +301,45 @@ void cdm_transfer_unref (CdmTransfer *transfer);
 CdmStatus cdm_transfer_file (CdmTransfer *transfer, const gchar *file_path,
                              CdmTransferEntryCallback callback, gpointer user_data);
 
+/**
+ * @brief Upload the metadata bundle of an archive ahead of the archive itself
+ * The metadata transfer state is kept in the journal.
+ * @param transfer Pointer to the transfer object
+ * @param file_path A pointer to the archive file_path string
+ * @return CDM_STATUS_OK if queued, CDM_STATUS_ERROR if metadata first uploads are disabled
+ */
+CdmStatus cdm_transfer_metadata (CdmTransfer *transfer, const gchar *file_path);
+
+/**
+ * @brief Call a function for the upload records of the last finished archives, newest first
+ * @param transfer Pointer to the transfer object
+ * @param callback The function to call for each record
+ * @param user_data The data passed to the callback
+ */
+void cdm_transfer_foreach_record (CdmTransfer *transfer, CdmTransferRecordCallback callback,
+                                  gpointer user_data);
+
+/**
+ * @brief Change the rate and window limits
+ * @param transfer Pointer to the transfer object
+ * @param limits The new limits
+ */
+void cdm_transfer_set_limits (CdmTransfer *transfer, const CdmTransferLimits *limits);
+
+/**
+ * @brief Get the rate and window limits
+ * @param transfer Pointer to the transfer object
+ * @param limits Pointer to the limits to fill
+ */
+void cdm_transfer_get_limits (CdmTransfer *transfer, CdmTransferLimits *limits);
+
+/**
+ * @brief Get the transfer queue metrics
+ * @param transfer Pointer to the transfer object
+ * @param metrics Pointer to the metrics to fill
+ */
+void cdm_transfer_get_metrics (CdmTransfer *transfer, CdmTransferMetrics *metrics);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (CdmTransfer, cdm_transfer_unref);
 
 G_END_DECLS
@@ -161,6 +161,63 @@ cdm_elogmsg_read (int fd, CdmELogMessage *msg)
   return 0;
 }
 
+int
+cdm_elogmsg_parse (CdmELogMessage *msg, const void *buf, size_t len)
+{
+  const uint8_t *data = (const uint8_t *)buf;
+  size_t hdr_len, offset = 0;
+
+  assert (msg);
+  assert (buf);
+
+  hdr_len = sizeof (msg->hdr.hsh) + sizeof (msg->hdr.version) + sizeof (msg->hdr.type)
+            + sizeof (msg->hdr.size_of_arg1) + sizeof (msg->hdr.size_of_arg2)
+            + sizeof (msg->hdr.size_of_arg3) + sizeof (msg->hdr.size_of_arg4);
+
+  if (len < hdr_len)
+    return 0;
+
+  memcpy (&msg->hdr.hsh, data + offset, sizeof (msg->hdr.hsh));
+  offset += sizeof (msg->hdr.hsh);
+  memcpy (&msg->hdr.version, data + offset, sizeof (msg->hdr.version));
+  offset += sizeof (msg->hdr.version);
+  memcpy (&msg->hdr.type, data + offset, sizeof (msg->hdr.type));
+  offset += sizeof (msg->hdr.type);
+  memcpy (&msg->hdr.size_of_arg1, data + offset, sizeof (msg->hdr.size_of_arg1));
+  offset += sizeof (msg->hdr.size_of_arg1);
+  memcpy (&msg->hdr.size_of_arg2, data + offset, sizeof (msg->hdr.size_of_arg2));
+  offset += sizeof (msg->hdr.size_of_arg2);
+  memcpy (&msg->hdr.size_of_arg3, data + offset, sizeof (msg->hdr.size_of_arg3));
+  offset += sizeof (msg->hdr.size_of_arg3);
+  memcpy (&msg->hdr.size_of_arg4, data + offset, sizeof (msg->hdr.size_of_arg4));
+  offset += sizeof (msg->hdr.size_of_arg4);
+
+  switch (cdm_elogmsg_get_type (msg))
+    {
+    case CDM_ELOGMSG_NEW:
+      if (msg->hdr.size_of_arg1 > sizeof (msg->data.process_pid)
+          || msg->hdr.size_of_arg2 > sizeof (msg->data.process_sig))
+        return -1;
+
+      if (len < offset + msg->hdr.size_of_arg1 + msg->hdr.size_of_arg2)
+        return 0;
+
+      /* arg1 */
+      memcpy (&msg->data.process_pid, data + offset, msg->hdr.size_of_arg1);
+      offset += msg->hdr.size_of_arg1;
+
+      /* arg2 */
+      memcpy (&msg->data.process_sig, data + offset, msg->hdr.size_of_arg2);
+      offset += msg->hdr.size_of_arg2;
+      break;
+
+    default:
+      return -1;
+    }
+
+  return (int)offset;
+}
+
 int
 cdm_elogmsg_write (int fd, CdmELogMessage *msg)
 {
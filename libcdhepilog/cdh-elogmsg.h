@@ -33,6 +33,7 @@ extern "C"
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define CDM_ELOGMSG_PROTOCOL_VERSION (0x0001)
@@ -136,6 +137,17 @@ extern "C"
    */
   int cdm_elogmsg_read (int fd, CdmELogMessage *msg);
 
+  /*
+   * @brief Parse elogmsg object from a receive buffer
+   * @param msg The elogmsg object
+   * @param buf The receive buffer
+   * @param len The number of bytes available in buffer
+   *
+   * @return The number of bytes used by the message, 0 if the buffer does not hold
+   * a complete message yet or -1 if the message is malformed
+   */
+  int cdm_elogmsg_parse (CdmELogMessage *msg, const void *buf, size_t len);
+
   /*
    * @brief Write data into elogmsg object
    * @param msg The elogmsg object
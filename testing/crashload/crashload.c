@@ -0,0 +1,344 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file crashload.c
+ */
+
+#include "cdm-defaults.h"
+#include "cdm-message.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define CRASHLOAD_DEFAULT_CLIENTS (500)
+#define CRASHLOAD_STALL_REQUESTS (800)
+
+typedef struct _LoadClient
+{
+  guint index;
+  gint64 latency;
+  gboolean connected;
+  gboolean context;
+  gboolean epilog;
+} LoadClient;
+
+static const gchar *sock_path;
+static GMutex start_lock;
+static GCond start_cond;
+static gboolean start_flag;
+static gboolean stop_flag;
+
+static gint
+connect_manager (void)
+{
+  struct sockaddr_un saddr;
+  struct timeval tout;
+  gint sfd;
+
+  sfd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sfd < 0)
+    return -1;
+
+  memset (&saddr, 0, sizeof (struct sockaddr_un));
+  saddr.sun_family = AF_UNIX;
+  g_strlcpy (saddr.sun_path, sock_path, sizeof (saddr.sun_path));
+
+  if (connect (sfd, (struct sockaddr *)&saddr, sizeof (struct sockaddr_un)) < 0)
+    {
+      close (sfd);
+      return -1;
+    }
+
+  tout.tv_sec = CDM_IPC_TIMEOUT_SEC;
+  tout.tv_usec = 0;
+
+  (void)setsockopt (sfd, SOL_SOCKET, SO_RCVTIMEO, (gchar *)&tout, sizeof (tout));
+  (void)setsockopt (sfd, SOL_SOCKET, SO_SNDTIMEO, (gchar *)&tout, sizeof (tout));
+
+  return sfd;
+}
+
+static gboolean
+read_epilog (gint sfd)
+{
+  g_autoptr (CdmMessage) msg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
+  guint64 frames;
+
+  if (cdm_message_read (sfd, msg) != CDM_STATUS_OK
+      || cdm_message_get_type (msg) != CDM_MESSAGE_EPILOG_FRAME_INFO)
+    return FALSE;
+
+  frames = cdm_message_get_epilog_frame_count (msg);
+
+  for (guint64 i = 0; i < frames; i++)
+    {
+      g_autoptr (CdmMessage) fmsg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
+
+      if (cdm_message_read (sfd, fmsg) != CDM_STATUS_OK
+          || cdm_message_get_type (fmsg) != CDM_MESSAGE_EPILOG_FRAME_DATA)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gpointer
+client_thread (gpointer data)
+{
+  LoadClient *client = (LoadClient *)data;
+  g_autoptr (CdmMessage) msg_new = NULL;
+  g_autoptr (CdmMessage) msg_update = NULL;
+  g_autoptr (CdmMessage) msg_reply = NULL;
+  g_autoptr (CdmMessage) msg_done = NULL;
+  g_autofree gchar *name = NULL;
+  gint64 start;
+  gint sfd;
+
+  g_mutex_lock (&start_lock);
+  while (!start_flag)
+    g_cond_wait (&start_cond, &start_lock);
+  g_mutex_unlock (&start_lock);
+
+  start = g_get_monotonic_time ();
+
+  if ((sfd = connect_manager ()) < 0)
+    return NULL;
+
+  client->connected = TRUE;
+  name = g_strdup_printf ("crashload%u", client->index);
+
+  /* walk the same message sequence as the crashhandler with an invalid pid */
+  msg_new = cdm_message_new (CDM_MESSAGE_COREDUMP_NEW, (uint16_t)client->index);
+  cdm_message_set_process_pid (msg_new, G_MAXINT32);
+  cdm_message_set_process_exit_signal (msg_new, 6);
+  cdm_message_set_process_timestamp (msg_new, (uint64_t)g_get_real_time () / G_USEC_PER_SEC);
+  cdm_message_set_process_name (msg_new, name);
+  cdm_message_set_thread_name (msg_new, name);
+
+  if (cdm_message_write (sfd, msg_new) == CDM_STATUS_OK)
+    {
+      msg_reply = cdm_message_new (CDM_MESSAGE_INVALID, 0);
+
+      if (cdm_message_read (sfd, msg_reply) == CDM_STATUS_OK
+          && cdm_message_get_type (msg_reply) == CDM_MESSAGE_COREDUMP_CONTEXT)
+        client->context = TRUE;
+    }
+
+  msg_update = cdm_message_new (CDM_MESSAGE_COREDUMP_UPDATE, (uint16_t)client->index);
+  cdm_message_set_process_crash_id (msg_update, "0000000000000000");
+  cdm_message_set_process_vector_id (msg_update, "0000000000000000");
+  cdm_message_set_process_context_id (msg_update, "0000000000000000");
+
+  if (client->context && cdm_message_write (sfd, msg_update) == CDM_STATUS_OK)
+    client->epilog = read_epilog (sfd);
+
+  /* report a failed coredump so the manager does not journal or transfer anything */
+  msg_done = cdm_message_new (CDM_MESSAGE_COREDUMP_FAILED, (uint16_t)client->index);
+  (void)cdm_message_write (sfd, msg_done);
+
+  client->latency = g_get_monotonic_time () - start;
+  close (sfd);
+
+  return NULL;
+}
+
+static gpointer
+stall_thread (gpointer data)
+{
+  LoadClient *client = (LoadClient *)data;
+  g_autofree gchar *name = NULL;
+  gint sfd;
+
+  g_mutex_lock (&start_lock);
+  while (!start_flag)
+    g_cond_wait (&start_cond, &start_lock);
+  g_mutex_unlock (&start_lock);
+
+  if ((sfd = connect_manager ()) < 0)
+    return NULL;
+
+  client->connected = TRUE;
+  name = g_strdup_printf ("crashstall%u", client->index);
+
+  /* ask for more replies than the socket buffers hold and hold off reading them */
+  for (guint i = 0; i < CRASHLOAD_STALL_REQUESTS; i++)
+    {
+      g_autoptr (CdmMessage) msg = cdm_message_new (CDM_MESSAGE_COREDUMP_NEW,
+                                                    (uint16_t)client->index);
+
+      cdm_message_set_process_pid (msg, G_MAXINT32);
+      cdm_message_set_process_exit_signal (msg, 6);
+      cdm_message_set_process_timestamp (msg, (uint64_t)g_get_real_time () / G_USEC_PER_SEC);
+      cdm_message_set_process_name (msg, name);
+      cdm_message_set_thread_name (msg, name);
+
+      if (cdm_message_write (sfd, msg) != CDM_STATUS_OK)
+        break;
+    }
+
+  /* the replies must wait for the regular clients to be done */
+  g_mutex_lock (&start_lock);
+  while (!stop_flag)
+    g_cond_wait (&start_cond, &start_lock);
+  g_mutex_unlock (&start_lock);
+
+  client->context = TRUE;
+  for (guint i = 0; i < CRASHLOAD_STALL_REQUESTS && client->context; i++)
+    {
+      g_autoptr (CdmMessage) msg = cdm_message_new (CDM_MESSAGE_INVALID, 0);
+
+      client->context = cdm_message_read (sfd, msg) == CDM_STATUS_OK
+                        && cdm_message_get_type (msg) == CDM_MESSAGE_COREDUMP_CONTEXT;
+    }
+
+  close (sfd);
+
+  return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autofree gchar *default_path = NULL;
+  g_autofree LoadClient *clients = NULL;
+  g_autofree GThread **threads = NULL;
+  g_autofree LoadClient *stallers = NULL;
+  g_autofree GThread **stall_threads = NULL;
+  guint count = CRASHLOAD_DEFAULT_CLIENTS;
+  guint stall = 0;
+  guint failed_connect = 0, failed_context = 0, failed_epilog = 0, failed_stall = 0;
+  gint64 latency_sum = 0, latency_max = 0;
+  gboolean help = FALSE;
+  gint long_index = 0;
+  gint c;
+
+  struct option longopts[] = { { "clients", required_argument, NULL, 'n' },
+                               { "socket", required_argument, NULL, 's' },
+                               { "stall", required_argument, NULL, 't' },
+                               { "help", no_argument, NULL, 'h' },
+                               { NULL, 0, NULL, 0 } };
+
+  default_path = g_build_filename (CDM_RUN_DIR, CDM_IPC_SOCK_ADDR, NULL);
+  sock_path = default_path;
+
+  while ((c = getopt_long (argc, argv, "n:s:t:h", longopts, &long_index)) != -1)
+    switch (c)
+      {
+      case 'n':
+        count = (guint)strtoul (optarg, NULL, 10);
+        break;
+
+      case 's':
+        sock_path = optarg;
+        break;
+
+      case 't':
+        stall = (guint)strtoul (optarg, NULL, 10);
+        break;
+
+      case 'h':
+        help = TRUE;
+        break;
+
+      default:
+        break;
+      }
+
+  if (help || count == 0)
+    {
+      printf ("crashload: connect many simultaneous crashhandler clients to crashmanager\n\n");
+      printf ("Usage: crashload [OPTIONS] \n\n");
+      printf ("  General:\n");
+      printf ("     --clients, -n <number>  Number of simultaneous clients (default %d)\n",
+              CRASHLOAD_DEFAULT_CLIENTS);
+      printf ("     --socket, -s  <path>    Manager IPC socket path\n");
+      printf ("     --stall, -t   <number>  Extra clients reading their replies late\n");
+      printf ("  Help:\n");
+      printf ("     --help, -h              Print this help\n\n");
+      exit (EXIT_SUCCESS);
+    }
+
+  clients = g_new0 (LoadClient, count);
+  threads = g_new0 (GThread *, count);
+
+  for (guint i = 0; i < count; i++)
+    {
+      clients[i].index = i;
+      threads[i] = g_thread_new ("crashload", client_thread, &clients[i]);
+    }
+
+  stallers = g_new0 (LoadClient, stall);
+  stall_threads = g_new0 (GThread *, stall);
+
+  for (guint i = 0; i < stall; i++)
+    {
+      stallers[i].index = count + i;
+      stall_threads[i] = g_thread_new ("crashstall", stall_thread, &stallers[i]);
+    }
+
+  /* release all clients at once to hit the listen backlog like a crash storm */
+  g_mutex_lock (&start_lock);
+  start_flag = TRUE;
+  g_cond_broadcast (&start_cond);
+  g_mutex_unlock (&start_lock);
+
+  for (guint i = 0; i < count; i++)
+    {
+      g_thread_join (threads[i]);
+
+      if (!clients[i].connected)
+        failed_connect++;
+      else if (!clients[i].context)
+        failed_context++;
+      else if (!clients[i].epilog)
+        failed_epilog++;
+
+      latency_sum += clients[i].latency;
+      latency_max = MAX (latency_max, clients[i].latency);
+    }
+
+  g_mutex_lock (&start_lock);
+  stop_flag = TRUE;
+  g_cond_broadcast (&start_cond);
+  g_mutex_unlock (&start_lock);
+
+  for (guint i = 0; i < stall; i++)
+    {
+      g_thread_join (stall_threads[i]);
+
+      if (!stallers[i].connected || !stallers[i].context)
+        failed_stall++;
+    }
+
+  printf ("clients=%u connect_failed=%u context_failed=%u epilog_failed=%u\n", count,
+          failed_connect, failed_context, failed_epilog);
+  printf ("latency_avg=%ldus latency_max=%ldus\n", latency_sum / (gint64)count, latency_max);
+
+  if (stall > 0)
+    printf ("stalled=%u stall_failed=%u\n", stall, failed_stall);
+
+  return (failed_connect + failed_context + failed_epilog + failed_stall) > 0 ? EXIT_FAILURE
+                                                                              : EXIT_SUCCESS;
+}
@@ -0,0 +1,511 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file httptest.c
+ */
+
+#include "cdm-httpbackend.h"
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <glib/gstdio.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define HTTPTEST_CHUNK_KB (16)
+#define HTTPTEST_ARCHIVE_SIZE (HTTPTEST_CHUNK_KB * 1024 * 3 + 1000)
+#define HTTPTEST_HEADER_MAX (8192)
+
+/**
+ * @brief The local stand-in of an upload server storing PUT bodies by path
+ */
+typedef struct _HTTPServer
+{
+  gint sockfd;            /**< Listening socket */
+  guint16 port;           /**< Listening port */
+  GMutex lock;            /**< Protects the fields below */
+  GHashTable *files;      /**< Stored bodies by request path */
+  gboolean final_308;     /**< Answer the last chunk of an archive with 308 */
+  guint requests;         /**< PUT requests received */
+  gint64 first_start;     /**< Range start of the first chunk request, -1 if none */
+  gboolean unranged_body; /**< A non-empty archive chunk arrived without Content-Range */
+  gboolean empty_range;   /**< An empty body arrived with a Content-Range header */
+} HTTPServer;
+
+/**
+ * @brief A client connection of the stand-in server
+ */
+typedef struct _HTTPConnection
+{
+  HTTPServer *server; /**< The server */
+  gint fd;            /**< Connection socket */
+} HTTPConnection;
+
+static gboolean
+read_headers (gint fd, GString *headers)
+{
+  gchar c;
+
+  /* byte by byte so the body of a pipelined request is never consumed here */
+  while (!g_str_has_suffix (headers->str, "\r\n\r\n"))
+    {
+      if (headers->len > HTTPTEST_HEADER_MAX || read (fd, &c, 1) != 1)
+        return FALSE;
+
+      g_string_append_c (headers, c);
+    }
+
+  return TRUE;
+}
+
+static const gchar *
+find_header (const gchar *headers, const gchar *name)
+{
+  g_autofree gchar *key = g_strconcat ("\r\n", name, ":", NULL);
+  g_autofree gchar *lower = g_ascii_strdown (headers, -1);
+  g_autofree gchar *lower_key = g_ascii_strdown (key, -1);
+  const gchar *found = strstr (lower, lower_key);
+
+  if (found == NULL)
+    return NULL;
+
+  return headers + (found - lower) + strlen (key);
+}
+
+static gboolean
+send_status (gint fd, gint code, const gchar *extra)
+{
+  g_autofree gchar *reply = g_strdup_printf ("HTTP/1.1 %d Test\r\nContent-Length: 0\r\n%s\r\n",
+                                             code, extra != NULL ? extra : "");
+
+  return write (fd, reply, strlen (reply)) == (ssize_t)strlen (reply);
+}
+
+static gint
+server_store (HTTPServer *server, const gchar *path, const gchar *range, const guint8 *body,
+              gsize length, gchar **extra)
+{
+  GByteArray *file;
+  gint64 start = 0;
+  gint64 end = 0;
+  gint64 total = 0;
+
+  g_mutex_lock (&server->lock);
+
+  server->requests++;
+
+  file = (GByteArray *)g_hash_table_lookup (server->files, path);
+  if (file == NULL)
+    {
+      file = g_byte_array_new ();
+      g_hash_table_insert (server->files, g_strdup (path), file);
+    }
+
+  if (range == NULL)
+    {
+      if (g_str_has_suffix (path, ".tar.gz") && length > 0)
+        server->unranged_body = TRUE;
+
+      g_byte_array_set_size (file, 0);
+      g_byte_array_append (file, body, (guint)length);
+      g_mutex_unlock (&server->lock);
+
+      return 201;
+    }
+
+  if (length == 0)
+    server->empty_range = TRUE;
+
+  if (sscanf (range, " bytes %ld-%ld/%ld", &start, &end, &total) != 3
+      || end - start + 1 != (gint64)length)
+    {
+      g_mutex_unlock (&server->lock);
+      return 400;
+    }
+
+  if (server->first_start < 0)
+    server->first_start = start;
+
+  /* a chunk past what is stored means the partial upload was lost */
+  if (start > (gint64)file->len)
+    {
+      g_mutex_unlock (&server->lock);
+      return 416;
+    }
+
+  g_byte_array_set_size (file, (guint)start);
+  g_byte_array_append (file, body, (guint)length);
+
+  if (end + 1 == total && !server->final_308)
+    {
+      g_mutex_unlock (&server->lock);
+      return 201;
+    }
+
+  *extra = g_strdup_printf ("Range: bytes=0-%ld\r\n", end);
+  g_mutex_unlock (&server->lock);
+
+  return 308;
+}
+
+static gpointer
+server_connection (gpointer _conn)
+{
+  HTTPConnection *conn = (HTTPConnection *)_conn;
+  gboolean healthy = TRUE;
+
+  /* the backend keeps its connection open between the requests */
+  while (healthy)
+    {
+      g_autoptr (GString) headers = g_string_new ("\r\n");
+      g_autofree guint8 *body = NULL;
+      g_autofree gchar *extra = NULL;
+      g_autofree gchar *path = NULL;
+      const gchar *length_header;
+      gsize length = 0;
+      gsize got = 0;
+      gint code;
+
+      if (!read_headers (conn->fd, headers) || !g_str_has_prefix (headers->str, "\r\nPUT /"))
+        break;
+
+      path = g_strndup (headers->str + 6, strcspn (headers->str + 6, " "));
+
+      length_header = find_header (headers->str, "Content-Length");
+      if (length_header != NULL)
+        length = (gsize)strtoul (length_header, NULL, 10);
+
+      body = g_malloc (MAX (length, 1));
+      while (got < length && healthy)
+        {
+          ssize_t nread = read (conn->fd, body + got, length - got);
+
+          healthy = nread > 0;
+          got += (gsize)MAX (nread, 0);
+        }
+
+      if (!healthy)
+        break;
+
+      code = server_store (conn->server, path, find_header (headers->str, "Content-Range"), body,
+                           length, &extra);
+      healthy = send_status (conn->fd, code, extra);
+    }
+
+  close (conn->fd);
+  g_free (conn);
+
+  return NULL;
+}
+
+static gpointer
+server_listen (gpointer _server)
+{
+  HTTPServer *server = (HTTPServer *)_server;
+  gint fd;
+
+  while ((fd = accept (server->sockfd, NULL, NULL)) >= 0)
+    {
+      HTTPConnection *conn = g_new0 (HTTPConnection, 1);
+
+      conn->server = server;
+      conn->fd = fd;
+
+      g_thread_unref (g_thread_new ("connection", server_connection, conn));
+    }
+
+  return NULL;
+}
+
+static gboolean
+server_start (HTTPServer *server)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof (addr);
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  server->sockfd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (server->sockfd < 0)
+    return FALSE;
+
+  if (bind (server->sockfd, (struct sockaddr *)&addr, sizeof (addr)) != 0
+      || listen (server->sockfd, 16) != 0
+      || getsockname (server->sockfd, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+      close (server->sockfd);
+      return FALSE;
+    }
+
+  server->port = ntohs (addr.sin_port);
+  server->files
+      = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_byte_array_unref);
+  g_mutex_init (&server->lock);
+
+  g_thread_unref (g_thread_new ("server", server_listen, server));
+
+  return TRUE;
+}
+
+static void
+server_reset (HTTPServer *server, gboolean final_308)
+{
+  g_mutex_lock (&server->lock);
+  g_hash_table_remove_all (server->files);
+  server->final_308 = final_308;
+  server->requests = 0;
+  server->first_start = -1;
+  server->unranged_body = FALSE;
+  server->empty_range = FALSE;
+  g_mutex_unlock (&server->lock);
+}
+
+static void
+server_seed (HTTPServer *server, const gchar *path, const guint8 *data, gsize size)
+{
+  GByteArray *file = g_byte_array_new ();
+
+  g_byte_array_append (file, data, (guint)size);
+
+  g_mutex_lock (&server->lock);
+  g_hash_table_insert (server->files, g_strdup (path), file);
+  g_mutex_unlock (&server->lock);
+}
+
+static gboolean
+server_check_file (HTTPServer *server, const gchar *name, const guint8 *data, gsize size)
+{
+  g_autofree gchar *path = g_strconcat ("/", name, NULL);
+  g_autofree gchar *hash_path = g_strconcat (path, ".sha256", NULL);
+  g_autofree gchar *hash = g_compute_checksum_for_data (G_CHECKSUM_SHA256, data, size);
+  g_autofree gchar *hash_line = g_strdup_printf ("%s  %s\n", hash, name);
+  GByteArray *file;
+  GByteArray *hash_file;
+  gboolean success = TRUE;
+
+  g_mutex_lock (&server->lock);
+
+  file = (GByteArray *)g_hash_table_lookup (server->files, path);
+  hash_file = (GByteArray *)g_hash_table_lookup (server->files, hash_path);
+
+  if (file == NULL || file->len != size || memcmp (file->data, data, size) != 0)
+    {
+      printf ("Server copy of %s does not match the archive\n", name);
+      success = FALSE;
+    }
+  else if (hash_file == NULL || hash_file->len != strlen (hash_line)
+           || memcmp (hash_file->data, hash_line, hash_file->len) != 0)
+    {
+      printf ("Server hash of %s does not match the archive\n", name);
+      success = FALSE;
+    }
+
+  g_mutex_unlock (&server->lock);
+
+  return success;
+}
+
+static gchar *
+create_options_file (const gchar *test_dir, guint16 port)
+{
+  g_autofree gchar *content = NULL;
+  gchar *conf_path = g_build_filename (test_dir, "crashmanager.conf", NULL);
+
+  content = g_strdup_printf ("[common]\nRunDirectory = %s\n\n"
+                             "[crashmanager]\nDatabaseFile = %s/journal.db\n"
+                             "TransferBackend = http\nTransferURL = http://127.0.0.1:%u/\n"
+                             "TransferChunkSize = %d\nTransferConnectTimeout = 5\n"
+                             "TransferIOTimeout = 5\n",
+                             test_dir, test_dir, port, HTTPTEST_CHUNK_KB);
+
+  if (!g_file_set_contents (conf_path, content, -1, NULL))
+    g_clear_pointer (&conf_path, g_free);
+
+  return conf_path;
+}
+
+static CdmStatus
+upload (CdmTransferBackend *backend, CdmTransfer *transfer, const gchar *path, gint64 offset)
+{
+  CdmTransferEntry entry;
+  CdmStatus status;
+
+  memset (&entry, 0, sizeof (entry));
+  entry.file_path = g_strdup (path);
+  entry.upload_path = g_strdup (path);
+  entry.tier = CDM_TRANSFER_TIER_ARCHIVE;
+  entry.offset = offset;
+
+  status = backend->upload (backend, transfer, &entry);
+
+  g_free (entry.file_path);
+  g_free (entry.upload_path);
+
+  return status;
+}
+
+static gboolean
+run_checks (HTTPServer *server, CdmTransferBackend *backend, CdmTransfer *transfer,
+            const gchar *test_dir)
+{
+  g_autofree guint8 *data = g_malloc (HTTPTEST_ARCHIVE_SIZE);
+  g_autofree gchar *path = g_build_filename (test_dir, "test.cdh.tar.gz", NULL);
+  g_autofree gchar *empty_path = g_build_filename (test_dir, "empty.cdh.tar.gz", NULL);
+  const gint64 chunk = HTTPTEST_CHUNK_KB * 1024;
+  gboolean success = TRUE;
+
+  for (gsize i = 0; i < HTTPTEST_ARCHIVE_SIZE; i++)
+    data[i] = (guint8)g_random_int ();
+
+  if (!g_file_set_contents (path, (const gchar *)data, HTTPTEST_ARCHIVE_SIZE, NULL)
+      || !g_file_set_contents (empty_path, "", 0, NULL))
+    return FALSE;
+
+  /* four chunks and the hash file */
+  server_reset (server, FALSE);
+  if (upload (backend, transfer, path, 0) != CDM_STATUS_OK
+      || !server_check_file (server, "test.cdh.tar.gz", data, HTTPTEST_ARCHIVE_SIZE)
+      || server->requests != 5 || server->first_start != 0 || server->unranged_body)
+    {
+      printf ("Full upload failed (%u requests)\n", server->requests);
+      success = FALSE;
+    }
+
+  /* the server kept the first two chunks, only the rest is sent */
+  server_reset (server, FALSE);
+  server_seed (server, "/test.cdh.tar.gz", data, (gsize)chunk * 2);
+  if (upload (backend, transfer, path, chunk * 2) != CDM_STATUS_OK
+      || !server_check_file (server, "test.cdh.tar.gz", data, HTTPTEST_ARCHIVE_SIZE)
+      || server->requests != 3 || server->first_start != chunk * 2)
+    {
+      printf ("Resume from checkpoint failed (%u requests, first at %ld)\n", server->requests,
+              server->first_start);
+      success = FALSE;
+    }
+
+  /* the server lost the partial upload, the 416 restarts it from the beginning */
+  server_reset (server, FALSE);
+  if (upload (backend, transfer, path, chunk * 2) != CDM_STATUS_OK
+      || !server_check_file (server, "test.cdh.tar.gz", data, HTTPTEST_ARCHIVE_SIZE)
+      || server->requests != 6)
+    {
+      printf ("Restart after 416 failed (%u requests)\n", server->requests);
+      success = FALSE;
+    }
+
+  /* a 308 for the last chunk means the server does not have the archive */
+  server_reset (server, TRUE);
+  if (upload (backend, transfer, path, 0) == CDM_STATUS_OK || server->requests != 4)
+    {
+      printf ("Final 308 accepted as complete (%u requests)\n", server->requests);
+      success = FALSE;
+    }
+
+  /* an empty archive is a plain PUT without a byte range */
+  server_reset (server, FALSE);
+  if (upload (backend, transfer, empty_path, 0) != CDM_STATUS_OK
+      || !server_check_file (server, "empty.cdh.tar.gz", data, 0) || server->empty_range)
+    {
+      printf ("Empty archive upload failed\n");
+      success = FALSE;
+    }
+
+  g_remove (path);
+  g_remove (empty_path);
+
+  return success;
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *test_dir = NULL;
+  g_autofree gchar *conf_path = NULL;
+  CdmTransferBackend *backend = NULL;
+  CdmTransfer *transfer = NULL;
+  CdmOptions *options = NULL;
+  HTTPServer server;
+  gboolean success = TRUE;
+  gint long_index = 0;
+  gint c;
+
+  struct option longopts[] = { { "help", no_argument, NULL, 'h' }, { NULL, 0, NULL, 0 } };
+
+  while ((c = getopt_long (argc, argv, "h", longopts, &long_index)) != -1)
+    switch (c)
+      {
+      case 'h':
+        printf ("httptest: check the http backend against a local upload server\n\n");
+        printf ("Usage: httptest [OPTIONS] \n\n");
+        printf ("  Help:\n");
+        printf ("     --help, -h            Print this help\n\n");
+        exit (EXIT_SUCCESS);
+
+      default:
+        break;
+      }
+
+  memset (&server, 0, sizeof (server));
+  if (!server_start (&server))
+    {
+      printf ("Cannot start the local server\n");
+      return EXIT_FAILURE;
+    }
+
+  test_dir = g_dir_make_tmp ("httptest-XXXXXX", &error);
+  if (test_dir == NULL)
+    {
+      printf ("Cannot create test directory: %s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  conf_path = create_options_file (test_dir, server.port);
+  options = cdm_options_new (conf_path);
+
+  /* the transfer provides the chunk size and the bandwidth policy */
+  transfer = cdm_transfer_new (options);
+  backend = cdm_httpbackend_new (options);
+
+  if (conf_path == NULL || backend == NULL)
+    {
+      printf ("Cannot create the http backend\n");
+      success = FALSE;
+    }
+  else if (!run_checks (&server, backend, transfer, test_dir))
+    success = FALSE;
+
+  if (backend != NULL)
+    backend->free (backend);
+
+  cdm_transfer_unref (transfer);
+  cdm_options_unref (options);
+
+  g_remove (conf_path);
+  g_rmdir (test_dir);
+
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
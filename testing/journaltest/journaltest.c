@@ -0,0 +1,278 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file journaltest.c
+ */
+
+#include "cdm-journal.h"
+
+#include <getopt.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define JOURNALTEST_QUERY_ROUNDS (100)
+#define JOURNALTEST_EPILOG_PID (4242)
+
+static gchar *
+create_options_file (const gchar *test_dir, const gchar *epilog_options)
+{
+  g_autofree gchar *content = NULL;
+  gchar *conf_path = g_build_filename (test_dir, "crashmanager.conf", NULL);
+
+  content = g_strdup_printf ("[common]\nRunDirectory = %s\n\n"
+                             "[crashmanager]\nDatabaseFile = %s/journal.db\n%s",
+                             test_dir, test_dir, epilog_options);
+
+  if (!g_file_set_contents (conf_path, content, -1, NULL))
+    g_clear_pointer (&conf_path, g_free);
+
+  return conf_path;
+}
+
+static void
+print_rate (const gchar *name, guint count, gint64 usec)
+{
+  printf ("%-24s %8u ops %10ld us %12.1f ops/s\n", name, count, usec,
+          usec > 0 ? (gdouble)count * G_USEC_PER_SEC / (gdouble)usec : 0.0);
+}
+
+static gboolean
+run_benchmark (CdmJournal *journal, const gchar *test_dir, guint entries)
+{
+  g_autoptr (GPtrArray) paths = g_ptr_array_new_with_free_func (g_free);
+  gint64 start;
+
+  for (guint i = 0; i < entries; i++)
+    {
+      gchar *path = g_strdup_printf ("%s/bench%u.cdh.tar.gz", test_dir, i);
+
+      if (!g_file_set_contents (path, "", 0, NULL))
+        {
+          g_free (path);
+          return FALSE;
+        }
+
+      g_ptr_array_add (paths, path);
+    }
+
+  start = g_get_monotonic_time ();
+
+  for (guint i = 0; i < entries; i++)
+    {
+      g_autofree gchar *name = g_strdup_printf ("proc%u", i % 64);
+      g_autofree gchar *crash_id = g_strdup_printf ("%016X", i % 256);
+      g_autoptr (GError) error = NULL;
+
+      cdm_journal_add_crash (journal, name, crash_id, crash_id, "0000000000000000", "bench",
+                             "running", (const gchar *)paths->pdata[i], (gint64)i, 6,
+                             (guint64)i, NULL, NULL, &error);
+      if (error != NULL)
+        {
+          printf ("Add crash failed: %s\n", error->message);
+          return FALSE;
+        }
+    }
+
+  cdm_journal_flush (journal);
+  print_rate ("insert", entries, g_get_monotonic_time () - start);
+
+  start = g_get_monotonic_time ();
+  cdm_journal_set_transfer_list (journal, paths, TRUE, NULL, NULL, NULL);
+  cdm_journal_flush (journal);
+  print_rate ("set transfer list", entries, g_get_monotonic_time () - start);
+
+  start = g_get_monotonic_time ();
+  for (guint i = 0; i < JOURNALTEST_QUERY_ROUNDS; i++)
+    g_ptr_array_unref (cdm_journal_get_victims (journal, NULL, NULL, G_MAXSSIZE, 64, NULL, NULL));
+  print_rate ("get victims", JOURNALTEST_QUERY_ROUNDS, g_get_monotonic_time () - start);
+
+  start = g_get_monotonic_time ();
+  for (guint i = 0; i < JOURNALTEST_QUERY_ROUNDS; i++)
+    g_ptr_array_unref (
+        cdm_journal_get_victims (journal, NULL, "proc1", G_MAXSSIZE, 16, NULL, NULL));
+  print_rate ("get process victims", JOURNALTEST_QUERY_ROUNDS, g_get_monotonic_time () - start);
+
+  start = g_get_monotonic_time ();
+  for (guint i = 0; i < JOURNALTEST_QUERY_ROUNDS; i++)
+    (void)cdm_journal_get_data_size (journal, NULL);
+  print_rate ("get data size", JOURNALTEST_QUERY_ROUNDS, g_get_monotonic_time () - start);
+
+  start = g_get_monotonic_time ();
+  for (guint i = 0; i < JOURNALTEST_QUERY_ROUNDS; i++)
+    g_ptr_array_unref (cdm_journal_get_untransferred (journal, NULL));
+  print_rate ("get untransferred", JOURNALTEST_QUERY_ROUNDS, g_get_monotonic_time () - start);
+
+  for (guint i = 0; i < paths->len; i++)
+    g_remove ((const gchar *)paths->pdata[i]);
+
+  return TRUE;
+}
+
+static gboolean
+check_epilog_spool (const gchar *test_dir)
+{
+  static const gchar backtrace[] = "#0 raise\n#1 abort\n#2 main\n";
+  g_autofree gchar *conf_path = NULL;
+  g_autoptr (GError) error = NULL;
+  CdmJournal *journal = NULL;
+  CdmJournalEpilog *elog = NULL;
+  CdmOptions *options = NULL;
+  int64_t pid = JOURNALTEST_EPILOG_PID;
+  gboolean success = TRUE;
+  gint64 deadline;
+
+  conf_path = create_options_file (
+      test_dir, "ELogLifetime = 1\nELogSpoolSlots = 4\nELogSpoolLifetime = 60\n");
+  if (conf_path == NULL)
+    return FALSE;
+
+  options = cdm_options_new (conf_path);
+  journal = cdm_journal_new (options, &error);
+  if (error != NULL)
+    {
+      printf ("Cannot open journal: %s\n", error->message);
+      cdm_options_unref (options);
+      return FALSE;
+    }
+
+  cdm_journal_epilog_add (journal, pid, backtrace, sizeof (backtrace));
+
+  /* let the expiry wheel drop the memory copy, a late crashhandler finds it in the spool */
+  deadline = g_get_monotonic_time () + 3 * G_USEC_PER_SEC;
+  while (g_get_monotonic_time () < deadline)
+    g_main_context_iteration (NULL, TRUE);
+
+  if (g_hash_table_lookup (journal->elogs, &pid) != NULL)
+    {
+      printf ("Epilog kept in memory past its lifetime\n");
+      success = FALSE;
+    }
+
+  elog = cdm_journal_epilog_get (journal, pid);
+  if (elog == NULL || g_strcmp0 (elog->backtrace, backtrace) != 0)
+    {
+      printf ("Epilog not served from the spool after its memory lifetime\n");
+      success = FALSE;
+    }
+
+  /* a consumed epilog must not be served again to a crash reusing the pid */
+  (void)cdm_journal_epilog_rem (journal, pid);
+  if (success && cdm_journal_epilog_get (journal, pid) != NULL)
+    {
+      printf ("Consumed epilog served again from the spool\n");
+      success = FALSE;
+    }
+
+  cdm_journal_unref (journal);
+  cdm_options_unref (options);
+  g_remove (conf_path);
+
+  return success;
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr (GError) error = NULL;
+  CdmOptions *options = NULL;
+  g_autoptr (CdmJournal) journal = NULL;
+  g_autofree gchar *test_dir = NULL;
+  g_autofree gchar *conf_path = NULL;
+  g_autofree gchar *db_path = NULL;
+  g_autofree gchar *spool_path = NULL;
+  gboolean success = TRUE;
+  guint bench = 0;
+  gint long_index = 0;
+  gint c;
+
+  struct option longopts[] = { { "bench", required_argument, NULL, 'b' },
+                               { "help", no_argument, NULL, 'h' },
+                               { NULL, 0, NULL, 0 } };
+
+  while ((c = getopt_long (argc, argv, "b:h", longopts, &long_index)) != -1)
+    switch (c)
+      {
+      case 'b':
+        bench = (guint)strtoul (optarg, NULL, 10);
+        break;
+
+      case 'h':
+        printf ("journaltest: check the journal query plans and epilog spool\n\n");
+        printf ("Usage: journaltest [OPTIONS] \n\n");
+        printf ("  General:\n");
+        printf ("     --bench, -b <number>  Also time the journal with this many entries\n");
+        printf ("  Help:\n");
+        printf ("     --help, -h            Print this help\n\n");
+        exit (EXIT_SUCCESS);
+
+      default:
+        break;
+      }
+
+  test_dir = g_dir_make_tmp ("journaltest-XXXXXX", &error);
+  if (test_dir == NULL)
+    {
+      printf ("Cannot create test directory: %s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  conf_path = create_options_file (test_dir, "ELogSpoolSlots = 0\n");
+  db_path = g_build_filename (test_dir, "journal.db", NULL);
+  spool_path = g_build_filename (test_dir, ".epilog.spool", NULL);
+  options = cdm_options_new (conf_path);
+
+  journal = cdm_journal_new (options, &error);
+  if (error != NULL)
+    {
+      printf ("Cannot open journal: %s\n", error->message);
+      success = FALSE;
+    }
+  else if (!cdm_journal_check_query_plans (journal, &error))
+    {
+      printf ("Query plan check failed: %s\n", error->message);
+      success = FALSE;
+    }
+  else if (bench > 0 && !run_benchmark (journal, test_dir, bench))
+    {
+      printf ("Benchmark failed\n");
+      success = FALSE;
+    }
+
+  g_clear_pointer (&journal, cdm_journal_unref);
+  cdm_options_unref (options);
+
+  if (success && !check_epilog_spool (test_dir))
+    success = FALSE;
+
+  for (guint i = 0; i < 3; i++)
+    {
+      static const gchar *suffix[] = { "", "-wal", "-shm" };
+      g_autofree gchar *path = g_strconcat (db_path, suffix[i], NULL);
+
+      g_remove (path);
+    }
+
+  g_remove (spool_path);
+  g_remove (conf_path);
+  g_rmdir (test_dir);
+
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,317 @@
+/*
+ * SPDX license identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2019-2020 Alin Popa
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * \author Alin Popa <alin.popa@fxdata.ro>
+ * \file transferbench.c
+ */
+
+#include "cdm-transfer.h"
+
+#include <getopt.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define TRANSFERBENCH_TIMEOUT_USEC (600 * G_USEC_PER_SEC)
+
+typedef struct _TransferBench
+{
+  guint completed; /**< Transfers reported back */
+  guint failed;    /**< Transfers reported back with an error */
+} TransferBench;
+
+static gchar *
+create_options_file (const gchar *test_dir, const gchar *backend, guint sim_rate)
+{
+  g_autofree gchar *content = NULL;
+  gchar *conf_path = g_build_filename (test_dir, "crashmanager.conf", NULL);
+
+  /* window sampling and batching are off so only the backend is timed */
+  content = g_strdup_printf ("[common]\nRunDirectory = %s\n\n"
+                             "[crashmanager]\nDatabaseFile = %s/journal.db\n"
+                             "TransferBackend = %s\nTransferSpoolDirectory = %s/spool\n"
+                             "TransferDLTSimRate = %u\nTransferBatchWindow = 0\n"
+                             "TransferMaxPressure = 0\nTransferIdlePressure = 0\n"
+                             "TransferMaxLoad = 0\n",
+                             test_dir, test_dir, backend, test_dir, sim_rate);
+
+  if (!g_file_set_contents (conf_path, content, -1, NULL))
+    g_clear_pointer (&conf_path, g_free);
+
+  return conf_path;
+}
+
+static gint64
+process_cpu_time (void)
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void
+print_rate (const gchar *name, guint count, gsize bytes, gint64 usec, gint64 cpu_usec)
+{
+  printf ("%-24s %8u files %10ld us %10.1f files/s %10.1f KB/s cpu %5.1f%%\n", name, count,
+          usec, usec > 0 ? (gdouble)count * G_USEC_PER_SEC / (gdouble)usec : 0.0,
+          usec > 0 ? (gdouble)bytes * G_USEC_PER_SEC / 1024 / (gdouble)usec : 0.0,
+          usec > 0 ? (gdouble)cpu_usec * 100 / (gdouble)usec : 0.0);
+}
+
+static void
+transfer_complete (gpointer _bench, const gchar *file_path, CdmStatus status)
+{
+  TransferBench *bench = (TransferBench *)_bench;
+
+  if (status != CDM_STATUS_OK)
+    {
+      printf ("Transfer failed for %s\n", file_path);
+      bench->failed++;
+    }
+
+  bench->completed++;
+}
+
+static gboolean
+create_archive (const gchar *path, const guint8 *data, gsize size)
+{
+  return g_file_set_contents (path, (const gchar *)data, (gssize)size, NULL);
+}
+
+static gboolean
+check_spool_file (const gchar *spool_dir, const gchar *archive, const guint8 *data, gsize size)
+{
+  g_autofree gchar *name = g_path_get_basename (archive);
+  g_autofree gchar *path = g_build_filename (spool_dir, name, NULL);
+  g_autofree gchar *hash_path = g_strconcat (path, ".sha256", NULL);
+  g_autofree gchar *marker_path = g_strconcat (path, ".done", NULL);
+  g_autofree gchar *hash = g_compute_checksum_for_data (G_CHECKSUM_SHA256, data, size);
+  g_autofree gchar *hash_line = g_strdup_printf ("%s  %s\n", hash, name);
+  g_autofree gchar *content = NULL;
+  g_autofree gchar *hash_content = NULL;
+  gsize length = 0;
+  gboolean success = TRUE;
+
+  if (!g_file_get_contents (path, &content, &length, NULL) || length != size
+      || memcmp (content, data, size) != 0)
+    {
+      printf ("Spool file %s does not match its archive\n", path);
+      success = FALSE;
+    }
+  else if (!g_file_get_contents (hash_path, &hash_content, NULL, NULL)
+           || !g_str_equal (hash_content, hash_line))
+    {
+      printf ("Spool hash file %s does not match its archive\n", hash_path);
+      success = FALSE;
+    }
+  else if (!g_file_test (marker_path, G_FILE_TEST_EXISTS))
+    {
+      printf ("Spool marker %s missing\n", marker_path);
+      success = FALSE;
+    }
+
+  g_remove (path);
+  g_remove (hash_path);
+  g_remove (marker_path);
+
+  return success;
+}
+
+static gboolean
+run_benchmark (const gchar *test_dir, const gchar *backend, guint archives, gsize size,
+               guint sim_rate)
+{
+  g_autoptr (GPtrArray) paths = g_ptr_array_new_with_free_func (g_free);
+  g_autofree gchar *conf_path = NULL;
+  g_autofree gchar *spool_dir = NULL;
+  g_autofree guint8 *data = g_malloc (MAX (size, 1));
+  TransferBench bench = { 0, 0 };
+  CdmTransfer *transfer = NULL;
+  CdmOptions *options = NULL;
+  gboolean spool = g_str_equal (backend, "spool");
+  gboolean success = TRUE;
+  gint64 cpu_start;
+  gint64 deadline;
+  gint64 start;
+
+  conf_path = create_options_file (test_dir, backend, sim_rate);
+  if (conf_path == NULL)
+    return FALSE;
+
+  spool_dir = g_build_filename (test_dir, "spool", NULL);
+  if (spool && g_mkdir (spool_dir, 0755) != 0)
+    {
+      g_remove (conf_path);
+      return FALSE;
+    }
+
+  /* incompressible content, the spool copy is compared byte by byte */
+  for (gsize i = 0; i < size; i++)
+    data[i] = (guint8)g_random_int ();
+
+  for (guint i = 0; i < archives; i++)
+    {
+      gchar *path = g_strdup_printf ("%s/bench%u.cdh.tar.gz", test_dir, i);
+
+      if (!create_archive (path, data, size))
+        {
+          g_free (path);
+          success = FALSE;
+          break;
+        }
+
+      g_ptr_array_add (paths, path);
+    }
+
+  options = cdm_options_new (conf_path);
+  transfer = cdm_transfer_new (options);
+
+  start = g_get_monotonic_time ();
+  cpu_start = process_cpu_time ();
+  deadline = start + TRANSFERBENCH_TIMEOUT_USEC;
+
+  for (guint i = 0; success && i < paths->len; i++)
+    (void)cdm_transfer_file (transfer, (const gchar *)paths->pdata[i], transfer_complete,
+                             &bench);
+
+  while (success && bench.completed < paths->len && g_get_monotonic_time () < deadline)
+    g_main_context_iteration (NULL, TRUE);
+
+  print_rate (backend, bench.completed, size * bench.completed, g_get_monotonic_time () - start,
+              process_cpu_time () - cpu_start);
+
+  if (bench.completed < paths->len || bench.failed > 0)
+    {
+      printf ("%u of %u transfers failed or did not finish\n",
+              paths->len - bench.completed + bench.failed, paths->len);
+      success = FALSE;
+    }
+
+  cdm_transfer_unref (transfer);
+  cdm_options_unref (options);
+
+  for (guint i = 0; i < paths->len; i++)
+    {
+      const gchar *path = (const gchar *)paths->pdata[i];
+
+      if (spool && !check_spool_file (spool_dir, path, data, size))
+        success = FALSE;
+
+      g_remove (path);
+    }
+
+  g_rmdir (spool_dir);
+  g_remove (conf_path);
+
+  return success;
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *test_dir = NULL;
+  g_autofree gchar *backend = g_strdup ("spool");
+  gboolean success = TRUE;
+  guint archives = 100;
+  guint sim_rate = 512;
+  gsize size = 256;
+  gint long_index = 0;
+  gint c;
+
+  struct option longopts[] = { { "backend", required_argument, NULL, 'b' },
+                               { "archives", required_argument, NULL, 'n' },
+                               { "size", required_argument, NULL, 's' },
+                               { "rate", required_argument, NULL, 'r' },
+                               { "help", no_argument, NULL, 'h' },
+                               { NULL, 0, NULL, 0 } };
+
+  while ((c = getopt_long (argc, argv, "b:n:s:r:h", longopts, &long_index)) != -1)
+    switch (c)
+      {
+      case 'b':
+        g_free (backend);
+        backend = g_strdup (optarg);
+        break;
+
+      case 'n':
+        archives = (guint)strtoul (optarg, NULL, 10);
+        break;
+
+      case 's':
+        size = (gsize)strtoul (optarg, NULL, 10);
+        break;
+
+      case 'r':
+        sim_rate = (guint)strtoul (optarg, NULL, 10);
+        break;
+
+      case 'h':
+        printf ("transferbench: push archives through the transfer pipeline\n\n");
+        printf ("Usage: transferbench [OPTIONS] \n\n");
+        printf ("  General:\n");
+        printf ("     --backend, -b <name>    Transfer backend, spool or dltsim (default spool)\n");
+        printf ("     --archives, -n <number> Number of archives to transfer (default 100)\n");
+        printf ("     --size, -s <number>     Size of each archive in KB (default 256)\n");
+        printf ("     --rate, -r <number>     Drain speed of the dltsim buffer in KB/s\n");
+        printf ("  Help:\n");
+        printf ("     --help, -h              Print this help\n\n");
+        exit (EXIT_SUCCESS);
+
+      default:
+        break;
+      }
+
+  if (!g_str_equal (backend, "spool") && !g_str_equal (backend, "dltsim"))
+    {
+      printf ("Backend %s needs a remote end, use spool or dltsim\n", backend);
+      return EXIT_FAILURE;
+    }
+
+  test_dir = g_dir_make_tmp ("transferbench-XXXXXX", &error);
+  if (test_dir == NULL)
+    {
+      printf ("Cannot create test directory: %s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (!run_benchmark (test_dir, backend, archives, size * 1024, sim_rate))
+    {
+      printf ("Benchmark failed\n");
+      success = FALSE;
+    }
+
+  for (guint i = 0; i < 3; i++)
+    {
+      static const gchar *suffix[] = { "", "-wal", "-shm" };
+      g_autofree gchar *path = g_strconcat (test_dir, "/journal.db", suffix[i], NULL);
+
+      g_remove (path);
+    }
+
+  g_rmdir (test_dir);
+
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}